@@ -0,0 +1,204 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of MQTT broker selection. Score of broker is sum of connect time and round trip time moving
+ * averages, lower score is better.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+
+#include "broker_selector.h"
+#include "user_config.h"
+
+/** Weight of new sample in moving average is 1 / 2^EWMA_SHIFT. */
+#define EWMA_SHIFT 2
+/** Hold down time stops doubling after this number of failures. */
+#define MAX_HOLD_DOWN_DOUBLINGS 3
+/** Probe results older than this are not used for fail back. */
+#define PROBE_VALID_MILLIS (2LL * MQTT_BROKER_PROBE_PERIOD_MS)
+
+static broker_health_t brokers[MQTT_MAX_BROKERS];
+static size_t broker_count = 0;
+static portMUX_TYPE broker_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t update_average(uint32_t average, uint32_t sample, bool initialized)
+{
+    if (!initialized)
+        return sample;
+    return (uint32_t)((int32_t)average + (((int32_t)sample - (int32_t)average) >> EWMA_SHIFT));
+}
+
+static uint32_t get_score(const broker_health_t *health)
+{
+    return health->connect_millis + health->rtt_millis;
+}
+
+static bool is_available(size_t index, int64_t now_millis)
+{
+    return now_millis >= brokers[index].hold_down_until_millis;
+}
+
+void broker_selector_init(size_t count)
+{
+    portENTER_CRITICAL(&broker_mux);
+    memset(brokers, 0, sizeof(brokers));
+    broker_count = count < MQTT_MAX_BROKERS ? count : MQTT_MAX_BROKERS;
+    portEXIT_CRITICAL(&broker_mux);
+}
+
+void broker_selector_report_connect(size_t index, uint32_t connect_millis)
+{
+    if (index >= broker_count)
+        return;
+    portENTER_CRITICAL(&broker_mux);
+    broker_health_t *health = &brokers[index];
+    health->connect_millis = update_average(health->connect_millis, connect_millis, health->measured);
+    if (!health->measured)
+    {
+        health->rtt_millis = 0;
+    }
+    health->measured = true;
+    health->failures = 0;
+    health->hold_down_until_millis = 0;
+    portEXIT_CRITICAL(&broker_mux);
+}
+
+void broker_selector_report_rtt(size_t index, uint32_t rtt_millis)
+{
+    if (index >= broker_count)
+        return;
+    portENTER_CRITICAL(&broker_mux);
+    broker_health_t *health = &brokers[index];
+    // The first measurement replaces zero set on connect
+    health->rtt_millis = update_average(health->rtt_millis, rtt_millis, health->rtt_millis != 0);
+    portEXIT_CRITICAL(&broker_mux);
+}
+
+void broker_selector_report_probe(size_t index, uint32_t rtt_millis, int64_t now_millis)
+{
+    if (index >= broker_count)
+        return;
+    portENTER_CRITICAL(&broker_mux);
+    broker_health_t *health = &brokers[index];
+    // Round trip time measured before failure is stale
+    bool is_valid = health->failures == 0 && health->rtt_millis != 0;
+    health->rtt_millis = update_average(health->rtt_millis, rtt_millis, is_valid);
+    health->failures = 0;
+    health->hold_down_until_millis = 0;
+    health->probed_millis = now_millis;
+    portEXIT_CRITICAL(&broker_mux);
+}
+
+bool broker_selector_should_probe(size_t index, size_t current, int64_t now_millis)
+{
+    if (index >= broker_count || index == current)
+        return false;
+    portENTER_CRITICAL(&broker_mux);
+    bool available = is_available(index, now_millis);
+    portEXIT_CRITICAL(&broker_mux);
+    return available;
+}
+
+void broker_selector_report_failure(size_t index, int64_t now_millis)
+{
+    if (index >= broker_count)
+        return;
+    portENTER_CRITICAL(&broker_mux);
+    broker_health_t *health = &brokers[index];
+    uint8_t doublings = health->failures < MAX_HOLD_DOWN_DOUBLINGS ? health->failures : MAX_HOLD_DOWN_DOUBLINGS;
+    health->hold_down_until_millis = now_millis + ((int64_t)MQTT_BROKER_HOLD_DOWN_MS << doublings);
+    health->probed_millis = 0;
+    if (health->failures < UINT8_MAX)
+    {
+        health->failures++;
+    }
+    portEXIT_CRITICAL(&broker_mux);
+}
+
+size_t broker_selector_select_failover(size_t current, int64_t now_millis)
+{
+    size_t selected = broker_count;
+    size_t earliest = (current + 1) % broker_count;
+    portENTER_CRITICAL(&broker_mux);
+    for (size_t i = 0; i < broker_count; i++)
+    {
+        if (brokers[i].hold_down_until_millis < brokers[earliest].hold_down_until_millis)
+        {
+            earliest = i;
+        }
+        if (i == current || !is_available(i, now_millis))
+            continue;
+        if (selected == broker_count)
+        {
+            selected = i;
+        }
+        else if (brokers[i].measured && (!brokers[selected].measured
+                || get_score(&brokers[i]) < get_score(&brokers[selected])))
+        {
+            selected = i;
+        }
+    }
+    portEXIT_CRITICAL(&broker_mux);
+    // All brokers are held down, the one released first is tried
+    return selected != broker_count ? selected : earliest;
+}
+
+bool broker_selector_select_failback(size_t current, int64_t now_millis, size_t *index)
+{
+    bool found = false;
+    portENTER_CRITICAL(&broker_mux);
+    // Probe measures TCP connect, so it is compared with round trip time of current broker, not with connect time
+    uint64_t current_rtt = brokers[current].rtt_millis;
+    uint32_t best_rtt = UINT32_MAX;
+    for (size_t i = 0; i < broker_count && current_rtt != 0; i++)
+    {
+        // Healthy connection is not dropped for broker which was not reachable by recent probe
+        if (i == current || brokers[i].probed_millis == 0 || now_millis - brokers[i].probed_millis > PROBE_VALID_MILLIS
+                || brokers[i].failures > 0 || !is_available(i, now_millis))
+            continue;
+        uint32_t rtt = brokers[i].rtt_millis;
+        if (rtt < best_rtt && (uint64_t)rtt * (100 + MQTT_FAILBACK_HYSTERESIS_PERCENT) < current_rtt * 100)
+        {
+            best_rtt = rtt;
+            *index = i;
+            found = true;
+        }
+    }
+    portEXIT_CRITICAL(&broker_mux);
+    return found;
+}
+
+const broker_health_t* broker_selector_get_health(size_t index)
+{
+    return index < broker_count ? &brokers[index] : NULL;
+}
@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for selecting MQTT broker. Health of every broker is tracked by moving averages
+ * of connect time and round trip time, failed brokers are held down and fail back is damped by hysteresis.
+ */
+
+#ifndef MAIN_BROKER_SELECTOR_H_
+#define MAIN_BROKER_SELECTOR_H_
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * Health of single broker.
+ */
+typedef struct broker_health
+{
+    /** Moving average of connect time in milliseconds. */
+    uint32_t connect_millis;
+    /** Moving average of round trip time in milliseconds. */
+    uint32_t rtt_millis;
+    /** True if broker was connected at least once and averages are valid. */
+    bool measured;
+    /** Number of failures since last successful connection or probe. */
+    uint8_t failures;
+    /** Broker is not selected until this time in milliseconds. */
+    int64_t hold_down_until_millis;
+    /** Time of last successful probe in milliseconds, 0 if broker was not probed. */
+    int64_t probed_millis;
+} broker_health_t;
+
+/**
+ * Initialize broker health table.
+ * @param[in] count Number of brokers, maximum is MQTT_MAX_BROKERS.
+ */
+void broker_selector_init(size_t count);
+
+/**
+ * Report successful connection to broker.
+ * @param[in] index Broker index.
+ * @param[in] connect_millis Duration of connection establishment in milliseconds.
+ */
+void broker_selector_report_connect(size_t index, uint32_t connect_millis);
+
+/**
+ * Report measured round trip time of connected broker.
+ * @param[in] index Broker index.
+ * @param[in] rtt_millis Round trip time in milliseconds.
+ */
+void broker_selector_report_rtt(size_t index, uint32_t rtt_millis);
+
+/**
+ * Report successful connect probe of broker which is not connected. Failures of the broker are cleared and its round
+ * trip time is refreshed by probe connect time.
+ * @param[in] index Broker index.
+ * @param[in] rtt_millis Duration of TCP connect in milliseconds.
+ * @param[in] now_millis Current time in milliseconds.
+ */
+void broker_selector_report_probe(size_t index, uint32_t rtt_millis, int64_t now_millis);
+
+/**
+ * Check if broker should be probed. Brokers other than connected one are probed when they are not held down.
+ * @param[in] index Broker index.
+ * @param[in] current Index of connected broker.
+ * @param[in] now_millis Current time in milliseconds.
+ * @return Return true if broker should be probed.
+ */
+bool broker_selector_should_probe(size_t index, size_t current, int64_t now_millis);
+
+/**
+ * Report failed connection, lost connection or failed probe. Broker is held down for time which doubles with every consecutive
+ * failure.
+ * @param[in] index Broker index.
+ * @param[in] now_millis Current time in milliseconds.
+ */
+void broker_selector_report_failure(size_t index, int64_t now_millis);
+
+/**
+ * Select broker to connect after current broker failed. The healthiest broker which is not held down is preferred,
+ * brokers which were never connected are tried in list order after measured ones.
+ * @param[in] current Index of failed broker.
+ * @param[in] now_millis Current time in milliseconds.
+ * @return Return index of selected broker.
+ */
+size_t broker_selector_select_failover(size_t current, int64_t now_millis);
+
+/**
+ * Check if connected broker should be replaced by healthier one. Candidate must be probed successfully within last two
+ * probe periods and its round trip time must be better than round trip time of current broker by
+ * MQTT_FAILBACK_HYSTERESIS_PERCENT. Failed broker becomes candidate again when its probe succeeds.
+ * @param[in] current Index of connected broker.
+ * @param[in] now_millis Current time in milliseconds.
+ * @param[out] index Index of better broker.
+ * @return Return true if better broker was found.
+ */
+bool broker_selector_select_failback(size_t current, int64_t now_millis, size_t *index);
+
+/**
+ * Get health of broker.
+ * @param[in] index Broker index.
+ * @return Return pointer to broker health.
+ */
+const broker_health_t* broker_selector_get_health(size_t index);
+
+#endif /* MAIN_BROKER_SELECTOR_H_ */
@@ -0,0 +1,160 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of static buffer pool. Every block class has its own storage and bitmap of used blocks,
+ * allocation and release run in short critical section, so buffers can be used from any task.
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <esp_log.h>
+
+#include "buffer_pool.h"
+#include "metrics.h"
+#include "user_config.h"
+
+#define TAG "buffer_pool"
+#define BITMAP_WORDS(count) (((count) + 31) / 32)
+
+typedef struct block_class
+{
+    size_t block_size;
+    size_t block_count;
+    uint8_t *storage;
+    uint32_t *used;
+} block_class_t;
+
+/** Storage and bitmap are static compound literals, so block sizes can be computed from configuration. */
+#define BUFFER_POOL_CLASS(size, count) { (size), (count), \
+    (uint8_t*)(uint64_t[((size) * (count) + 7) / 8]){ 0 }, (uint32_t[BITMAP_WORDS(count)]){ 0 } },
+
+static const block_class_t classes[] = { BUFFER_POOL_CLASSES(BUFFER_POOL_CLASS) };
+static const size_t class_count = sizeof(classes) / sizeof(classes[0]);
+static uint32_t in_use_bytes = 0;
+static uint32_t peak_bytes = 0;
+static portMUX_TYPE pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Find and mark free block of class. Must be called in critical section.
+ */
+static void* take_block(const block_class_t *block_class)
+{
+    for (size_t word = 0; word < BITMAP_WORDS(block_class->block_count); word++)
+    {
+        uint32_t free_bits = ~block_class->used[word];
+        if (free_bits == 0)
+            continue;
+        size_t bit = __builtin_ctz(free_bits);
+        size_t index = word * 32 + bit;
+        if (index >= block_class->block_count)
+            break;
+        block_class->used[word] |= 1UL << bit;
+        return block_class->storage + index * block_class->block_size;
+    }
+    return NULL;
+}
+
+void* buffer_pool_alloc(size_t size)
+{
+    if (size > buffer_pool_get_max_size())
+    {
+        ESP_LOGW(TAG, "Buffer of %zu bytes is larger than the largest block.", size);
+        metrics_increment(METRIC_BUFFER_POOL_OVERSIZED);
+        return NULL;
+    }
+    void *buffer = NULL;
+    uint32_t in_use = 0;
+    uint32_t peak = 0;
+    portENTER_CRITICAL(&pool_mux);
+    for (size_t i = 0; i < class_count && buffer == NULL; i++)
+    {
+        if (classes[i].block_size < size)
+            continue;
+        buffer = take_block(&classes[i]);
+        if (buffer != NULL)
+        {
+            in_use_bytes += classes[i].block_size;
+            if (in_use_bytes > peak_bytes)
+            {
+                peak_bytes = in_use_bytes;
+            }
+        }
+    }
+    in_use = in_use_bytes;
+    peak = peak_bytes;
+    portEXIT_CRITICAL(&pool_mux);
+    if (buffer == NULL)
+    {
+        ESP_LOGW(TAG, "Pool exhausted for buffer of %zu bytes.", size);
+        metrics_increment(METRIC_BUFFER_POOL_EXHAUSTED);
+        return NULL;
+    }
+    metrics_set(METRIC_BUFFER_POOL_IN_USE_BYTES, in_use);
+    metrics_set(METRIC_BUFFER_POOL_PEAK_BYTES, peak);
+    return buffer;
+}
+
+void buffer_pool_free(void *buffer)
+{
+    if (buffer == NULL)
+        return;
+    uint8_t *block = buffer;
+    for (size_t i = 0; i < class_count; i++)
+    {
+        const block_class_t *block_class = &classes[i];
+        if (block < block_class->storage || block >= block_class->storage
+                + block_class->block_size * block_class->block_count)
+            continue;
+        size_t index = (block - block_class->storage) / block_class->block_size;
+        uint32_t mask = 1UL << (index % 32);
+        portENTER_CRITICAL(&pool_mux);
+        bool used = (block_class->used[index / 32] & mask) != 0;
+        block_class->used[index / 32] &= ~mask;
+        if (used)
+        {
+            in_use_bytes -= block_class->block_size;
+        }
+        uint32_t in_use = in_use_bytes;
+        portEXIT_CRITICAL(&pool_mux);
+        if (!used)
+        {
+            ESP_LOGE(TAG, "Double free of block %p.", buffer);
+        }
+        metrics_set(METRIC_BUFFER_POOL_IN_USE_BYTES, in_use);
+        return;
+    }
+    ESP_LOGE(TAG, "Buffer %p does not belong to pool.", buffer);
+}
+
+size_t buffer_pool_get_max_size()
+{
+    return classes[class_count - 1].block_size;
+}
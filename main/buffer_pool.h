@@ -0,0 +1,62 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for allocating buffers from static pool. Request and message buffers and JSON
+ * documents are allocated from fixed size blocks reserved at build time, so they do not fragment heap.
+ */
+
+#ifndef MAIN_BUFFER_POOL_H_
+#define MAIN_BUFFER_POOL_H_
+
+#include <stddef.h>
+
+/**
+ * Allocate buffer from the smallest block class which has free block. Pool never falls back to heap, failures are
+ * counted in metrics.
+ * @param[in] size Requested size in bytes.
+ * @return Return pointer to buffer or NULL if request is larger than the largest block or pool is exhausted.
+ */
+void* buffer_pool_alloc(size_t size);
+
+/**
+ * Return buffer to pool.
+ * @param[in] buffer Buffer allocated by buffer_pool_alloc or NULL.
+ */
+void buffer_pool_free(void *buffer);
+
+/**
+ * Get size of the largest block.
+ * @return Return maximum size of single allocation in bytes.
+ */
+size_t buffer_pool_get_max_size(void);
+
+#endif /* MAIN_BUFFER_POOL_H_ */
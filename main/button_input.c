@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file implements local button input. Interrupt handler only wakes debounce task which feeds switching requests
+ * to relay switch. Debouncing acts on leading edge, so the relay is switched right after the first edge and following
+ * contact bounces are ignored.
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/gpio.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#include "button_input.h"
+#include "relay_switch.h"
+#include "user_config.h"
+
+#define TAG "button_input"
+#define BUTTON_TASK_PRIORITY 10
+#define DEBOUNCE_US (BUTTON_DEBOUNCE_MS * 1000LL)
+#define LONG_PRESS_US (BUTTON_LONG_PRESS_MS * 1000LL)
+
+static TaskHandle_t button_task = NULL;
+static volatile int64_t last_edge_us = 0;
+
+static void IRAM_ATTR button_isr_handler(void* arg)
+{
+    BaseType_t task_woken = pdFALSE;
+    last_edge_us = esp_timer_get_time();
+    vTaskNotifyGiveFromISR(button_task, &task_woken);
+    if (task_woken == pdTRUE)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static bool is_pressed(void)
+{
+    return gpio_get_level(BUTTON_GPIO_NUM) == BUTTON_ACTIVE_LEVEL;
+}
+
+static void switch_channel(bool switch_on, uint32_t timeout)
+{
+    relay_switch_command_t command = {
+        .channel = BUTTON_CHANNEL,
+        .switch_on = switch_on,
+        .timeout = timeout,
+        .source = RELAY_SWITCH_SOURCE_LOCAL
+    };
+    int64_t dispatch_us = esp_timer_get_time() - last_edge_us;
+    esp_err_t error = relay_switch_set_state(&command);
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Local switching failed: %s", relay_switch_err_to_name(error));
+        return;
+    }
+    ESP_LOGD(TAG, "Local switching dispatched %lld us after edge", dispatch_us);
+}
+
+static void toggle_channel(uint32_t timeout)
+{
+    switch_channel(!relay_switch_get_state(BUTTON_CHANNEL).is_switched_on, timeout);
+}
+
+static void handle_press(void)
+{
+#if BUTTON_MODE == BUTTON_MODE_TOGGLE
+    toggle_channel(0);
+#elif BUTTON_MODE == BUTTON_MODE_MOMENTARY
+    switch_channel(true, 0);
+#endif
+}
+
+static void handle_release(bool long_press_handled)
+{
+#if BUTTON_MODE == BUTTON_MODE_MOMENTARY
+    switch_channel(false, 0);
+#elif BUTTON_MODE == BUTTON_MODE_LONG_PRESS
+    if (!long_press_handled)
+    {
+        toggle_channel(0);
+    }
+#endif
+}
+
+static void button_task_run(void* pvParameters)
+{
+    bool stable_pressed = is_pressed();
+    int64_t stable_since_us = esp_timer_get_time();
+    bool long_press_handled = false;
+    bool bouncing = false;
+    while (true)
+    {
+        TickType_t wait_ticks = portMAX_DELAY;
+        int64_t now = esp_timer_get_time();
+        int64_t wake_us = 0;
+        if (bouncing)
+        {
+            // Level differs from debounced state, it must be checked again when debounce period ends
+            wake_us = stable_since_us + DEBOUNCE_US;
+        }
+#if BUTTON_MODE == BUTTON_MODE_LONG_PRESS
+        if (stable_pressed && !long_press_handled && (wake_us == 0 || stable_since_us + LONG_PRESS_US < wake_us))
+        {
+            wake_us = stable_since_us + LONG_PRESS_US;
+        }
+#endif
+        if (wake_us != 0)
+        {
+            wait_ticks = wake_us > now ? pdMS_TO_TICKS((wake_us - now + 999) / 1000) + 1 : 0;
+        }
+        ulTaskNotifyTake(pdTRUE, wait_ticks);
+
+        now = esp_timer_get_time();
+        bool pressed = is_pressed();
+        bouncing = pressed != stable_pressed;
+        if (bouncing && now - stable_since_us >= DEBOUNCE_US)
+        {
+            stable_pressed = pressed;
+            stable_since_us = now;
+            bouncing = false;
+            if (pressed)
+            {
+                long_press_handled = false;
+                handle_press();
+            }
+            else
+            {
+                handle_release(long_press_handled);
+            }
+        }
+#if BUTTON_MODE == BUTTON_MODE_LONG_PRESS
+        if (stable_pressed && !long_press_handled && now - stable_since_us >= LONG_PRESS_US)
+        {
+            long_press_handled = true;
+            switch_channel(true, BUTTON_LONG_PRESS_TIMEOUT_MS);
+        }
+#endif
+    }
+}
+
+esp_err_t button_input_init()
+{
+    gpio_config_t io_conf;
+    io_conf.intr_type = GPIO_INTR_ANYEDGE;
+    io_conf.mode = GPIO_MODE_INPUT;
+    io_conf.pin_bit_mask = (1ULL<<BUTTON_GPIO_NUM);
+    io_conf.pull_down_en = BUTTON_ACTIVE_LEVEL ? 1 : 0;
+    io_conf.pull_up_en = BUTTON_ACTIVE_LEVEL ? 0 : 1;
+    esp_err_t error = gpio_config(&io_conf);
+    if (error != ESP_OK)
+        return error;
+
+    if (xTaskCreate(button_task_run, "button_input", 4096, NULL, BUTTON_TASK_PRIORITY, &button_task) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    error = gpio_install_isr_service(0);
+    // ISR service can be already installed by another component
+    if (error != ESP_OK && error != ESP_ERR_INVALID_STATE)
+        return error;
+    error = gpio_isr_handler_add(BUTTON_GPIO_NUM, button_isr_handler, NULL);
+    if (error != ESP_OK)
+        return error;
+    ESP_LOGI(TAG, "Button input on GPIO %d controls channel %d", BUTTON_GPIO_NUM, BUTTON_CHANNEL);
+    return ESP_OK;
+}
@@ -0,0 +1,185 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file implements serialization and deserialization of compact CBOR payloads used by CoAP adapter.
+ */
+
+#include <esp_log.h>
+#include <cbor.h>
+
+#include "cbor_serializer.h"
+#include "user_config.h"
+
+#define TAG "cbor_serializer"
+#define COMMAND_ITEMS 3
+/** Command items including optional required version. */
+#define COMMAND_MAX_ITEMS 4
+#define STATE_ITEMS 5
+
+static esp_err_t get_channel(CborValue *value, uint8_t *channel)
+{
+    if (cbor_value_is_unsigned_integer(value))
+    {
+        uint64_t index = 0;
+        cbor_value_get_uint64(value, &index);
+        if (index >= relay_switch_get_channel_count())
+        {
+            ESP_LOGE(TAG, "channel index out of range.");
+            return ESP_ERR_NOT_FOUND;
+        }
+        *channel = (uint8_t)index;
+        return ESP_OK;
+    }
+    if (cbor_value_is_text_string(value))
+    {
+        char name[32];
+        size_t name_length = sizeof(name);
+        if (cbor_value_copy_text_string(value, name, &name_length, NULL) != CborNoError)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        return relay_switch_find_channel(name, channel);
+    }
+    ESP_LOGE(TAG, "channel must be index or name.");
+    return ESP_FAIL;
+}
+
+/**
+ * Get switching request from [channel, switchedOn, timeout] or [channel, switchedOn, timeout, ifVersion] array.
+ */
+static esp_err_t get_command(CborValue *command_value, relay_switch_command_t *command)
+{
+    size_t items = 0;
+    if (!cbor_value_is_array(command_value) || cbor_value_get_array_length(command_value, &items) != CborNoError
+            || items < COMMAND_ITEMS || items > COMMAND_MAX_ITEMS)
+    {
+        ESP_LOGE(TAG, "command must be array of %d or %d items.", COMMAND_ITEMS, COMMAND_MAX_ITEMS);
+        return ESP_FAIL;
+    }
+    CborValue item;
+    uint64_t timeout = 0;
+    cbor_value_enter_container(command_value, &item);
+    esp_err_t error = get_channel(&item, &command->channel);
+    if (error != ESP_OK)
+        return error;
+    cbor_value_advance(&item);
+    if (!cbor_value_is_boolean(&item))
+        return ESP_FAIL;
+    cbor_value_get_boolean(&item, &command->switch_on);
+    cbor_value_advance(&item);
+    if (!cbor_value_is_unsigned_integer(&item))
+        return ESP_FAIL;
+    cbor_value_get_uint64(&item, &timeout);
+    if (timeout > UINT32_MAX)
+        return ESP_ERR_INVALID_ARG;
+    command->timeout = (uint32_t)timeout;
+    cbor_value_advance(&item);
+    command->if_version = 0;
+    if (items == COMMAND_MAX_ITEMS)
+    {
+        uint64_t if_version = 0;
+        if (!cbor_value_is_unsigned_integer(&item))
+            return ESP_FAIL;
+        cbor_value_get_uint64(&item, &if_version);
+        if (if_version > UINT32_MAX)
+            return ESP_ERR_INVALID_ARG;
+        command->if_version = (uint32_t)if_version;
+        cbor_value_advance(&item);
+    }
+    cbor_value_leave_container(command_value, &item);
+    return ESP_OK;
+}
+
+esp_err_t cbor_serializer_serialize(const relay_switch_state_t *switch_states, size_t count, uint8_t *buffer,
+        size_t *length)
+{
+    CborEncoder encoder;
+    CborEncoder channels;
+    CborError error = CborNoError;
+    cbor_encoder_init(&encoder, buffer, *length, 0);
+    error |= cbor_encoder_create_array(&encoder, &channels, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        CborEncoder channel;
+        error |= cbor_encoder_create_array(&channels, &channel, STATE_ITEMS);
+        error |= cbor_encode_boolean(&channel, switch_states[i].is_switched_on);
+        error |= cbor_encode_uint(&channel, switch_states[i].switch_timeout_millis);
+        error |= cbor_encode_uint(&channel, switch_states[i].last_change_source);
+        error |= cbor_encode_uint(&channel, switch_states[i].last_change_utc_millis);
+        error |= cbor_encode_uint(&channel, switch_states[i].version);
+        error |= cbor_encoder_close_container(&channels, &channel);
+    }
+    error |= cbor_encoder_close_container(&encoder, &channels);
+    if (error != CborNoError)
+    {
+        return error == CborErrorOutOfMemory ? ESP_ERR_INVALID_SIZE : ESP_FAIL;
+    }
+    *length = cbor_encoder_get_buffer_size(&encoder, buffer);
+    return ESP_OK;
+}
+
+esp_err_t cbor_serializer_deserialize(const uint8_t *data, size_t data_length, relay_switch_command_t *commands,
+        size_t *count)
+{
+    CborParser parser;
+    CborValue root;
+    CborValue first;
+    if (cbor_parser_init(data, data_length, 0, &parser, &root) != CborNoError || !cbor_value_is_array(&root))
+    {
+        ESP_LOGE(TAG, "Payload is not CBOR array.");
+        return ESP_FAIL;
+    }
+    cbor_value_enter_container(&root, &first);
+    if (!cbor_value_is_array(&first))
+    {
+        // Single request
+        if (*count < 1)
+            return ESP_ERR_INVALID_SIZE;
+        esp_err_t error = get_command(&root, &commands[0]);
+        *count = error == ESP_OK ? 1 : 0;
+        return error;
+    }
+    size_t channel_count = 0;
+    if (cbor_value_get_array_length(&root, &channel_count) != CborNoError || channel_count > *count)
+    {
+        ESP_LOGE(TAG, "Too many channels in CBOR.");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    CborValue command_value = first;
+    for (size_t i = 0; i < channel_count; i++)
+    {
+        esp_err_t error = get_command(&command_value, &commands[i]);
+        if (error != ESP_OK)
+            return error;
+    }
+    *count = channel_count;
+    return ESP_OK;
+}
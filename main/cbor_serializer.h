@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for serialization and deserialization of compact CBOR payloads for CoAP adapter.
+ * Payloads use arrays instead of maps, so channel state fits into about 15 bytes.
+ */
+
+#ifndef MAIN_CBOR_SERIALIZER_H_
+#define MAIN_CBOR_SERIALIZER_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <esp_err.h>
+
+#include "relay_switch.h"
+
+/**
+ * Serialize state of all channels to CBOR array of [switchedOn, timeout, source, lastChangeUtcMillis] arrays in channel
+ * order.
+ * @param[in] switch_states Array of channel states to be serialized.
+ * @param[in] count Number of channel states.
+ * @param[out] buffer Buffer for serialized data.
+ * @param[in,out] length A pointer to buffer capacity. It is set to serialized data length.
+ * @return Return ESP_OK if succeeded or ESP_ERR_INVALID_SIZE if buffer is too small.
+ */
+esp_err_t cbor_serializer_serialize(const relay_switch_state_t *switch_states, size_t count, uint8_t *buffer,
+        size_t *length);
+
+/**
+ * Deserialize switching requests from CBOR. Payload is single [channel, switchedOn, timeout] array or array of such
+ * arrays. Channel can be specified by index or by name.
+ * @param[in] data A pointer to CBOR payload.
+ * @param[in] data_length Length of payload.
+ * @param[out] commands Array of switching requests to be set.
+ * @param[in,out] count A pointer to capacity of commands array. It is set to number of deserialized requests.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t cbor_serializer_deserialize(const uint8_t *data, size_t data_length, relay_switch_command_t *commands,
+        size_t *count);
+
+#endif /* MAIN_CBOR_SERIALIZER_H_ */
@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file implements CoAP adapter. Resource /state supports GET, PUT and observe. Observers are notified by
+ * confirmable messages. libcoap is not thread safe, so state changes only set flag and notifications are sent from
+ * server task.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <coap3/coap.h>
+
+#include "coap_adapter.h"
+#include "cbor_serializer.h"
+#include "relay_switch.h"
+#include "rate_limiter.h"
+#include "user_config.h"
+
+#define TAG "coap_adapter"
+#define COAP_TASK_PRIORITY 5
+#define STATE_RESOURCE "state"
+#define STATE_MAX_SIZE (8 + RELAY_CHANNEL_COUNT * 28)
+
+static coap_context_t *coap_context = NULL;
+static coap_resource_t *state_resource = NULL;
+static volatile bool is_state_changed = false;
+static uint8_t payload[STATE_MAX_SIZE];
+
+static coap_pdu_code_t get_response_code(esp_err_t error)
+{
+    switch (error)
+    {
+    case ESP_ERR_RELAY_INTERLOCK:
+    case ESP_ERR_RELAY_DEPENDENCY:
+        return COAP_RESPONSE_CODE(409);
+    case ESP_ERR_RELAY_VERSION:
+        return COAP_RESPONSE_CODE(412);
+    case ESP_ERR_RELAY_RATE_LIMIT:
+    case ESP_ERR_RELAY_WEAR:
+        return COAP_RESPONSE_CODE(429);
+    case ESP_ERR_NOT_FOUND:
+        return COAP_RESPONSE_CODE(404);
+    case ESP_ERR_INVALID_SIZE:
+        return COAP_RESPONSE_CODE(413);
+    default:
+        return COAP_RESPONSE_CODE(400);
+    }
+}
+
+static void send_state(coap_resource_t *resource, coap_session_t *session, const coap_pdu_t *request,
+        const coap_string_t *query, coap_pdu_t *response)
+{
+    relay_switch_state_t switch_states[RELAY_CHANNEL_COUNT];
+    size_t count = relay_switch_get_states(switch_states);
+    size_t length = sizeof(payload);
+    if (cbor_serializer_serialize(switch_states, count, payload, &length) != ESP_OK)
+    {
+        coap_pdu_set_code(response, COAP_RESPONSE_CODE(500));
+        return;
+    }
+    // Observe option is added for registered observers and notifications
+    coap_add_data_large_response(resource, session, request, response, query, COAP_MEDIATYPE_APPLICATION_CBOR, -1, 0,
+            length, payload, NULL, NULL);
+}
+
+static void get_state_handler(coap_resource_t *resource, coap_session_t *session, const coap_pdu_t *request,
+        const coap_string_t *query, coap_pdu_t *response)
+{
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+    send_state(resource, session, request, query, response);
+}
+
+static void put_state_handler(coap_resource_t *resource, coap_session_t *session, const coap_pdu_t *request,
+        const coap_string_t *query, coap_pdu_t *response)
+{
+    size_t length = 0;
+    const uint8_t *data = NULL;
+    relay_switch_command_t commands[RELAY_CHANNEL_COUNT];
+    size_t count = RELAY_CHANNEL_COUNT;
+    const coap_address_t *remote = coap_session_get_addr_remote(session);
+    esp_err_t error = rate_limiter_acquire(RELAY_SWITCH_SOURCE_COAP,
+            remote != NULL ? rate_limiter_get_client_address(&remote->addr.sa) : 0);
+    if (error == ESP_OK && !coap_get_data(request, &length, &data))
+    {
+        error = ESP_FAIL;
+    }
+    if (error == ESP_OK)
+    {
+        error = cbor_serializer_deserialize(data, length, commands, &count);
+    }
+    if (error == ESP_OK)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            commands[i].source = RELAY_SWITCH_SOURCE_COAP;
+        }
+        error = relay_switch_set_states(commands, count);
+    }
+    if (error != ESP_OK)
+    {
+        // Error name is sent as diagnostic payload
+        const char* error_string = relay_switch_err_to_name(error);
+        ESP_LOGW(TAG, "CoAP switch request failed: %s", error_string);
+        coap_pdu_set_code(response, get_response_code(error));
+        coap_add_data(response, strlen(error_string), (const uint8_t*)error_string);
+        return;
+    }
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+    send_state(resource, session, request, query, response);
+}
+
+static void coap_task_run(void* pvParameters)
+{
+    while (true)
+    {
+        if (is_state_changed)
+        {
+            is_state_changed = false;
+            coap_resource_notify_observers(state_resource, NULL);
+        }
+        // Waiting is interrupted by incoming request, timeout only limits delay of notifications
+        coap_io_process(coap_context, COAP_NOTIFY_MAX_DELAY_MS);
+    }
+}
+
+esp_err_t coap_adapter_init()
+{
+    coap_address_t address;
+    coap_startup();
+    coap_address_init(&address);
+    address.addr.sin.sin_family = AF_INET;
+    address.addr.sin.sin_addr.s_addr = INADDR_ANY;
+    address.addr.sin.sin_port = htons(COAP_PORT);
+
+    coap_context = coap_new_context(NULL);
+    if (coap_context == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (coap_new_endpoint(coap_context, &address, COAP_PROTO_UDP) == NULL)
+    {
+        coap_free_context(coap_context);
+        coap_context = NULL;
+        return ESP_FAIL;
+    }
+    state_resource = coap_resource_init(coap_make_str_const(STATE_RESOURCE), COAP_RESOURCE_FLAGS_NOTIFY_CON);
+    if (state_resource == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    coap_register_handler(state_resource, COAP_REQUEST_GET, get_state_handler);
+    coap_register_handler(state_resource, COAP_REQUEST_PUT, put_state_handler);
+    coap_resource_set_get_observable(state_resource, 1);
+    coap_add_resource(coap_context, state_resource);
+
+    if (xTaskCreate(coap_task_run, "coap_adapter", 6144, NULL, COAP_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "CoAP server listening on port %d", COAP_PORT);
+    return ESP_OK;
+}
+
+void coap_adapter_notify_switch_status()
+{
+    is_state_changed = true;
+}
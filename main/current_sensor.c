@@ -0,0 +1,278 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of load current sensing. DMA fills ADC buffers in background, processing task only feeds them
+ * to RMS kernel and evaluates whole block once per CURRENT_BLOCK_MS.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <driver/adc.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "current_sensor.h"
+#include "rms_kernel.h"
+#include "relay_switch.h"
+#include "metrics.h"
+#include "user_config.h"
+
+#define TAG "current_sensor"
+#define CURRENT_TASK_PRIORITY (tskIDLE_PRIORITY + 3)
+#define ADC1_CHANNEL_COUNT 8
+#define ADC_NO_CHANNEL -1
+#define READ_WORDS 256
+
+static const int8_t adc_channels[] = CURRENT_CHANNEL_ADC_CHANNELS;
+_Static_assert(sizeof(adc_channels) / sizeof(adc_channels[0]) == RELAY_CHANNEL_COUNT,
+        "CURRENT_CHANNEL_ADC_CHANNELS must contain RELAY_CHANNEL_COUNT items");
+
+static current_reading_t readings[RELAY_CHANNEL_COUNT];
+static current_fault_t mismatches[RELAY_CHANNEL_COUNT];
+static int64_t mismatch_since_us[RELAY_CHANNEL_COUNT];
+static SemaphoreHandle_t readings_mutex = NULL;
+static current_fault_cb_t current_fault_cb = NULL;
+static void* current_fault_context = NULL;
+
+static esp_err_t adc_init(void)
+{
+    adc_digi_pattern_config_t patterns[SOC_ADC_PATT_LEN_MAX] = { 0 };
+    uint32_t pattern_count = 0;
+    uint32_t channel_mask = 0;
+    for (int channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        int8_t adc_channel = adc_channels[channel];
+        if (adc_channel == ADC_NO_CHANNEL || (channel_mask & (1UL << adc_channel)) != 0)
+        {
+            continue;
+        }
+        if (adc_channel >= ADC1_CHANNEL_COUNT)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        channel_mask |= 1UL << adc_channel;
+        patterns[pattern_count].atten = ADC_ATTEN_DB_11;
+        patterns[pattern_count].channel = adc_channel;
+        patterns[pattern_count].unit = 0;
+        patterns[pattern_count].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+        pattern_count++;
+    }
+    if (pattern_count == 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    adc_digi_init_config_t init_config = {
+        .max_store_buf_size = READ_WORDS * sizeof(uint16_t) * 4,
+        .conv_num_each_intr = READ_WORDS * sizeof(uint16_t),
+        .adc1_chan_mask = channel_mask,
+        .adc2_chan_mask = 0,
+    };
+    esp_err_t error = adc_digi_initialize(&init_config);
+    if (error != ESP_OK)
+        return error;
+    adc_digi_configuration_t config = {
+        .conv_limit_en = true,
+        .conv_limit_num = 250,
+        .pattern_num = pattern_count,
+        .adc_pattern = patterns,
+        .sample_freq_hz = CURRENT_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    error = adc_digi_controller_configure(&config);
+    if (error != ESP_OK)
+        return error;
+    return adc_digi_start();
+}
+
+/**
+ * Update fault of channel. Mismatch must persist for CURRENT_FAULT_MS, so inrush, coil delay and load run-down after
+ * switching are not reported.
+ */
+static current_fault_t update_fault(uint8_t channel, bool is_switched_on, uint32_t milliamps, int64_t now)
+{
+    bool is_flowing = milliamps >= CURRENT_ON_THRESHOLD_MA;
+    current_fault_t observed = CURRENT_FAULT_NONE;
+    if (is_flowing != is_switched_on)
+    {
+        observed = is_flowing ? CURRENT_FAULT_STUCK_ON : CURRENT_FAULT_NO_LOAD;
+    }
+    if (observed != mismatches[channel])
+    {
+        mismatches[channel] = observed;
+        mismatch_since_us[channel] = now;
+    }
+    if (observed == CURRENT_FAULT_NONE || now - mismatch_since_us[channel] >= CURRENT_FAULT_MS * 1000LL)
+    {
+        return observed;
+    }
+    return readings[channel].fault;
+}
+
+static void finish_block(const rms_accumulator_t *accumulators, int64_t block_us, int64_t now)
+{
+    relay_switch_state_t states[RELAY_CHANNEL_COUNT];
+    relay_switch_get_states(states);
+    current_fault_t changed_faults[RELAY_CHANNEL_COUNT];
+    uint32_t changed_mask = 0;
+
+    xSemaphoreTake(readings_mutex, portMAX_DELAY);
+    for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        if (adc_channels[channel] == ADC_NO_CHANNEL)
+        {
+            continue;
+        }
+        current_reading_t *reading = &readings[channel];
+        uint32_t rms_milli_counts = rms_kernel_compute(&accumulators[adc_channels[channel]]);
+        reading->rms_milliamps = (uint32_t)((uint64_t)rms_milli_counts * CURRENT_UA_PER_COUNT / 1000000);
+        // mA * V gives mW, multiplied by block duration in s gives mJ
+        reading->energy_millijoules += (uint64_t)reading->rms_milliamps * CURRENT_LOAD_VOLTAGE * block_us / 1000000;
+        current_fault_t fault = update_fault(channel, states[channel].is_switched_on, reading->rms_milliamps, now);
+        if (fault != reading->fault)
+        {
+            reading->fault = fault;
+            changed_faults[channel] = fault;
+            changed_mask |= 1UL << channel;
+        }
+    }
+    xSemaphoreGive(readings_mutex);
+
+    for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        if ((changed_mask & (1UL << channel)) == 0)
+        {
+            continue;
+        }
+        current_fault_t fault = changed_faults[channel];
+        if (fault == CURRENT_FAULT_STUCK_ON)
+        {
+            metrics_increment(METRIC_CURRENT_FAULT_STUCK_ON);
+        }
+        else if (fault == CURRENT_FAULT_NO_LOAD)
+        {
+            metrics_increment(METRIC_CURRENT_FAULT_NO_LOAD);
+        }
+        ESP_LOGW(TAG, "Channel %d current fault: %s", channel, current_sensor_fault_to_name(fault));
+        if (current_fault_cb != NULL)
+        {
+            current_fault_cb(channel, fault, current_fault_context);
+        }
+    }
+}
+
+static void current_sensor_task(void* pvParameters)
+{
+    static uint16_t words[READ_WORDS];
+    rms_accumulator_t accumulators[ADC1_CHANNEL_COUNT];
+    memset(accumulators, 0, sizeof(accumulators));
+    int64_t block_start = esp_timer_get_time();
+    while (true)
+    {
+        uint32_t length = 0;
+        esp_err_t error = adc_digi_read_bytes((uint8_t*)words, sizeof(words), &length, ADC_MAX_DELAY);
+        if (error == ESP_ERR_INVALID_STATE)
+        {
+            // Driver pool overflowed and samples were dropped, remaining data are still valid
+            metrics_increment(METRIC_CURRENT_ADC_OVERRUNS);
+        }
+        else if (error != ESP_OK)
+        {
+            continue;
+        }
+        rms_kernel_accumulate(accumulators, ADC1_CHANNEL_COUNT, words, length / sizeof(uint16_t));
+        int64_t now = esp_timer_get_time();
+        if (now - block_start >= CURRENT_BLOCK_MS * 1000LL)
+        {
+            finish_block(accumulators, now - block_start, now);
+            memset(accumulators, 0, sizeof(accumulators));
+            block_start = now;
+        }
+    }
+}
+
+esp_err_t current_sensor_init()
+{
+    memset(readings, 0, sizeof(readings));
+    memset(mismatches, 0, sizeof(mismatches));
+    readings_mutex = xSemaphoreCreateMutex();
+    if (readings_mutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t error = adc_init();
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "ADC initialization failed: %s", esp_err_to_name(error));
+        return error;
+    }
+    if (xTaskCreate(current_sensor_task, "current_sensor", 4096, NULL, CURRENT_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t current_sensor_get_reading(uint8_t channel, current_reading_t *reading)
+{
+    if (channel >= RELAY_CHANNEL_COUNT || adc_channels[channel] == ADC_NO_CHANNEL || readings_mutex == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    xSemaphoreTake(readings_mutex, portMAX_DELAY);
+    *reading = readings[channel];
+    xSemaphoreGive(readings_mutex);
+    return ESP_OK;
+}
+
+const char* current_sensor_fault_to_name(current_fault_t fault)
+{
+    switch (fault)
+    {
+    case CURRENT_FAULT_NONE:
+        return "none";
+    case CURRENT_FAULT_STUCK_ON:
+        return "stuckOn";
+    case CURRENT_FAULT_NO_LOAD:
+        return "noLoad";
+    default:
+        return "unknown";
+    }
+}
+
+void current_sensor_set_fault_cb(current_fault_cb_t fault_cb, void* context)
+{
+    current_fault_context = context;
+    current_fault_cb = fault_cb;
+}
@@ -0,0 +1,101 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for load current sensing. Current of each relay channel is sampled continuously
+ * by ADC with DMA and compared with commanded relay position to detect welded contacts and dead loads.
+ */
+
+#ifndef MAIN_CURRENT_SENSOR_H_
+#define MAIN_CURRENT_SENSOR_H_
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <esp_err.h>
+
+/**
+ * Mismatch between commanded relay position and measured current.
+ */
+typedef enum current_fault
+{
+    /** Measured current corresponds to relay position. */
+    CURRENT_FAULT_NONE = 0,
+    /** Current flows while relay is switched off, contact is probably welded. */
+    CURRENT_FAULT_STUCK_ON,
+    /** No current flows while relay is switched on, load is dead or disconnected. */
+    CURRENT_FAULT_NO_LOAD
+} current_fault_t;
+
+/**
+ * Current measurement of single relay channel.
+ */
+typedef struct current_reading
+{
+    /** RMS current of last block in mA. */
+    uint32_t rms_milliamps;
+    /** Apparent energy since startup in mJ computed from CURRENT_LOAD_VOLTAGE. */
+    uint64_t energy_millijoules;
+    current_fault_t fault;
+} current_reading_t;
+
+/**
+ * Callback which is called when fault of channel changes.
+ */
+typedef void (*current_fault_cb_t)(uint8_t channel, current_fault_t fault, void* context);
+
+/**
+ * Initialize ADC in continuous mode and start processing task.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t current_sensor_init(void);
+
+/**
+ * Get current measurement of relay channel.
+ * @param[in] channel Index of relay channel.
+ * @param[out] reading A pointer to measurement to be set.
+ * @return Return ESP_OK if succeeded or ESP_ERR_NOT_FOUND if channel has no current sensor.
+ */
+esp_err_t current_sensor_get_reading(uint8_t channel, current_reading_t *reading);
+
+/**
+ * Get fault name used in API.
+ * @param[in] fault Fault type.
+ * @return Return fault name.
+ */
+const char* current_sensor_fault_to_name(current_fault_t fault);
+
+/**
+ * Set callback for fault changes.
+ * @param[in] fault_cb A pointer to callback function.
+ * @param[in] context A pointer to context which is passed to callback.
+ */
+void current_sensor_set_fault_cb(current_fault_cb_t fault_cb, void* context);
+
+#endif /* MAIN_CURRENT_SENSOR_H_ */
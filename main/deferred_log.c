@@ -0,0 +1,407 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of deferred logging. Writers reserve slot by atomic increment of ring head and publish it by
+ * storing its sequence number, readers copy the slot and validate the sequence number before and after the copy, so
+ * neither writers nor readers take locks. Slots of the oldest records are overwritten when ring is full.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "deferred_log.h"
+#include "metrics.h"
+
+#define TAG "deferred_log"
+#define DRAIN_TASK_PRIORITY 1
+#define DRAIN_BUFFER_SIZE 256
+#define MESSAGE_MAX_LENGTH 160
+#define SPEC_MAX_LENGTH 16
+#define WORD_SIZE sizeof(uint32_t)
+
+typedef enum arg_type
+{
+    ARG_INT,
+    ARG_LONG,
+    ARG_LONG_LONG,
+    ARG_SIZE,
+    ARG_POINTER,
+    ARG_DOUBLE,
+    ARG_LITERAL,
+    ARG_UNSUPPORTED
+} arg_type_t;
+
+typedef struct log_record
+{
+    /** Record index + 1, 0 while slot is being written. */
+    uint32_t sequence;
+    uint32_t timestamp_millis;
+    const char *tag;
+    const char *format;
+    uint8_t level;
+    uint8_t word_count;
+    uint32_t words[DEFERRED_LOG_MAX_WORDS];
+} log_record_t;
+
+static log_record_t ring[DEFERRED_LOG_RECORDS];
+static uint32_t ring_head = 0;
+static const char level_letters[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+
+/**
+ * Parse conversion specification which starts after '%'. End is set to conversion character.
+ */
+static arg_type_t parse_spec(const char *spec, const char **end)
+{
+    const char *c = spec + strspn(spec, "-+ #0123456789.");
+    arg_type_t type = ARG_INT;
+    if (*c == '*')
+    {
+        *end = c;
+        return ARG_UNSUPPORTED;
+    }
+    if (c[0] == 'l' && c[1] == 'l')
+    {
+        type = ARG_LONG_LONG;
+        c += 2;
+    }
+    else if (*c == 'j')
+    {
+        type = ARG_LONG_LONG;
+        c++;
+    }
+    else if (*c == 'l')
+    {
+        type = ARG_LONG;
+        c++;
+    }
+    else if (*c == 'z' || *c == 't')
+    {
+        type = ARG_SIZE;
+        c++;
+    }
+    else
+    {
+        c += strspn(c, "h");
+    }
+    *end = c;
+    switch (*c)
+    {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        return type;
+    case 's': case 'p':
+        return ARG_POINTER;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        return ARG_DOUBLE;
+    case '%':
+        return ARG_LITERAL;
+    default:
+        return ARG_UNSUPPORTED;
+    }
+}
+
+static size_t get_arg_size(arg_type_t type)
+{
+    switch (type)
+    {
+    case ARG_INT:
+        return sizeof(int);
+    case ARG_LONG:
+        return sizeof(long);
+    case ARG_LONG_LONG:
+        return sizeof(long long);
+    case ARG_SIZE:
+        return sizeof(size_t);
+    case ARG_POINTER:
+        return sizeof(void*);
+    case ARG_DOUBLE:
+        return sizeof(double);
+    default:
+        return 0;
+    }
+}
+
+static uint32_t store_args(const char *format, va_list args, uint32_t *words)
+{
+    uint32_t word_count = 0;
+    for (const char *c = strchr(format, '%'); c != NULL; c = strchr(c + 1, '%'))
+    {
+        arg_type_t type = parse_spec(c + 1, &c);
+        size_t size = get_arg_size(type);
+        if (type == ARG_UNSUPPORTED || word_count + (size + WORD_SIZE - 1) / WORD_SIZE > DEFERRED_LOG_MAX_WORDS)
+            break;
+        int int_value;
+        long long_value;
+        long long long_long_value;
+        size_t size_value;
+        void *pointer_value;
+        double double_value;
+        const void *value = NULL;
+        switch (type)
+        {
+        case ARG_INT:
+            int_value = va_arg(args, int);
+            value = &int_value;
+            break;
+        case ARG_LONG:
+            long_value = va_arg(args, long);
+            value = &long_value;
+            break;
+        case ARG_LONG_LONG:
+            long_long_value = va_arg(args, long long);
+            value = &long_long_value;
+            break;
+        case ARG_SIZE:
+            size_value = va_arg(args, size_t);
+            value = &size_value;
+            break;
+        case ARG_POINTER:
+            pointer_value = va_arg(args, void*);
+            value = &pointer_value;
+            break;
+        case ARG_DOUBLE:
+            double_value = va_arg(args, double);
+            value = &double_value;
+            break;
+        default:
+            continue;
+        }
+        memcpy(&words[word_count], value, size);
+        word_count += (size + WORD_SIZE - 1) / WORD_SIZE;
+    }
+    return word_count;
+}
+
+/**
+ * Format message of record. Arguments are read back in the same order and with the same types as they were stored.
+ */
+static void format_message(const log_record_t *record, char *buffer, size_t size)
+{
+    const char *format = record->format;
+    size_t length = 0;
+    uint32_t word = 0;
+    buffer[0] = '\0';
+    while (*format != '\0' && length + 1 < size)
+    {
+        const char *percent = strchr(format, '%');
+        size_t literal_length = percent != NULL ? (size_t)(percent - format) : strlen(format);
+        if (literal_length > size - length - 1)
+        {
+            literal_length = size - length - 1;
+        }
+        memcpy(buffer + length, format, literal_length);
+        length += literal_length;
+        buffer[length] = '\0';
+        if (percent == NULL)
+            break;
+        const char *end = NULL;
+        arg_type_t type = parse_spec(percent + 1, &end);
+        size_t arg_size = get_arg_size(type);
+        size_t arg_words = (arg_size + WORD_SIZE - 1) / WORD_SIZE;
+        if (type == ARG_UNSUPPORTED || word + arg_words > record->word_count)
+        {
+            // Arguments which did not fit to the record are not printed
+            strlcat(buffer, "...", size);
+            break;
+        }
+        char spec[SPEC_MAX_LENGTH];
+        size_t spec_length = end - percent + 1;
+        if (spec_length >= sizeof(spec))
+            break;
+        memcpy(spec, percent, spec_length);
+        spec[spec_length] = '\0';
+        union
+        {
+            int int_value;
+            long long_value;
+            long long long_long_value;
+            size_t size_value;
+            void *pointer_value;
+            double double_value;
+        } value;
+        memcpy(&value, &record->words[word], arg_size);
+        word += arg_words;
+        size_t remaining = size - length;
+        int written = 0;
+        switch (type)
+        {
+        case ARG_INT:
+            written = snprintf(buffer + length, remaining, spec, value.int_value);
+            break;
+        case ARG_LONG:
+            written = snprintf(buffer + length, remaining, spec, value.long_value);
+            break;
+        case ARG_LONG_LONG:
+            written = snprintf(buffer + length, remaining, spec, value.long_long_value);
+            break;
+        case ARG_SIZE:
+            written = snprintf(buffer + length, remaining, spec, value.size_value);
+            break;
+        case ARG_POINTER:
+            written = snprintf(buffer + length, remaining, spec, value.pointer_value);
+            break;
+        case ARG_DOUBLE:
+            written = snprintf(buffer + length, remaining, spec, value.double_value);
+            break;
+        default:
+            written = snprintf(buffer + length, remaining, "%%");
+            break;
+        }
+        length += written > 0 ? ((size_t)written < remaining ? (size_t)written : remaining - 1) : 0;
+        format = end + 1;
+    }
+}
+
+/**
+ * Copy record with given index. Return false if the record was not written yet or it was already overwritten.
+ */
+static bool read_record(uint32_t index, log_record_t *record)
+{
+    const log_record_t *slot = &ring[index % DEFERRED_LOG_RECORDS];
+    uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != index + 1)
+        return false;
+    memcpy(record, slot, sizeof(*record));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+#if DEFERRED_LOG_ENABLE && DEFERRED_LOG_CONSOLE_ENABLE
+static void drain_task_run(void *pvParameters)
+{
+    static char buffer[DRAIN_BUFFER_SIZE];
+    uint32_t cursor = 0;
+    uint32_t dropped = 0;
+    while (true)
+    {
+        uint32_t skipped = 0;
+        size_t length = deferred_log_read(&cursor, buffer, sizeof(buffer), &skipped);
+        if (skipped > 0)
+        {
+            dropped += skipped;
+            metrics_set(METRIC_LOG_RECORDS_DROPPED, dropped);
+        }
+        if (length > 0)
+        {
+            fputs(buffer, stdout);
+            // Ring may contain more records
+            continue;
+        }
+        vTaskDelay(pdMS_TO_TICKS(DEFERRED_LOG_DRAIN_PERIOD_MS));
+    }
+}
+#endif
+
+esp_err_t deferred_log_init()
+{
+#if DEFERRED_LOG_ENABLE && DEFERRED_LOG_CONSOLE_ENABLE
+    if (xTaskCreate(drain_task_run, "deferred_log", 3072, NULL, DRAIN_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+    return ESP_OK;
+}
+
+void deferred_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    uint32_t index = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+    log_record_t *slot = &ring[index % DEFERRED_LOG_RECORDS];
+    // Readers ignore slot while it is being written
+    __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->timestamp_millis = esp_log_timestamp();
+    slot->tag = tag;
+    slot->format = format;
+    slot->level = level;
+    va_list args;
+    va_start(args, format);
+    slot->word_count = store_args(format, args, slot->words);
+    va_end(args);
+    __atomic_store_n(&slot->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+size_t deferred_log_read(uint32_t *cursor, char *buffer, size_t size, uint32_t *skipped)
+{
+    uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    uint32_t oldest = head > DEFERRED_LOG_RECORDS ? head - DEFERRED_LOG_RECORDS : 0;
+    if (skipped != NULL)
+    {
+        *skipped = *cursor < oldest ? oldest - *cursor : 0;
+    }
+    if (*cursor < oldest || *cursor > head)
+    {
+        *cursor = oldest;
+    }
+    size_t length = 0;
+    buffer[0] = '\0';
+    while (*cursor < head)
+    {
+        log_record_t record;
+        if (!read_record(*cursor, &record))
+        {
+            uint32_t sequence = __atomic_load_n(&ring[*cursor % DEFERRED_LOG_RECORDS].sequence, __ATOMIC_ACQUIRE);
+            if (sequence == 0 || (int32_t)(sequence - (*cursor + 1)) < 0)
+                break; // Record is being written, it is read next time
+            // Record was overwritten during read
+            (*cursor)++;
+            if (skipped != NULL)
+            {
+                (*skipped)++;
+            }
+            continue;
+        }
+        char message[MESSAGE_MAX_LENGTH];
+        format_message(&record, message, sizeof(message));
+        int line_length = snprintf(buffer + length, size - length, "%" PRIu32 " %c (%" PRIu32 ") %s: %s\n",
+                *cursor, level_letters[record.level < sizeof(level_letters) ? record.level : 0],
+                record.timestamp_millis, record.tag, message);
+        if (line_length < 0)
+            break;
+        if ((size_t)line_length >= size - length)
+        {
+            if (length > 0)
+            {
+                // Line does not fit, it is read next time
+                buffer[length] = '\0';
+                break;
+            }
+            // Line is longer than whole buffer, it is truncated
+            line_length = size - 1;
+        }
+        length += line_length;
+        (*cursor)++;
+    }
+    return length;
+}
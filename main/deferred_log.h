@@ -0,0 +1,89 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for deferred logging. Log record stores only format string pointer and raw
+ * arguments to lock-free ring, formatting and output are done later by low priority drain task or when logs are
+ * read by API. String arguments must point to constant strings because they are read after the call returns.
+ */
+
+#ifndef MAIN_DEFERRED_LOG_H_
+#define MAIN_DEFERRED_LOG_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "user_config.h"
+
+#if DEFERRED_LOG_ENABLE
+#define DEFERRED_LOG(level, tag, format, ...) do { \
+        if ((level) <= DEFERRED_LOG_LEVEL) deferred_log_write(level, tag, format, ##__VA_ARGS__); \
+    } while (0)
+#else
+#define DEFERRED_LOG(level, tag, format, ...) ESP_LOG_LEVEL_LOCAL(level, tag, format, ##__VA_ARGS__)
+#endif
+
+#define DEFERRED_LOGE(tag, format, ...) DEFERRED_LOG(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGW(tag, format, ...) DEFERRED_LOG(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGI(tag, format, ...) DEFERRED_LOG(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGD(tag, format, ...) DEFERRED_LOG(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+/**
+ * Initialize deferred log and start drain task which prints records to console.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t deferred_log_init(void);
+
+/**
+ * Store log record. Function does not block and does not format the message. Use DEFERRED_LOG macros which respect
+ * DEFERRED_LOG_LEVEL instead of calling it directly.
+ * @param[in] level Log level.
+ * @param[in] tag Constant tag string.
+ * @param[in] format Constant printf format string. Star width and precision are not supported.
+ */
+void deferred_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+        __attribute__((format(printf, 3, 4)));
+
+/**
+ * Format stored records to text lines in form "{sequence} {level} ({millis}) {tag}: {message}". Only complete
+ * lines are written.
+ * @param[in,out] cursor Sequence number of the first record to read. It is moved to the first record which was not
+ * read. Cursor older than the oldest stored record is moved to the oldest record.
+ * @param[out] buffer Output buffer, output is null terminated.
+ * @param[in] size Size of output buffer.
+ * @param[out] skipped Number of records which were overwritten before they were read, can be NULL.
+ * @return Return length of output.
+ */
+size_t deferred_log_read(uint32_t *cursor, char *buffer, size_t size, uint32_t *skipped);
+
+#endif /* MAIN_DEFERRED_LOG_H_ */
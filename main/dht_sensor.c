@@ -0,0 +1,145 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of DHT22 single wire protocol. Bits are encoded in length of high pulses, so the transfer
+ * runs in critical section to keep pulse timing measurable.
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <driver/gpio.h>
+#include <rom/ets_sys.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "dht_sensor.h"
+
+#define TAG "dht_sensor"
+#define DHT_START_SIGNAL_US 1100
+#define DHT_RESPONSE_TIMEOUT_US 100
+#define DHT_BIT_TIMEOUT_US 100
+#define DHT_BIT_ONE_THRESHOLD_US 48
+#define DHT_DATA_BYTES 5
+
+static gpio_num_t dht_gpio = GPIO_NUM_NC;
+static portMUX_TYPE dht_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Wait while data line has given level.
+ * @return Return duration of the level in microseconds or -1 on timeout.
+ */
+static int32_t wait_while_level(int level, int32_t timeout_us)
+{
+    int64_t start = esp_timer_get_time();
+    int32_t elapsed = 0;
+    while (gpio_get_level(dht_gpio) == level)
+    {
+        elapsed = (int32_t)(esp_timer_get_time() - start);
+        if (elapsed > timeout_us)
+        {
+            return -1;
+        }
+    }
+    return elapsed;
+}
+
+static esp_err_t read_data(uint8_t *data)
+{
+    // Start signal, sensor responds by 80 us low and 80 us high level
+    gpio_set_level(dht_gpio, 0);
+    ets_delay_us(DHT_START_SIGNAL_US);
+    gpio_set_level(dht_gpio, 1);
+    if (wait_while_level(1, DHT_RESPONSE_TIMEOUT_US) < 0
+            || wait_while_level(0, DHT_RESPONSE_TIMEOUT_US) < 0
+            || wait_while_level(1, DHT_RESPONSE_TIMEOUT_US) < 0)
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+    // Every bit starts with 50 us low level, following high level lasts 26-28 us for 0 and 70 us for 1
+    for (int bit = 0; bit < DHT_DATA_BYTES * 8; bit++)
+    {
+        if (wait_while_level(0, DHT_BIT_TIMEOUT_US) < 0)
+        {
+            return ESP_ERR_TIMEOUT;
+        }
+        int32_t high_us = wait_while_level(1, DHT_BIT_TIMEOUT_US);
+        if (high_us < 0)
+        {
+            return ESP_ERR_TIMEOUT;
+        }
+        data[bit / 8] = (data[bit / 8] << 1) | (high_us > DHT_BIT_ONE_THRESHOLD_US ? 1 : 0);
+    }
+    return ESP_OK;
+}
+
+esp_err_t dht_sensor_init(gpio_num_t gpio)
+{
+    gpio_config_t io_conf;
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    io_conf.mode = GPIO_MODE_INPUT_OUTPUT_OD;
+    io_conf.pin_bit_mask = (1ULL<<gpio);
+    io_conf.pull_down_en = 0;
+    io_conf.pull_up_en = 1;
+    esp_err_t error = gpio_config(&io_conf);
+    if (error != ESP_OK)
+        return error;
+    dht_gpio = gpio;
+    return gpio_set_level(dht_gpio, 1);
+}
+
+esp_err_t dht_sensor_read(int16_t *humidity, int16_t *temperature)
+{
+    uint8_t data[DHT_DATA_BYTES] = { 0 };
+    if (dht_gpio == GPIO_NUM_NC)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&dht_mux);
+    esp_err_t error = read_data(data);
+    portEXIT_CRITICAL(&dht_mux);
+    gpio_set_level(dht_gpio, 1);
+    if (error != ESP_OK)
+    {
+        ESP_LOGD(TAG, "Sensor does not respond.");
+        return error;
+    }
+    if ((uint8_t)(data[0] + data[1] + data[2] + data[3]) != data[4])
+    {
+        ESP_LOGD(TAG, "Checksum mismatch.");
+        return ESP_ERR_INVALID_CRC;
+    }
+    *humidity = (int16_t)((data[0] << 8) | data[1]);
+    *temperature = (int16_t)(((data[2] & 0x7F) << 8) | data[3]);
+    if ((data[2] & 0x80) != 0)
+    {
+        *temperature = -*temperature;
+    }
+    return ESP_OK;
+}
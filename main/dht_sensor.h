@@ -0,0 +1,58 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for reading DHT22 (AM2302) temperature and humidity sensor connected to single
+ * GPIO pin.
+ */
+
+#ifndef MAIN_DHT_SENSOR_H_
+#define MAIN_DHT_SENSOR_H_
+
+#include <inttypes.h>
+#include <driver/gpio.h>
+#include <esp_err.h>
+
+/**
+ * Initialize sensor pin. Pin is configured as open drain input/output with internal pull-up.
+ * @param[in] gpio GPIO pin with sensor data line.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t dht_sensor_init(gpio_num_t gpio);
+
+/**
+ * Read single measurement from sensor. Sensor must not be read more often than once per 2 seconds.
+ * @param[out] humidity A pointer to relative humidity in tenths of percent to be set.
+ * @param[out] temperature A pointer to temperature in tenths of degree Celsius to be set.
+ * @return Return ESP_OK if succeeded, ESP_ERR_TIMEOUT if sensor does not respond or ESP_ERR_INVALID_CRC if data are corrupted.
+ */
+esp_err_t dht_sensor_read(int16_t *humidity, int16_t *temperature);
+
+#endif /* MAIN_DHT_SENSOR_H_ */
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file implements network discovery. Every enabled interface is advertised as DNS-SD service with device
+ * id in TXT record.
+ */
+
+#include <string.h>
+#include <mdns.h>
+#include <esp_log.h>
+
+#include "discovery.h"
+#include "user_config.h"
+
+#define TAG "discovery"
+
+#if GROUP_CONTROL_ENABLE
+static const char* group_names[] = GROUP_NAMES;
+static char groups_txt[128];
+
+/**
+ * Join group names to comma separated list for TXT record.
+ */
+static const char* get_groups_txt(void)
+{
+    groups_txt[0] = '\0';
+    for (size_t i = 0; i < sizeof(group_names) / sizeof(group_names[0]); i++)
+    {
+        if (i > 0)
+        {
+            strlcat(groups_txt, ",", sizeof(groups_txt));
+        }
+        strlcat(groups_txt, group_names[i], sizeof(groups_txt));
+    }
+    return groups_txt;
+}
+#endif
+
+esp_err_t discovery_init()
+{
+    esp_err_t error = mdns_init();
+    if (error != ESP_OK)
+        return error;
+    error = mdns_hostname_set(DISCOVERY_HOSTNAME);
+    if (error != ESP_OK)
+        return error;
+    mdns_instance_name_set(SWITCH_ID);
+
+#if HTTP_HTML_ENABLE || HTTP_JSON_ENABLE
+    mdns_txt_item_t http_txt[] = {
+        { "id", SWITCH_ID },
+        { "api", HTTP_JSON_ENABLE ? "/api" : "" }
+    };
+    error = mdns_service_add(NULL, "_http", "_tcp", 80, http_txt, sizeof(http_txt) / sizeof(http_txt[0]));
+    if (error != ESP_OK)
+        return error;
+#endif
+#if COAP_ADAPTER_ENABLE
+    mdns_txt_item_t coap_txt[] = {
+        { "id", SWITCH_ID },
+        { "path", "/state" }
+    };
+    error = mdns_service_add(NULL, "_coap", "_udp", COAP_PORT, coap_txt, sizeof(coap_txt) / sizeof(coap_txt[0]));
+    if (error != ESP_OK)
+        return error;
+#endif
+#if GROUP_CONTROL_ENABLE
+    mdns_txt_item_t group_txt[] = {
+        { "id", SWITCH_ID },
+        { "address", GROUP_MULTICAST_ADDRESS },
+        { "groups", get_groups_txt() }
+    };
+    error = mdns_service_add(NULL, "_relay-group", "_udp", GROUP_PORT, group_txt,
+            sizeof(group_txt) / sizeof(group_txt[0]));
+    if (error != ESP_OK)
+        return error;
+#endif
+    ESP_LOGI(TAG, "Advertising as %s.local", DISCOVERY_HOSTNAME);
+    return ESP_OK;
+}
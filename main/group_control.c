@@ -0,0 +1,218 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file implements group control over UDP multicast. Requests carry sender name and sequence number, every
+ * sender must increase its sequence number, so duplicated and replayed datagrams are dropped. Last sequence numbers
+ * are kept in RTC memory and survive software reset.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <lwip/sockets.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_log.h>
+
+#include "group_control.h"
+#include "json_serializer.h"
+#include "relay_switch.h"
+#include "metrics.h"
+#include "rate_limiter.h"
+
+#define TAG "group_control"
+#define GROUP_TASK_PRIORITY 5
+#define SENDER_TABLE_MAGIC 0x47525053UL
+
+typedef struct sender_entry
+{
+    char sender[GROUP_NAME_MAX_LENGTH];
+    uint32_t sequence;
+    /** Value of use counter at last accepted request, the least recently used entry is replaced. */
+    uint32_t last_use;
+} sender_entry_t;
+
+typedef struct sender_table
+{
+    uint32_t magic;
+    uint32_t use_counter;
+    sender_entry_t entries[GROUP_MAX_SENDERS];
+} sender_table_t;
+
+static const char* group_names[] = GROUP_NAMES;
+static RTC_NOINIT_ATTR sender_table_t sender_table;
+static char datagram[GROUP_MAX_DATAGRAM_SIZE + 1];
+static int group_socket = -1;
+
+static bool is_member(const char* group)
+{
+    for (size_t i = 0; i < sizeof(group_names) / sizeof(group_names[0]); i++)
+    {
+        if (strcmp(group_names[i], group) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Find entry of the sender. Unknown sender gets the least recently used entry, which is replaced only when request
+ * is accepted.
+ */
+static sender_entry_t* find_sender(const char* sender, bool* is_known)
+{
+    sender_entry_t *oldest = &sender_table.entries[0];
+    for (size_t i = 0; i < GROUP_MAX_SENDERS; i++)
+    {
+        sender_entry_t *candidate = &sender_table.entries[i];
+        if (strcmp(candidate->sender, sender) == 0)
+        {
+            *is_known = true;
+            return candidate;
+        }
+        if (candidate->last_use < oldest->last_use)
+        {
+            oldest = candidate;
+        }
+    }
+    *is_known = false;
+    return oldest;
+}
+
+/**
+ * Remember sequence number of accepted request.
+ */
+static void accept_sequence(sender_entry_t* entry, const group_header_t* header)
+{
+    strlcpy(entry->sender, header->sender, sizeof(entry->sender));
+    entry->sequence = header->sequence;
+    entry->last_use = ++sender_table.use_counter;
+}
+
+static void handle_datagram(void)
+{
+    group_header_t header;
+    relay_switch_command_t commands[RELAY_CHANNEL_COUNT];
+    size_t count = RELAY_CHANNEL_COUNT;
+    esp_err_t error = json_serializer_deserialize_group(datagram, &header, commands, &count);
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Invalid group request: %s", relay_switch_err_to_name(error));
+        return;
+    }
+    if (!is_member(header.group))
+        return;
+    // Replays are dropped before rate limiting, so duplicated datagrams do not consume tokens of valid requests.
+    // Sequence numbers are compared by serial number arithmetic, so they can wrap around.
+    bool is_known = false;
+    sender_entry_t *entry = find_sender(header.sender, &is_known);
+    if (is_known && (int32_t)(header.sequence - entry->sequence) <= 0)
+    {
+        ESP_LOGD(TAG, "Dropped request %u of %s", header.sequence, header.sender);
+        metrics_increment(METRIC_GROUP_REPLAYS_DROPPED);
+        return;
+    }
+    if (rate_limiter_acquire(RELAY_SWITCH_SOURCE_GROUP, 0) != ESP_OK)
+    {
+        ESP_LOGD(TAG, "Dropped request %u of %s over rate limit", header.sequence, header.sender);
+        return;
+    }
+    accept_sequence(entry, &header);
+    for (size_t i = 0; i < count; i++)
+    {
+        commands[i].source = RELAY_SWITCH_SOURCE_GROUP;
+    }
+    metrics_increment(METRIC_GROUP_REQUESTS);
+    error = relay_switch_set_states(commands, count);
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Group switch request failed: %s", relay_switch_err_to_name(error));
+    }
+}
+
+static void group_task_run(void* pvParameters)
+{
+    while (true)
+    {
+        int length = recv(group_socket, datagram, GROUP_MAX_DATAGRAM_SIZE, 0);
+        if (length <= 0)
+        {
+            ESP_LOGE(TAG, "Receiving failed: %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+        datagram[length] = '\0';
+        handle_datagram();
+    }
+}
+
+esp_err_t group_control_init()
+{
+    // Sender table is valid only after software reset, RTC memory contains garbage after power on
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (sender_table.magic != SENDER_TABLE_MAGIC || reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT)
+    {
+        memset(&sender_table, 0, sizeof(sender_table));
+        sender_table.magic = SENDER_TABLE_MAGIC;
+    }
+    for (size_t i = 0; i < GROUP_MAX_SENDERS; i++)
+    {
+        sender_table.entries[i].sender[GROUP_NAME_MAX_LENGTH - 1] = '\0';
+    }
+
+    group_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (group_socket < 0)
+    {
+        return ESP_FAIL;
+    }
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(GROUP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY)
+    };
+    struct ip_mreq membership = {
+        .imr_interface.s_addr = htonl(INADDR_ANY)
+    };
+    if (inet_aton(GROUP_MULTICAST_ADDRESS, &membership.imr_multiaddr) == 0
+            || bind(group_socket, (struct sockaddr*)&address, sizeof(address)) < 0
+            || setsockopt(group_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+    {
+        ESP_LOGE(TAG, "Joining multicast group failed: %d", errno);
+        close(group_socket);
+        group_socket = -1;
+        return ESP_FAIL;
+    }
+    if (xTaskCreate(group_task_run, "group_control", 4096, NULL, GROUP_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Listening for group requests on %s:%d", GROUP_MULTICAST_ADDRESS, GROUP_PORT);
+    return ESP_OK;
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for managing group control. Single UDP multicast datagram switches channels of
+ * all devices in addressed group.
+ */
+
+#ifndef MAIN_GROUP_CONTROL_H_
+#define MAIN_GROUP_CONTROL_H_
+
+#include <inttypes.h>
+#include <esp_err.h>
+
+#include "user_config.h"
+
+/**
+ * Addressing of group switching request.
+ */
+typedef struct group_header
+{
+    /** Name of addressed device group. */
+    char group[GROUP_NAME_MAX_LENGTH];
+    /** Name of sending controller. */
+    char sender[GROUP_NAME_MAX_LENGTH];
+    /** Sequence number which must increase with every request of the sender. */
+    uint32_t sequence;
+} group_header_t;
+
+/**
+ * Initialize group control. UDP socket joins multicast group and receiving task is started. Network must be
+ * initialized.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t group_control_init(void);
+
+#endif /* MAIN_GROUP_CONTROL_H_ */
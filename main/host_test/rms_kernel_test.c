@@ -0,0 +1,150 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains host test of RMS kernel with synthetic waveforms. Test is not part of firmware build, it is
+ * compiled and run on development machine from repository root:
+ *
+ *     gcc -Wall -Imain main/host_test/rms_kernel_test.c main/rms_kernel.c -lm -o rms_kernel_test && ./rms_kernel_test
+ *
+ * Program prints result of each case and returns non-zero exit code when any case fails.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rms_kernel.h"
+
+#define SAMPLE_COUNT 4000
+#define SAMPLES_PER_PERIOD 80
+#define MAX_SAMPLE_VALUE RMS_KERNEL_DATA_MASK
+
+static uint16_t words[SAMPLE_COUNT];
+static int failures;
+
+static uint16_t make_word(uint32_t channel, double value)
+{
+    long sample = lround(value);
+    if (sample < 0)
+    {
+        sample = 0;
+    }
+    else if (sample > MAX_SAMPLE_VALUE)
+    {
+        sample = MAX_SAMPLE_VALUE;
+    }
+    return (uint16_t)(channel << RMS_KERNEL_CHANNEL_SHIFT | (uint32_t)sample);
+}
+
+static void fill_sine(uint32_t channel, double offset, double amplitude)
+{
+    for (size_t i = 0; i < SAMPLE_COUNT; i++)
+    {
+        double phase = 2.0 * M_PI * (double)i / SAMPLES_PER_PERIOD;
+        words[i] = make_word(channel, offset + amplitude * sin(phase));
+    }
+}
+
+static void check(const char *name, uint32_t actual, uint32_t expected, uint32_t tolerance)
+{
+    uint32_t difference = actual > expected ? actual - expected : expected - actual;
+    int passed = difference <= tolerance;
+    printf("%s %s: expected %u +- %u, got %u\n", passed ? "PASS" : "FAIL", name, expected, tolerance, actual);
+    if (!passed)
+    {
+        failures++;
+    }
+}
+
+static void test_sine_with_offset(void)
+{
+    rms_accumulator_t accumulators[2];
+    memset(accumulators, 0, sizeof(accumulators));
+    fill_sine(1, 2048.0, 1000.0);
+    rms_kernel_accumulate(accumulators, 2, words, SAMPLE_COUNT);
+
+    // Sensor offset is removed, so only amplitude / sqrt(2) remains, rounding of samples adds less than 0.1 count
+    check("sine with offset", rms_kernel_compute(&accumulators[1]), (uint32_t)lround(1000.0 / M_SQRT2 * 1000.0), 100);
+    check("sine with offset, other channel", rms_kernel_compute(&accumulators[0]), 0, 0);
+}
+
+static void test_zero_signal(void)
+{
+    rms_accumulator_t accumulator;
+    memset(&accumulator, 0, sizeof(accumulator));
+    fill_sine(0, 0.0, 0.0);
+    rms_kernel_accumulate(&accumulator, 1, words, SAMPLE_COUNT);
+    check("zero signal", rms_kernel_compute(&accumulator), 0, 0);
+
+    memset(&accumulator, 0, sizeof(accumulator));
+    fill_sine(0, 2048.0, 0.0);
+    rms_kernel_accumulate(&accumulator, 1, words, SAMPLE_COUNT);
+    check("constant offset", rms_kernel_compute(&accumulator), 0, 0);
+}
+
+static void test_empty_block(void)
+{
+    rms_accumulator_t accumulator;
+    memset(&accumulator, 0, sizeof(accumulator));
+    rms_kernel_accumulate(&accumulator, 1, words, 0);
+    check("empty block", rms_kernel_compute(&accumulator), 0, 0);
+
+    // Samples of channel without accumulator must be skipped and leave block empty
+    fill_sine(3, 2048.0, 1000.0);
+    rms_kernel_accumulate(&accumulator, 1, words, SAMPLE_COUNT);
+    check("samples of unknown channel", rms_kernel_compute(&accumulator), 0, 0);
+}
+
+static void test_largest_block(void)
+{
+    // Full scale square wave over 2^20 samples is the worst case of 64-bit block sums
+    rms_accumulator_t accumulator;
+    memset(&accumulator, 0, sizeof(accumulator));
+    for (size_t i = 0; i < SAMPLE_COUNT; i++)
+    {
+        words[i] = (i % 2) ? MAX_SAMPLE_VALUE : 0;
+    }
+    for (uint32_t block = 0; block < (1UL << 20) / SAMPLE_COUNT; block++)
+    {
+        rms_kernel_accumulate(&accumulator, 1, words, SAMPLE_COUNT);
+    }
+    rms_kernel_accumulate(&accumulator, 1, words, (1UL << 20) % SAMPLE_COUNT);
+    check("largest block", rms_kernel_compute(&accumulator), MAX_SAMPLE_VALUE * 1000 / 2, 1);
+}
+
+int main(void)
+{
+    test_sine_with_offset();
+    test_zero_signal();
+    test_empty_block();
+    test_largest_block();
+    printf("%s\n", failures == 0 ? "All tests passed" : "Some tests failed");
+    return failures == 0 ? 0 : 1;
+}
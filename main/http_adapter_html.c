@@ -41,11 +41,16 @@
 
 #include "http_adapter_html.h"
 #include "relay_switch.h"
+#include "rate_limiter.h"
+#include "preset_engine.h"
+#include "buffer_pool.h"
+#include "deferred_log.h"
+#include "user_config.h"
 
 /**
- * HTML content of default web page containing current state information.
+ * HTML header of default web page containing current state information.
  */
-#define DEFAULT_HTML "<!DOCTYPE html>\n" \
+#define DEFAULT_HTML_HEADER "<!DOCTYPE html>\n" \
 "<html>\n" \
 "<head>\n" \
 "<title>\n" \
@@ -54,22 +59,51 @@
 "</head>\n" \
 "<body>\n" \
 "\n" \
-"<h2>Relay Switch</h2>\n" \
+"<h2>Relay Switch</h2>\n"
+
+/**
+ * HTML content of default web page for single switch channel.
+ */
+#define DEFAULT_HTML_CHANNEL "<h3>%s</h3>\n" \
 "<p>\n" \
 "Current switch state: %s<br/>\n" \
 "Last change: %s\n" \
-"Switch timeout: %d ms\n" \
+"Switch timeout: %u ms\n" \
 "</p>\n" \
 "\n" \
 "<form action=\"/state\" method=\"POST\">\n" \
+"  <input type=\"hidden\" name=\"channel\" value=\"%u\">\n" \
 "  <input type=\"hidden\" name=\"switch_on\" value=\"%s\">\n" \
+"  <input type=\"hidden\" name=\"if_version\" value=\"%u\">\n" \
 "  Timeout (ms): <input type=\"number\" name=\"timeout\" value=\"0\"><br/>\n" \
 "  <input type=\"submit\" value=\"%s\">\n" \
 "</form>\n" \
-"\n" \
-"</body>\n" \
+"\n"
+
+/**
+ * HTML header of preset section of default web page.
+ */
+#define DEFAULT_HTML_PRESETS "<h3>Presets</h3>\n"
+
+/**
+ * HTML form of default web page which applies preset.
+ */
+#define DEFAULT_HTML_PRESET "<form action=\"/preset\" method=\"POST\" style=\"display:inline\">\n" \
+"  <input type=\"hidden\" name=\"name\" value=\"%s\">\n" \
+"  <input type=\"submit\" value=\"%s\">\n" \
+"</form>\n"
+
+/**
+ * HTML footer of default web page.
+ */
+#define DEFAULT_HTML_FOOTER "</body>\n" \
 "</html>"
 
+/**
+ * Maximum length of rendered channel content.
+ */
+#define CHANNEL_HTML_MAX_LENGTH 640
+
 /**
  * HTML page which renders confirmation after sucessfully executing switching request.
  */
@@ -106,7 +140,7 @@
 "<body>\n" \
 "\n" \
 "<p>\n" \
-"Action failed!\n" \
+"Action failed: %s\n" \
 "</p>\n" \
 "\n" \
 "<form action=\"/\" method=\"GET\">\n" \
@@ -154,72 +188,153 @@ static uint32_t get_uint_from_string(const char *value)
     return result;
 }
 
-static esp_err_t send_get_response(httpd_req_t *req, relay_switch_state_t switch_state)
+static esp_err_t send_channel_chunk(httpd_req_t *req, const relay_switch_state_t *switch_state)
 {
-    const char *is_switched_on_string = get_on_off_string_from_bool(switch_state.is_switched_on);
-    const char *form_action_value = get_string_from_bool(!switch_state.is_switched_on);
-    time_t epoch = switch_state.last_change_utc_millis / 1000;
-    const char *formated_time_string = asctime(gmtime (&epoch));
-    const char *submit_string = switch_state.is_switched_on ? switch_off_string : switch_on_string;
+    const char *is_switched_on_string = get_on_off_string_from_bool(switch_state->is_switched_on);
+    const char *form_action_value = get_string_from_bool(!switch_state->is_switched_on);
+    time_t epoch = switch_state->last_change_utc_millis / 1000;
+    struct tm time_info;
+    char formated_time_string[32];
+    asctime_r(gmtime_r(&epoch, &time_info), formated_time_string);
+    const char *submit_string = switch_state->is_switched_on ? switch_off_string : switch_on_string;
 
-    size_t buf_len = strlen(DEFAULT_HTML) + strlen(is_switched_on_string) + strlen(form_action_value)
-        + strlen(formated_time_string) + 1;
-    char *resp = malloc(buf_len * sizeof(char));
-    if (resp == NULL)
+    char resp[CHANNEL_HTML_MAX_LENGTH];
+    int resp_len = snprintf(resp, sizeof(resp), DEFAULT_HTML_CHANNEL, relay_switch_get_channel_name(switch_state->channel),
+            is_switched_on_string, formated_time_string, switch_state->switch_timeout_millis, switch_state->channel,
+            form_action_value, switch_state->version, submit_string);
+    if (resp_len < 0 || (size_t)resp_len >= sizeof(resp))
     {
-        return ESP_ERR_NO_MEM;
+        return ESP_ERR_INVALID_SIZE;
     }
+    return httpd_resp_send_chunk(req, resp, resp_len);
+}
 
-    size_t resp_len = snprintf(resp, buf_len, DEFAULT_HTML, is_switched_on_string, formated_time_string, switch_state.switch_timeout_millis, form_action_value, submit_string);
-    httpd_resp_send(req, resp, resp_len);
-    return ESP_OK;
+#if PRESET_ENABLE
+/**
+ * Send button of every preset. Section is omitted when there are no presets.
+ */
+static esp_err_t send_presets_chunk(httpd_req_t *req)
+{
+    char name[PRESET_NAME_MAX_LENGTH];
+    char resp[sizeof(DEFAULT_HTML_PRESET) + 2 * PRESET_NAME_MAX_LENGTH];
+    esp_err_t error = ESP_OK;
+    for (size_t i = 0; error == ESP_OK && preset_engine_get_name(i, name) == ESP_OK; i++)
+    {
+        if (i == 0)
+        {
+            error = httpd_resp_sendstr_chunk(req, DEFAULT_HTML_PRESETS);
+        }
+        // Preset names contain only characters which do not need escaping
+        int resp_len = snprintf(resp, sizeof(resp), DEFAULT_HTML_PRESET, name, name);
+        if (error == ESP_OK)
+        {
+            error = httpd_resp_send_chunk(req, resp, resp_len);
+        }
+    }
+    return error;
+}
+#endif
+
+static esp_err_t send_get_response(httpd_req_t *req)
+{
+    relay_switch_state_t switch_states[RELAY_CHANNEL_COUNT];
+    size_t count = relay_switch_get_states(switch_states);
+    esp_err_t error = httpd_resp_sendstr_chunk(req, DEFAULT_HTML_HEADER);
+    for (size_t i = 0; i < count && error == ESP_OK; i++)
+    {
+        error = send_channel_chunk(req, &switch_states[i]);
+    }
+#if PRESET_ENABLE
+    if (error == ESP_OK)
+    {
+        error = send_presets_chunk(req);
+    }
+#endif
+    if (error == ESP_OK)
+    {
+        error = httpd_resp_sendstr_chunk(req, DEFAULT_HTML_FOOTER);
+    }
+    if (error == ESP_OK)
+    {
+        error = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return error;
 }
 
 static esp_err_t get_handler(httpd_req_t *req)
 {
-    relay_switch_state_t switch_state = relay_switch_get_state();
-    send_get_response(req, switch_state);
+    send_get_response(req);
     return ESP_OK;
 }
 
 /**
  * Parse switching request data from HTTP request.
  */
-static esp_err_t parse_switch_payload(httpd_req_t *req, bool *value, uint32_t *timeout)
+static esp_err_t parse_switch_payload(httpd_req_t *req, relay_switch_command_t *command)
 {
     esp_err_t error = ESP_FAIL;
     size_t buf_len = req->content_len + 1;
     if (buf_len > 1)
     {
-        char* buf = malloc(buf_len * sizeof(char));
+        char* buf = buffer_pool_alloc(buf_len * sizeof(char));
+        if (buf == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
         memset(buf, 0, buf_len);
         httpd_req_recv(req, buf, buf_len);
-        ESP_LOGI(TAG, "/state URI called. Found query: %s", buf);
+        ESP_LOGD(TAG, "/state URI called. Found query: %s", buf);
+        char channel_param[32];
+        if (httpd_query_key_value(buf, "channel", channel_param, sizeof(channel_param)) == ESP_OK)
+        {
+            ESP_LOGD(TAG, "channel parameter: %s", channel_param);
+            error = relay_switch_find_channel(channel_param, &command->channel);
+            if (error != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Unknown channel.");
+                buffer_pool_free(buf);
+                return error;
+            }
+        }
+        else
+        {
+            command->channel = 0;
+        }
         char param[6];
         error = httpd_query_key_value(buf, "switch_on", param, sizeof(param));
         if (error == ESP_OK)
         {
-            ESP_LOGI(TAG, "switch_on parameter: %s", param);
-            bool switch_on = get_bool_from_string(param);
-            *value = switch_on;
+            ESP_LOGD(TAG, "switch_on parameter: %s", param);
+            command->switch_on = get_bool_from_string(param);
         }
         else
         {
             ESP_LOGW(TAG, "Failed to get switch_on value.");
+            buffer_pool_free(buf);
+            return error;
         }
         char timeout_param[11];
         error = httpd_query_key_value(buf, "timeout", timeout_param, sizeof(timeout_param));
         if (error == ESP_OK)
         {
-            ESP_LOGI(TAG, "timeout paramter: %s", timeout_param);
-            *timeout = get_uint_from_string(timeout_param);
+            ESP_LOGD(TAG, "timeout paramter: %s", timeout_param);
+            command->timeout = get_uint_from_string(timeout_param);
         }
         else
         {
-            ESP_LOGI(TAG, "Failed to get timeout. Set to 0.");
-            *timeout = 0;
+            DEFERRED_LOGI(TAG, "Failed to get timeout. Set to 0.");
+            command->timeout = 0;
+        }
+        // Page rendered before another change must not switch channel again
+        char if_version_param[11];
+        command->if_version = 0;
+        if (httpd_query_key_value(buf, "if_version", if_version_param, sizeof(if_version_param)) == ESP_OK)
+        {
+            command->if_version = get_uint_from_string(if_version_param);
         }
-        free(buf);
+        DEFERRED_LOGI(TAG, "Switch request of channel %u: %d, timeout %u", command->channel, command->switch_on,
+                (unsigned)command->timeout);
+        buffer_pool_free(buf);
     }
     else
     {
@@ -228,26 +343,119 @@ static esp_err_t parse_switch_payload(httpd_req_t *req, bool *value, uint32_t *t
     return error;
 }
 
+static const char* get_error_description(esp_err_t error)
+{
+    switch (error)
+    {
+    case ESP_ERR_RELAY_INTERLOCK:
+        return "channel is interlocked with channel which is switched on";
+    case ESP_ERR_RELAY_DEPENDENCY:
+        return "channel dependency is not satisfied";
+    case ESP_ERR_RELAY_VERSION:
+        return "channel was changed meanwhile, reload the page";
+    case ESP_ERR_RELAY_RATE_LIMIT:
+        return "too many requests, try it later";
+    case ESP_ERR_RELAY_WEAR:
+        return "channel was switched too recently, try it later";
+    case ESP_ERR_NOT_FOUND:
+        return "preset or channel not found";
+    default:
+        return relay_switch_err_to_name(error);
+    }
+}
+
+static esp_err_t send_error_response(httpd_req_t *req, const char *reason)
+{
+    char resp[sizeof(POST_ERROR_RESPONSE_HTML) + 96];
+    int resp_len = snprintf(resp, sizeof(resp), POST_ERROR_RESPONSE_HTML, reason);
+    if (resp_len < 0 || (size_t)resp_len >= sizeof(resp))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return httpd_resp_send(req, resp, resp_len);
+}
+
 static esp_err_t post_handler(httpd_req_t *req)
 {
-    bool switch_on;
-    uint32_t timeout;
-    esp_err_t error = parse_switch_payload(req, &switch_on, &timeout);
-    const char* resp;
-    if (error == ESP_OK)
+    relay_switch_command_t command;
+    esp_err_t error = rate_limiter_acquire(RELAY_SWITCH_SOURCE_HTML,
+            rate_limiter_get_socket_address(httpd_req_to_sockfd(req)));
+    if (error != ESP_OK)
     {
-        relay_switch_set_state(switch_on, timeout);
-        resp = POST_SUCCESS_RESPONSE_HTML;
+        httpd_resp_set_status(req, "429 Too Many Requests");
+        send_error_response(req, get_error_description(error));
+        return ESP_OK;
     }
-    else
+    error = parse_switch_payload(req, &command);
+    if (error != ESP_OK)
     {
-        const char* error_string = esp_err_to_name(error);
-        ESP_LOGW(TAG, "Request parse failed: %s", error_string);
-        resp = POST_ERROR_RESPONSE_HTML;
+        ESP_LOGW(TAG, "Request parse failed: %s", esp_err_to_name(error));
+        send_error_response(req, "invalid request");
+        return error;
     }
-    httpd_resp_send(req, resp, strlen(resp));
-    return error;
+    command.source = RELAY_SWITCH_SOURCE_HTML;
+    error = relay_switch_set_state(&command);
+    if (error != ESP_OK)
+    {
+        const char* error_string = relay_switch_err_to_name(error);
+        ESP_LOGW(TAG, "Switching failed: %s", error_string);
+        send_error_response(req, get_error_description(error));
+        return ESP_OK;
+    }
+    httpd_resp_send(req, POST_SUCCESS_RESPONSE_HTML, strlen(POST_SUCCESS_RESPONSE_HTML));
+    return ESP_OK;
+}
+
+#if PRESET_ENABLE
+/**
+ * Parse preset name from HTTP request.
+ */
+static esp_err_t parse_preset_payload(httpd_req_t *req, char *name)
+{
+    char buf[64];
+    if (req->content_len == 0 || req->content_len >= sizeof(buf))
+    {
+        ESP_LOGW(TAG, "Invalid preset request length.");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int length = httpd_req_recv(req, buf, req->content_len);
+    if (length <= 0)
+    {
+        return ESP_FAIL;
+    }
+    buf[length] = '\0';
+    return httpd_query_key_value(buf, "name", name, PRESET_NAME_MAX_LENGTH);
+}
+
+static esp_err_t post_preset_handler(httpd_req_t *req)
+{
+    char name[PRESET_NAME_MAX_LENGTH];
+    esp_err_t error = rate_limiter_acquire(RELAY_SWITCH_SOURCE_HTML,
+            rate_limiter_get_socket_address(httpd_req_to_sockfd(req)));
+    if (error != ESP_OK)
+    {
+        httpd_resp_set_status(req, "429 Too Many Requests");
+        send_error_response(req, get_error_description(error));
+        return ESP_OK;
+    }
+    error = parse_preset_payload(req, name);
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Preset request parse failed: %s", esp_err_to_name(error));
+        send_error_response(req, "invalid request");
+        return ESP_OK;
+    }
+    error = preset_engine_apply(name, RELAY_SWITCH_SOURCE_HTML);
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Applying preset failed: %s", relay_switch_err_to_name(error));
+        send_error_response(req, get_error_description(error));
+        return ESP_OK;
+    }
+    httpd_resp_send(req, POST_SUCCESS_RESPONSE_HTML, strlen(POST_SUCCESS_RESPONSE_HTML));
+    return ESP_OK;
 }
+#endif
 
 esp_err_t http_adapter_html_init(httpd_handle_t* server)
 {
@@ -271,5 +479,17 @@ esp_err_t http_adapter_html_init(httpd_handle_t* server)
     error = httpd_register_uri_handler(server, &uri_get);
     if (error != ESP_OK)
         return error;
+#if PRESET_ENABLE
+    httpd_uri_t uri_preset =
+    {
+        .uri = "/preset",
+        .method = HTTP_POST,
+        .handler = post_preset_handler,
+        .user_ctx = NULL
+    };
+    error = httpd_register_uri_handler(server, &uri_preset);
+    if (error != ESP_OK)
+        return error;
+#endif
     return httpd_register_uri_handler(server, &uri_post);
 }
@@ -34,96 +34,841 @@
  * resource prefix in URL.
  */
 
+#include <string.h>
+#include <stdlib.h>
+#include <esp_system.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include <esp_log.h>
 
 #include "http_adapter_json.h"
 #include "json_serializer.h"
+#include "buffer_pool.h"
+#include "deferred_log.h"
+#include "metrics.h"
 #include "relay_switch.h"
+#include "state_cache.h"
+#include "rate_limiter.h"
+#include "usage_stats.h"
+#include "state_history.h"
+#include "platform_time.h"
+#include "relay_interlock.h"
+#include "sensor_sampler.h"
+#include "rule_engine.h"
+#include "preset_engine.h"
+#include "wifi_power.h"
+#include "ota_updater.h"
 #include "user_config.h"
 
 #define TAG "http_adapter_json"
+#define STATE_URI "/api/state"
+#define CHANNEL_URI_PREFIX STATE_URI "/"
+#define INTERLOCK_URI "/api/interlock"
+#define SENSORS_URI "/api/sensors"
+#define RULES_URI "/api/rules"
+#define PRESETS_URI "/api/presets"
+#define PRESET_URI_PREFIX PRESETS_URI "/"
+#define METRICS_URI "/api/metrics"
+#define POWER_URI "/api/power"
+#define OTA_URI "/api/ota"
+#define LOGS_URI "/api/logs"
+#define LOGS_CHUNK_SIZE 512
+#define USAGE_URI "/api/usage"
+/** Maximum length of serialized usage of single channel. */
+#define USAGE_CHANNEL_MAX_LENGTH (160 + (USAGE_DAYS + USAGE_MONTHS) * 96)
+#define HISTORY_ARCHIVE_URI "/api/history/archive"
+#define HISTORY_CHUNK_SIZE 512
+/** Maximum length of serialized transition including separator. */
+#define HISTORY_ENTRY_MAX_LENGTH 128
 
-static esp_err_t send_get_response(httpd_req_t *req, relay_switch_state_t switch_state)
+/**
+ * State of streamed history response.
+ */
+typedef struct history_response
 {
-    size_t length = 0;
-    char *serialized_string = NULL;
-    esp_err_t error = json_serializer_serialize(&switch_state, &serialized_string, &length);
-    if (error != ESP_OK) return error;
-    ESP_LOGI(TAG, "Response body: %s", serialized_string);
+    httpd_req_t *req;
+    char chunk[HISTORY_CHUNK_SIZE];
+    size_t length;
+    bool is_first;
+} history_response_t;
+
+static esp_err_t send_serialized_response(httpd_req_t *req, char *serialized_string, size_t length)
+{
+    DEFERRED_LOGD(TAG, "Response of %u bytes", (unsigned)length);
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, serialized_string, length);
     json_serializer_free(serialized_string);
     return ESP_OK;
 }
 
+/**
+ * Send JSON error response. Interlock violations are reported as conflict, version mismatch as failed precondition,
+ * exceeded rate and relay wear protection as too many requests, incomplete request body as request timeout or server
+ * error, other errors as bad request.
+ */
+static esp_err_t send_error_response(httpd_req_t *req, esp_err_t error)
+{
+    size_t length = 0;
+    char *serialized_string = NULL;
+    if (error == ESP_ERR_RELAY_INTERLOCK || error == ESP_ERR_RELAY_DEPENDENCY)
+    {
+        httpd_resp_set_status(req, "409 Conflict");
+    }
+    else if (error == ESP_ERR_RELAY_VERSION)
+    {
+        httpd_resp_set_status(req, "412 Precondition Failed");
+    }
+    else if (error == ESP_ERR_OTA_UPDATER_UNAUTHORIZED)
+    {
+        httpd_resp_set_status(req, "401 Unauthorized");
+    }
+    else if (error == ESP_ERR_RELAY_RATE_LIMIT || error == ESP_ERR_RELAY_WEAR)
+    {
+        httpd_resp_set_status(req, "429 Too Many Requests");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+    }
+    else if (error == ESP_ERR_TIMEOUT)
+    {
+        httpd_resp_set_status(req, "408 Request Timeout");
+    }
+    else if (error == ESP_ERR_INVALID_RESPONSE)
+    {
+        httpd_resp_set_status(req, "500 Internal Server Error");
+    }
+    else
+    {
+        httpd_resp_set_status(req, "400 Bad Request");
+    }
+    if (json_serializer_serialize_error(error, &serialized_string, &length) != ESP_OK)
+    {
+        return httpd_resp_send(req, NULL, 0);
+    }
+    return send_serialized_response(req, serialized_string, length);
+}
+
+/**
+ * Receive request body to allocated null terminated buffer. Buffer must be freed by caller. Body can arrive in several
+ * segments, so it is received until content length is reached.
+ * @return Return ESP_OK if succeeded, ESP_ERR_TIMEOUT if client did not send whole body in time or
+ * ESP_ERR_INVALID_RESPONSE if connection failed.
+ */
+static esp_err_t receive_body(httpd_req_t *req, char **body)
+{
+    size_t buf_len = req->content_len + 1;
+    if (buf_len <= 1)
+    {
+        ESP_LOGW(TAG, "Content is empty.");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (buf_len > buffer_pool_get_max_size())
+    {
+        ESP_LOGW(TAG, "Content is too large.");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    char* buf = buffer_pool_alloc(buf_len * sizeof(char));
+    if (buf == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    size_t received = 0;
+    while (received < req->content_len)
+    {
+        int length = httpd_req_recv(req, buf + received, req->content_len - received);
+        if (length <= 0)
+        {
+            ESP_LOGW(TAG, "Receiving body failed: %d", length);
+            buffer_pool_free(buf);
+            return length == HTTPD_SOCK_ERR_TIMEOUT ? ESP_ERR_TIMEOUT : ESP_ERR_INVALID_RESPONSE;
+        }
+        received += length;
+    }
+    buf[received] = '\0';
+    DEFERRED_LOGI(TAG, "Request body of %u bytes", (unsigned)(buf_len - 1));
+    ESP_LOGD(TAG, "%s URI called. Body:\n%s", req->uri, buf);
+    *body = buf;
+    return ESP_OK;
+}
+
+static esp_err_t send_get_response(httpd_req_t *req)
+{
+    size_t length = 0;
+    char *serialized_string = NULL;
+    esp_err_t error = state_cache_get(&serialized_string, &length);
+    if (error != ESP_OK) return error;
+    return send_serialized_response(req, serialized_string, length);
+}
+
+static esp_err_t send_channel_response(httpd_req_t *req, uint8_t channel)
+{
+    relay_switch_state_t switch_state = relay_switch_get_state(channel);
+    size_t length = 0;
+    char *serialized_string = NULL;
+    esp_err_t error = json_serializer_serialize_channel(&switch_state, &serialized_string, &length);
+    if (error != ESP_OK) return error;
+    return send_serialized_response(req, serialized_string, length);
+}
+
+/**
+ * Get channel addressed by URI in form /api/state/{channel}. Channel can be specified by name or index.
+ */
+static esp_err_t get_uri_channel(httpd_req_t *req, uint8_t *channel)
+{
+    char name[32];
+    const char *start = req->uri + strlen(CHANNEL_URI_PREFIX);
+    size_t length = strcspn(start, "?");
+    if (length == 0 || length >= sizeof(name))
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(name, start, length);
+    name[length] = '\0';
+    return relay_switch_find_channel(name, channel);
+}
+
 static esp_err_t get_handler(httpd_req_t *req)
 {
-    relay_switch_state_t switch_state = relay_switch_get_state();
-    return send_get_response(req, switch_state);
+    return send_get_response(req);
+}
+
+static esp_err_t get_channel_handler(httpd_req_t *req)
+{
+    uint8_t channel = 0;
+    if (get_uri_channel(req, &channel) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+        return ESP_OK;
+    }
+    return send_channel_response(req, channel);
+}
+
+static esp_err_t handle_switch_request(httpd_req_t *req, uint8_t default_channel)
+{
+    relay_switch_command_t commands[RELAY_CHANNEL_COUNT];
+    size_t count = RELAY_CHANNEL_COUNT;
+    char *buf = NULL;
+    relay_switch_trace_t trace = { .received_us = esp_timer_get_time() };
+    // Flood is rejected before body is received and parsed
+    esp_err_t error = rate_limiter_acquire(RELAY_SWITCH_SOURCE_JSON_API,
+            rate_limiter_get_socket_address(httpd_req_to_sockfd(req)));
+    if (error != ESP_OK)
+    {
+        send_error_response(req, error);
+        return ESP_OK;
+    }
+    error = receive_body(req, &buf);
+    if (error != ESP_OK)
+    {
+        send_error_response(req, error);
+        return error;
+    }
+    error = json_serializer_deserialize(buf, default_channel, commands, &count, &trace);
+    buffer_pool_free(buf);
+    trace.parsed_us = esp_timer_get_time();
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "JSON deserialization failed.");
+        send_error_response(req, error);
+        return ESP_OK;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        commands[i].source = RELAY_SWITCH_SOURCE_JSON_API;
+    }
+    error = relay_switch_set_states_traced(commands, count, trace.id[0] != '\0' ? &trace : NULL);
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "JSON relay_switch_set_states failed: %s", relay_switch_err_to_name(error));
+        send_error_response(req, error);
+        return ESP_OK;
+    }
+    return send_get_response(req);
 }
 
 static esp_err_t post_handler(httpd_req_t *req)
 {
-    esp_err_t error = ESP_FAIL;
-    size_t buf_len = req->content_len + 1;
-    bool switch_on = false;
-    uint32_t timeout = 0;
-    relay_switch_state_t switch_state;
-    if (buf_len > 1)
-    {
-        char* buf = malloc(buf_len * sizeof(char));
-        memset(buf, 0, buf_len);
-        httpd_req_recv(req, buf, buf_len);
-        ESP_LOGI(TAG, "/api/state URI called. Body:\n%s", buf);
-        error = json_serializer_deserialize(buf, &switch_on, &timeout);
-        if (error != ESP_OK)
+    return handle_switch_request(req, 0);
+}
+
+static esp_err_t post_channel_handler(httpd_req_t *req)
+{
+    uint8_t channel = 0;
+    if (get_uri_channel(req, &channel) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+        return ESP_OK;
+    }
+    return handle_switch_request(req, channel);
+}
+
+static esp_err_t get_interlock_handler(httpd_req_t *req)
+{
+    char *rules_json = NULL;
+    esp_err_t error = relay_interlock_get_rules(&rules_json);
+    if (error != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+        return ESP_OK;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, rules_json);
+    buffer_pool_free(rules_json);
+    return ESP_OK;
+}
+
+static esp_err_t post_interlock_handler(httpd_req_t *req)
+{
+    char *buf = NULL;
+    esp_err_t error = receive_body(req, &buf);
+    if (error == ESP_OK)
+    {
+        error = relay_interlock_set_rules(buf);
+        buffer_pool_free(buf);
+    }
+    if (error != ESP_OK)
+    {
+        send_error_response(req, error);
+        return ESP_OK;
+    }
+    return get_interlock_handler(req);
+}
+
+#if PRESET_ENABLE
+static esp_err_t get_presets_handler(httpd_req_t *req)
+{
+    char *presets_json = NULL;
+    esp_err_t error = preset_engine_get_presets(&presets_json);
+    if (error != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+        return ESP_OK;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, presets_json);
+    buffer_pool_free(presets_json);
+    return ESP_OK;
+}
+
+static esp_err_t post_presets_handler(httpd_req_t *req)
+{
+    char *buf = NULL;
+    esp_err_t error = receive_body(req, &buf);
+    if (error == ESP_OK)
+    {
+        error = preset_engine_set_presets(buf);
+        buffer_pool_free(buf);
+    }
+    if (error != ESP_OK)
+    {
+        send_error_response(req, error);
+        return ESP_OK;
+    }
+    return get_presets_handler(req);
+}
+
+/**
+ * Apply preset addressed by URI in form /api/presets/{name}. Request has no body, response contains state of all
+ * channels after the transition.
+ */
+static esp_err_t post_preset_apply_handler(httpd_req_t *req)
+{
+    char name[PRESET_NAME_MAX_LENGTH];
+    const char *start = req->uri + strlen(PRESET_URI_PREFIX);
+    size_t length = strcspn(start, "?");
+    if (length == 0 || length >= sizeof(name))
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+        return ESP_OK;
+    }
+    memcpy(name, start, length);
+    name[length] = '\0';
+    esp_err_t error = rate_limiter_acquire(RELAY_SWITCH_SOURCE_JSON_API,
+            rate_limiter_get_socket_address(httpd_req_to_sockfd(req)));
+    if (error == ESP_OK)
+    {
+        error = preset_engine_apply(name, RELAY_SWITCH_SOURCE_JSON_API);
+    }
+    if (error == ESP_ERR_NOT_FOUND)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+        return ESP_OK;
+    }
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Applying preset failed: %s", relay_switch_err_to_name(error));
+        send_error_response(req, error);
+        return ESP_OK;
+    }
+    return send_get_response(req);
+}
+#endif
+
+static esp_err_t get_metrics_handler(httpd_req_t *req)
+{
+    // Heap gauges are sampled on request, they are used to detect heap drift
+    metrics_set(METRIC_HEAP_FREE_BYTES, esp_get_free_heap_size());
+    metrics_set(METRIC_HEAP_LARGEST_FREE_BLOCK, heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    size_t length = 0;
+    char *serialized_string = NULL;
+    esp_err_t error = json_serializer_serialize_metrics(&serialized_string, &length);
+    if (error != ESP_OK) return error;
+    return send_serialized_response(req, serialized_string, length);
+}
+
+/**
+ * Send deferred log records as text lines. Query parameter since selects the first sequence number, so client can
+ * poll only new records.
+ */
+static esp_err_t get_logs_handler(httpd_req_t *req)
+{
+    char query[32];
+    char since[11];
+    uint32_t cursor = 0;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+            && httpd_query_key_value(query, "since", since, sizeof(since)) == ESP_OK)
+    {
+        cursor = strtoul(since, NULL, 10);
+    }
+    uint32_t start = cursor;
+    char chunk[LOGS_CHUNK_SIZE];
+    httpd_resp_set_type(req, "text/plain");
+    // Records logged during response are sent only while they fit to one ring length
+    while (cursor - start < DEFERRED_LOG_RECORDS)
+    {
+        size_t length = deferred_log_read(&cursor, chunk, sizeof(chunk), NULL);
+        if (length == 0)
+            break;
+        if (httpd_resp_send_chunk(req, chunk, length) != ESP_OK)
+            return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+#if USAGE_STATS_ENABLE
+/**
+ * Send usage of all channels. Every channel is serialized and sent as separate chunk, so response size does not
+ * depend on channel count.
+ */
+static esp_err_t get_usage_handler(httpd_req_t *req)
+{
+    char *buffer = buffer_pool_alloc(USAGE_CHANNEL_MAX_LENGTH);
+    if (buffer == NULL)
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    httpd_resp_set_type(req, "application/json");
+    int header_length = snprintf(buffer, USAGE_CHANNEL_MAX_LENGTH,
+            "{\"id\":\"%s\",\"timeQuality\":\"%s\",\"channels\":[", SWITCH_ID,
+            platform_time_quality_to_name(platform_get_time_quality()));
+    esp_err_t error = httpd_resp_send_chunk(req, buffer, header_length);
+    for (uint8_t channel = 0; channel < relay_switch_get_channel_count() && error == ESP_OK; channel++)
+    {
+        usage_report_t report;
+        size_t length = USAGE_CHANNEL_MAX_LENGTH - 1;
+        error = usage_stats_get_report(channel, &report);
+        if (error == ESP_OK)
         {
-            ESP_LOGE(TAG, "JSON deserialization failed.");
-            goto exit;
+            // Separator is written before object, so it is sent in the same chunk
+            buffer[0] = ',';
+            error = json_serializer_serialize_usage(channel, &report, buffer + 1, &length);
         }
-        error = relay_switch_set_state(switch_on, timeout);
+        if (error == ESP_OK)
+        {
+            error = channel == 0 ? httpd_resp_send_chunk(req, buffer + 1, length)
+                    : httpd_resp_send_chunk(req, buffer, length + 1);
+        }
+    }
+    buffer_pool_free(buffer);
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Sending usage failed: %s", esp_err_to_name(error));
+        return ESP_FAIL;
+    }
+    error = httpd_resp_sendstr_chunk(req, "]}");
+    if (error == ESP_OK)
+    {
+        error = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return error;
+}
+#endif
+
+#if HISTORY_ENABLE
+/**
+ * Append transitions of history record to response chunk. Chunk is sent when next transition may not fit.
+ */
+static esp_err_t append_history_record(const state_history_record_t *record, void *context)
+{
+    history_response_t *response = (history_response_t*)context;
+    for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        if ((record->changed_mask & (1UL << channel)) == 0)
+            continue;
+        if (response->length + HISTORY_ENTRY_MAX_LENGTH > HISTORY_CHUNK_SIZE)
+        {
+            esp_err_t error = httpd_resp_send_chunk(response->req, response->chunk, response->length);
+            if (error != ESP_OK)
+                return error;
+            response->length = 0;
+        }
+        if (!response->is_first)
+        {
+            response->chunk[response->length++] = ',';
+        }
+        size_t length = HISTORY_ENTRY_MAX_LENGTH - 1;
+        esp_err_t error = json_serializer_serialize_history(record, channel, response->chunk + response->length,
+                &length);
         if (error != ESP_OK)
+            return error;
+        response->length += length;
+        response->is_first = false;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Stream transitions from history partition as JSON array. Query parameters from and to select range of UTC
+ * timestamps in milliseconds, both are optional.
+ */
+static esp_err_t get_history_archive_handler(httpd_req_t *req)
+{
+    char query[64];
+    char value[21];
+    uint64_t from_utc_millis = 0;
+    uint64_t to_utc_millis = UINT64_MAX;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        if (httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK)
         {
-            ESP_LOGE(TAG, "JSON relay_switch_set_state failed.");
+            from_utc_millis = strtoull(value, NULL, 10);
         }
-        free(buf);
+        if (httpd_query_key_value(query, "to", value, sizeof(value)) == ESP_OK)
+        {
+            to_utc_millis = strtoull(value, NULL, 10);
+        }
+    }
+    history_response_t response = {
+        .req = req,
+        .chunk = "[",
+        .length = 1,
+        .is_first = true
+    };
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t error = state_history_query(from_utc_millis, to_utc_millis, append_history_record, &response);
+    if (error == ESP_ERR_INVALID_STATE || error == ESP_ERR_NO_MEM)
+    {
+        // Nothing was sent yet
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    if (error == ESP_OK)
+    {
+        response.chunk[response.length++] = ']';
+        error = httpd_resp_send_chunk(req, response.chunk, response.length);
+    }
+    if (error != ESP_OK)
+    {
+        // Response can be already partially sent, so connection is closed
+        ESP_LOGE(TAG, "Sending history failed: %s", esp_err_to_name(error));
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+#endif
 
-        switch_state = relay_switch_get_state();
-        switch_state.switch_timeout_millis = timeout;
-        send_get_response(req, switch_state);
+static esp_err_t get_power_handler(httpd_req_t *req)
+{
+    wifi_power_config_t config;
+    uint16_t listen_interval = 0;
+    wifi_power_get_config(&config, &listen_interval);
+    size_t length = 0;
+    char *serialized_string = NULL;
+    esp_err_t error = json_serializer_serialize_power(&config, listen_interval, &serialized_string, &length);
+    if (error != ESP_OK) return error;
+    return send_serialized_response(req, serialized_string, length);
+}
+
+static esp_err_t post_power_handler(httpd_req_t *req)
+{
+    wifi_power_config_t config;
+    uint16_t listen_interval = 0;
+    wifi_power_get_config(&config, &listen_interval);
+    char *buf = NULL;
+    esp_err_t error = receive_body(req, &buf);
+    if (error == ESP_OK)
+    {
+        error = json_serializer_deserialize_power(buf, &config);
+        buffer_pool_free(buf);
+    }
+    if (error == ESP_OK)
+    {
+        error = wifi_power_set_config(&config);
+    }
+    if (error != ESP_OK)
+    {
+        send_error_response(req, error);
         return ESP_OK;
     }
-    else
+    return get_power_handler(req);
+}
+
+#if OTA_ENABLE
+#define BEARER_PREFIX "Bearer "
+
+/**
+ * Receive next image chunk directly to OTA buffer. Socket timeouts are retried until no data comes for
+ * OTA_UPLOAD_STALL_TIMEOUT_MS, then the update is aborted, so stalled client does not hold HTTP server and OTA lock.
+ */
+static int read_ota_chunk(void* context, char* buffer, size_t size)
+{
+    httpd_req_t *req = (httpd_req_t*)context;
+    int64_t deadline = esp_timer_get_time() + OTA_UPLOAD_STALL_TIMEOUT_MS * 1000LL;
+    int length;
+    do
     {
-        ESP_LOGW(TAG, "Content is empty.");
+        length = httpd_req_recv(req, buffer, size);
+    } while (length == HTTPD_SOCK_ERR_TIMEOUT && esp_timer_get_time() < deadline);
+    if (length == HTTPD_SOCK_ERR_TIMEOUT)
+    {
+        ESP_LOGW(TAG, "Upload stalled for %d ms", OTA_UPLOAD_STALL_TIMEOUT_MS);
     }
+    return length;
+}
 
-exit:
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, NULL);
-    return error;
+/**
+ * Check "Authorization: Bearer {token}" header against OTA_AUTH_TOKEN.
+ */
+static bool is_ota_authorized(httpd_req_t *req)
+{
+    char authorization[sizeof(BEARER_PREFIX) + sizeof(OTA_AUTH_TOKEN)];
+    if (httpd_req_get_hdr_value_str(req, "Authorization", authorization, sizeof(authorization)) != ESP_OK
+            || strncmp(authorization, BEARER_PREFIX, strlen(BEARER_PREFIX)) != 0)
+    {
+        return ota_updater_is_authorized("");
+    }
+    return ota_updater_is_authorized(authorization + strlen(BEARER_PREFIX));
 }
 
-esp_err_t http_adapter_json_init(httpd_handle_t* server)
+static esp_err_t post_ota_handler(httpd_req_t *req)
 {
-    httpd_uri_t uri_get =
+    ota_updater_result_t result;
+    if (!is_ota_authorized(req))
     {
-        .uri = "/api/state",
-        .method = HTTP_GET,
-        .handler = get_handler,
-        .user_ctx = NULL
-    };
+        send_error_response(req, ESP_ERR_OTA_UPDATER_UNAUTHORIZED);
+        return ESP_OK;
+    }
+    if (req->content_len == 0)
+    {
+        send_error_response(req, ESP_ERR_INVALID_SIZE);
+        return ESP_OK;
+    }
+    esp_err_t error = ota_updater_run(req->content_len, read_ota_chunk, req, &result);
+    if (error != ESP_OK)
+    {
+        send_error_response(req, error);
+        return ESP_OK;
+    }
+    size_t length = 0;
+    char *serialized_string = NULL;
+    error = json_serializer_serialize_ota(error, &result, &serialized_string, &length);
+    if (error == ESP_OK)
+    {
+        send_serialized_response(req, serialized_string, length);
+    }
+    ota_updater_schedule_restart();
+    return ESP_OK;
+}
+#endif
 
-    httpd_uri_t uri_post =
+#if SENSOR_ENABLE
+static esp_err_t get_sensors_handler(httpd_req_t *req)
+{
+    sensor_aggregates_t aggregates;
+    if (sensor_sampler_get_aggregates(&aggregates) != ESP_OK)
     {
-        .uri = "/api/state",
-        .method = HTTP_POST,
-        .handler = post_handler,
-        .user_ctx = NULL
-    };
+        // No valid sample yet
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    size_t length = 0;
+    char *serialized_string = NULL;
+    esp_err_t error = json_serializer_serialize_sensors(&aggregates, &serialized_string, &length);
+    if (error != ESP_OK) return error;
+    return send_serialized_response(req, serialized_string, length);
+}
+#endif
 
-    esp_err_t error = ESP_OK;
-    error = httpd_register_uri_handler(server, &uri_get);
+#if RULE_ENGINE_ENABLE
+static esp_err_t get_rules_handler(httpd_req_t *req)
+{
+    char *rules_json = NULL;
+    esp_err_t error = rule_engine_get_rules(&rules_json);
     if (error != ESP_OK)
-        return error;
-    return httpd_register_uri_handler(server, &uri_post);
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+        return ESP_OK;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, rules_json);
+    buffer_pool_free(rules_json);
+    return ESP_OK;
+}
+
+static esp_err_t post_rules_handler(httpd_req_t *req)
+{
+    char *buf = NULL;
+    esp_err_t error = receive_body(req, &buf);
+    if (error == ESP_OK)
+    {
+        error = rule_engine_set_rules(buf);
+        buffer_pool_free(buf);
+    }
+    if (error != ESP_OK)
+    {
+        send_error_response(req, error);
+        return ESP_OK;
+    }
+    return get_rules_handler(req);
+}
+#endif
+
+esp_err_t http_adapter_json_init(httpd_handle_t* server)
+{
+    const httpd_uri_t uri_handlers[] =
+    {
+        {
+            .uri = STATE_URI,
+            .method = HTTP_GET,
+            .handler = get_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = STATE_URI,
+            .method = HTTP_POST,
+            .handler = post_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = CHANNEL_URI_PREFIX "*",
+            .method = HTTP_GET,
+            .handler = get_channel_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = CHANNEL_URI_PREFIX "*",
+            .method = HTTP_POST,
+            .handler = post_channel_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = INTERLOCK_URI,
+            .method = HTTP_GET,
+            .handler = get_interlock_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = INTERLOCK_URI,
+            .method = HTTP_POST,
+            .handler = post_interlock_handler,
+            .user_ctx = NULL
+        },
+#if PRESET_ENABLE
+        {
+            .uri = PRESETS_URI,
+            .method = HTTP_GET,
+            .handler = get_presets_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = PRESETS_URI,
+            .method = HTTP_POST,
+            .handler = post_presets_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = PRESET_URI_PREFIX "*",
+            .method = HTTP_POST,
+            .handler = post_preset_apply_handler,
+            .user_ctx = NULL
+        },
+#endif
+        {
+            .uri = METRICS_URI,
+            .method = HTTP_GET,
+            .handler = get_metrics_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = LOGS_URI,
+            .method = HTTP_GET,
+            .handler = get_logs_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = POWER_URI,
+            .method = HTTP_GET,
+            .handler = get_power_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = POWER_URI,
+            .method = HTTP_POST,
+            .handler = post_power_handler,
+            .user_ctx = NULL
+        },
+#if USAGE_STATS_ENABLE
+        {
+            .uri = USAGE_URI,
+            .method = HTTP_GET,
+            .handler = get_usage_handler,
+            .user_ctx = NULL
+        },
+#endif
+#if HISTORY_ENABLE
+        {
+            .uri = HISTORY_ARCHIVE_URI,
+            .method = HTTP_GET,
+            .handler = get_history_archive_handler,
+            .user_ctx = NULL
+        },
+#endif
+#if OTA_ENABLE
+        {
+            .uri = OTA_URI,
+            .method = HTTP_POST,
+            .handler = post_ota_handler,
+            .user_ctx = NULL
+        },
+#endif
+#if SENSOR_ENABLE
+        {
+            .uri = SENSORS_URI,
+            .method = HTTP_GET,
+            .handler = get_sensors_handler,
+            .user_ctx = NULL
+        },
+#endif
+#if RULE_ENGINE_ENABLE
+        {
+            .uri = RULES_URI,
+            .method = HTTP_GET,
+            .handler = get_rules_handler,
+            .user_ctx = NULL
+        },
+        {
+            .uri = RULES_URI,
+            .method = HTTP_POST,
+            .handler = post_rules_handler,
+            .user_ctx = NULL
+        },
+#endif
+    };
+
+    for (size_t i = 0; i < sizeof(uri_handlers) / sizeof(uri_handlers[0]); i++)
+    {
+        esp_err_t error = httpd_register_uri_handler(server, &uri_handlers[i]);
+        if (error != ESP_OK)
+            return error;
+    }
+    return ESP_OK;
 }
@@ -34,14 +34,199 @@
 
 #include <esp_log.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
 
 #include "json_serializer.h"
+#include "buffer_pool.h"
+#include "current_sensor.h"
+#include "metrics.h"
+#include "platform_time.h"
 #include "user_config.h"
 #include "parson.h"
 
 #define TAG "json_serializer"
 
-esp_err_t json_serializer_deserialize(const char *received_data, bool *value, uint32_t *timeout)
+#define FITS_STATE_DOCUMENT(size, count) || (size) >= STATE_DOCUMENT_SIZE
+_Static_assert(0 BUFFER_POOL_CLASSES(FITS_STATE_DOCUMENT),
+        "The largest buffer pool block must hold serialized state document, see BUFFER_POOL_LARGE_BLOCK_SIZE");
+
+void json_serializer_init()
+{
+    json_set_allocation_functions(buffer_pool_alloc, buffer_pool_free);
+}
+
+/**
+ * Get channel from JSON value. Channel can be specified by index or by name.
+ */
+static esp_err_t get_channel_value(const JSON_Value *channel_value, uint8_t *channel)
+{
+    if (json_value_get_type(channel_value) == JSONNumber)
+    {
+        double index = json_value_get_number(channel_value);
+        if (index < 0 || index >= relay_switch_get_channel_count())
+        {
+            ESP_LOGE(TAG, "channel index out of range.");
+            return ESP_ERR_NOT_FOUND;
+        }
+        *channel = (uint8_t)index;
+        return ESP_OK;
+    }
+    if (json_value_get_type(channel_value) == JSONString)
+    {
+        esp_err_t error = relay_switch_find_channel(json_value_get_string(channel_value), channel);
+        if (error != ESP_OK)
+        {
+            ESP_LOGE(TAG, "channel not found.");
+        }
+        return error;
+    }
+    ESP_LOGE(TAG, "channel has invalid type.");
+    return ESP_FAIL;
+}
+
+static esp_err_t get_channel(const JSON_Object *command_data, uint8_t default_channel, uint8_t *channel)
+{
+    JSON_Value *channel_value = json_object_get_value(command_data, "channel");
+    if (channel_value == NULL)
+    {
+        *channel = default_channel;
+        return ESP_OK;
+    }
+    return get_channel_value(channel_value, channel);
+}
+
+/**
+ * Get bit mask of channels from JSON array of channel names or indexes.
+ */
+static esp_err_t get_channel_mask(const JSON_Array *channels, uint32_t *mask)
+{
+    *mask = 0;
+    if (channels == NULL)
+    {
+        ESP_LOGE(TAG, "channel array not found in JSON.");
+        return ESP_ERR_NOT_FOUND;
+    }
+    for (size_t i = 0; i < json_array_get_count(channels); i++)
+    {
+        uint8_t channel;
+        esp_err_t error = get_channel_value(json_array_get_value(channels, i), &channel);
+        if (error != ESP_OK)
+        {
+            return error;
+        }
+        *mask |= 1UL << channel;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t get_command(const JSON_Object *command_data, uint8_t default_channel, relay_switch_command_t *command)
+{
+    esp_err_t error = get_channel(command_data, default_channel, &command->channel);
+    if (error != ESP_OK)
+    {
+        return error;
+    }
+    const char *switch_on_name = "switchedOn";
+    if (json_object_has_value_of_type(command_data, switch_on_name, JSONBoolean))
+    {
+        command->switch_on = json_object_get_boolean(command_data, switch_on_name);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "switchOn property not found in JSON.");
+        return ESP_ERR_NOT_FOUND;
+    }
+    const char *timeout_name = "timeout";
+    if (json_object_has_value_of_type(command_data, timeout_name, JSONNumber))
+    {
+        command->timeout = (uint32_t)json_object_get_number(command_data, timeout_name);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "timeout property not found in JSON.");
+        return ESP_ERR_NOT_FOUND;
+    }
+    // Optional version required for compare-and-set switching
+    const char *if_version_name = "ifVersion";
+    command->if_version = 0;
+    if (json_object_has_value_of_type(command_data, if_version_name, JSONNumber))
+    {
+        double if_version = json_object_get_number(command_data, if_version_name);
+        if (if_version < 1 || if_version > UINT32_MAX)
+        {
+            ESP_LOGE(TAG, "ifVersion out of range.");
+            return ESP_ERR_INVALID_ARG;
+        }
+        command->if_version = (uint32_t)if_version;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Get switching requests from single request object or from object with "channels" array of requests.
+ */
+static esp_err_t get_commands(const JSON_Object *switch_data, uint8_t default_channel, relay_switch_command_t *commands,
+        size_t *count)
+{
+    JSON_Array *channels = json_object_get_array(switch_data, "channels");
+    if (channels == NULL)
+    {
+        if (*count < 1)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        esp_err_t error = get_command(switch_data, default_channel, &commands[0]);
+        *count = error == ESP_OK ? 1 : 0;
+        return error;
+    }
+    size_t channel_count = json_array_get_count(channels);
+    if (channel_count > *count)
+    {
+        ESP_LOGE(TAG, "Too many channels in JSON.");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < channel_count; i++)
+    {
+        JSON_Object *command_data = json_array_get_object(channels, i);
+        if (command_data == NULL)
+        {
+            return ESP_FAIL;
+        }
+        esp_err_t error = get_command(command_data, default_channel, &commands[i]);
+        if (error != ESP_OK)
+        {
+            return error;
+        }
+    }
+    *count = channel_count;
+    return ESP_OK;
+}
+
+/**
+ * Get optional trace ID and client timestamp of switching request.
+ */
+static esp_err_t get_trace(const JSON_Object *switch_data, relay_switch_trace_t *trace)
+{
+    trace->id[0] = '\0';
+    trace->client_millis = 0;
+    const char *id = json_object_get_string(switch_data, "traceId");
+    if (id != NULL && strlcpy(trace->id, id, sizeof(trace->id)) >= sizeof(trace->id))
+    {
+        ESP_LOGE(TAG, "traceId is too long.");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    double client_millis = json_object_get_number(switch_data, "clientMillis");
+    if (client_millis > 0)
+    {
+        trace->client_millis = (uint64_t)client_millis;
+    }
+    return ESP_OK;
+}
+
+esp_err_t json_serializer_deserialize(const char *received_data, uint8_t default_channel, relay_switch_command_t *commands, size_t *count,
+        relay_switch_trace_t *trace)
 {
     esp_err_t error = ESP_FAIL;
     JSON_Value *root_value;
@@ -53,48 +238,709 @@ esp_err_t json_serializer_deserialize(const char *received_data, bool *value, ui
         return error;
     }
     switch_data = json_value_get_object(root_value);
-    const char *switch_on_name = "switchedOn";
-    if (json_object_has_value_of_type(switch_data, switch_on_name, JSONBoolean))
+    if (switch_data == NULL)
     {
-        *value = json_object_get_boolean(switch_data, switch_on_name);
+        ESP_LOGE(TAG, "JSON payload is not object.");
     }
     else
     {
-        ESP_LOGE(TAG, "switchOn property not found in JSON.");
-        error = ESP_ERR_NOT_FOUND;
-        goto exit;
+        error = trace != NULL ? get_trace(switch_data, trace) : ESP_OK;
+        if (error == ESP_OK)
+        {
+            error = get_commands(switch_data, default_channel, commands, count);
+        }
     }
-    const char *timeout_name = "timeout";
-    if (json_object_has_value_of_type(switch_data, timeout_name, JSONNumber))
+    json_value_free(root_value);
+    return error;
+}
+
+esp_err_t json_serializer_deserialize_group(const char *received_data, group_header_t *header,
+        relay_switch_command_t *commands, size_t *count)
+{
+    esp_err_t error = ESP_FAIL;
+    JSON_Value *root_value = json_parse_string(received_data);
+    if (root_value == NULL)
     {
-        *timeout = (uint32_t)json_object_get_number(switch_data, timeout_name);
-        error = ESP_OK;
-        goto exit;
+        ESP_LOGE(TAG, "Cannot parse JSON.");
+        return error;
+    }
+    JSON_Object *group_data = json_value_get_object(root_value);
+    const char *group = json_object_get_string(group_data, "group");
+    const char *sender = json_object_get_string(group_data, "sender");
+    double sequence = json_object_get_number(group_data, "seq");
+    if (group == NULL || sender == NULL || !json_object_has_value_of_type(group_data, "seq", JSONNumber)
+            || sequence < 0 || sequence > UINT32_MAX)
+    {
+        ESP_LOGE(TAG, "group, sender or seq property not found in JSON.");
+    }
+    else if (strlcpy(header->group, group, sizeof(header->group)) >= sizeof(header->group)
+            || strlcpy(header->sender, sender, sizeof(header->sender)) >= sizeof(header->sender))
+    {
+        error = ESP_ERR_INVALID_SIZE;
     }
     else
     {
-        ESP_LOGE(TAG, "timeout property not found in JSON.");
-        error = ESP_ERR_NOT_FOUND;
+        header->sequence = (uint32_t)sequence;
+        error = get_commands(group_data, 0, commands, count);
     }
-exit:
     json_value_free(root_value);
     return error;
 }
 
-esp_err_t json_serializer_serialize(const relay_switch_state_t *switch_state, char **serialized_string, size_t *length)
+static void set_channel_object(JSON_Object *channel_object, const relay_switch_state_t *switch_state)
+{
+    json_object_set_number(channel_object, "channel", switch_state->channel);
+    json_object_set_string(channel_object, "name", relay_switch_get_channel_name(switch_state->channel));
+    json_object_set_boolean(channel_object, "switchedOn", switch_state->is_switched_on);
+    json_object_set_number(channel_object, JSON_SERIALIZER_TIMEOUT_KEY, switch_state->switch_timeout_millis);
+    json_object_set_number(channel_object, "lastChangeUtcMillis", switch_state->last_change_utc_millis);
+    json_object_set_string(channel_object, "source", relay_switch_source_to_name(switch_state->last_change_source));
+    json_object_set_number(channel_object, "version", switch_state->version);
+#if CURRENT_SENSOR_ENABLE
+    current_reading_t reading;
+    if (current_sensor_get_reading(switch_state->channel, &reading) == ESP_OK)
+    {
+        json_object_set_number(channel_object, "current", reading.rms_milliamps);
+        json_object_set_number(channel_object, "energyWh", reading.energy_millijoules / 3600000.0);
+        json_object_set_string(channel_object, "fault", current_sensor_fault_to_name(reading.fault));
+    }
+#endif
+}
+
+static esp_err_t serialize_value(JSON_Value *root_value, char **serialized_string, size_t *length)
+{
+    // Documents are not pretty printed, indentation would take pool blocks and bandwidth
+    *serialized_string = json_serialize_to_string(root_value);
+    json_value_free(root_value);
+    if (*serialized_string == NULL) return ESP_FAIL;
+    *length = strlen(*serialized_string);
+    return ESP_OK;
+}
+
+static void set_trace_object(JSON_Object *root_object, const relay_switch_trace_t *trace)
+{
+    JSON_Value *trace_value = json_value_init_object();
+    JSON_Object *trace_object = json_value_get_object(trace_value);
+    json_object_set_string(trace_object, "id", trace->id);
+    if (trace->client_millis > 0)
+    {
+        json_object_set_number(trace_object, "clientMillis", trace->client_millis);
+    }
+    json_object_set_number(trace_object, "receivedMicros", trace->received_us);
+    json_object_set_number(trace_object, "parsedMicros", trace->parsed_us);
+    json_object_set_number(trace_object, "actuatedMicros", trace->actuated_us);
+    json_object_set_number(trace_object, "version", trace->version);
+    json_object_set_value(root_object, "trace", trace_value);
+}
+
+esp_err_t json_serializer_serialize(const relay_switch_state_t *switch_states, size_t count,
+        const relay_switch_trace_t *trace, char **serialized_string, size_t *length)
 {
     JSON_Value *root_value = json_value_init_object();
     JSON_Object *root_object = json_value_get_object(root_value);
+    JSON_Value *channels_value = json_value_init_array();
+    JSON_Array *channels = json_value_get_array(channels_value);
 
     json_object_set_string(root_object, "id", SWITCH_ID);
-    json_object_set_boolean(root_object, "switchedOn", switch_state->is_switched_on);
-    json_object_set_number(root_object, "timeout", switch_state->switch_timeout_millis);
-    json_object_set_number(root_object, "lastChangeUtcMillis", switch_state->last_change_utc_millis);
+    json_object_set_string(root_object, "timeQuality", platform_time_quality_to_name(platform_get_time_quality()));
+    for (size_t i = 0; i < count; i++)
+    {
+        JSON_Value *channel_value = json_value_init_object();
+        set_channel_object(json_value_get_object(channel_value), &switch_states[i]);
+        json_array_append_value(channels, channel_value);
+    }
+    json_object_set_value(root_object, "channels", channels_value);
+    if (trace != NULL)
+    {
+        set_trace_object(root_object, trace);
+    }
+    return serialize_value(root_value, serialized_string, length);
+}
 
-    *serialized_string = json_serialize_to_string_pretty(root_value);
-    if (*serialized_string == NULL) return ESP_FAIL;
-    *length = strlen(*serialized_string);
+esp_err_t json_serializer_serialize_channel(const relay_switch_state_t *switch_state, char **serialized_string, size_t *length)
+{
+    JSON_Value *root_value = json_value_init_object();
+    JSON_Object *root_object = json_value_get_object(root_value);
+
+    json_object_set_string(root_object, "id", SWITCH_ID);
+    json_object_set_string(root_object, "timeQuality", platform_time_quality_to_name(platform_get_time_quality()));
+    set_channel_object(root_object, switch_state);
+    return serialize_value(root_value, serialized_string, length);
+}
+
+static esp_err_t get_interlock_rule(const JSON_Object *rule_data, relay_interlock_rules_t *rules)
+{
+    const char *type = json_object_get_string(rule_data, "type");
+    if (type == NULL)
+    {
+        ESP_LOGE(TAG, "type property not found in JSON.");
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t error = ESP_OK;
+    uint8_t channel = 0;
+    uint32_t mask = 0;
+    if (strcmp(type, "exclusive") == 0)
+    {
+        error = get_channel_mask(json_object_get_array(rule_data, "channels"), &mask);
+        for (uint8_t i = 0; i < RELAY_CHANNEL_COUNT && error == ESP_OK; i++)
+        {
+            if ((mask & (1UL << i)) != 0)
+            {
+                rules->exclusive_masks[i] |= mask & ~(1UL << i);
+            }
+        }
+        return error;
+    }
+    error = get_channel(rule_data, RELAY_CHANNEL_COUNT, &channel);
+    if (error != ESP_OK || channel >= RELAY_CHANNEL_COUNT)
+    {
+        ESP_LOGE(TAG, "channel property not found in JSON.");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (strcmp(type, "requires") == 0)
+    {
+        error = get_channel_mask(json_object_get_array(rule_data, "requires"), &mask);
+        rules->requires_masks[channel] |= mask & ~(1UL << channel);
+        return error;
+    }
+    if (strcmp(type, "maxOn") == 0)
+    {
+        if (!json_object_has_value_of_type(rule_data, "millis", JSONNumber))
+        {
+            ESP_LOGE(TAG, "millis property not found in JSON.");
+            return ESP_ERR_NOT_FOUND;
+        }
+        rules->max_on_millis[channel] = (uint32_t)json_object_get_number(rule_data, "millis");
+        return ESP_OK;
+    }
+    ESP_LOGE(TAG, "Unknown interlock rule type: %s", type);
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t json_serializer_deserialize_interlock(const char *received_data, relay_interlock_rules_t *rules)
+{
+    esp_err_t error = ESP_OK;
+    JSON_Value *root_value = json_parse_string(received_data);
+    if (root_value == NULL)
+    {
+        ESP_LOGE(TAG, "Cannot parse JSON.");
+        return ESP_FAIL;
+    }
+    JSON_Array *rule_array = json_value_get_array(root_value);
+    if (rule_array == NULL)
+    {
+        ESP_LOGE(TAG, "JSON payload is not array.");
+        error = ESP_FAIL;
+    }
+    for (size_t i = 0; rule_array != NULL && i < json_array_get_count(rule_array) && error == ESP_OK; i++)
+    {
+        JSON_Object *rule_data = json_array_get_object(rule_array, i);
+        error = rule_data != NULL ? get_interlock_rule(rule_data, rules) : ESP_FAIL;
+    }
     json_value_free(root_value);
+    return error;
+}
+
+static esp_err_t get_quantity(const char *name, uint8_t *quantity)
+{
+    for (int i = 0; name != NULL && i < SENSOR_QUANTITY_COUNT; i++)
+    {
+        if (strcmp(name, sensor_sampler_quantity_to_name(i)) == 0)
+        {
+            *quantity = i;
+            return ESP_OK;
+        }
+    }
+    ESP_LOGE(TAG, "Unknown sensor quantity.");
+    return ESP_ERR_NOT_FOUND;
+}
+
+static esp_err_t get_aggregate(const char *name, uint8_t *aggregate)
+{
+    static const char *aggregate_names[] = { "last", "min", "max", "mean" };
+    if (name == NULL)
+    {
+        *aggregate = RULE_AGGREGATE_LAST;
+        return ESP_OK;
+    }
+    for (uint8_t i = 0; i < sizeof(aggregate_names) / sizeof(aggregate_names[0]); i++)
+    {
+        if (strcmp(name, aggregate_names[i]) == 0)
+        {
+            *aggregate = i;
+            return ESP_OK;
+        }
+    }
+    ESP_LOGE(TAG, "Unknown sensor aggregate.");
+    return ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * Get minute of day from string in HH:MM format.
+ */
+static esp_err_t get_minute_of_day(const char *time_string, int32_t *minute)
+{
+    unsigned int hours = 0;
+    unsigned int minutes = 0;
+    char end = '\0';
+    if (time_string == NULL || sscanf(time_string, "%u:%u%c", &hours, &minutes, &end) != 2 || hours > 24
+            || minutes > 59 || hours * 60 + minutes > 1440)
+    {
+        ESP_LOGE(TAG, "Time must be in HH:MM format.");
+        return ESP_ERR_INVALID_ARG;
+    }
+    *minute = hours * 60 + minutes;
+    return ESP_OK;
+}
+
+static esp_err_t get_rule_condition(const JSON_Object *condition_data, rule_condition_t *condition)
+{
+    const char *type = json_object_get_string(condition_data, "type");
+    if (type == NULL)
+    {
+        ESP_LOGE(TAG, "type property not found in JSON.");
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t error = ESP_OK;
+    if (strcmp(type, "sensor") == 0)
+    {
+        error = get_quantity(json_object_get_string(condition_data, "quantity"), &condition->operand);
+        if (error == ESP_OK)
+        {
+            error = get_aggregate(json_object_get_string(condition_data, "aggregate"), &condition->aggregate);
+        }
+        if (error != ESP_OK)
+        {
+            return error;
+        }
+        const char *threshold_name = "below";
+        condition->type = RULE_CONDITION_SENSOR_BELOW;
+        if (json_object_has_value_of_type(condition_data, "above", JSONNumber))
+        {
+            threshold_name = "above";
+            condition->type = RULE_CONDITION_SENSOR_ABOVE;
+        }
+        else if (!json_object_has_value_of_type(condition_data, threshold_name, JSONNumber))
+        {
+            ESP_LOGE(TAG, "below or above property not found in JSON.");
+            return ESP_ERR_NOT_FOUND;
+        }
+        // Sensor values are compared in tenths
+        double threshold = json_object_get_number(condition_data, threshold_name) * 10.0;
+        condition->value = (int32_t)(threshold < 0 ? threshold - 0.5 : threshold + 0.5);
+        return ESP_OK;
+    }
+    if (strcmp(type, "time") == 0)
+    {
+        condition->type = RULE_CONDITION_TIME_WINDOW;
+        error = get_minute_of_day(json_object_get_string(condition_data, "from"), &condition->value);
+        if (error == ESP_OK)
+        {
+            error = get_minute_of_day(json_object_get_string(condition_data, "to"), &condition->end_value);
+        }
+        return error;
+    }
+    if (strcmp(type, "relay") == 0)
+    {
+        error = get_channel(condition_data, RELAY_CHANNEL_COUNT, &condition->operand);
+        if (error != ESP_OK || condition->operand >= RELAY_CHANNEL_COUNT
+                || !json_object_has_value_of_type(condition_data, "switchedOn", JSONBoolean))
+        {
+            ESP_LOGE(TAG, "channel or switchedOn property not found in JSON.");
+            return ESP_ERR_NOT_FOUND;
+        }
+        condition->type = json_object_get_boolean(condition_data, "switchedOn")
+                ? RULE_CONDITION_RELAY_ON : RULE_CONDITION_RELAY_OFF;
+        return ESP_OK;
+    }
+    ESP_LOGE(TAG, "Unknown rule condition type: %s", type);
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static esp_err_t get_rule(const JSON_Object *rule_data, rule_t *rule)
+{
+    JSON_Array *conditions = json_object_get_array(rule_data, "conditions");
+    if (conditions == NULL || json_array_get_count(conditions) > RULE_MAX_CONDITIONS)
+    {
+        ESP_LOGE(TAG, "conditions array not found in JSON or too long.");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < json_array_get_count(conditions); i++)
+    {
+        JSON_Object *condition_data = json_array_get_object(conditions, i);
+        esp_err_t error = condition_data != NULL ? get_rule_condition(condition_data, &rule->conditions[i]) : ESP_FAIL;
+        if (error != ESP_OK)
+        {
+            return error;
+        }
+    }
+    rule->condition_count = json_array_get_count(conditions);
+
+    JSON_Object *action_data = json_object_get_object(rule_data, "action");
+    if (action_data == NULL)
+    {
+        ESP_LOGE(TAG, "action property not found in JSON.");
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t error = get_command(action_data, RELAY_CHANNEL_COUNT, &rule->action);
+    if (error != ESP_OK || rule->action.channel >= RELAY_CHANNEL_COUNT)
+    {
+        return error != ESP_OK ? error : ESP_ERR_NOT_FOUND;
+    }
+    rule->action.source = RELAY_SWITCH_SOURCE_RULE;
+    // Stored rule must not depend on state version seen when it was written
+    rule->action.if_version = 0;
+    rule->cooldown_millis = (uint32_t)json_object_get_number(rule_data, "cooldown");
+    return ESP_OK;
+}
+
+esp_err_t json_serializer_deserialize_rules(const char *received_data, rule_table_t *rules)
+{
+    esp_err_t error = ESP_OK;
+    JSON_Value *root_value = json_parse_string(received_data);
+    if (root_value == NULL)
+    {
+        ESP_LOGE(TAG, "Cannot parse JSON.");
+        return ESP_FAIL;
+    }
+    JSON_Array *rule_array = json_value_get_array(root_value);
+    if (rule_array == NULL)
+    {
+        ESP_LOGE(TAG, "JSON payload is not array.");
+        error = ESP_FAIL;
+    }
+    else if (json_array_get_count(rule_array) > RULE_MAX_COUNT)
+    {
+        ESP_LOGE(TAG, "Too many rules in JSON.");
+        error = ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; error == ESP_OK && i < json_array_get_count(rule_array); i++)
+    {
+        JSON_Object *rule_data = json_array_get_object(rule_array, i);
+        error = rule_data != NULL ? get_rule(rule_data, &rules->rules[i]) : ESP_FAIL;
+    }
+    rules->count = error == ESP_OK ? json_array_get_count(rule_array) : 0;
+    json_value_free(root_value);
+    return error;
+}
+
+/**
+ * Check that preset name can be used in URI, MQTT topic and HTML form without escaping.
+ */
+static bool is_valid_preset_name(const char *name)
+{
+    size_t length = name != NULL ? strlen(name) : 0;
+    if (length == 0 || length >= PRESET_NAME_MAX_LENGTH)
+        return false;
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = name[i];
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_')
+            return false;
+    }
+    return true;
+}
+
+static esp_err_t get_preset(const JSON_Object *preset_data, const preset_table_t *presets, preset_t *preset)
+{
+    const char *name = json_object_get_string(preset_data, "name");
+    if (!is_valid_preset_name(name))
+    {
+        ESP_LOGE(TAG, "name of preset is missing, too long or contains invalid characters.");
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (uint8_t i = 0; i < presets->count; i++)
+    {
+        if (strcmp(presets->presets[i].name, name) == 0)
+        {
+            ESP_LOGE(TAG, "Duplicate preset %s.", name);
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    strlcpy(preset->name, name, sizeof(preset->name));
+    if (json_object_get_array(preset_data, "channels") == NULL)
+    {
+        ESP_LOGE(TAG, "channels array not found in JSON.");
+        return ESP_ERR_NOT_FOUND;
+    }
+    size_t count = RELAY_CHANNEL_COUNT;
+    esp_err_t error = get_commands(preset_data, RELAY_CHANNEL_COUNT, preset->commands, &count);
+    if (error != ESP_OK)
+        return error;
+    uint32_t channel_mask = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t channel = preset->commands[i].channel;
+        if (channel >= RELAY_CHANNEL_COUNT || (channel_mask & (1UL << channel)) != 0)
+        {
+            ESP_LOGE(TAG, "Channel of preset %s is missing or repeated.", name);
+            return ESP_ERR_INVALID_ARG;
+        }
+        channel_mask |= 1UL << channel;
+        // Stored preset must not depend on state version seen when it was written
+        preset->commands[i].if_version = 0;
+    }
+    preset->command_count = count;
+    return ESP_OK;
+}
+
+esp_err_t json_serializer_deserialize_presets(const char *received_data, preset_table_t *presets)
+{
+    esp_err_t error = ESP_OK;
+    JSON_Value *root_value = json_parse_string(received_data);
+    if (root_value == NULL)
+    {
+        ESP_LOGE(TAG, "Cannot parse JSON.");
+        return ESP_FAIL;
+    }
+    JSON_Array *preset_array = json_value_get_array(root_value);
+    if (preset_array == NULL)
+    {
+        ESP_LOGE(TAG, "JSON payload is not array.");
+        error = ESP_FAIL;
+    }
+    else if (json_array_get_count(preset_array) > PRESET_MAX_COUNT)
+    {
+        ESP_LOGE(TAG, "Too many presets in JSON.");
+        error = ESP_ERR_INVALID_SIZE;
+    }
+    presets->count = 0;
+    for (size_t i = 0; error == ESP_OK && i < json_array_get_count(preset_array); i++)
+    {
+        JSON_Object *preset_data = json_array_get_object(preset_array, i);
+        error = preset_data != NULL ? get_preset(preset_data, presets, &presets->presets[i]) : ESP_FAIL;
+        presets->count += error == ESP_OK ? 1 : 0;
+    }
+    if (error != ESP_OK)
+    {
+        presets->count = 0;
+    }
+    json_value_free(root_value);
+    return error;
+}
+
+esp_err_t json_serializer_serialize_sensors(const sensor_aggregates_t *aggregates, char **serialized_string, size_t *length)
+{
+    JSON_Value *root_value = json_value_init_object();
+    JSON_Object *root_object = json_value_get_object(root_value);
+
+    json_object_set_string(root_object, "id", SWITCH_ID);
+    json_object_set_number(root_object, "utcMillis", aggregates->utc_millis);
+    json_object_set_string(root_object, "timeQuality", platform_time_quality_to_name(platform_get_time_quality()));
+    json_object_set_number(root_object, "samples", aggregates->sample_count);
+    json_object_set_number(root_object, "samplePeriod", SENSOR_SAMPLE_PERIOD_MS);
+    json_object_set_number(root_object, "errors", aggregates->error_count);
+    for (int quantity = 0; quantity < SENSOR_QUANTITY_COUNT; quantity++)
+    {
+        const sensor_aggregate_t *aggregate = &aggregates->quantities[quantity];
+        JSON_Value *quantity_value = json_value_init_object();
+        JSON_Object *quantity_object = json_value_get_object(quantity_value);
+        json_object_set_number(quantity_object, "last", aggregate->last / 10.0);
+        json_object_set_number(quantity_object, "min", aggregate->min / 10.0);
+        json_object_set_number(quantity_object, "max", aggregate->max / 10.0);
+        json_object_set_number(quantity_object, "mean", aggregate->mean / 10.0);
+        json_object_set_value(root_object, sensor_sampler_quantity_to_name(quantity), quantity_value);
+    }
+    return serialize_value(root_value, serialized_string, length);
+}
+
+esp_err_t json_serializer_deserialize_power(const char *received_data, wifi_power_config_t *config)
+{
+    esp_err_t error = ESP_OK;
+    JSON_Value *root_value = json_parse_string(received_data);
+    if (root_value == NULL)
+    {
+        ESP_LOGE(TAG, "Cannot parse JSON.");
+        return ESP_FAIL;
+    }
+    JSON_Object *power_data = json_value_get_object(root_value);
+    if (power_data == NULL)
+    {
+        ESP_LOGE(TAG, "JSON payload is not object.");
+        error = ESP_FAIL;
+    }
+    else
+    {
+        error = wifi_power_policy_from_name(json_object_get_string(power_data, "policy"), &config->policy);
+        if (error != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Unknown power save policy.");
+        }
+        else if (json_object_has_value_of_type(power_data, "maxLatency", JSONNumber))
+        {
+            config->max_latency_millis = (uint32_t)json_object_get_number(power_data, "maxLatency");
+        }
+    }
+    json_value_free(root_value);
+    return error;
+}
+
+esp_err_t json_serializer_serialize_power(const wifi_power_config_t *config, uint16_t listen_interval,
+        char **serialized_string, size_t *length)
+{
+    JSON_Value *root_value = json_value_init_object();
+    JSON_Object *root_object = json_value_get_object(root_value);
+
+    json_object_set_string(root_object, "id", SWITCH_ID);
+    json_object_set_string(root_object, "policy", wifi_power_policy_to_name(config->policy));
+    json_object_set_number(root_object, "maxLatency", config->max_latency_millis);
+    json_object_set_number(root_object, "listenInterval", listen_interval);
+    return serialize_value(root_value, serialized_string, length);
+}
+
+esp_err_t json_serializer_deserialize_ota(const char *received_data, char *url, size_t url_size, char *token,
+        size_t token_size)
+{
+    esp_err_t error = ESP_OK;
+    JSON_Value *root_value = json_parse_string(received_data);
+    if (root_value == NULL)
+    {
+        ESP_LOGE(TAG, "Cannot parse JSON.");
+        return ESP_FAIL;
+    }
+    const char *url_value = json_object_get_string(json_value_get_object(root_value), "url");
+    const char *token_value = json_object_get_string(json_value_get_object(root_value), "token");
+    strlcpy(token, token_value != NULL ? token_value : "", token_size);
+    if (url_value == NULL)
+    {
+        ESP_LOGE(TAG, "Image url is missing.");
+        error = ESP_FAIL;
+    }
+    else if (strlcpy(url, url_value, url_size) >= url_size)
+    {
+        ESP_LOGE(TAG, "Image url is too long.");
+        error = ESP_ERR_INVALID_SIZE;
+    }
+    json_value_free(root_value);
+    return error;
+}
+
+/**
+ * Get name of relay switch, OTA updater or ESP-IDF error code.
+ */
+static const char* get_error_name(esp_err_t error)
+{
+#if OTA_ENABLE
+    if ((error & ~0xFFF) == ESP_ERR_OTA_UPDATER_BASE)
+        return ota_updater_err_to_name(error);
+#endif
+    return relay_switch_err_to_name(error);
+}
+
+esp_err_t json_serializer_serialize_ota(esp_err_t error, const ota_updater_result_t *result, char **serialized_string,
+        size_t *length)
+{
+    JSON_Value *root_value = json_value_init_object();
+    JSON_Object *root_object = json_value_get_object(root_value);
+
+    json_object_set_string(root_object, "id", SWITCH_ID);
+    if (error != ESP_OK)
+    {
+        json_object_set_string(root_object, "error", get_error_name(error));
+        json_object_set_number(root_object, "code", error);
+    }
+    json_object_set_string(root_object, "version", result->version);
+    json_object_set_number(root_object, "bytes", result->image_size);
+    json_object_set_number(root_object, "millis", result->duration_millis);
+    json_object_set_number(root_object, "bytesPerSecond", result->bytes_per_second);
+    json_object_set_number(root_object, "peakHeapBytes", result->peak_heap_bytes);
+    return serialize_value(root_value, serialized_string, length);
+}
+
+esp_err_t json_serializer_serialize_metrics(char **serialized_string, size_t *length)
+{
+    JSON_Value *root_value = json_value_init_object();
+    JSON_Object *root_object = json_value_get_object(root_value);
+
+    json_object_set_string(root_object, "id", SWITCH_ID);
+    for (int id = 0; id < METRIC_COUNT; id++)
+    {
+        json_object_set_number(root_object, metrics_get_name(id), metrics_get(id));
+    }
+    return serialize_value(root_value, serialized_string, length);
+}
+
+esp_err_t json_serializer_serialize_error(esp_err_t error, char **serialized_string, size_t *length)
+{
+    JSON_Value *root_value = json_value_init_object();
+    JSON_Object *root_object = json_value_get_object(root_value);
+
+    json_object_set_string(root_object, "id", SWITCH_ID);
+    json_object_set_string(root_object, "error", get_error_name(error));
+    json_object_set_number(root_object, "code", error);
+    return serialize_value(root_value, serialized_string, length);
+}
+
+/**
+ * Append formatted text to buffer.
+ */
+static bool append(char *buffer, size_t size, size_t *length, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + *length, size - *length, format, args);
+    va_end(args);
+    if (written < 0 || (size_t)written >= size - *length)
+        return false;
+    *length += written;
+    return true;
+}
+
+static bool append_counters(char *buffer, size_t size, size_t *length, const usage_counters_t *counters)
+{
+    bool is_written = append(buffer, size, length, "\"onMillis\":%llu,\"cycles\":%u",
+            (unsigned long long)counters->on_millis, (unsigned)counters->cycles);
+#if CURRENT_SENSOR_ENABLE
+    is_written = is_written && append(buffer, size, length, ",\"energyWh\":%.3f",
+            counters->energy_millijoules / 3600000.0);
+#endif
+    return is_written;
+}
+
+esp_err_t json_serializer_serialize_usage(uint8_t channel, const usage_report_t *report, char *buffer, size_t *length)
+{
+    size_t size = *length;
+    size_t written = 0;
+    bool is_written = append(buffer, size, &written, "{\"channel\":%u,\"name\":\"%s\",", channel,
+            relay_switch_get_channel_name(channel));
+    is_written = is_written && append_counters(buffer, size, &written, &report->total);
+    is_written = is_written && append(buffer, size, &written, ",\"days\":[");
+    for (size_t i = 0; i < report->day_count && is_written; i++)
+    {
+        time_t epoch = (time_t)report->days[i].period * 86400;
+        struct tm time_info;
+        char date[16];
+        strftime(date, sizeof(date), "%Y-%m-%d", gmtime_r(&epoch, &time_info));
+        is_written = append(buffer, size, &written, "%s{\"date\":\"%s\",", i > 0 ? "," : "", date)
+                && append_counters(buffer, size, &written, &report->days[i].counters)
+                && append(buffer, size, &written, "}");
+    }
+    is_written = is_written && append(buffer, size, &written, "],\"months\":[");
+    for (size_t i = 0; i < report->month_count && is_written; i++)
+    {
+        uint32_t period = report->months[i].period;
+        is_written = append(buffer, size, &written, "%s{\"month\":\"%04u-%02u\",", i > 0 ? "," : "",
+                (unsigned)(period / 12), (unsigned)(period % 12 + 1))
+                && append_counters(buffer, size, &written, &report->months[i].counters)
+                && append(buffer, size, &written, "}");
+    }
+    is_written = is_written && append(buffer, size, &written, "]}");
+    if (!is_written)
+        return ESP_ERR_INVALID_SIZE;
+    *length = written;
+    return ESP_OK;
+}
+
+esp_err_t json_serializer_serialize_history(const state_history_record_t *record, uint8_t channel, char *buffer,
+        size_t *length)
+{
+    size_t written = 0;
+    if (!append(buffer, *length, &written, "{\"utcMillis\":%llu,\"channel\":%u,\"switchedOn\":%s,\"source\":\"%s\"}",
+            (unsigned long long)record->utc_millis, channel,
+            (record->on_mask & (1UL << channel)) != 0 ? "true" : "false",
+            relay_switch_source_to_name(record->source)))
+        return ESP_ERR_INVALID_SIZE;
+    *length = written;
     return ESP_OK;
 }
 
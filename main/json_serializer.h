@@ -38,24 +38,198 @@
 #include <stdio.h>
 
 #include "relay_switch.h"
+#include "relay_interlock.h"
+#include "sensor_sampler.h"
+#include "rule_engine.h"
+#include "wifi_power.h"
+#include "ota_updater.h"
+#include "group_control.h"
+#include "usage_stats.h"
+#include "state_history.h"
+#include "preset_engine.h"
 
 /**
- * Deserialize switching request data from JSON serialized string.
+ * Key of remaining timeout in serialized channel state. State cache finds the values by this key and rewrites them.
+ */
+#define JSON_SERIALIZER_TIMEOUT_KEY "timeout"
+
+/**
+ * Initialize JSON serializer. JSON documents are allocated from buffer pool, so serialized strings must be freed by
+ * json_serializer_free.
+ */
+void json_serializer_init(void);
+
+/**
+ * Deserialize switching requests from JSON serialized string. Payload is either single request object or object with
+ * "channels" array of requests. Channel can be specified by index or by name. Root object can contain optional
+ * "traceId" string and "clientMillis" timestamp.
+ * @param[in] received_data A pointer to string with JSON payload.
+ * @param[in] default_channel Channel used for requests which do not specify channel.
+ * @param[out] commands Array of switching requests to be set.
+ * @param[in,out] count A pointer to capacity of commands array. It is set to number of deserialized requests.
+ * @param[out] trace A pointer to trace whose client fields are set. ID is empty when request is not traced. It can be
+ * NULL when trace is not needed.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_deserialize(const char *received_data, uint8_t default_channel, relay_switch_command_t *commands, size_t *count,
+        relay_switch_trace_t *trace);
+
+/**
+ * Deserialize group switching request from JSON serialized string. Payload is switching request with "group" name,
+ * "sender" name and "seq" sequence number.
+ * @param[in] received_data A pointer to string with JSON payload.
+ * @param[out] header A pointer to group header to be set.
+ * @param[out] commands Array of switching requests to be set.
+ * @param[in,out] count A pointer to capacity of commands array. It is set to number of deserialized requests.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_deserialize_group(const char *received_data, group_header_t *header,
+        relay_switch_command_t *commands, size_t *count);
+
+/**
+ * Serialize data about current state of all switch channels to JSON. Output serialized string must be freed when it is not needed anymore.
+ * @param[in] switch_states Array of channel states to be serialized.
+ * @param[in] count Number of channel states.
+ * @param[in] trace A pointer to latency trace of transition which created the state or NULL if it was not traced.
+ * @param[out] serialized_string A pointer to string valiable for setting serialized string.
+ * @param[out] length A pointer to variable with serialized string length to be set.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_serialize(const relay_switch_state_t *switch_states, size_t count,
+        const relay_switch_trace_t *trace, char **serialized_string, size_t *length);
+
+/**
+ * Serialize data about current state of single switch channel to JSON. Output serialized string must be freed when it is not needed anymore.
+ * @param[in] switch_state A pointer to channel state to be serialized.
+ * @param[out] serialized_string A pointer to string valiable for setting serialized string.
+ * @param[out] length A pointer to variable with serialized string length to be set.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_serialize_channel(const relay_switch_state_t *switch_state, char **serialized_string, size_t *length);
+
+/**
+ * Deserialize interlock rules from JSON serialized string and compile them to bit masks. Payload is array of rules of type
+ * "exclusive" with "channels" array, "requires" with "channel" and "requires" array or "maxOn" with "channel" and "millis".
+ * @param[in] received_data A pointer to string with JSON payload.
+ * @param[out] rules A pointer to rules to be set. Rules must be cleared by caller.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_deserialize_interlock(const char *received_data, relay_interlock_rules_t *rules);
+
+/**
+ * Deserialize automation rules from JSON serialized string and compile them to rule table. Payload is array of rules
+ * with "conditions" array, "action" switching request and optional "cooldown" in ms. Condition is of type "sensor" with
+ * "quantity", optional "aggregate" and "below" or "above" threshold, "time" with "from" and "to" in HH:MM UTC format or
+ * "relay" with "channel" and "switchedOn".
+ * @param[in] received_data A pointer to string with JSON payload.
+ * @param[out] rules A pointer to rule table to be set. Table must be cleared by caller.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_deserialize_rules(const char *received_data, rule_table_t *rules);
+
+/**
+ * Deserialize presets from JSON serialized string and compile them to preset table. Payload is array of presets with
+ * "name" consisting of letters, digits, '-' and '_' and "channels" array of switching requests with "channel",
+ * "switchedOn" and "timeout".
+ * @param[in] received_data A pointer to string with JSON payload.
+ * @param[out] presets A pointer to preset table to be set. Table must be cleared by caller.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_deserialize_presets(const char *received_data, preset_table_t *presets);
+
+/**
+ * Serialize sensor aggregates to JSON. Values are converted from tenths to quantity units. Output serialized string must
+ * be freed when it is not needed anymore.
+ * @param[in] aggregates A pointer to aggregates to be serialized.
+ * @param[out] serialized_string A pointer to string valiable for setting serialized string.
+ * @param[out] length A pointer to variable with serialized string length to be set.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_serialize_sensors(const sensor_aggregates_t *aggregates, char **serialized_string, size_t *length);
+
+/**
+ * Deserialize Wi-Fi power save configuration from JSON serialized string. Payload is object with "policy" name and
+ * optional "maxLatency" in ms.
  * @param[in] received_data A pointer to string with JSON payload.
- * @param[out] value A pointer to switch value variable to be set.
- * @param[out] timeout A pointer to timeout variable to be set.
+ * @param[in,out] config A pointer to configuration to be updated.
  * @return Return ESP_OK if succeeded.
  */
-esp_err_t json_serializer_deserialize(const char *received_data, bool *value, uint32_t *timeout);
+esp_err_t json_serializer_deserialize_power(const char *received_data, wifi_power_config_t *config);
 
 /**
- * Serialize data about current switch state to JSON. Output serialized string must be freed when it is not needed anymore.
- * @param[in] switch_state A pointer to switch state dtaa to be serialized.
+ * Serialize Wi-Fi power save configuration to JSON. Output serialized string must be freed when it is not needed anymore.
+ * @param[in] config A pointer to configuration to be serialized.
+ * @param[in] listen_interval Listen interval derived from configuration.
  * @param[out] serialized_string A pointer to string valiable for setting serialized string.
  * @param[out] length A pointer to variable with serialized string length to be set.
  * @return Return ESP_OK if succeeded.
  */
-esp_err_t json_serializer_serialize(const relay_switch_state_t *switch_state, char **serialized_string, size_t *length);
+esp_err_t json_serializer_serialize_power(const wifi_power_config_t *config, uint16_t listen_interval,
+        char **serialized_string, size_t *length);
+
+/**
+ * Deserialize OTA pull request from JSON serialized string. Payload is object with image "url" and optional "token".
+ * @param[in] received_data A pointer to string with JSON payload.
+ * @param[out] url Buffer for image URL.
+ * @param[in] url_size Size of URL buffer.
+ * @param[out] token Buffer for token, it is empty when token is missing and truncated when it is too long.
+ * @param[in] token_size Size of token buffer.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_deserialize_ota(const char *received_data, char *url, size_t url_size, char *token,
+        size_t token_size);
+
+/**
+ * Serialize result of OTA update to JSON. Error name is included when update failed. Output serialized string must be
+ * freed when it is not needed anymore.
+ * @param[in] error Result of the update.
+ * @param[in] result A pointer to update statistics.
+ * @param[out] serialized_string A pointer to string valiable for setting serialized string.
+ * @param[out] length A pointer to variable with serialized string length to be set.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_serialize_ota(esp_err_t error, const ota_updater_result_t *result, char **serialized_string,
+        size_t *length);
+
+/**
+ * Serialize all runtime metrics to JSON. Output serialized string must be freed when it is not needed anymore.
+ * @param[out] serialized_string A pointer to string valiable for setting serialized string.
+ * @param[out] length A pointer to variable with serialized string length to be set.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_serialize_metrics(char **serialized_string, size_t *length);
+
+/**
+ * Serialize error of switching request to JSON. Output serialized string must be freed when it is not needed anymore.
+ * @param[in] error Error code.
+ * @param[out] serialized_string A pointer to string valiable for setting serialized string.
+ * @param[out] length A pointer to variable with serialized string length to be set.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t json_serializer_serialize_error(esp_err_t error, char **serialized_string, size_t *length);
+
+/**
+ * Serialize usage report of relay channel to JSON object. Object is written directly to buffer without JSON document,
+ * so long rollups do not exhaust buffer pool.
+ * @param[in] channel Index of relay channel.
+ * @param[in] report A pointer to usage report of the channel.
+ * @param[out] buffer Buffer for serialized object.
+ * @param[in,out] length A pointer to buffer size. It is set to length of serialized object.
+ * @return Return ESP_OK if succeeded or ESP_ERR_INVALID_SIZE if buffer is too small.
+ */
+esp_err_t json_serializer_serialize_usage(uint8_t channel, const usage_report_t *report, char *buffer, size_t *length);
+
+/**
+ * Serialize transition of single channel from history record to JSON object. Object is written directly to buffer,
+ * so history can be streamed without JSON document.
+ * @param[in] record A pointer to history record.
+ * @param[in] channel Index of changed relay channel.
+ * @param[out] buffer Buffer for serialized object.
+ * @param[in,out] length A pointer to buffer size. It is set to length of serialized object.
+ * @return Return ESP_OK if succeeded or ESP_ERR_INVALID_SIZE if buffer is too small.
+ */
+esp_err_t json_serializer_serialize_history(const state_history_record_t *record, uint8_t channel, char *buffer,
+        size_t *length);
 
 /**
  * Free allocated string with serialized JSON data.
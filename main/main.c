@@ -44,74 +44,38 @@
 #include <nvs_flash.h>
 #include <lwip/err.h>
 #include <lwip/sys.h>
-#include <esp_sntp.h>
 #include <esp_http_server.h>
 
+#include "button_input.h"
+#include "coap_adapter.h"
+#include "deferred_log.h"
+#include "discovery.h"
+#include "group_control.h"
 #include "http_adapter_html.h"
 #include "http_adapter_json.h"
+#include "json_serializer.h"
 #include "mqtt_adapter.h"
+#include "ota_updater.h"
 #include "platform_time.h"
+#include "rate_limiter.h"
+#include "usage_stats.h"
+#include "state_history.h"
 #include "relay_switch.h"
+#include "sensor_sampler.h"
+#include "state_cache.h"
+#include "rule_engine.h"
+#include "preset_engine.h"
+#include "current_sensor.h"
+#include "wifi_manager.h"
 #include "user_config.h"
 
 #define TAG "main"
-#define DHT_GPIO_NUM GPIO_NUM_27
-static EventGroupHandle_t wifi_event_group;
-const int WIFI_CONNECTED_BIT = BIT0;
-const int SNTP_SYNCHRONIZED_BIT = BIT1;
 
-#if HTTP_PLAIN_ENABLE || HTTP_JSON_ENABLE
+#if HTTP_HTML_ENABLE || HTTP_JSON_ENABLE
 static httpd_handle_t server;
 static httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 #endif
 
-/**
- * Handle Wi-Fi connection events and set related bits for tasks synchronization.
- */
-static void event_handler(void* arg, esp_event_base_t event_base,
-        int32_t event_id, void* event_data)
-{
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
-    {
-        esp_wifi_connect();
-    }
-    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
-    {
-        esp_wifi_connect();
-        xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
-        ESP_LOGI(TAG, "retry to connect to the AP");
-    }
-    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
-    {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
-    }
-}
-
-void wifi_init()
-{
-    esp_netif_create_default_wifi_sta();
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL));
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASSWORD
-        }
-    };
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-
-    ESP_LOGI(TAG, "wifi_init_sta finished.");
-    ESP_LOGI(TAG, "connect to ap SSID:%s password:%s", WIFI_SSID, WIFI_PASSWORD);
-}
-
 static void nvs_init()
 {
     esp_err_t ret = nvs_flash_init();
@@ -123,29 +87,41 @@ static void nvs_init()
     ESP_ERROR_CHECK(ret);
 }
 
-void time_sync_notification_cb(struct timeval *tv)
+void switch_state_changed(const relay_switch_state_t* relay_switch_states, size_t count, void* context)
 {
-    uint64_t utcMs = ((uint64_t)tv->tv_sec) * 1000 + tv->tv_usec;
-    ESP_LOGI(TAG, "UTC time synchronized: %llu", utcMs);
-    xEventGroupSetBits(wifi_event_group, SNTP_SYNCHRONIZED_BIT);
+#if MQTT_ADAPTER_ENABLE
+    mqtt_adapter_notify_switch_status();
+#endif
+#if COAP_ADAPTER_ENABLE
+    coap_adapter_notify_switch_status();
+#endif
+}
+
+#if CURRENT_SENSOR_ENABLE
+void current_fault_changed(uint8_t channel, current_fault_t fault, void* context)
+{
+    state_cache_invalidate();
+#if MQTT_ADAPTER_ENABLE
+    mqtt_adapter_notify_switch_status();
+#endif
 }
+#endif
 
-static void initialize_sntp(void)
+#if RULE_ENGINE_ENABLE
+void sensor_sampled(const sensor_aggregates_t* aggregates, void* context)
 {
-    ESP_LOGI(TAG, "Initializing SNTP");
-    sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    sntp_setservername(0, NTP_SERVER);
-    sntp_set_time_sync_notification_cb(time_sync_notification_cb);
-    sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
-    sntp_init();
+    rule_engine_evaluate(aggregates);
 }
+#endif
 
-void switch_state_changed(const relay_switch_state_t* relay_switch_state, void* context)
+#if SENSOR_ENABLE
+void sensor_aggregates_changed(const sensor_aggregates_t* aggregates, void* context)
 {
 #if MQTT_ADAPTER_ENABLE
-    mqtt_adapter_notify_switch_status(relay_switch_state);
+    mqtt_adapter_notify_sensors(aggregates);
 #endif
 }
+#endif
 
 void init_httpd()
 {
@@ -154,28 +130,72 @@ void init_httpd()
 
 void app_main(void)
 {
-    wifi_event_group = xEventGroupCreate();
     nvs_init();
+    // JSON documents use buffer pool, rules are deserialized during initialization
+    json_serializer_init();
+    ESP_ERROR_CHECK(deferred_log_init());
+    ESP_ERROR_CHECK(state_cache_init());
+    // Clock is seeded before anything records timestamps
+    ESP_ERROR_CHECK(platform_time_init());
+#if OTA_ENABLE
+    ESP_ERROR_CHECK(ota_updater_init());
+#endif
+    rate_limiter_init();
+#if USAGE_STATS_ENABLE
+    // Counters are loaded before relay switch records the first transition
+    ESP_ERROR_CHECK(usage_stats_init());
+#endif
+#if HISTORY_ENABLE
+    // Missing history partition disables history only, relays must work anyway
+    if (state_history_init() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "State history is not available");
+    }
+#endif
+    // Relays and local input must work before network is available
+    ESP_ERROR_CHECK(relay_switch_init());
+#if BUTTON_INPUT_ENABLE
+    ESP_ERROR_CHECK(button_input_init());
+#endif
+#if PRESET_ENABLE
+    ESP_ERROR_CHECK(preset_engine_init());
+#endif
+#if RULE_ENGINE_ENABLE
+    ESP_ERROR_CHECK(rule_engine_init());
+    sensor_sampler_set_sample_cb(sensor_sampled, NULL);
+#endif
+#if SENSOR_ENABLE
+    ESP_ERROR_CHECK(sensor_sampler_init());
+#endif
+#if CURRENT_SENSOR_ENABLE
+    ESP_ERROR_CHECK(current_sensor_init());
+#endif
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     ESP_LOGI(TAG, "WiFi init");
-    wifi_init();
+    ESP_ERROR_CHECK(wifi_manager_init());
     ESP_LOGI(TAG, "Connecting to WiFi...");
-    xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE,
-        pdFALSE, portMAX_DELAY);
+    wifi_manager_wait_connected(portMAX_DELAY);
     ESP_LOGI(TAG, "Connected to WiFi");
-    ESP_LOGI(TAG, "SNTP init");
-    initialize_sntp();
-    ESP_LOGI(TAG, "Waiting for SNTP synchronize...");
-    xEventGroupWaitBits(wifi_event_group, SNTP_SYNCHRONIZED_BIT, pdFALSE,
-        pdFALSE, portMAX_DELAY);
-    ESP_LOGI(TAG, "SNTP synchronized");
+    // Time is refined in background, adapters report its quality meanwhile
+    platform_time_start_sync();
     ESP_LOGI(TAG, "Connecting to MQTT...");
 #if MQTT_ADAPTER_ENABLE
     ESP_ERROR_CHECK(mqtt_adapter_init());
 #endif
+#if COAP_ADAPTER_ENABLE
+    ESP_ERROR_CHECK(coap_adapter_init());
+#endif
+#if GROUP_CONTROL_ENABLE
+    ESP_ERROR_CHECK(group_control_init());
+#endif
+#if DISCOVERY_ENABLE
+    ESP_ERROR_CHECK(discovery_init());
+#endif
 
 #if HTTP_HTML_ENABLE || HTTP_JSON_ENABLE
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = 26;
     ESP_ERROR_CHECK(httpd_start(&server, &config));
 #endif
 #if HTTP_HTML_ENABLE
@@ -184,17 +204,15 @@ void app_main(void)
 #if HTTP_JSON_ENABLE
     ESP_ERROR_CHECK(http_adapter_json_init(server));
 #endif
-    ESP_ERROR_CHECK(relay_switch_init());
     relay_switch_set_state_changed_cb(switch_state_changed, NULL);
-}
-
-uint64_t platform_get_utc_millis()
-{
-    struct timeval tv;
-    uint64_t millisecondsSinceEpoch = 0;
-
-    gettimeofday(&tv, NULL);
-    millisecondsSinceEpoch = (uint64_t) (tv.tv_sec) * 1000 + (uint64_t) (tv.tv_usec) / 1000;
-
-    return millisecondsSinceEpoch;
+#if SENSOR_ENABLE
+    sensor_sampler_set_aggregates_cb(sensor_aggregates_changed, NULL);
+#endif
+#if CURRENT_SENSOR_ENABLE
+    current_sensor_set_fault_cb(current_fault_changed, NULL);
+#endif
+#if OTA_ENABLE
+    // Image which reached network and started adapters is kept, otherwise bootloader rolls back on next reset
+    ESP_ERROR_CHECK(ota_updater_confirm());
+#endif
 }
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of runtime metrics. Metrics are updated in short critical section, so they can be updated
+ * from any task.
+ */
+
+#include <freertos/FreeRTOS.h>
+
+#include "metrics.h"
+
+#define METRICS_NAME_ITEM(id, name) name,
+
+static const char* metric_names[METRIC_COUNT] = { METRICS_LIST(METRICS_NAME_ITEM) };
+static uint32_t metric_values[METRIC_COUNT];
+static portMUX_TYPE metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void metrics_increment(metric_id_t id)
+{
+    portENTER_CRITICAL(&metrics_mux);
+    metric_values[id]++;
+    portEXIT_CRITICAL(&metrics_mux);
+}
+
+void metrics_set(metric_id_t id, uint32_t value)
+{
+    portENTER_CRITICAL(&metrics_mux);
+    metric_values[id] = value;
+    portEXIT_CRITICAL(&metrics_mux);
+}
+
+uint32_t metrics_get(metric_id_t id)
+{
+    portENTER_CRITICAL(&metrics_mux);
+    uint32_t value = metric_values[id];
+    portEXIT_CRITICAL(&metrics_mux);
+    return value;
+}
+
+const char* metrics_get_name(metric_id_t id)
+{
+    return id < METRIC_COUNT ? metric_names[id] : "unknown";
+}
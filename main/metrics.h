@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for runtime metrics. Metrics are 32-bit counters and gauges identified by enum
+ * generated from METRICS_LIST, so adding new metric requires only new list entry.
+ */
+
+#ifndef MAIN_METRICS_H_
+#define MAIN_METRICS_H_
+
+#include <inttypes.h>
+
+/**
+ * List of metrics. Each entry contains enum suffix and name used in API.
+ */
+#define METRICS_LIST(X) \
+    X(CURRENT_FAULT_STUCK_ON, "currentFaultStuckOn") \
+    X(CURRENT_FAULT_NO_LOAD, "currentFaultNoLoad") \
+    X(CURRENT_ADC_OVERRUNS, "currentAdcOverruns") \
+    X(WIFI_CONNECT_ATTEMPTS, "wifiConnectAttempts") \
+    X(WIFI_FAST_CONNECTS, "wifiFastConnects") \
+    X(WIFI_SCAN_FALLBACKS, "wifiScanFallbacks") \
+    X(WIFI_LAST_CONNECT_MILLIS, "wifiLastConnectMillis") \
+    X(OTA_UPDATES, "otaUpdates") \
+    X(OTA_FAILURES, "otaFailures") \
+    X(OTA_LAST_BYTES_PER_SECOND, "otaLastBytesPerSecond") \
+    X(OTA_LAST_PEAK_HEAP_BYTES, "otaLastPeakHeapBytes") \
+    X(GROUP_REQUESTS, "groupRequests") \
+    X(GROUP_REPLAYS_DROPPED, "groupReplaysDropped") \
+    X(MQTT_CONNECTS, "mqttConnects") \
+    X(MQTT_SESSIONS_PRESENT, "mqttSessionsPresent") \
+    X(MQTT_LAST_CONNECT_MILLIS, "mqttLastConnectMillis") \
+    X(MQTT_CONNECTION_HEAP_BYTES, "mqttConnectionHeapBytes") \
+    X(MQTT_BROKER_INDEX, "mqttBrokerIndex") \
+    X(MQTT_LAST_RTT_MILLIS, "mqttLastRttMillis") \
+    X(MQTT_FAILOVERS, "mqttFailovers") \
+    X(MQTT_FAILBACKS, "mqttFailbacks") \
+    X(MQTT_LAST_FAILOVER_MILLIS, "mqttLastFailoverMillis") \
+    X(BUFFER_POOL_IN_USE_BYTES, "bufferPoolInUseBytes") \
+    X(BUFFER_POOL_PEAK_BYTES, "bufferPoolPeakBytes") \
+    X(BUFFER_POOL_EXHAUSTED, "bufferPoolExhausted") \
+    X(BUFFER_POOL_OVERSIZED, "bufferPoolOversized") \
+    X(HEAP_FREE_BYTES, "heapFreeBytes") \
+    X(HEAP_LARGEST_FREE_BLOCK, "heapLargestFreeBlock") \
+    X(LOG_RECORDS_DROPPED, "logRecordsDropped") \
+    X(STATE_CACHE_HITS, "stateCacheHits") \
+    X(STATE_CACHE_MISSES, "stateCacheMisses") \
+    X(STATE_CACHE_OVERFLOWS, "stateCacheOverflows") \
+    X(RATE_LIMITED_REQUESTS, "rateLimitedRequests") \
+    X(RELAY_WEAR_REJECTED, "relayWearRejected") \
+    X(HISTORY_RECORDS, "historyRecords") \
+    X(HISTORY_RECORDS_DROPPED, "historyRecordsDropped")
+
+#define METRICS_ENUM_ITEM(id, name) METRIC_##id,
+
+typedef enum metric_id
+{
+    METRICS_LIST(METRICS_ENUM_ITEM)
+    METRIC_COUNT
+} metric_id_t;
+
+/**
+ * Increment counter metric.
+ * @param[in] id Metric identifier.
+ */
+void metrics_increment(metric_id_t id);
+
+/**
+ * Set gauge metric.
+ * @param[in] id Metric identifier.
+ * @param[in] value New metric value.
+ */
+void metrics_set(metric_id_t id, uint32_t value);
+
+/**
+ * Get current metric value.
+ * @param[in] id Metric identifier.
+ * @return Return metric value.
+ */
+uint32_t metrics_get(metric_id_t id);
+
+/**
+ * Get metric name used in API.
+ * @param[in] id Metric identifier.
+ * @return Return metric name.
+ */
+const char* metrics_get_name(metric_id_t id);
+
+#endif /* MAIN_METRICS_H_ */
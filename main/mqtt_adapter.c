@@ -35,84 +35,508 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
 #include <mqtt_client.h>
+#include <esp_crt_bundle.h>
+#include <esp_timer.h>
+#include <esp_system.h>
 #include <esp_log.h>
 
 #include "mqtt_adapter.h"
 #include "json_serializer.h"
+#include "state_cache.h"
+#include "buffer_pool.h"
+#include "deferred_log.h"
 #include "relay_switch.h"
+#include "ota_updater.h"
+#include "metrics.h"
+#include "broker_selector.h"
+#include "rate_limiter.h"
+#include "preset_engine.h"
 #include "user_config.h"
 
 #define MQTT_STATE_TOPIC "switch/state"
-#define MQTT_SWITCH_TOPIC "switch/" SWITCH_ID "/switch"
+#define MQTT_ERROR_TOPIC "switch/error"
+#define MQTT_SENSORS_TOPIC "switch/sensors"
+#define MQTT_OTA_RESULT_TOPIC "switch/ota"
+#define MQTT_SWITCH_TOPIC_PREFIX "switch/" SWITCH_ID "/"
+#define MQTT_SWITCH_TOPIC_SUFFIX "/switch"
+#define MQTT_SWITCH_TOPIC MQTT_SWITCH_TOPIC_PREFIX "switch"
+#define MQTT_CHANNEL_SWITCH_TOPIC MQTT_SWITCH_TOPIC_PREFIX "+" MQTT_SWITCH_TOPIC_SUFFIX
+#define MQTT_OTA_TOPIC MQTT_SWITCH_TOPIC_PREFIX "ota"
+#define MQTT_PRESET_TOPIC MQTT_SWITCH_TOPIC_PREFIX "preset"
+#define MQTT_PROBE_TOPIC MQTT_SWITCH_TOPIC_PREFIX "probe"
 #define TAG "mqtt_adapter"
+/** Connect probes of other brokers run below all adapters. */
+#define BROKER_PROBE_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
+#define BROKER_COUNT (sizeof(broker_uris) / sizeof(broker_uris[0]))
+
+static const char* broker_uris[] = MQTT_BROKER_URIS;
+_Static_assert(BROKER_COUNT <= MQTT_MAX_BROKERS, "Too many MQTT brokers");
 
 static esp_mqtt_client_handle_t mqtt_client = NULL;
+static esp_timer_handle_t probe_timer = NULL;
+static int64_t connect_start_us = 0;
+static uint32_t connect_start_heap = 0;
+static size_t broker_index = 0;
+static volatile bool connected = false;
+/** Time when connection was lost, 0 if failover is not in progress. */
+static int64_t failover_start_us = 0;
+static volatile bool failback_pending = false;
+static size_t failback_index = 0;
+static volatile int probe_msg_id = -1;
+static int64_t probe_start_us = 0;
+static bool is_rate_limited = false;
 
-esp_err_t get_switch_from_json(esp_mqtt_event_handle_t event, bool *value, uint32_t *timeout)
+static esp_err_t get_switch_from_json(esp_mqtt_event_handle_t event, uint8_t default_channel,
+        relay_switch_command_t *commands, size_t *count, relay_switch_trace_t *trace)
 {
-    char *received_data = malloc((event->data_len + 1) * sizeof(char));
+    char *received_data = buffer_pool_alloc((event->data_len + 1) * sizeof(char));
+    if (received_data == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
     memcpy(received_data, event->data, event->data_len);
     received_data[event->data_len] = '\0';
-    return json_serializer_deserialize(received_data, value, timeout);
+    esp_err_t error = json_serializer_deserialize(received_data, default_channel, commands, count, trace);
+    buffer_pool_free(received_data);
+    trace->parsed_us = esp_timer_get_time();
+    return error;
 }
 
-static bool is_valid_switch_request(esp_mqtt_event_handle_t event)
+/**
+ * Check if topic is switching request topic. Requests can be sent to switch/{ID}/switch topic with channel in payload
+ * or to switch/{ID}/{channel}/switch topic where channel is name or index.
+ */
+static bool is_valid_switch_request(esp_mqtt_event_handle_t event, uint8_t *channel)
 {
-    if (strlen(MQTT_SWITCH_TOPIC) != event->topic_len)
+    if (strlen(MQTT_SWITCH_TOPIC) == event->topic_len
+            && strncmp(MQTT_SWITCH_TOPIC, event->topic, event->topic_len) == 0)
+    {
+        *channel = 0;
+        return true;
+    }
+    size_t prefix_len = strlen(MQTT_SWITCH_TOPIC_PREFIX);
+    size_t suffix_len = strlen(MQTT_SWITCH_TOPIC_SUFFIX);
+    if ((size_t)event->topic_len <= prefix_len + suffix_len
+            || strncmp(MQTT_SWITCH_TOPIC_PREFIX, event->topic, prefix_len) != 0
+            || strncmp(MQTT_SWITCH_TOPIC_SUFFIX, event->topic + event->topic_len - suffix_len, suffix_len) != 0)
     {
         return false;
     }
-    if (strncmp(MQTT_SWITCH_TOPIC, event->topic, event->topic_len) == 0)
+    char name[32];
+    size_t name_len = event->topic_len - prefix_len - suffix_len;
+    if (name_len >= sizeof(name))
     {
-        return true;
+        return false;
+    }
+    memcpy(name, event->topic + prefix_len, name_len);
+    name[name_len] = '\0';
+    return relay_switch_find_channel(name, channel) == ESP_OK;
+}
+
+/**
+ * Acquire rate limit of switching request. Only the first rejected message of flood is answered, so errors do not
+ * multiply the traffic.
+ */
+static esp_err_t acquire_rate_limit(bool *is_flood)
+{
+    esp_err_t error = rate_limiter_acquire(RELAY_SWITCH_SOURCE_MQTT, 0);
+    *is_flood = error == ESP_ERR_RELAY_RATE_LIMIT && is_rate_limited;
+    is_rate_limited = error == ESP_ERR_RELAY_RATE_LIMIT;
+    return error;
+}
+
+#if PRESET_ENABLE
+static bool is_preset_request(esp_mqtt_event_handle_t event)
+{
+    return strlen(MQTT_PRESET_TOPIC) == event->topic_len
+            && strncmp(MQTT_PRESET_TOPIC, event->topic, event->topic_len) == 0;
+}
+
+/**
+ * Apply preset named by plain text payload.
+ */
+static esp_err_t apply_preset(esp_mqtt_event_handle_t event)
+{
+    char name[PRESET_NAME_MAX_LENGTH];
+    if (event->data_len <= 0 || (size_t)event->data_len >= sizeof(name))
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(name, event->data, event->data_len);
+    name[event->data_len] = '\0';
+    return preset_engine_apply(name, RELAY_SWITCH_SOURCE_MQTT);
+}
+#endif
+
+/**
+ * Report rejected switching request. MQTT has no response to publish, so errors are sent to separate topic.
+ */
+static void notify_error(esp_err_t error)
+{
+    char *serialized_string = NULL;
+    size_t length = 0;
+    if (json_serializer_serialize_error(error, &serialized_string, &length) != ESP_OK) return;
+    esp_mqtt_client_publish(mqtt_client, MQTT_ERROR_TOPIC, serialized_string, length, 1, false);
+    json_serializer_free(serialized_string);
+}
+
+#if OTA_ENABLE
+/**
+ * Publish result of pulled update. Device is restarted to new image when update succeeded.
+ */
+static void ota_done(esp_err_t error, const ota_updater_result_t* result, void* context)
+{
+    char *serialized_string = NULL;
+    size_t length = 0;
+    if (json_serializer_serialize_ota(error, result, &serialized_string, &length) == ESP_OK)
+    {
+        esp_mqtt_client_publish(mqtt_client, MQTT_OTA_RESULT_TOPIC, serialized_string, length, 1, false);
+        json_serializer_free(serialized_string);
+    }
+    if (error == ESP_OK)
+    {
+        ota_updater_schedule_restart();
+    }
+}
+
+static bool is_ota_request(esp_mqtt_event_handle_t event)
+{
+    return strlen(MQTT_OTA_TOPIC) == event->topic_len && strncmp(MQTT_OTA_TOPIC, event->topic, event->topic_len) == 0;
+}
+
+static void handle_ota_request(esp_mqtt_event_handle_t event)
+{
+    char url[OTA_URL_MAX_LENGTH];
+    // One more character, so too long token does not match after truncation
+    char token[sizeof(OTA_AUTH_TOKEN) + 1];
+    char *received_data = buffer_pool_alloc(event->data_len + 1);
+    if (received_data == NULL)
+        return;
+    memcpy(received_data, event->data, event->data_len);
+    received_data[event->data_len] = '\0';
+    esp_err_t error = json_serializer_deserialize_ota(received_data, url, sizeof(url), token, sizeof(token));
+    buffer_pool_free(received_data);
+    if (error == ESP_OK && !ota_updater_is_authorized(token))
+    {
+        error = ESP_ERR_OTA_UPDATER_UNAUTHORIZED;
+    }
+    if (error == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Pulling firmware image from %s", url);
+        error = ota_updater_pull(url, ota_done, NULL);
+    }
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Mqtt OTA request failed: %s", ota_updater_err_to_name(error));
+        notify_error(error);
+    }
+}
+#endif
+
+/**
+ * Record duration of connection establishment and heap held by connection. Duration contains TCP connect, TLS
+ * handshake and MQTT CONNECT exchange.
+ */
+static void update_connect_metrics(void)
+{
+    int64_t now_us = esp_timer_get_time();
+    uint32_t connect_millis = (now_us - connect_start_us) / 1000;
+    uint32_t free_heap = esp_get_free_heap_size();
+    metrics_increment(METRIC_MQTT_CONNECTS);
+    metrics_set(METRIC_MQTT_LAST_CONNECT_MILLIS, connect_millis);
+    metrics_set(METRIC_MQTT_CONNECTION_HEAP_BYTES, connect_start_heap > free_heap ? connect_start_heap - free_heap : 0);
+    metrics_set(METRIC_MQTT_BROKER_INDEX, broker_index);
+    broker_selector_report_connect(broker_index, connect_millis);
+    if (failover_start_us != 0)
+    {
+        metrics_set(METRIC_MQTT_LAST_FAILOVER_MILLIS, (now_us - failover_start_us) / 1000);
+        failover_start_us = 0;
+    }
+}
+
+/**
+ * Select broker for next connection. Client reconnects automatically after MQTT_RECONNECT_DELAY_MS.
+ */
+static void select_next_broker(void)
+{
+    int64_t now_us = esp_timer_get_time();
+    if (failback_pending)
+    {
+        failback_pending = false;
+        broker_index = failback_index;
+        metrics_increment(METRIC_MQTT_FAILBACKS);
+    }
+    else
+    {
+        if (connected && failover_start_us == 0)
+        {
+            failover_start_us = now_us;
+        }
+        broker_selector_report_failure(broker_index, now_us / 1000);
+        size_t next_index = broker_selector_select_failover(broker_index, now_us / 1000);
+        if (next_index != broker_index)
+        {
+            broker_index = next_index;
+            metrics_increment(METRIC_MQTT_FAILOVERS);
+        }
+    }
+    connected = false;
+    probe_msg_id = -1;
+    DEFERRED_LOGI(TAG, "Next broker %s", broker_uris[broker_index]);
+    esp_mqtt_client_set_uri(mqtt_client, broker_uris[broker_index]);
+}
+
+/**
+ * Measure round trip time by QoS 1 publish and check whether healthier broker is available. Fail back is done by
+ * disconnecting from current broker, the next broker is selected in disconnection event.
+ */
+static void probe_timer_callback(void* arg)
+{
+    if (!connected || failback_pending)
+        return;
+    size_t index = 0;
+    if (broker_selector_select_failback(broker_index, esp_timer_get_time() / 1000, &index))
+    {
+        ESP_LOGI(TAG, "Failing back to %s", broker_uris[index]);
+        failback_index = index;
+        failback_pending = true;
+        esp_mqtt_client_disconnect(mqtt_client);
+        return;
+    }
+    if (probe_msg_id == -1)
+    {
+        probe_start_us = esp_timer_get_time();
+        probe_msg_id = esp_mqtt_client_enqueue(mqtt_client, MQTT_PROBE_TOPIC, "", 0, 1, false, true);
+    }
+}
+
+/**
+ * Get host and port of broker URI. Port which is not present in URI is taken from MQTT_BROKER_PORT or from scheme.
+ */
+static bool get_broker_address(const char *uri, char *host, size_t host_size, uint16_t *port)
+{
+    const char *start = strstr(uri, "://");
+    if (start == NULL)
+        return false;
+    size_t scheme_length = start - uri;
+    start += strlen("://");
+    size_t length = strcspn(start, ":/");
+    if (length == 0 || length >= host_size)
+        return false;
+    memcpy(host, start, length);
+    host[length] = '\0';
+    if (start[length] == ':')
+    {
+        *port = (uint16_t)atoi(start + length + 1);
+    }
+    else if (MQTT_BROKER_PORT != 0)
+    {
+        *port = MQTT_BROKER_PORT;
+    }
+    else if (scheme_length == strlen("mqtts") && strncmp(uri, "mqtts", scheme_length) == 0)
+    {
+        *port = 8883;
+    }
+    else if (scheme_length == strlen("wss") && strncmp(uri, "wss", scheme_length) == 0)
+    {
+        *port = 443;
+    }
+    else if (scheme_length == strlen("ws") && strncmp(uri, "ws", scheme_length) == 0)
+    {
+        *port = 80;
+    }
+    else
+    {
+        *port = 1883;
+    }
+    return *port != 0;
+}
+
+/**
+ * Probe broker by TCP connect limited by MQTT_NETWORK_TIMEOUT_MS. Name resolution is not included in measured time.
+ */
+static bool probe_broker(const char *uri, uint32_t *rtt_millis)
+{
+    char host[64];
+    char port_string[6];
+    uint16_t port = 0;
+    if (!get_broker_address(uri, host, sizeof(host), &port))
+        return false;
+    snprintf(port_string, sizeof(port_string), "%u", port);
+    const struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *address = NULL;
+    if (getaddrinfo(host, port_string, &hints, &address) != 0 || address == NULL)
+        return false;
+    bool is_connected = false;
+    int sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (sock >= 0)
+    {
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+        int64_t start_us = esp_timer_get_time();
+        int result = connect(sock, address->ai_addr, address->ai_addrlen);
+        if (result != 0 && errno == EINPROGRESS)
+        {
+            fd_set write_set;
+            FD_ZERO(&write_set);
+            FD_SET(sock, &write_set);
+            struct timeval timeout = { .tv_sec = MQTT_NETWORK_TIMEOUT_MS / 1000,
+                    .tv_usec = (MQTT_NETWORK_TIMEOUT_MS % 1000) * 1000 };
+            int socket_error = 0;
+            socklen_t length = sizeof(socket_error);
+            result = select(sock + 1, NULL, &write_set, NULL, &timeout) == 1
+                    && getsockopt(sock, SOL_SOCKET, SO_ERROR, &socket_error, &length) == 0 && socket_error == 0
+                    ? 0 : -1;
+        }
+        is_connected = result == 0;
+        *rtt_millis = (esp_timer_get_time() - start_us) / 1000;
+        close(sock);
+    }
+    freeaddrinfo(address);
+    return is_connected;
+}
+
+/**
+ * Probe brokers which are not connected, so that broker which recovered after failure can be selected by fail back.
+ * Probes run in own low priority task because TCP connect blocks.
+ */
+static void broker_probe_task_run(void* pvParameters)
+{
+    for (;;)
+    {
+        vTaskDelay(pdMS_TO_TICKS(MQTT_BROKER_PROBE_PERIOD_MS));
+        for (size_t i = 0; i < BROKER_COUNT && connected; i++)
+        {
+            if (!broker_selector_should_probe(i, broker_index, esp_timer_get_time() / 1000))
+                continue;
+            uint32_t rtt_millis = 0;
+            if (probe_broker(broker_uris[i], &rtt_millis))
+            {
+                // Probe measures TCP handshake, which is one round trip, so it is stored as round trip time
+                broker_selector_report_probe(i, rtt_millis > 0 ? rtt_millis : 1, esp_timer_get_time() / 1000);
+            }
+            else
+            {
+                DEFERRED_LOGI(TAG, "Probe of broker %u failed", (unsigned)i);
+                broker_selector_report_failure(i, esp_timer_get_time() / 1000);
+            }
+        }
     }
-    return false;
 }
 
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
+    uint8_t channel = 0;
     switch (event->event_id) {
+    case MQTT_EVENT_BEFORE_CONNECT:
+        connect_start_us = esp_timer_get_time();
+        connect_start_heap = esp_get_free_heap_size();
+        break;
     case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-        const char switch_topic[] = MQTT_SWITCH_TOPIC;
-        ESP_LOGI(TAG, "Subscribing to topic %s", switch_topic);
-        esp_mqtt_client_subscribe(mqtt_client, switch_topic, 2);
+        DEFERRED_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        update_connect_metrics();
+        connected = true;
+        if (event->session_present)
+        {
+            // Broker kept subscriptions of persistent session
+            DEFERRED_LOGI(TAG, "MQTT session present");
+            metrics_increment(METRIC_MQTT_SESSIONS_PRESENT);
+            break;
+        }
+        DEFERRED_LOGI(TAG, "Subscribing to topic %s", MQTT_SWITCH_TOPIC);
+        esp_mqtt_client_subscribe(mqtt_client, MQTT_SWITCH_TOPIC, 2);
+        DEFERRED_LOGI(TAG, "Subscribing to topic %s", MQTT_CHANNEL_SWITCH_TOPIC);
+        esp_mqtt_client_subscribe(mqtt_client, MQTT_CHANNEL_SWITCH_TOPIC, 2);
+#if PRESET_ENABLE
+        DEFERRED_LOGI(TAG, "Subscribing to topic %s", MQTT_PRESET_TOPIC);
+        esp_mqtt_client_subscribe(mqtt_client, MQTT_PRESET_TOPIC, 2);
+#endif
+#if OTA_ENABLE
+        DEFERRED_LOGI(TAG, "Subscribing to topic %s", MQTT_OTA_TOPIC);
+        esp_mqtt_client_subscribe(mqtt_client, MQTT_OTA_TOPIC, 1);
+#endif
         break;
     case MQTT_EVENT_DISCONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        DEFERRED_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        select_next_broker();
         break;
     case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED");
+        DEFERRED_LOGI(TAG, "MQTT_EVENT_PUBLISHED");
+        if (event->msg_id == probe_msg_id)
+        {
+            uint32_t rtt_millis = (esp_timer_get_time() - probe_start_us) / 1000;
+            metrics_set(METRIC_MQTT_LAST_RTT_MILLIS, rtt_millis);
+            broker_selector_report_rtt(broker_index, rtt_millis);
+            probe_msg_id = -1;
+        }
         break;
     case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
-        ESP_LOGI(TAG, "Topic %.*s", event->topic_len, event->topic);
-        if (is_valid_switch_request(event))
+        DEFERRED_LOGI(TAG, "MQTT_EVENT_DATA, msg_id=%d", event->msg_id);
+        ESP_LOGD(TAG, "Topic %.*s", event->topic_len, event->topic);
+        if (is_valid_switch_request(event, &channel))
         {
-            bool switch_on;
-            uint32_t timeout;
-            esp_err_t  error = get_switch_from_json(event, &switch_on, &timeout);
+            relay_switch_command_t commands[RELAY_CHANNEL_COUNT];
+            size_t count = RELAY_CHANNEL_COUNT;
+            relay_switch_trace_t trace = { .received_us = esp_timer_get_time() };
+            bool is_flood = false;
+            esp_err_t error = acquire_rate_limit(&is_flood);
             if (error == ESP_OK)
             {
-                relay_switch_set_state(switch_on, timeout);
+                error = get_switch_from_json(event, channel, commands, &count, &trace);
             }
-            else
+            if (error == ESP_OK)
             {
-                const char* error_string = esp_err_to_name(error);
-                ESP_LOGW(TAG, "Mqtt payload parse failed: %s", error_string);
+                for (size_t i = 0; i < count; i++)
+                {
+                    commands[i].source = RELAY_SWITCH_SOURCE_MQTT;
+                }
+                error = relay_switch_set_states_traced(commands, count, trace.id[0] != '\0' ? &trace : NULL);
             }
+            if (error != ESP_OK && !is_flood)
+            {
+                const char* error_string = relay_switch_err_to_name(error);
+                ESP_LOGW(TAG, "Mqtt switch request failed: %s", error_string);
+                notify_error(error);
+            }
+        }
+#if PRESET_ENABLE
+        else if (is_preset_request(event))
+        {
+            bool is_flood = false;
+            esp_err_t error = acquire_rate_limit(&is_flood);
+            if (error == ESP_OK)
+            {
+                error = apply_preset(event);
+            }
+            if (error != ESP_OK && !is_flood)
+            {
+                ESP_LOGW(TAG, "Mqtt preset request failed: %s", relay_switch_err_to_name(error));
+                notify_error(error);
+            }
+        }
+#endif
+#if OTA_ENABLE
+        else if (is_ota_request(event))
+        {
+            handle_ota_request(event);
         }
+#endif
         else
         {
             ESP_LOGW(TAG, "Publish received from unknown topic.");
         }
         break;
     case MQTT_EVENT_SUBSCRIBED:
-        ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED");
+        DEFERRED_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED");
         break;
     case MQTT_EVENT_ERROR:
-        ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+        DEFERRED_LOGI(TAG, "MQTT_EVENT_ERROR");
         break;
     default:
         break;
@@ -122,26 +546,63 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 
 esp_err_t mqtt_adapter_init()
 {
+    broker_selector_init(BROKER_COUNT);
     const esp_mqtt_client_config_t mqtt_cfg = {
-        .host = MQTT_BROKER_HOST,
+        .uri = broker_uris[0],
+        .port = MQTT_BROKER_PORT,
         .event_handle = mqtt_event_handler,
+        // Persistent session is bound to client id, so it must not change between connections
+        .client_id = SWITCH_ID,
+        .disable_clean_session = MQTT_PERSISTENT_SESSION,
+        .keepalive = MQTT_KEEPALIVE_S,
+        .reconnect_timeout_ms = MQTT_RECONNECT_DELAY_MS,
+        .network_timeout_ms = MQTT_NETWORK_TIMEOUT_MS,
+#if MQTT_TLS_ENABLE
+        .cert_pem = MQTT_BROKER_CA_CERT,
+        .crt_bundle_attach = MQTT_BROKER_CA_CERT == NULL ? esp_crt_bundle_attach : NULL,
+#endif
     };
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
     if (mqtt_client == NULL)
     {
         return ESP_FAIL;
     }
-    esp_err_t error = esp_mqtt_client_start(mqtt_client);
+    const esp_timer_create_args_t timer_args = {
+        .callback = probe_timer_callback,
+        .name = "mqtt_probe"
+    };
+    esp_err_t error = esp_timer_create(&timer_args, &probe_timer);
+    if (error != ESP_OK)
+        return error;
+    error = esp_timer_start_periodic(probe_timer, MQTT_BROKER_PROBE_PERIOD_MS * 1000ULL);
+    if (error != ESP_OK)
+        return error;
+    if (BROKER_COUNT > 1 && xTaskCreate(broker_probe_task_run, "broker_probe", 3072, NULL, BROKER_PROBE_TASK_PRIORITY,
+            NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    error = esp_mqtt_client_start(mqtt_client);
     return error;
 }
 
-esp_err_t mqtt_adapter_notify_switch_status(const relay_switch_state_t* switch_state)
+esp_err_t mqtt_adapter_notify_switch_status()
 {
     char *serialized_string = NULL;
     size_t length = 0;
-    esp_err_t error = json_serializer_serialize(switch_state, &serialized_string, &length);
+    esp_err_t error = state_cache_get(&serialized_string, &length);
     if (error != ESP_OK) return error;
     esp_mqtt_client_publish(mqtt_client, MQTT_STATE_TOPIC, serialized_string, length, 1, false);
     json_serializer_free(serialized_string);
     return ESP_OK;
 }
+
+esp_err_t mqtt_adapter_notify_sensors(const sensor_aggregates_t* aggregates)
+{
+    char *serialized_string = NULL;
+    size_t length = 0;
+    esp_err_t error = json_serializer_serialize_sensors(aggregates, &serialized_string, &length);
+    if (error != ESP_OK) return error;
+    // Aggregates are periodic, lost message is replaced by the next one
+    esp_mqtt_client_publish(mqtt_client, MQTT_SENSORS_TOPIC, serialized_string, length, 0, false);
+    json_serializer_free(serialized_string);
+    return ESP_OK;
+}
@@ -39,6 +39,7 @@
 #include <esp_err.h>
 
 #include "relay_switch.h"
+#include "sensor_sampler.h"
 
 /**
  * Initialize and start MQTT adapter. MQTT client is started and appropriate topics are subscribed.
@@ -47,10 +48,16 @@
 esp_err_t mqtt_adapter_init(void);
 
 /**
- * Send message with new switch state data to the topic.
- * @param[in] switch_state A pointer to current switch state data.
+ * Send message with current switch state data to the topic. State is taken from state cache.
  * @return Return ESP_OK if succeeded.
  */
-esp_err_t mqtt_adapter_notify_switch_status(const relay_switch_state_t* switch_state);
+esp_err_t mqtt_adapter_notify_switch_status(void);
+
+/**
+ * Send message with sensor aggregates to the topic.
+ * @param[in] aggregates A pointer to current sensor aggregates.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t mqtt_adapter_notify_sensors(const sensor_aggregates_t* aggregates);
 
 #endif /* MAIN_MQTT_ADAPTER_H_ */
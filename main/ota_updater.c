@@ -0,0 +1,346 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file implements over-the-air firmware update. Image chunks are received to single static buffer and
+ * written to flash directly from it. Partition is erased sector by sector as it is written, so flash is not blocked
+ * by erasing whole partition and relay control stays responsive.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_ota_ops.h>
+#include <esp_image_format.h>
+#include <esp_http_client.h>
+#include <esp_crt_bundle.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_log.h>
+
+#include "ota_updater.h"
+#include "metrics.h"
+#include "user_config.h"
+
+#define TAG "ota_updater"
+/** Download runs below relay timeouts, button, sensors and network adapters. */
+#define PULL_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#define IMAGE_HEADER_SIZE (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t))
+
+_Static_assert(OTA_BUFFER_SIZE >= IMAGE_HEADER_SIZE, "OTA buffer must hold image header");
+#if OTA_ENABLE
+_Static_assert(sizeof(OTA_AUTH_TOKEN) > 1, "OTA_AUTH_TOKEN must be set when OTA_ENABLE is 1");
+#endif
+
+typedef struct pull_request
+{
+    char url[OTA_URL_MAX_LENGTH];
+    ota_updater_done_cb_t done_cb;
+    void* context;
+} pull_request_t;
+
+static char buffer[OTA_BUFFER_SIZE];
+static bool is_running = false;
+static portMUX_TYPE ota_mux = portMUX_INITIALIZER_UNLOCKED;
+static pull_request_t pull_request;
+static esp_timer_handle_t restart_timer = NULL;
+
+static bool try_lock(void)
+{
+    bool locked = false;
+    portENTER_CRITICAL(&ota_mux);
+    if (!is_running)
+    {
+        is_running = true;
+        locked = true;
+    }
+    portEXIT_CRITICAL(&ota_mux);
+    return locked;
+}
+
+static void unlock(void)
+{
+    portENTER_CRITICAL(&ota_mux);
+    is_running = false;
+    portEXIT_CRITICAL(&ota_mux);
+}
+
+/**
+ * Validate image header and application descriptor at the beginning of the image.
+ */
+static esp_err_t validate_header(const char* data, ota_updater_result_t* result)
+{
+    esp_image_header_t header;
+    esp_app_desc_t app_desc;
+    memcpy(&header, data, sizeof(header));
+    memcpy(&app_desc, data + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(app_desc));
+    if (header.magic != ESP_IMAGE_HEADER_MAGIC || header.chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID)
+    {
+        ESP_LOGW(TAG, "Image is not valid for this chip.");
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    if (app_desc.magic_word != ESP_APP_DESC_MAGIC_WORD
+            || strncmp(app_desc.project_name, esp_ota_get_app_description()->project_name,
+                    sizeof(app_desc.project_name)) != 0)
+    {
+        ESP_LOGW(TAG, "Image is not built for this project.");
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    strlcpy(result->version, app_desc.version, sizeof(result->version));
+    return ESP_OK;
+}
+
+static esp_err_t run_locked(size_t image_size, ota_updater_read_cb_t read_cb, void* context,
+        ota_updater_result_t* result)
+{
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL)
+        return ESP_ERR_NOT_FOUND;
+    if (image_size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    int64_t start_us = esp_timer_get_time();
+    uint32_t start_heap = esp_get_free_heap_size();
+    uint32_t min_heap = start_heap;
+    esp_ota_handle_t handle = 0;
+    bool is_begun = false;
+    size_t received = 0;
+    size_t filled = 0;
+    esp_err_t error = ESP_OK;
+    while (error == ESP_OK)
+    {
+        int length = read_cb(context, buffer + filled, sizeof(buffer) - filled);
+        if (length < 0)
+        {
+            error = ESP_FAIL;
+            break;
+        }
+        if (length == 0)
+            break;
+        filled += length;
+        if (!is_begun)
+        {
+            // Header is collected first, so invalid image is rejected before the partition is touched
+            if (filled < IMAGE_HEADER_SIZE)
+                continue;
+            error = validate_header(buffer, result);
+            if (error == ESP_OK)
+            {
+                error = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle);
+            }
+            if (error != ESP_OK)
+                break;
+            is_begun = true;
+        }
+        received += filled;
+        if (received > partition->size)
+        {
+            error = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        error = esp_ota_write(handle, buffer, filled);
+        filled = 0;
+        uint32_t free_heap = esp_get_free_heap_size();
+        if (free_heap < min_heap)
+        {
+            min_heap = free_heap;
+        }
+    }
+    if (error == ESP_OK && (!is_begun || (image_size != 0 && received != image_size)))
+    {
+        error = ESP_ERR_INVALID_SIZE;
+    }
+    if (is_begun)
+    {
+        if (error == ESP_OK)
+        {
+            // Checksum, hash and signature of whole image are verified here
+            error = esp_ota_end(handle);
+        }
+        else
+        {
+            esp_ota_abort(handle);
+        }
+    }
+    if (error == ESP_OK)
+    {
+        error = esp_ota_set_boot_partition(partition);
+    }
+
+    uint32_t duration_millis = (esp_timer_get_time() - start_us) / 1000;
+    result->image_size = received;
+    result->duration_millis = duration_millis;
+    result->bytes_per_second = duration_millis > 0 ? (uint64_t)received * 1000 / duration_millis : 0;
+    result->peak_heap_bytes = start_heap - min_heap;
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Update failed after %u bytes: %s", result->image_size, esp_err_to_name(error));
+        metrics_increment(METRIC_OTA_FAILURES);
+        return error;
+    }
+    ESP_LOGI(TAG, "Image %s written: %u bytes, %u ms, %u B/s, peak heap %u B", result->version, result->image_size,
+            result->duration_millis, result->bytes_per_second, result->peak_heap_bytes);
+    metrics_increment(METRIC_OTA_UPDATES);
+    metrics_set(METRIC_OTA_LAST_BYTES_PER_SECOND, result->bytes_per_second);
+    metrics_set(METRIC_OTA_LAST_PEAK_HEAP_BYTES, result->peak_heap_bytes);
+    return ESP_OK;
+}
+
+static int read_http_client(void* context, char* data, size_t size)
+{
+    return esp_http_client_read((esp_http_client_handle_t)context, data, size);
+}
+
+static void pull_task_run(void* pvParameters)
+{
+    ota_updater_result_t result;
+    memset(&result, 0, sizeof(result));
+    esp_http_client_config_t config = {
+        .url = pull_request.url,
+        .timeout_ms = OTA_PULL_TIMEOUT_MS,
+        .crt_bundle_attach = esp_crt_bundle_attach
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    esp_err_t error = client != NULL ? esp_http_client_open(client, 0) : ESP_ERR_NO_MEM;
+    if (error == ESP_OK)
+    {
+        int content_length = esp_http_client_fetch_headers(client);
+        if (esp_http_client_get_status_code(client) != 200)
+        {
+            error = ESP_ERR_INVALID_RESPONSE;
+        }
+        else
+        {
+            error = run_locked(content_length > 0 ? content_length : 0, read_http_client, client, &result);
+        }
+        esp_http_client_close(client);
+    }
+    if (client != NULL)
+    {
+        esp_http_client_cleanup(client);
+    }
+    // Request must be copied before unlocking, next pull can overwrite it then
+    ota_updater_done_cb_t done_cb = pull_request.done_cb;
+    void* context = pull_request.context;
+    unlock();
+    if (done_cb != NULL)
+    {
+        done_cb(error, &result, context);
+    }
+    vTaskDelete(NULL);
+}
+
+static void restart_timer_callback(void* arg)
+{
+    esp_restart();
+}
+
+esp_err_t ota_updater_init()
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    ESP_LOGI(TAG, "Running image %s from partition %s", esp_ota_get_app_description()->version, running->label);
+    const esp_timer_create_args_t timer_args = {
+        .callback = restart_timer_callback,
+        .name = "ota_restart"
+    };
+    return esp_timer_create(&timer_args, &restart_timer);
+}
+
+esp_err_t ota_updater_confirm()
+{
+    esp_ota_img_states_t state;
+    esp_err_t error = esp_ota_get_state_partition(esp_ota_get_running_partition(), &state);
+    if (error != ESP_OK || state != ESP_OTA_IMG_PENDING_VERIFY)
+        return ESP_OK;
+    ESP_LOGI(TAG, "New image confirmed, rollback cancelled.");
+    return esp_ota_mark_app_valid_cancel_rollback();
+}
+
+esp_err_t ota_updater_run(size_t image_size, ota_updater_read_cb_t read_cb, void* context,
+        ota_updater_result_t* result)
+{
+    memset(result, 0, sizeof(*result));
+    if (!try_lock())
+        return ESP_ERR_INVALID_STATE;
+    esp_err_t error = run_locked(image_size, read_cb, context, result);
+    unlock();
+    return error;
+}
+
+esp_err_t ota_updater_pull(const char* url, ota_updater_done_cb_t done_cb, void* context)
+{
+    if (strlen(url) >= sizeof(pull_request.url))
+        return ESP_ERR_INVALID_SIZE;
+    if (!try_lock())
+        return ESP_ERR_INVALID_STATE;
+    strlcpy(pull_request.url, url, sizeof(pull_request.url));
+    pull_request.done_cb = done_cb;
+    pull_request.context = context;
+    if (xTaskCreate(pull_task_run, "ota_pull", 6144, NULL, PULL_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        unlock();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool ota_updater_is_authorized(const char* token)
+{
+    static const char expected[] = OTA_AUTH_TOKEN;
+    size_t expected_length = strlen(expected);
+    // Firmware is never replaced by unauthenticated request
+    if (expected_length == 0)
+        return false;
+    size_t length = strlen(token);
+    // Every character is compared, so response time does not reveal length of matching prefix
+    uint8_t difference = length != expected_length;
+    for (size_t i = 0; i < expected_length; i++)
+    {
+        difference |= (uint8_t)(expected[i] ^ (i < length ? token[i] : 0));
+    }
+    return difference == 0;
+}
+
+const char* ota_updater_err_to_name(esp_err_t error)
+{
+    switch (error)
+    {
+    case ESP_ERR_OTA_UPDATER_UNAUTHORIZED:
+        return "ESP_ERR_OTA_UPDATER_UNAUTHORIZED";
+    default:
+        return esp_err_to_name(error);
+    }
+}
+
+void ota_updater_schedule_restart()
+{
+    ESP_LOGI(TAG, "Restarting in %d ms", OTA_RESTART_DELAY_MS);
+    esp_timer_start_once(restart_timer, OTA_RESTART_DELAY_MS * 1000ULL);
+}
@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for over-the-air firmware update. Image is streamed to inactive OTA partition
+ * through fixed buffer, so memory use does not depend on image size.
+ */
+
+#ifndef MAIN_OTA_UPDATER_H_
+#define MAIN_OTA_UPDATER_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <esp_err.h>
+
+/** Base of OTA updater error codes. */
+#define ESP_ERR_OTA_UPDATER_BASE 0x71000
+/** Request does not carry token required by OTA_AUTH_TOKEN. */
+#define ESP_ERR_OTA_UPDATER_UNAUTHORIZED (ESP_ERR_OTA_UPDATER_BASE + 1)
+
+/**
+ * Statistics of finished update.
+ */
+typedef struct ota_updater_result
+{
+    /** Version of received image. */
+    char version[32];
+    /** Number of received image bytes. */
+    uint32_t image_size;
+    /** Update duration in ms. */
+    uint32_t duration_millis;
+    /** Average throughput in bytes per second. */
+    uint32_t bytes_per_second;
+    /** Maximum heap consumption during update in bytes. */
+    uint32_t peak_heap_bytes;
+} ota_updater_result_t;
+
+/**
+ * Read next part of image to the buffer.
+ * @param context Context of the image source.
+ * @param buffer Buffer to be filled.
+ * @param size Capacity of the buffer.
+ * @return Return number of read bytes, 0 at the end of image or negative value on error.
+ */
+typedef int (*ota_updater_read_cb_t)(void* context, char* buffer, size_t size);
+
+/**
+ * Callback called from pull task when update is finished.
+ * @param error ESP_OK if new image was written and set as boot image.
+ * @param result Statistics of the update.
+ * @param context Context passed to pull request.
+ */
+typedef void (*ota_updater_done_cb_t)(esp_err_t error, const ota_updater_result_t* result, void* context);
+
+/**
+ * Initialize OTA updater.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t ota_updater_init(void);
+
+/**
+ * Confirm that running image works. Image booted first time after update is rolled back by bootloader on next reset
+ * if it is not confirmed.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t ota_updater_confirm(void);
+
+/**
+ * Stream image to inactive partition and set it as boot partition. Image header is validated before the partition is
+ * written, whole image is verified when it is complete. Only one update can run at the same time.
+ * @param[in] image_size Expected image size or 0 when it is unknown.
+ * @param[in] read_cb Function reading the image.
+ * @param[in] context Context passed to read function.
+ * @param[out] result Statistics of the update.
+ * @return Return ESP_OK if succeeded, ESP_ERR_INVALID_STATE if another update is running,
+ * ESP_ERR_OTA_VALIDATE_FAILED if image is not valid or ESP_ERR_INVALID_SIZE if image size does not fit.
+ */
+esp_err_t ota_updater_run(size_t image_size, ota_updater_read_cb_t read_cb, void* context,
+        ota_updater_result_t* result);
+
+/**
+ * Start update from HTTP or HTTPS URL in background task.
+ * @param[in] url Image URL.
+ * @param[in] done_cb Callback called when update is finished.
+ * @param[in] context Context passed to callback.
+ * @return Return ESP_OK if update was started or ESP_ERR_INVALID_STATE if another update is running.
+ */
+esp_err_t ota_updater_pull(const char* url, ota_updater_done_cb_t done_cb, void* context);
+
+/**
+ * Check token of update request against OTA_AUTH_TOKEN.
+ * @param[in] token Token sent with request.
+ * @return Return true if token matches, every request is refused when OTA_AUTH_TOKEN is empty.
+ */
+bool ota_updater_is_authorized(const char* token);
+
+/**
+ * Get name of OTA updater error code.
+ * @param[in] error Error code.
+ * @return Return name of OTA updater error or name from esp_err_to_name for other errors.
+ */
+const char* ota_updater_err_to_name(esp_err_t error);
+
+/**
+ * Restart device after OTA_RESTART_DELAY_MS, so response to update request can be sent.
+ */
+void ota_updater_schedule_restart(void);
+
+#endif /* MAIN_OTA_UPDATER_H_ */
@@ -0,0 +1,235 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file implements real time hold-over. Offset between UTC and RTC timer is kept in RTC memory, which
+ * survives software reset, so the clock continues right after reboot. After power loss the clock is seeded from last
+ * time persisted in NVS. SNTP refines the time in background and does not gate startup.
+ */
+
+#include <string.h>
+#include <sys/time.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <esp_sntp.h>
+#include <esp32/clk.h>
+#include <nvs.h>
+
+#include "platform_time.h"
+#include "user_config.h"
+
+#define TAG "platform_time"
+#define NVS_NAMESPACE "relay_switch"
+#define NVS_SEED_KEY "time_seed"
+#define TIME_RECORD_MAGIC 0x54484f4cUL
+/** Any earlier time was not synchronized (2020-01-01). */
+#define MIN_VALID_UTC_MILLIS 1577836800000ULL
+
+/**
+ * Time record retained in RTC memory over software reset.
+ */
+typedef struct time_record
+{
+    uint32_t magic;
+    /** UTC time minus RTC timer in microseconds. */
+    int64_t utc_offset_us;
+    uint64_t last_sync_utc_millis;
+    uint32_t checksum;
+} time_record_t;
+
+static RTC_NOINIT_ATTR time_record_t time_record;
+static esp_timer_handle_t persist_timer = NULL;
+static time_quality_t seed_quality = TIME_QUALITY_UNKNOWN;
+static volatile uint64_t last_sync_utc_millis = 0;
+
+static uint32_t get_record_checksum(const time_record_t *record)
+{
+    uint32_t checksum = record->magic;
+    checksum ^= (uint32_t)record->utc_offset_us ^ (uint32_t)(record->utc_offset_us >> 32);
+    checksum ^= (uint32_t)record->last_sync_utc_millis ^ (uint32_t)(record->last_sync_utc_millis >> 32);
+    return ~checksum;
+}
+
+static bool is_record_valid(void)
+{
+    // RTC timer and memory are reset on power on and brownout, record contains garbage then
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT)
+        return false;
+    return time_record.magic == TIME_RECORD_MAGIC && time_record.checksum == get_record_checksum(&time_record);
+}
+
+static void set_utc_millis(uint64_t utc_millis)
+{
+    struct timeval tv = {
+        .tv_sec = utc_millis / 1000,
+        .tv_usec = (utc_millis % 1000) * 1000
+    };
+    settimeofday(&tv, NULL);
+}
+
+static uint64_t load_seed(void)
+{
+    nvs_handle_t handle;
+    uint64_t seed = 0;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return 0;
+    if (nvs_get_u64(handle, NVS_SEED_KEY, &seed) != ESP_OK)
+    {
+        seed = 0;
+    }
+    nvs_close(handle);
+    return seed;
+}
+
+static void store_seed(uint64_t utc_millis)
+{
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (error != ESP_OK)
+        return;
+    error = nvs_set_u64(handle, NVS_SEED_KEY, utc_millis);
+    if (error == ESP_OK)
+    {
+        error = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to store time seed: %s", esp_err_to_name(error));
+    }
+}
+
+static void persist_timer_callback(void* arg)
+{
+    // Seed written with low frequency limits flash wear and also the lag after power loss
+    if (platform_get_time_quality() >= TIME_QUALITY_HOLDOVER)
+    {
+        store_seed(platform_get_utc_millis());
+    }
+}
+
+static void time_sync_notification_cb(struct timeval *tv)
+{
+    uint64_t utc_millis = ((uint64_t)tv->tv_sec) * 1000 + tv->tv_usec / 1000;
+    bool is_first_sync = last_sync_utc_millis == 0;
+    time_record.magic = TIME_RECORD_MAGIC;
+    time_record.utc_offset_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec - (int64_t)esp_clk_rtc_time();
+    time_record.last_sync_utc_millis = utc_millis;
+    time_record.checksum = get_record_checksum(&time_record);
+    last_sync_utc_millis = utc_millis;
+    ESP_LOGI(TAG, "UTC time synchronized: %llu", utc_millis);
+    if (is_first_sync)
+    {
+        store_seed(utc_millis);
+    }
+}
+
+esp_err_t platform_time_init()
+{
+    if (is_record_valid())
+    {
+        set_utc_millis(((int64_t)esp_clk_rtc_time() + time_record.utc_offset_us) / 1000);
+        seed_quality = TIME_QUALITY_HOLDOVER;
+        ESP_LOGI(TAG, "Time held over reset, last sync %llu", time_record.last_sync_utc_millis);
+    }
+    else
+    {
+        uint64_t seed = load_seed();
+        if (seed >= MIN_VALID_UTC_MILLIS)
+        {
+            set_utc_millis(seed);
+            seed_quality = TIME_QUALITY_SEEDED;
+            ESP_LOGI(TAG, "Time seeded from NVS: %llu", seed);
+        }
+        else
+        {
+            ESP_LOGI(TAG, "No time seed available.");
+        }
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = persist_timer_callback,
+        .name = "time_persist"
+    };
+    esp_err_t error = esp_timer_create(&timer_args, &persist_timer);
+    if (error != ESP_OK)
+        return error;
+    return esp_timer_start_periodic(persist_timer, TIME_SEED_PERSIST_PERIOD_MS * 1000ULL);
+}
+
+void platform_time_start_sync()
+{
+    ESP_LOGI(TAG, "Initializing SNTP");
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, NTP_SERVER);
+    sntp_set_time_sync_notification_cb(time_sync_notification_cb);
+    // Held over time is slewed without jumps, SNTP steps the clock only when the error is too large to adjust
+    sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
+    sntp_init();
+}
+
+time_quality_t platform_get_time_quality()
+{
+    uint64_t last_sync = last_sync_utc_millis;
+    if (last_sync == 0)
+        return seed_quality;
+    if (platform_get_utc_millis() - last_sync < TIME_SYNC_VALID_MS)
+        return TIME_QUALITY_SYNCHRONIZED;
+    return TIME_QUALITY_HOLDOVER;
+}
+
+const char* platform_time_quality_to_name(time_quality_t quality)
+{
+    switch (quality)
+    {
+    case TIME_QUALITY_SEEDED:
+        return "seeded";
+    case TIME_QUALITY_HOLDOVER:
+        return "holdover";
+    case TIME_QUALITY_SYNCHRONIZED:
+        return "synchronized";
+    default:
+        return "unknown";
+    }
+}
+
+uint64_t platform_get_utc_millis()
+{
+    struct timeval tv;
+    uint64_t millisecondsSinceEpoch = 0;
+
+    gettimeofday(&tv, NULL);
+    millisecondsSinceEpoch = (uint64_t) (tv.tv_sec) * 1000 + (uint64_t) (tv.tv_usec) / 1000;
+
+    return millisecondsSinceEpoch;
+}
@@ -29,13 +29,62 @@
 /**
  * @file
  * @author Vit Holasek
- * @brief This file contains basic functions for obtaining real and system time.
+ * @brief This file contains basic functions for obtaining real and system time. Real time is seeded right after reset
+ * from last known time and refined by SNTP in background, so time quality must be checked before relying on it.
  */
 
 #ifndef MAIN_PLATFORM_TIME_H_
 #define MAIN_PLATFORM_TIME_H_
 
 #include <inttypes.h>
+#include <esp_err.h>
+
+/**
+ * Quality of real time, ordered from the worst to the best.
+ */
+typedef enum time_quality
+{
+    /**
+     * No time is known, clock starts at epoch.
+     */
+    TIME_QUALITY_UNKNOWN = 0,
+    /**
+     * Clock was seeded from last time stored in NVS. Time lags behind by the power off duration at least.
+     */
+    TIME_QUALITY_SEEDED,
+    /**
+     * Clock is kept by RTC timer since last synchronization or over software reset. Error is given by RTC drift.
+     */
+    TIME_QUALITY_HOLDOVER,
+    /**
+     * Clock was synchronized by SNTP recently.
+     */
+    TIME_QUALITY_SYNCHRONIZED
+} time_quality_t;
+
+/**
+ * Seed real time clock from RTC retained memory or NVS. It should be called right after NVS is initialized.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t platform_time_init(void);
+
+/**
+ * Start SNTP synchronization in background. Network must be initialized.
+ */
+void platform_time_start_sync(void);
+
+/**
+ * Get quality of current real time.
+ * @return Return time quality.
+ */
+time_quality_t platform_get_time_quality(void);
+
+/**
+ * Convert time quality to name used in payloads.
+ * @param quality Time quality.
+ * @return Return quality name.
+ */
+const char* platform_time_quality_to_name(time_quality_t quality);
 
 uint64_t platform_get_utc_millis(void);
 
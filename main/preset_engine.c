@@ -0,0 +1,205 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of presets. Presets JSON is kept in NVS as it was received, compiled table lives in RAM.
+ * Preset is copied out of the table before it is applied, so presets can be replaced while another one is switching.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+#include <esp_log.h>
+
+#include "preset_engine.h"
+#include "json_serializer.h"
+#include "buffer_pool.h"
+
+#define TAG "preset_engine"
+#define NVS_NAMESPACE "relay_switch"
+#define NVS_PRESETS_KEY "presets"
+#define EMPTY_PRESETS "[]"
+
+static preset_table_t active_presets;
+static SemaphoreHandle_t presets_mutex = NULL;
+
+static esp_err_t load_presets(char **presets_json)
+{
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (error != ESP_OK)
+        return error;
+    size_t length = 0;
+    error = nvs_get_str(handle, NVS_PRESETS_KEY, NULL, &length);
+    if (error == ESP_OK)
+    {
+        *presets_json = buffer_pool_alloc(length);
+        if (*presets_json == NULL)
+        {
+            error = ESP_ERR_NO_MEM;
+        }
+        else
+        {
+            error = nvs_get_str(handle, NVS_PRESETS_KEY, *presets_json, &length);
+        }
+    }
+    nvs_close(handle);
+    return error;
+}
+
+static esp_err_t store_presets(const char *presets_json)
+{
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (error != ESP_OK)
+        return error;
+    error = nvs_set_str(handle, NVS_PRESETS_KEY, presets_json);
+    if (error == ESP_OK)
+    {
+        error = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return error;
+}
+
+static void activate_presets(const preset_table_t *presets)
+{
+    xSemaphoreTake(presets_mutex, portMAX_DELAY);
+    active_presets = *presets;
+    xSemaphoreGive(presets_mutex);
+}
+
+esp_err_t preset_engine_init()
+{
+    memset(&active_presets, 0, sizeof(active_presets));
+    presets_mutex = xSemaphoreCreateMutex();
+    if (presets_mutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    char *presets_json = NULL;
+    esp_err_t error = load_presets(&presets_json);
+    if (error != ESP_OK)
+    {
+        ESP_LOGI(TAG, "No presets stored.");
+        return ESP_OK;
+    }
+    preset_table_t presets;
+    memset(&presets, 0, sizeof(presets));
+    error = json_serializer_deserialize_presets(presets_json, &presets);
+    buffer_pool_free(presets_json);
+    if (error != ESP_OK)
+    {
+        // Broken presets can be fixed by API
+        ESP_LOGE(TAG, "Stored presets are invalid: %s", esp_err_to_name(error));
+        return ESP_OK;
+    }
+    activate_presets(&presets);
+    ESP_LOGI(TAG, "Loaded %d presets.", presets.count);
+    return ESP_OK;
+}
+
+esp_err_t preset_engine_apply(const char *name, relay_switch_source_t source)
+{
+    relay_switch_command_t commands[RELAY_CHANNEL_COUNT];
+    size_t count = 0;
+    bool is_found = false;
+    xSemaphoreTake(presets_mutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < active_presets.count && !is_found; i++)
+    {
+        const preset_t *preset = &active_presets.presets[i];
+        if (strcmp(preset->name, name) == 0)
+        {
+            count = preset->command_count;
+            memcpy(commands, preset->commands, count * sizeof(commands[0]));
+            is_found = true;
+        }
+    }
+    xSemaphoreGive(presets_mutex);
+    if (!is_found)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        commands[i].source = source;
+    }
+    ESP_LOGI(TAG, "Applying preset %s (%s)", name, relay_switch_source_to_name(source));
+    return relay_switch_set_states(commands, count);
+}
+
+esp_err_t preset_engine_get_name(size_t index, char *name)
+{
+    esp_err_t error = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(presets_mutex, portMAX_DELAY);
+    if (index < active_presets.count)
+    {
+        strlcpy(name, active_presets.presets[index].name, PRESET_NAME_MAX_LENGTH);
+        error = ESP_OK;
+    }
+    xSemaphoreGive(presets_mutex);
+    return error;
+}
+
+esp_err_t preset_engine_set_presets(const char *presets_json)
+{
+    preset_table_t presets;
+    memset(&presets, 0, sizeof(presets));
+    esp_err_t error = json_serializer_deserialize_presets(presets_json, &presets);
+    if (error != ESP_OK)
+    {
+        return error;
+    }
+    error = store_presets(presets_json);
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to store presets: %s", esp_err_to_name(error));
+        return error;
+    }
+    activate_presets(&presets);
+    ESP_LOGI(TAG, "Presets updated.");
+    return ESP_OK;
+}
+
+esp_err_t preset_engine_get_presets(char **presets_json)
+{
+    esp_err_t error = load_presets(presets_json);
+    if (error == ESP_ERR_NVS_NOT_FOUND)
+    {
+        *presets_json = buffer_pool_alloc(sizeof(EMPTY_PRESETS));
+        if (*presets_json == NULL)
+            return ESP_ERR_NO_MEM;
+        strcpy(*presets_json, EMPTY_PRESETS);
+        error = ESP_OK;
+    }
+    return error;
+}
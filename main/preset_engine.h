@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for named presets. Preset describes target states of several channels, it is
+ * stored in NVS in JSON form and applied as single transition, so all channels change together and state is published
+ * once.
+ */
+
+#ifndef MAIN_PRESET_ENGINE_H_
+#define MAIN_PRESET_ENGINE_H_
+
+#include <inttypes.h>
+
+#include <esp_err.h>
+
+#include "relay_switch.h"
+#include "user_config.h"
+
+/**
+ * Compiled preset.
+ */
+typedef struct preset
+{
+    /** Unique name of preset used to apply it. */
+    char name[PRESET_NAME_MAX_LENGTH];
+    /** Switching requests of channels in preset. */
+    relay_switch_command_t commands[RELAY_CHANNEL_COUNT];
+    uint8_t command_count;
+} preset_t;
+
+/**
+ * Table of compiled presets.
+ */
+typedef struct preset_table
+{
+    preset_t presets[PRESET_MAX_COUNT];
+    uint8_t count;
+} preset_table_t;
+
+/**
+ * Initialize presets. Presets stored in NVS are loaded and compiled.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t preset_engine_init(void);
+
+/**
+ * Apply preset. All channels of preset are switched in one transition.
+ * @param[in] name Name of preset.
+ * @param[in] source Origin of switching request.
+ * @return Return ESP_OK if succeeded, ESP_ERR_NOT_FOUND if preset does not exist or error of relay_switch_set_states.
+ */
+esp_err_t preset_engine_apply(const char *name, relay_switch_source_t source);
+
+/**
+ * Get name of preset at position in table.
+ * @param[in] index Position of preset.
+ * @param[out] name Buffer for name of at least PRESET_NAME_MAX_LENGTH bytes.
+ * @return Return ESP_OK if succeeded or ESP_ERR_NOT_FOUND if index is out of table.
+ */
+esp_err_t preset_engine_get_name(size_t index, char *name);
+
+/**
+ * Compile, activate and store presets.
+ * @param[in] presets_json String with presets in JSON format.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t preset_engine_set_presets(const char *presets_json);
+
+/**
+ * Get stored presets. Output string must be freed by buffer_pool_free when it is not needed anymore.
+ * @param[out] presets_json A pointer to string variable for setting presets in JSON format.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t preset_engine_get_presets(char **presets_json);
+
+#endif /* MAIN_PRESET_ENGINE_H_ */
@@ -0,0 +1,170 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of rate limiting. Buckets are guarded by spinlock, so rejected request costs only a few
+ * arithmetic operations and does not wait for relay switch lock.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+
+#include "rate_limiter.h"
+#include "metrics.h"
+#include "user_config.h"
+
+#define MILLI_TOKENS 1000
+/** Number of request sources, group is the last one. */
+#define SOURCE_COUNT (RELAY_SWITCH_SOURCE_GROUP + 1)
+
+typedef struct client_entry
+{
+    uint32_t address;
+    token_bucket_t bucket;
+} client_entry_t;
+
+static token_bucket_t source_buckets[SOURCE_COUNT];
+static client_entry_t clients[RATE_LIMIT_MAX_CLIENTS];
+static portMUX_TYPE limiter_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Find bucket of client address. Unknown client replaces entry which was refilled the longest time ago, it is the
+ * least recently used one.
+ */
+static token_bucket_t* get_client_bucket(uint32_t address, int64_t now)
+{
+    client_entry_t *oldest = &clients[0];
+    for (size_t i = 0; i < RATE_LIMIT_MAX_CLIENTS; i++)
+    {
+        if (clients[i].address == address)
+            return &clients[i].bucket;
+        if (clients[i].bucket.updated_us < oldest->bucket.updated_us)
+        {
+            oldest = &clients[i];
+        }
+    }
+    oldest->address = address;
+    rate_limiter_reset(&oldest->bucket, RATE_LIMIT_CLIENT_BURST, now);
+    return &oldest->bucket;
+}
+
+void rate_limiter_reset(token_bucket_t *bucket, uint32_t burst, int64_t now_us)
+{
+    bucket->milli_tokens = burst * MILLI_TOKENS;
+    bucket->updated_us = now_us;
+}
+
+bool rate_limiter_refill(token_bucket_t *bucket, uint32_t rate_per_minute, uint32_t burst, int64_t now_us)
+{
+    int64_t added = (now_us - bucket->updated_us) * rate_per_minute / 60000;
+    // Time of refill is kept when nothing was added, so frequent calls do not lose fractions of tokens
+    if (added > 0)
+    {
+        int64_t milli_tokens = bucket->milli_tokens + added;
+        bucket->milli_tokens = milli_tokens < burst * MILLI_TOKENS ? (uint32_t)milli_tokens : burst * MILLI_TOKENS;
+        bucket->updated_us = now_us;
+    }
+    return bucket->milli_tokens >= MILLI_TOKENS;
+}
+
+void rate_limiter_consume(token_bucket_t *bucket)
+{
+    bucket->milli_tokens -= MILLI_TOKENS;
+}
+
+void rate_limiter_init()
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&limiter_mux);
+    for (size_t i = 0; i < SOURCE_COUNT; i++)
+    {
+        rate_limiter_reset(&source_buckets[i], RATE_LIMIT_SOURCE_BURST, now);
+    }
+    memset(clients, 0, sizeof(clients));
+    portEXIT_CRITICAL(&limiter_mux);
+}
+
+esp_err_t rate_limiter_acquire(relay_switch_source_t source, uint32_t client_address)
+{
+#if RATE_LIMIT_ENABLE
+    if ((size_t)source >= SOURCE_COUNT)
+        return ESP_OK;
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&limiter_mux);
+    token_bucket_t *source_bucket = &source_buckets[source];
+    token_bucket_t *client_bucket = client_address != 0 ? get_client_bucket(client_address, now) : NULL;
+    bool allowed = rate_limiter_refill(source_bucket, RATE_LIMIT_SOURCE_PER_MINUTE, RATE_LIMIT_SOURCE_BURST, now);
+    if (client_bucket != NULL)
+    {
+        allowed &= rate_limiter_refill(client_bucket, RATE_LIMIT_CLIENT_PER_MINUTE, RATE_LIMIT_CLIENT_BURST, now);
+    }
+    if (allowed)
+    {
+        rate_limiter_consume(source_bucket);
+        if (client_bucket != NULL)
+        {
+            rate_limiter_consume(client_bucket);
+        }
+    }
+    portEXIT_CRITICAL(&limiter_mux);
+    if (!allowed)
+    {
+        metrics_increment(METRIC_RATE_LIMITED_REQUESTS);
+        return ESP_ERR_RELAY_RATE_LIMIT;
+    }
+#endif
+    return ESP_OK;
+}
+
+uint32_t rate_limiter_get_client_address(const struct sockaddr *address)
+{
+    if (address->sa_family == AF_INET)
+    {
+        return ((const struct sockaddr_in*)address)->sin_addr.s_addr;
+    }
+    if (address->sa_family == AF_INET6)
+    {
+        uint32_t key = 0;
+        memcpy(&key, &((const struct sockaddr_in6*)address)->sin6_addr.s6_addr[12], sizeof(key));
+        return key;
+    }
+    return 0;
+}
+
+uint32_t rate_limiter_get_socket_address(int sockfd)
+{
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if (sockfd < 0 || getpeername(sockfd, (struct sockaddr*)&address, &length) != 0)
+        return 0;
+    return rate_limiter_get_client_address((struct sockaddr*)&address);
+}
@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for rate limiting of switching requests. Every request source and every client
+ * address has its token bucket, requests over limit are rejected before they are parsed.
+ */
+
+#ifndef MAIN_RATE_LIMITER_H_
+#define MAIN_RATE_LIMITER_H_
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <esp_err.h>
+#include <lwip/sockets.h>
+
+#include "relay_switch.h"
+
+/**
+ * Token bucket. Tokens are counted in thousandths so that slow rates are refilled smoothly.
+ */
+typedef struct token_bucket
+{
+    /** Available tokens multiplied by 1000. */
+    uint32_t milli_tokens;
+    /** Monotonic time in microseconds of last refill. */
+    int64_t updated_us;
+} token_bucket_t;
+
+/**
+ * Fill token bucket up to burst size.
+ * @param[out] bucket A pointer to token bucket.
+ * @param[in] burst Maximum number of tokens.
+ * @param[in] now_us Current monotonic time in microseconds.
+ */
+void rate_limiter_reset(token_bucket_t *bucket, uint32_t burst, int64_t now_us);
+
+/**
+ * Refill token bucket by elapsed time. Caller must serialize access to the bucket.
+ * @param[in,out] bucket A pointer to token bucket.
+ * @param[in] rate_per_minute Number of tokens added per minute.
+ * @param[in] burst Maximum number of tokens.
+ * @param[in] now_us Current monotonic time in microseconds.
+ * @return Return true if at least one token is available.
+ */
+bool rate_limiter_refill(token_bucket_t *bucket, uint32_t rate_per_minute, uint32_t burst, int64_t now_us);
+
+/**
+ * Take one token from bucket. Availability must be checked by rate_limiter_refill.
+ * @param[in,out] bucket A pointer to token bucket.
+ */
+void rate_limiter_consume(token_bucket_t *bucket);
+
+/**
+ * Initialize token buckets of all sources and clear client table.
+ */
+void rate_limiter_init(void);
+
+/**
+ * Take token for switching request. Token is taken from bucket of the source and from bucket of client address if it
+ * is known, request is allowed only when both have token available.
+ * @param[in] source Origin of switching request.
+ * @param[in] client_address IPv4 address of client or 0 if it is unknown.
+ * @return Return ESP_OK if request is allowed or ESP_ERR_RELAY_RATE_LIMIT if it is over limit.
+ */
+esp_err_t rate_limiter_acquire(relay_switch_source_t source, uint32_t client_address);
+
+/**
+ * Get client address key for rate limiting. IPv4 mapped IPv6 addresses give the same key as IPv4 address.
+ * @param[in] address A pointer to socket address.
+ * @return Return IPv4 address or last 32 bits of IPv6 address, 0 if address family is not supported.
+ */
+uint32_t rate_limiter_get_client_address(const struct sockaddr *address);
+
+/**
+ * Get client address key of connected socket.
+ * @param[in] sockfd Socket descriptor.
+ * @return Return client address key or 0 if it cannot be determined.
+ */
+uint32_t rate_limiter_get_socket_address(int sockfd);
+
+#endif /* MAIN_RATE_LIMITER_H_ */
@@ -0,0 +1,225 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of relay coil drivers. Driver is selected at compile time by RELAY_DRIVER_MODE.
+ */
+
+
+#include <freertos/FreeRTOS.h>
+#include <driver/gpio.h>
+#include <soc/gpio_struct.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#include "relay_driver.h"
+#include "user_config.h"
+
+#define TAG "relay_driver"
+
+/**
+ * Bit masks of GPIO pins. ESP32 has separate output registers for pins 0-31 and 32-39.
+ */
+typedef struct gpio_masks
+{
+    uint32_t low;
+    uint32_t high;
+} gpio_masks_t;
+
+static void add_gpio(gpio_masks_t* masks, gpio_num_t gpio)
+{
+    if (gpio < 32)
+    {
+        masks->low |= 1UL << gpio;
+    }
+    else
+    {
+        masks->high |= 1UL << (gpio - 32);
+    }
+}
+
+static uint64_t get_pin_bit_mask(const gpio_masks_t* masks)
+{
+    return ((uint64_t)masks->high << 32) | masks->low;
+}
+
+/**
+ * Drive pins to active or inactive level with respect to HIGH_ON setting. Pins in each mask change in the same cycle,
+ * write to set register is immediately followed by write to clear register.
+ */
+static void write_gpio_masks(const gpio_masks_t* active, const gpio_masks_t* inactive)
+{
+#if HIGH_ON
+    const gpio_masks_t* high = active;
+    const gpio_masks_t* low = inactive;
+#else
+    const gpio_masks_t* high = inactive;
+    const gpio_masks_t* low = active;
+#endif
+    if (high->low != 0) GPIO.out_w1ts = high->low;
+    if (low->low != 0) GPIO.out_w1tc = low->low;
+    if (high->high != 0) GPIO.out1_w1ts.data = high->high;
+    if (low->high != 0) GPIO.out1_w1tc.data = low->high;
+}
+
+#if RELAY_DRIVER_MODE == RELAY_DRIVER_LATCHING
+
+static const gpio_num_t set_gpios[] = RELAY_CHANNEL_SET_GPIOS;
+static const gpio_num_t reset_gpios[] = RELAY_CHANNEL_RESET_GPIOS;
+_Static_assert(sizeof(set_gpios) / sizeof(set_gpios[0]) == RELAY_CHANNEL_COUNT,
+        "RELAY_CHANNEL_SET_GPIOS must contain RELAY_CHANNEL_COUNT items");
+_Static_assert(sizeof(reset_gpios) / sizeof(reset_gpios[0]) == RELAY_CHANNEL_COUNT,
+        "RELAY_CHANNEL_RESET_GPIOS must contain RELAY_CHANNEL_COUNT items");
+
+static esp_timer_handle_t pulse_timer = NULL;
+static volatile int64_t pulse_end_us = 0;
+static gpio_masks_t pulse_coils = { 0, 0 };
+static portMUX_TYPE pulse_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Terminate coil pulses. Callback of already stopped timer can be dispatched late when new pulse is running,
+ * such callback must not cut the new pulse.
+ */
+static void pulse_timer_callback(void* arg)
+{
+    static const gpio_masks_t none = { 0, 0 };
+    portENTER_CRITICAL(&pulse_mux);
+    if (esp_timer_get_time() >= pulse_end_us)
+    {
+        write_gpio_masks(&none, &pulse_coils);
+        pulse_coils.low = 0;
+        pulse_coils.high = 0;
+    }
+    portEXIT_CRITICAL(&pulse_mux);
+}
+
+esp_err_t relay_driver_init()
+{
+    gpio_masks_t all_coils = { 0, 0 };
+    for (int channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        add_gpio(&all_coils, set_gpios[channel]);
+        add_gpio(&all_coils, reset_gpios[channel]);
+    }
+    gpio_config_t io_conf;
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    io_conf.mode = GPIO_MODE_OUTPUT;
+    io_conf.pin_bit_mask = get_pin_bit_mask(&all_coils);
+    io_conf.pull_down_en = 0;
+    io_conf.pull_up_en = 0;
+    esp_err_t error = gpio_config(&io_conf);
+    if (error != ESP_OK)
+        return error;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = pulse_timer_callback,
+        .arg = NULL,
+        .name = "relay_pulse"
+    };
+    error = esp_timer_create(&timer_args, &pulse_timer);
+    if (error != ESP_OK)
+        return error;
+    // Bistable relays keep their position over reset so they must be driven to defined position
+    return relay_driver_set((uint32_t)((1ULL << RELAY_CHANNEL_COUNT) - 1), 0);
+}
+
+esp_err_t relay_driver_set(uint32_t channel_mask, uint32_t on_mask)
+{
+    static const gpio_masks_t none = { 0, 0 };
+    gpio_masks_t released = { 0, 0 };
+    gpio_masks_t energized = { 0, 0 };
+    for (int channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        uint32_t channel_bit = 1UL << channel;
+        if ((channel_mask & channel_bit) == 0)
+        {
+            continue;
+        }
+        add_gpio(&released, set_gpios[channel]);
+        add_gpio(&released, reset_gpios[channel]);
+        add_gpio(&energized, (on_mask & channel_bit) != 0 ? set_gpios[channel] : reset_gpios[channel]);
+    }
+
+    esp_timer_stop(pulse_timer);
+    portENTER_CRITICAL(&pulse_mux);
+    pulse_end_us = esp_timer_get_time() + RELAY_PULSE_WIDTH_MS * 1000;
+    // Set and reset coil of the same relay must never be energized together
+    write_gpio_masks(&none, &released);
+    write_gpio_masks(&energized, &none);
+    pulse_coils.low |= energized.low;
+    pulse_coils.high |= energized.high;
+    portEXIT_CRITICAL(&pulse_mux);
+    return esp_timer_start_once(pulse_timer, RELAY_PULSE_WIDTH_MS * 1000);
+}
+
+#else
+
+static const gpio_num_t relay_gpios[] = RELAY_CHANNEL_GPIOS;
+_Static_assert(sizeof(relay_gpios) / sizeof(relay_gpios[0]) == RELAY_CHANNEL_COUNT,
+        "RELAY_CHANNEL_GPIOS must contain RELAY_CHANNEL_COUNT items");
+
+esp_err_t relay_driver_init()
+{
+    gpio_masks_t all_relays = { 0, 0 };
+    for (int channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        add_gpio(&all_relays, relay_gpios[channel]);
+    }
+    gpio_config_t io_conf;
+    io_conf.intr_type = GPIO_INTR_DISABLE; //disable interrupt
+    io_conf.mode = GPIO_MODE_OUTPUT; //set as output mode
+    io_conf.pin_bit_mask = get_pin_bit_mask(&all_relays);
+    io_conf.pull_down_en = 0;
+    io_conf.pull_up_en = 1;
+    esp_err_t error = gpio_config(&io_conf);
+    if (error != ESP_OK)
+        return error;
+    return relay_driver_set((uint32_t)((1ULL << RELAY_CHANNEL_COUNT) - 1), 0);
+}
+
+esp_err_t relay_driver_set(uint32_t channel_mask, uint32_t on_mask)
+{
+    gpio_masks_t active = { 0, 0 };
+    gpio_masks_t inactive = { 0, 0 };
+    for (int channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        uint32_t channel_bit = 1UL << channel;
+        if ((channel_mask & channel_bit) == 0)
+        {
+            continue;
+        }
+        add_gpio((on_mask & channel_bit) != 0 ? &active : &inactive, relay_gpios[channel]);
+    }
+    write_gpio_masks(&active, &inactive);
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for driving relay coil. Monostable relay coil is held by GPIO level, bistable (latching)
+ * relay is switched by short pulses on separate set and reset coil pins.
+ */
+
+#ifndef MAIN_RELAY_DRIVER_H_
+#define MAIN_RELAY_DRIVER_H_
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <esp_err.h>
+
+/**
+ * Initialize relay driver. Coil pins of all channels are configured as outputs and relays are driven to off position.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t relay_driver_init(void);
+
+/**
+ * Drive relay channels to new positions. All channels in the mask are switched by single write to GPIO set and clear
+ * registers. In latching mode the function only starts coil pulses and returns immediately, pulses are terminated by timer.
+ * @param[in] channel_mask Bit mask of channels to be driven.
+ * @param[in] on_mask Bit mask of new channel positions. Channels with bit set are switched on.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t relay_driver_set(uint32_t channel_mask, uint32_t on_mask);
+
+#endif /* MAIN_RELAY_DRIVER_H_ */
@@ -0,0 +1,225 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of interlock rules. Rules JSON is kept in NVS as it was received, compiled masks live in RAM.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+#include <esp_log.h>
+
+#include "relay_interlock.h"
+#include "json_serializer.h"
+#include "buffer_pool.h"
+
+#define TAG "relay_interlock"
+#define NVS_NAMESPACE "relay_switch"
+#define NVS_RULES_KEY "interlock"
+#define EMPTY_RULES "[]"
+
+static relay_interlock_rules_t active_rules;
+static SemaphoreHandle_t rules_mutex = NULL;
+
+static void compile_dependents(relay_interlock_rules_t *rules)
+{
+    for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        rules->required_by_masks[channel] = 0;
+    }
+    for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        for (uint8_t required = 0; required < RELAY_CHANNEL_COUNT; required++)
+        {
+            if ((rules->requires_masks[channel] & (1UL << required)) != 0)
+            {
+                rules->required_by_masks[required] |= 1UL << channel;
+            }
+        }
+    }
+}
+
+static esp_err_t compile_rules(const char *rules_json, relay_interlock_rules_t *rules)
+{
+    memset(rules, 0, sizeof(*rules));
+    esp_err_t error = json_serializer_deserialize_interlock(rules_json, rules);
+    if (error != ESP_OK)
+    {
+        return error;
+    }
+    compile_dependents(rules);
+    return ESP_OK;
+}
+
+static esp_err_t load_rules(char **rules_json)
+{
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (error != ESP_OK)
+        return error;
+    size_t length = 0;
+    error = nvs_get_str(handle, NVS_RULES_KEY, NULL, &length);
+    if (error == ESP_OK)
+    {
+        *rules_json = buffer_pool_alloc(length);
+        if (*rules_json == NULL)
+        {
+            error = ESP_ERR_NO_MEM;
+        }
+        else
+        {
+            error = nvs_get_str(handle, NVS_RULES_KEY, *rules_json, &length);
+        }
+    }
+    nvs_close(handle);
+    return error;
+}
+
+static esp_err_t store_rules(const char *rules_json)
+{
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (error != ESP_OK)
+        return error;
+    error = nvs_set_str(handle, NVS_RULES_KEY, rules_json);
+    if (error == ESP_OK)
+    {
+        error = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return error;
+}
+
+esp_err_t relay_interlock_init()
+{
+    memset(&active_rules, 0, sizeof(active_rules));
+    rules_mutex = xSemaphoreCreateMutex();
+    if (rules_mutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    char *rules_json = NULL;
+    esp_err_t error = load_rules(&rules_json);
+    if (error != ESP_OK)
+    {
+        ESP_LOGI(TAG, "No interlock rules stored.");
+        return ESP_OK;
+    }
+    relay_interlock_rules_t rules;
+    error = compile_rules(rules_json, &rules);
+    buffer_pool_free(rules_json);
+    if (error != ESP_OK)
+    {
+        // Device must stay controllable even with broken rules, they can be fixed by API
+        ESP_LOGE(TAG, "Stored interlock rules are invalid: %s", esp_err_to_name(error));
+        return ESP_OK;
+    }
+    active_rules = rules;
+    return ESP_OK;
+}
+
+esp_err_t relay_interlock_check(uint32_t on_mask, uint32_t new_on_mask, relay_switch_command_t *command)
+{
+    uint8_t channel = command->channel;
+    esp_err_t error = ESP_OK;
+    xSemaphoreTake(rules_mutex, portMAX_DELAY);
+    if (command->switch_on)
+    {
+        if ((active_rules.exclusive_masks[channel] & new_on_mask) != 0)
+        {
+            error = ESP_ERR_RELAY_INTERLOCK;
+        }
+        // Required channels must be on before the transition and stay on after it
+        else if ((active_rules.requires_masks[channel] & ~(on_mask & new_on_mask)) != 0)
+        {
+            error = ESP_ERR_RELAY_DEPENDENCY;
+        }
+        else if (active_rules.max_on_millis[channel] > 0
+                && (command->timeout == 0 || command->timeout > active_rules.max_on_millis[channel]))
+        {
+            command->timeout = active_rules.max_on_millis[channel];
+        }
+    }
+    else if ((active_rules.required_by_masks[channel] & new_on_mask) != 0)
+    {
+        error = ESP_ERR_RELAY_DEPENDENCY;
+    }
+    xSemaphoreGive(rules_mutex);
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Request for channel %u rejected: %s", channel, relay_switch_err_to_name(error));
+    }
+    return error;
+}
+
+uint32_t relay_interlock_get_dependents(uint8_t channel)
+{
+    xSemaphoreTake(rules_mutex, portMAX_DELAY);
+    uint32_t dependents = active_rules.required_by_masks[channel];
+    xSemaphoreGive(rules_mutex);
+    return dependents;
+}
+
+esp_err_t relay_interlock_set_rules(const char *rules_json)
+{
+    relay_interlock_rules_t rules;
+    esp_err_t error = compile_rules(rules_json, &rules);
+    if (error != ESP_OK)
+    {
+        return error;
+    }
+    error = store_rules(rules_json);
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to store interlock rules: %s", esp_err_to_name(error));
+        return error;
+    }
+    xSemaphoreTake(rules_mutex, portMAX_DELAY);
+    active_rules = rules;
+    xSemaphoreGive(rules_mutex);
+    ESP_LOGI(TAG, "Interlock rules updated.");
+    return ESP_OK;
+}
+
+esp_err_t relay_interlock_get_rules(char **rules_json)
+{
+    esp_err_t error = load_rules(rules_json);
+    if (error == ESP_ERR_NVS_NOT_FOUND)
+    {
+        *rules_json = buffer_pool_alloc(sizeof(EMPTY_RULES));
+        if (*rules_json == NULL)
+            return ESP_ERR_NO_MEM;
+        strcpy(*rules_json, EMPTY_RULES);
+        error = ESP_OK;
+    }
+    return error;
+}
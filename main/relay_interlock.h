@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for validating switching requests against interlock rules. Rules are stored in NVS
+ * in declarative JSON form and compiled to per-channel bit masks, so each request is validated in constant time.
+ */
+
+#ifndef MAIN_RELAY_INTERLOCK_H_
+#define MAIN_RELAY_INTERLOCK_H_
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <esp_err.h>
+
+#include "relay_switch.h"
+#include "user_config.h"
+
+/**
+ * Interlock rules compiled to bit masks indexed by channel.
+ */
+typedef struct relay_interlock_rules
+{
+    /** Channels which must be switched off when the channel is switched on. */
+    uint32_t exclusive_masks[RELAY_CHANNEL_COUNT];
+    /** Channels which must be already switched on before the channel is switched on. */
+    uint32_t requires_masks[RELAY_CHANNEL_COUNT];
+    /** Channels which require the channel. It is derived from requires_masks. */
+    uint32_t required_by_masks[RELAY_CHANNEL_COUNT];
+    /** Maximum on duration of the channel in milliseconds. When 0 then the duration is not limited. */
+    uint32_t max_on_millis[RELAY_CHANNEL_COUNT];
+} relay_interlock_rules_t;
+
+/**
+ * Initialize interlock rules. Rules stored in NVS are loaded and compiled.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t relay_interlock_init(void);
+
+/**
+ * Validate switching request. Timeout of request is limited to maximum on duration of the channel.
+ * @param[in] on_mask Bit mask of channels which are currently switched on.
+ * @param[in] new_on_mask Bit mask of channels which will be switched on after the transition.
+ * @param[in,out] command A pointer to switching request to be validated.
+ * @return Return ESP_OK if request is allowed, ESP_ERR_RELAY_INTERLOCK or ESP_ERR_RELAY_DEPENDENCY otherwise.
+ */
+esp_err_t relay_interlock_check(uint32_t on_mask, uint32_t new_on_mask, relay_switch_command_t *command);
+
+/**
+ * Get channels which require the channel to be switched on.
+ * @param[in] channel Index of relay channel.
+ * @return Return bit mask of dependent channels.
+ */
+uint32_t relay_interlock_get_dependents(uint8_t channel);
+
+/**
+ * Compile, activate and store interlock rules.
+ * @param[in] rules_json String with rules in JSON format.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t relay_interlock_set_rules(const char *rules_json);
+
+/**
+ * Get stored interlock rules. Output string must be freed by buffer_pool_free when it is not needed anymore.
+ * @param[out] rules_json A pointer to string variable for setting rules in JSON format.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t relay_interlock_get_rules(char **rules_json);
+
+#endif /* MAIN_RELAY_INTERLOCK_H_ */
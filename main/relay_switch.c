@@ -32,151 +32,575 @@
  * @brief Implementation of switch state handling.
  */
 
+
+#include <string.h>
+#include <stdlib.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <driver/gpio.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
 #include <esp_log.h>
 #include <esp_err.h>
-#include <time.h>
-#include <sys/time.h>
+#include <nvs.h>
 
 #include "relay_switch.h"
+#include "relay_driver.h"
+#include "relay_interlock.h"
+#include "rate_limiter.h"
+#include "usage_stats.h"
+#include "state_history.h"
+#include "metrics.h"
+#include "deferred_log.h"
 #include "user_config.h"
 #include "platform_time.h"
 
 #define TAG "relay_switch"
+#define NVS_NAMESPACE "relay_switch"
+#define NVS_BOOT_COUNT_KEY "boot_count"
+/** Versions of each boot start at boot counter shifted by this number of bits. */
+#define VERSION_BOOT_SHIFT 16
+/**
+ * Timeout reverts are safety shutoffs, so the task runs above all other application tasks. It is still below ESP-IDF
+ * Wi-Fi, lwIP and esp_timer tasks.
+ */
+#define TIMEOUT_TASK_PRIORITY 11
 
-typedef struct scheduled_switch
-{
-    uint32_t timeout;
-    bool is_switched_on;
-} scheduled_switch_t;
+#if RELAY_CHANNEL_COUNT < 1 || RELAY_CHANNEL_COUNT > 32
+#error "RELAY_CHANNEL_COUNT must be in range 1-32"
+#endif
+
+static const char* channel_names[] = RELAY_CHANNEL_NAMES;
+_Static_assert(sizeof(channel_names) / sizeof(channel_names[0]) == RELAY_CHANNEL_COUNT,
+        "RELAY_CHANNEL_NAMES must contain RELAY_CHANNEL_COUNT items");
 
-static scheduled_switch_t scheduled_switch = { 0, false };
+/**
+ * Per-channel state table. Switch positions are kept in single bit mask so that all channels can be driven at once.
+ * Timeout deadlines use monotonic time, so they are not affected by SNTP time adjustments.
+ */
+static uint32_t on_mask = 0;
+static int64_t timeout_deadline_us[RELAY_CHANNEL_COUNT];
+static uint64_t last_change_utc_millis[RELAY_CHANNEL_COUNT];
+static uint8_t last_change_source[RELAY_CHANNEL_COUNT];
+/** Changed by every transition, readers compare it to detect state change. */
+static volatile uint32_t state_version = 0;
+/** Value of state version at last change of each channel. */
+static uint32_t channel_version[RELAY_CHANNEL_COUNT];
+/** Trace of the last traced transition, it is valid only while its version is current. */
+static relay_switch_trace_t last_trace;
+/** Monotonic time of last position change and switching budget of each channel. */
+static int64_t last_transition_us[RELAY_CHANNEL_COUNT];
+static token_bucket_t transition_buckets[RELAY_CHANNEL_COUNT];
 
 static state_changed_cb_t state_changed_callback = NULL;
 static void* state_changed_context = NULL;
-static relay_switch_state_t current_state;
-static uint64_t timeout_start = 0;
+static SemaphoreHandle_t state_mutex = NULL;
 static TaskHandle_t timeout_task = NULL;
 
-static esp_err_t relay_switch_set_state_internal(bool switch_on, uint32_t timeout);
+static esp_err_t relay_switch_set_states_internal(const relay_switch_command_t* commands, size_t count,
+        relay_switch_trace_t* trace);
 
 /**
- * Get current UTC time in ms (synchronized by SNTP)
+ * Increase state version. Version 0 is reserved for requests without version check.
  */
-static uint64_t get_utc_now()
+static uint32_t next_version(void)
 {
-    struct timeval tv;
-    uint64_t millisecondsSinceEpoch = 0;
-    gettimeofday(&tv, NULL);
-    millisecondsSinceEpoch = (uint64_t) (tv.tv_sec) * 1000 + (uint64_t) (tv.tv_usec) / 1000;
-    return millisecondsSinceEpoch;
+    state_version++;
+    if (state_version == 0)
+    {
+        state_version = 1;
+    }
+    return state_version;
 }
 
-esp_err_t relay_switch_init()
+/**
+ * Seed state version from boot counter, so versions seen by clients before restart are not reused.
+ */
+static void seed_version(void)
 {
-    current_state.is_switched_on = false;
-    current_state.last_change_utc_millis = platform_get_utc_millis();
-    current_state.switch_timeout_millis = 0;
-	gpio_config_t io_conf;
-    io_conf.intr_type = GPIO_INTR_DISABLE; //disable interrupt
-    io_conf.mode = GPIO_MODE_OUTPUT; //set as output mode
-    io_conf.pin_bit_mask = (1ULL<<RELAY_GPIO_NUM);
-    io_conf.pull_down_en = 0;
-    io_conf.pull_up_en = 1;
-    esp_err_t result = gpio_config(&io_conf);
-#if !HIGH_ON
-    if (result == ESP_OK)
-        result = gpio_set_level(RELAY_GPIO_NUM, (uint32_t)1);
-#endif
-    return result;
+    nvs_handle_t handle;
+    uint16_t boot_count = 0;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (error == ESP_OK)
+    {
+        nvs_get_u16(handle, NVS_BOOT_COUNT_KEY, &boot_count);
+        boot_count++;
+        error = nvs_set_u16(handle, NVS_BOOT_COUNT_KEY, boot_count);
+        if (error == ESP_OK)
+        {
+            error = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to store boot counter: %s", esp_err_to_name(error));
+    }
+    state_version = (uint32_t)boot_count << VERSION_BOOT_SHIFT;
+    next_version();
 }
 
-static bool get_switch_value(bool switch_on)
+/**
+ * Check that channel can change position. Timeout reverts are not limited by rate, otherwise channel could stay
+ * switched on forever.
+ */
+static esp_err_t check_wear(uint8_t channel, relay_switch_source_t source, int64_t now)
 {
-#if HIGH_ON
-    return switch_on;
-#else
-    return !switch_on;
+    if (source == RELAY_SWITCH_SOURCE_TIMEOUT)
+        return ESP_OK;
+    if (now - last_transition_us[channel] < RELAY_MIN_DWELL_MS * 1000LL
+            || !rate_limiter_refill(&transition_buckets[channel], RELAY_MAX_SWITCHES_PER_MINUTE,
+                    RELAY_MAX_SWITCHES_PER_MINUTE, now))
+    {
+        metrics_increment(METRIC_RELAY_WEAR_REJECTED);
+        return ESP_ERR_RELAY_WEAR;
+    }
+    return ESP_OK;
+}
+
+static uint32_t relay_switch_get_expire_ms(uint8_t channel, int64_t now)
+{
+    int64_t deadline = timeout_deadline_us[channel];
+    if (deadline == 0 || now >= deadline)
+    {
+        return 0;
+    }
+    return (uint32_t)((deadline - now + 999) / 1000);
+}
+
+#if HISTORY_ENABLE
+/**
+ * Record transitions of one batch to history. Commands of batch can carry different sources, every source gets its own
+ * record with the same time and on mask of each record includes transitions of the previous ones.
+ */
+static void record_history(const relay_switch_command_t* commands, size_t count, uint32_t transition_mask)
+{
+    uint32_t recorded_mask = 0;
+    uint32_t history_on_mask = on_mask ^ transition_mask;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t source_mask = 0;
+        for (size_t j = i; j < count; j++)
+        {
+            if (commands[j].source == commands[i].source)
+            {
+                source_mask |= 1UL << commands[j].channel;
+            }
+        }
+        source_mask &= transition_mask & ~recorded_mask;
+        if (source_mask == 0)
+            continue;
+        recorded_mask |= source_mask;
+        history_on_mask ^= source_mask;
+        state_history_record(source_mask, history_on_mask, commands[i].source);
+    }
+}
 #endif
+
+static void fill_state(uint8_t channel, int64_t now, relay_switch_state_t* state)
+{
+    state->channel = channel;
+    state->is_switched_on = (on_mask & (1UL << channel)) != 0;
+    state->switch_timeout_millis = relay_switch_get_expire_ms(channel, now);
+    state->last_change_utc_millis = last_change_utc_millis[channel];
+    state->last_change_source = (relay_switch_source_t)last_change_source[channel];
+    state->version = channel_version[channel];
 }
 
+/**
+ * Single task handles timeouts of all channels. It sleeps until the nearest deadline and it is woken by notification
+ * when new timeout is scheduled. Channels which expire together are reverted by one transition.
+ */
 static void relay_switch_timeout_task(void* pvParameters)
 {
-    scheduled_switch_t scheduled_switch = *((scheduled_switch_t*)pvParameters);
-    timeout_start = get_utc_now();
-    TickType_t now = xTaskGetTickCount();
-    ESP_LOGI(TAG, "Scheduling timeout to: %u ms", scheduled_switch.timeout);
-    vTaskDelayUntil(&now, scheduled_switch.timeout / portTICK_PERIOD_MS);
-    relay_switch_set_state_internal(scheduled_switch.is_switched_on, 0);
-
-    scheduled_switch.is_switched_on = false;
-    scheduled_switch.timeout = 0;
-    timeout_task = NULL;
-    vTaskDelete(NULL);
+    TickType_t wait_ticks = portMAX_DELAY;
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, wait_ticks);
+        xSemaphoreTakeRecursive(state_mutex, portMAX_DELAY);
+        relay_switch_command_t expired[RELAY_CHANNEL_COUNT];
+        size_t expired_count = 0;
+        uint32_t expired_mask = 0;
+        uint32_t dependents_mask = 0;
+        int64_t nearest_deadline = 0;
+        int64_t now = esp_timer_get_time();
+        for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+        {
+            int64_t deadline = timeout_deadline_us[channel];
+            if (deadline == 0)
+            {
+                continue;
+            }
+            if (deadline <= now)
+            {
+                expired[expired_count].channel = channel;
+                expired[expired_count].switch_on = (on_mask & (1UL << channel)) == 0;
+                expired[expired_count].timeout = 0;
+                expired[expired_count].source = RELAY_SWITCH_SOURCE_TIMEOUT;
+                expired[expired_count].if_version = 0;
+                expired_mask |= 1UL << channel;
+                if (!expired[expired_count].switch_on)
+                {
+                    dependents_mask |= relay_interlock_get_dependents(channel);
+                }
+                expired_count++;
+            }
+            else if (nearest_deadline == 0 || deadline < nearest_deadline)
+            {
+                nearest_deadline = deadline;
+            }
+        }
+        // Channels depending on expired channel are switched off together with it
+        dependents_mask &= on_mask & ~expired_mask;
+        for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT && dependents_mask != 0; channel++)
+        {
+            if ((dependents_mask & (1UL << channel)) != 0)
+            {
+                expired[expired_count].channel = channel;
+                expired[expired_count].switch_on = false;
+                expired[expired_count].timeout = 0;
+                expired[expired_count].source = RELAY_SWITCH_SOURCE_TIMEOUT;
+                expired[expired_count].if_version = 0;
+                expired_count++;
+            }
+        }
+        if (expired_count > 0)
+        {
+            DEFERRED_LOGI(TAG, "Timeout elapsed on %u channel(s)", (unsigned)expired_count);
+            if (relay_switch_set_states_internal(expired, expired_count, NULL) != ESP_OK)
+            {
+                // Revert is not allowed in current state so timeout is dropped
+                uint32_t version = next_version();
+                for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+                {
+                    if ((expired_mask & (1UL << channel)) != 0)
+                    {
+                        timeout_deadline_us[channel] = 0;
+                        channel_version[channel] = version;
+                    }
+                }
+            }
+        }
+        xSemaphoreGiveRecursive(state_mutex);
+        wait_ticks = nearest_deadline == 0 ? portMAX_DELAY : pdMS_TO_TICKS((nearest_deadline - now + 999) / 1000) + 1;
+    }
 }
 
-static uint32_t relay_switch_get_expire_ms()
+esp_err_t relay_switch_init()
 {
-    uint64_t now = get_utc_now();
-    if (scheduled_switch.timeout == 0 || now <= timeout_start)
+    uint64_t now_utc = platform_get_utc_millis();
+    int64_t now = esp_timer_get_time();
+    on_mask = 0;
+    seed_version();
+    for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
     {
-        return 0;
+        channel_version[channel] = state_version;
+        last_transition_us[channel] = now - RELAY_MIN_DWELL_MS * 1000LL;
+        rate_limiter_reset(&transition_buckets[channel], RELAY_MAX_SWITCHES_PER_MINUTE, now);
+        timeout_deadline_us[channel] = 0;
+        last_change_utc_millis[channel] = now_utc;
+        last_change_source[channel] = RELAY_SWITCH_SOURCE_STARTUP;
     }
-    uint32_t diff = (uint32_t)(now - timeout_start);
-    if (diff > scheduled_switch.timeout)
+    state_mutex = xSemaphoreCreateRecursiveMutex();
+    if (state_mutex == NULL)
     {
-        return 0;
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t error = relay_interlock_init();
+    if (error != ESP_OK)
+    {
+        return error;
+    }
+    if (xTaskCreate(relay_switch_timeout_task, "relay_timeout", 4096, NULL, TIMEOUT_TASK_PRIORITY, &timeout_task)
+            != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
     }
-    return scheduled_switch.timeout - diff;
+    return relay_driver_init();
+}
+
+esp_err_t relay_switch_set_state(const relay_switch_command_t* command)
+{
+    return relay_switch_set_states(command, 1);
+}
+
+esp_err_t relay_switch_set_states(const relay_switch_command_t* commands, size_t count)
+{
+    return relay_switch_set_states_traced(commands, count, NULL);
+}
+
+esp_err_t relay_switch_set_states_traced(const relay_switch_command_t* commands, size_t count,
+        relay_switch_trace_t* trace)
+{
+    xSemaphoreTakeRecursive(state_mutex, portMAX_DELAY);
+    esp_err_t error = relay_switch_set_states_internal(commands, count, trace);
+    xSemaphoreGiveRecursive(state_mutex);
+    return error;
 }
 
-esp_err_t relay_switch_set_state(bool switch_on, uint32_t timeout)
+esp_err_t relay_switch_get_trace(uint32_t version, relay_switch_trace_t* trace)
 {
-    if (timeout_task != NULL)
+    esp_err_t error = ESP_ERR_NOT_FOUND;
+    xSemaphoreTakeRecursive(state_mutex, portMAX_DELAY);
+    if (version != 0 && last_trace.version == version)
     {
-        scheduled_switch.is_switched_on = false;
-        scheduled_switch.timeout = 0;
-        vTaskDelete(timeout_task);
+        *trace = last_trace;
+        error = ESP_OK;
     }
-	return relay_switch_set_state_internal(switch_on, timeout);
+    xSemaphoreGiveRecursive(state_mutex);
+    return error;
 }
 
-esp_err_t relay_switch_set_state_internal(bool switch_on, uint32_t timeout)
+/**
+ * Apply switching requests. State mutex must be held by caller.
+ */
+static esp_err_t relay_switch_set_states_internal(const relay_switch_command_t* requested_commands, size_t count,
+        relay_switch_trace_t* trace)
 {
-    ESP_LOGI(TAG, "Set new state: %s", switch_on ? "true" : "false");
-    esp_err_t error = gpio_set_level(RELAY_GPIO_NUM, (uint32_t)get_switch_value(switch_on));
+    uint32_t channel_mask = 0;
+    uint32_t new_on_mask = on_mask;
+    bool timeout_scheduled = false;
+    int64_t now = esp_timer_get_time();
+    if (count > RELAY_CHANNEL_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    relay_switch_command_t commands[RELAY_CHANNEL_COUNT];
+    memcpy(commands, requested_commands, count * sizeof(relay_switch_command_t));
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t channel = commands[i].channel;
+        uint32_t channel_bit = channel < RELAY_CHANNEL_COUNT ? 1UL << channel : 0;
+        if (channel_bit == 0 || (channel_mask & channel_bit) != 0)
+        {
+            ESP_LOGW(TAG, "Invalid channel in request: %u", channel);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (commands[i].if_version != 0 && commands[i].if_version != channel_version[channel])
+        {
+            DEFERRED_LOGW(TAG, "Version of channel %u is %u, required %u", channel, (unsigned)channel_version[channel],
+                    (unsigned)commands[i].if_version);
+            return ESP_ERR_RELAY_VERSION;
+        }
+        channel_mask |= channel_bit;
+        if (commands[i].switch_on)
+        {
+            new_on_mask |= channel_bit;
+        }
+        else
+        {
+            new_on_mask &= ~channel_bit;
+        }
+        DEFERRED_LOGI(TAG, "Set new state of channel %u: %s (%s)", channel, commands[i].switch_on ? "true" : "false",
+                relay_switch_source_to_name(commands[i].source));
+    }
+    if (channel_mask == 0)
+    {
+        return ESP_OK;
+    }
+    uint32_t transition_mask = new_on_mask ^ on_mask;
+    for (size_t i = 0; i < count; i++)
+    {
+        esp_err_t error = ESP_OK;
+        if ((transition_mask & (1UL << commands[i].channel)) != 0)
+        {
+            error = check_wear(commands[i].channel, commands[i].source, now);
+        }
+        if (error == ESP_OK)
+        {
+            error = relay_interlock_check(on_mask, new_on_mask, &commands[i]);
+        }
+        if (error != ESP_OK)
+        {
+            return error;
+        }
+    }
+
+    esp_err_t error = relay_driver_set(channel_mask, new_on_mask);
     if (error != ESP_OK)
     {
-        ESP_LOGE(TAG, "gpio_set_level failed: %d", error);
+        ESP_LOGE(TAG, "relay_driver_set failed: %d", error);
         return error;
     }
-    current_state.is_switched_on = switch_on;
-    current_state.last_change_utc_millis = platform_get_utc_millis();
-    current_state.switch_timeout_millis = timeout;
-    if (timeout > 0)
+    int64_t actuated_us = esp_timer_get_time();
+    on_mask = new_on_mask;
+    uint64_t now_utc = platform_get_utc_millis();
+    uint32_t version = next_version();
+    if (trace != NULL)
+    {
+        // Trace is stored before state changed callback, so the next publication echoes it
+        trace->actuated_us = actuated_us;
+        trace->version = version;
+        last_trace = *trace;
+    }
+    for (size_t i = 0; i < count; i++)
     {
-        scheduled_switch.timeout = timeout;
-        scheduled_switch.is_switched_on = !switch_on;
-        // Schedule task which changes switch position after timeout elapsed
-        xTaskCreate(relay_switch_timeout_task, "measurement_task_run", 4096, &scheduled_switch, tskIDLE_PRIORITY, &timeout_task);
+        uint8_t channel = commands[i].channel;
+        uint32_t timeout = commands[i].timeout;
+        if ((transition_mask & (1UL << channel)) != 0)
+        {
+            last_transition_us[channel] = now;
+            if (commands[i].source != RELAY_SWITCH_SOURCE_TIMEOUT)
+            {
+                rate_limiter_consume(&transition_buckets[channel]);
+            }
+#if USAGE_STATS_ENABLE
+            usage_stats_record_transition(channel, commands[i].switch_on, now);
+#endif
+        }
+        // Revert must not come earlier than minimum dwell time
+        if (timeout > 0 && timeout < RELAY_MIN_DWELL_MS)
+        {
+            timeout = RELAY_MIN_DWELL_MS;
+        }
+        channel_version[channel] = version;
+        last_change_utc_millis[channel] = now_utc;
+        last_change_source[channel] = (uint8_t)commands[i].source;
+        timeout_deadline_us[channel] = timeout > 0 ? now + (int64_t)timeout * 1000 : 0;
+        timeout_scheduled |= timeout > 0;
     }
+#if HISTORY_ENABLE
+    if (transition_mask != 0)
+    {
+        record_history(commands, count, transition_mask);
+    }
+#endif
+    if (timeout_scheduled)
+    {
+        // Wake timeout task so that it recalculates the nearest deadline
+        xTaskNotifyGive(timeout_task);
+    }
+
     if (state_changed_callback != NULL)
     {
-        state_changed_callback(&current_state, state_changed_context);
+        relay_switch_state_t states[RELAY_CHANNEL_COUNT];
+        for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+        {
+            fill_state(channel, now, &states[channel]);
+        }
+        state_changed_callback(states, RELAY_CHANNEL_COUNT, state_changed_context);
     }
     return ESP_OK;
 }
 
-relay_switch_state_t relay_switch_get_state()
+relay_switch_state_t relay_switch_get_state(uint8_t channel)
 {
-    current_state.switch_timeout_millis = relay_switch_get_expire_ms();
-	return current_state;
+    relay_switch_state_t state = { 0 };
+    if (channel >= RELAY_CHANNEL_COUNT)
+    {
+        return state;
+    }
+    xSemaphoreTakeRecursive(state_mutex, portMAX_DELAY);
+    fill_state(channel, esp_timer_get_time(), &state);
+    xSemaphoreGiveRecursive(state_mutex);
+    return state;
+}
+
+size_t relay_switch_get_states(relay_switch_state_t* states)
+{
+    uint32_t version = 0;
+    return relay_switch_get_versioned_states(states, &version);
+}
+
+size_t relay_switch_get_versioned_states(relay_switch_state_t* states, uint32_t* version)
+{
+    xSemaphoreTakeRecursive(state_mutex, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        fill_state(channel, now, &states[channel]);
+    }
+    *version = state_version;
+    xSemaphoreGiveRecursive(state_mutex);
+    return RELAY_CHANNEL_COUNT;
+}
+
+uint32_t relay_switch_get_version()
+{
+    return state_version;
+}
+
+size_t relay_switch_get_channel_count()
+{
+    return RELAY_CHANNEL_COUNT;
+}
+
+const char* relay_switch_get_channel_name(uint8_t channel)
+{
+    if (channel >= RELAY_CHANNEL_COUNT)
+    {
+        return NULL;
+    }
+    return channel_names[channel];
+}
+
+esp_err_t relay_switch_find_channel(const char* name, uint8_t* channel)
+{
+    for (uint8_t i = 0; i < RELAY_CHANNEL_COUNT; i++)
+    {
+        if (strcmp(channel_names[i], name) == 0)
+        {
+            *channel = i;
+            return ESP_OK;
+        }
+    }
+    char *end = NULL;
+    unsigned long index = strtoul(name, &end, 10);
+    if (end == name || *end != '\0' || index >= RELAY_CHANNEL_COUNT)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *channel = (uint8_t)index;
+    return ESP_OK;
+}
+
+const char* relay_switch_source_to_name(relay_switch_source_t source)
+{
+    switch (source)
+    {
+    case RELAY_SWITCH_SOURCE_STARTUP:
+        return "startup";
+    case RELAY_SWITCH_SOURCE_HTML:
+        return "html";
+    case RELAY_SWITCH_SOURCE_JSON_API:
+        return "api";
+    case RELAY_SWITCH_SOURCE_MQTT:
+        return "mqtt";
+    case RELAY_SWITCH_SOURCE_LOCAL:
+        return "local";
+    case RELAY_SWITCH_SOURCE_TIMEOUT:
+        return "timeout";
+    case RELAY_SWITCH_SOURCE_RULE:
+        return "rule";
+    case RELAY_SWITCH_SOURCE_COAP:
+        return "coap";
+    case RELAY_SWITCH_SOURCE_GROUP:
+        return "group";
+    default:
+        return "unknown";
+    }
+}
+
+const char* relay_switch_err_to_name(esp_err_t error)
+{
+    switch (error)
+    {
+    case ESP_ERR_RELAY_INTERLOCK:
+        return "ESP_ERR_RELAY_INTERLOCK";
+    case ESP_ERR_RELAY_DEPENDENCY:
+        return "ESP_ERR_RELAY_DEPENDENCY";
+    case ESP_ERR_RELAY_VERSION:
+        return "ESP_ERR_RELAY_VERSION";
+    case ESP_ERR_RELAY_RATE_LIMIT:
+        return "ESP_ERR_RELAY_RATE_LIMIT";
+    case ESP_ERR_RELAY_WEAR:
+        return "ESP_ERR_RELAY_WEAR";
+    default:
+        return esp_err_to_name(error);
+    }
 }
 
 void relay_switch_set_state_changed_cb(state_changed_cb_t callback, void* context)
 {
-	state_changed_callback = callback;
-	state_changed_context = context;
+    state_changed_callback = callback;
+    state_changed_context = context;
 }
@@ -36,49 +36,226 @@
 #define MAIN_RELAY_SWITCH_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <inttypes.h>
 
 #include <esp_err.h>
 
+#include "user_config.h"
+
+/** Base of relay switch error codes. */
+#define ESP_ERR_RELAY_SWITCH_BASE 0x70000
+/** Channel is mutually exclusive with channel which is switched on. */
+#define ESP_ERR_RELAY_INTERLOCK (ESP_ERR_RELAY_SWITCH_BASE + 1)
+/** Channel depends on channel which is not switched on or it is required by channel which stays switched on. */
+#define ESP_ERR_RELAY_DEPENDENCY (ESP_ERR_RELAY_SWITCH_BASE + 2)
+/** Channel state version does not match version required by switching request. */
+#define ESP_ERR_RELAY_VERSION (ESP_ERR_RELAY_SWITCH_BASE + 3)
+/** Request source or client exceeded allowed request rate. */
+#define ESP_ERR_RELAY_RATE_LIMIT (ESP_ERR_RELAY_SWITCH_BASE + 4)
+/** Channel changed position too recently or too often, relay is protected from wear. */
+#define ESP_ERR_RELAY_WEAR (ESP_ERR_RELAY_SWITCH_BASE + 5)
+
+/**
+ * Origin of switch position change.
+ */
+typedef enum relay_switch_source
+{
+    /** Initial position after device startup. */
+    RELAY_SWITCH_SOURCE_STARTUP = 0,
+    /** Request from HTML web interface. */
+    RELAY_SWITCH_SOURCE_HTML,
+    /** Request from HTTP API. */
+    RELAY_SWITCH_SOURCE_JSON_API,
+    /** Request from MQTT. */
+    RELAY_SWITCH_SOURCE_MQTT,
+    /** Local physical input. */
+    RELAY_SWITCH_SOURCE_LOCAL,
+    /** Elapsed switch timeout. */
+    RELAY_SWITCH_SOURCE_TIMEOUT,
+    /** Local automation rule. */
+    RELAY_SWITCH_SOURCE_RULE,
+    /** Request from CoAP. */
+    RELAY_SWITCH_SOURCE_COAP,
+    /** Multicast group request. */
+    RELAY_SWITCH_SOURCE_GROUP
+} relay_switch_source_t;
+
 /**
- * Switch state data.
+ * Switch state data of single relay channel.
  */
 typedef struct relay_switch_state
 {
-	/** Determines if switch switched on or off. When it is true then it is switched on. */
-	bool is_switched_on;
-	/** Switch timeout in milliseconds. After this timeout switch position will be reverted. When 0 then switch state is permanent. */
-	uint32_t switch_timeout_millis;
-	/** UTC timestamp in milliseconds of last switch position change. It is set to startup time after device startup. */
-	uint64_t last_change_utc_millis;
+    /** Index of relay channel. */
+    uint8_t channel;
+    /** Determines if switch switched on or off. When it is true then it is switched on. */
+    bool is_switched_on;
+    /** Switch timeout in milliseconds. After this timeout switch position will be reverted. When 0 then switch state is permanent. */
+    uint32_t switch_timeout_millis;
+    /** UTC timestamp in milliseconds of last switch position change. It is set to startup time after device startup. */
+    uint64_t last_change_utc_millis;
+    /** Origin of last switch position change. */
+    relay_switch_source_t last_change_source;
+    /** Version of channel state. It is increased by every change of the channel and it is not reused after restart. */
+    uint32_t version;
 } relay_switch_state_t;
 
+/**
+ * Switching request for single relay channel.
+ */
+typedef struct relay_switch_command
+{
+    /** Index of relay channel. */
+    uint8_t channel;
+    /** New switch value. Set to true to switch on. */
+    bool switch_on;
+    /** Switch timeout in milliseconds. After this timeout switch position will be reverted. When 0 then switch state is permanent. */
+    uint32_t timeout;
+    /** Origin of switching request. */
+    relay_switch_source_t source;
+    /** Required version of channel state. Request is rejected when channel has another version. When 0 then version is not checked. */
+    uint32_t if_version;
+} relay_switch_command_t;
+
+/**
+ * Latency trace of switching request. Timestamps are monotonic microseconds since boot.
+ */
+typedef struct relay_switch_trace
+{
+    /** Trace ID sent by client. */
+    char id[TRACE_ID_MAX_LENGTH];
+    /** Client timestamp sent with request in milliseconds, 0 if it was not sent. */
+    uint64_t client_millis;
+    /** Time when request was received by adapter. */
+    int64_t received_us;
+    /** Time when request was deserialized. */
+    int64_t parsed_us;
+    /** Time when relay outputs were written. It is set by relay switch. */
+    int64_t actuated_us;
+    /** State version created by traced transition. It is set by relay switch. */
+    uint32_t version;
+} relay_switch_trace_t;
+
 /**
  * Declaration of function for notifying about switch state changes.
- * @param[in]  relay_switch_state Current switch state.
+ * @param[in]  relay_switch_states States of all relay channels.
+ * @param[in]  count Number of relay channels.
  * @param[in]  context Context of callback.
  */
-typedef void (*state_changed_cb_t)(const relay_switch_state_t* relay_switch_state, void* context);
+typedef void (*state_changed_cb_t)(const relay_switch_state_t* relay_switch_states, size_t count, void* context);
 
 /**
- * Initialize relay switch. Pin for relay signaling is configured as output. Switch is switched off by default.
+ * Initialize relay switch. Pins for relay signaling are configured as outputs. All channels are switched off by default.
+ * State versions are seeded from boot counter stored in NVS, so NVS must be initialized.
  * @return Return ESP_OK if succeeded.
  */
 esp_err_t relay_switch_init(void);
 
 /**
- * Change relay switch position.
- * @param[in]  switch_on New switch value. Set to true to switch on.
- * @param[in] Switch timeout in milliseconds. After this timeout switch position will be reverted. When 0 then switch state is permanent.
+ * Change position of single relay channel.
+ * @param[in] command A pointer to switching request.
  * @return Return ESP_OK if succeeded.
  */
-esp_err_t relay_switch_set_state(bool switch_on, uint32_t timeout);
+esp_err_t relay_switch_set_state(const relay_switch_command_t* command);
+
+/**
+ * Change positions of several relay channels at once. All channels are switched in the same moment and state changed
+ * callback is called only once.
+ * Requests are validated against required versions and interlock rules and whole batch is rejected when any of them
+ * is not allowed. Position changes are limited by minimum dwell time and maximum switching rate of each channel, timeout
+ * reverts are delayed until dwell time elapses.
+ * @param[in] commands Array of switching requests. Each channel can be present only once.
+ * @param[in] count Number of switching requests.
+ * @return Return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if channel is not valid, ESP_ERR_RELAY_VERSION if channel
+ * version does not match, ESP_ERR_RELAY_WEAR if channel would switch too often or ESP_ERR_RELAY_INTERLOCK and
+ * ESP_ERR_RELAY_DEPENDENCY if interlock rules are violated.
+ */
+esp_err_t relay_switch_set_states(const relay_switch_command_t* commands, size_t count);
+
+/**
+ * Change positions of several relay channels at once and record latency trace of the request. Trace is completed
+ * before state changed callback is called, so it can be echoed in state notification. It is the same as
+ * relay_switch_set_states otherwise.
+ * @param[in] commands Array of switching requests. Each channel can be present only once.
+ * @param[in] count Number of switching requests.
+ * @param[in,out] trace A pointer to trace with client fields and receive and parse times set, actuation time and state
+ * version are set when request succeeds. When NULL then request is not traced.
+ * @return Return the same errors as relay_switch_set_states.
+ */
+esp_err_t relay_switch_set_states_traced(const relay_switch_command_t* commands, size_t count,
+        relay_switch_trace_t* trace);
+
+/**
+ * Get latency trace of transition which created state version.
+ * @param[in] version State version.
+ * @param[out] trace A pointer to trace to be set.
+ * @return Return ESP_OK if succeeded or ESP_ERR_NOT_FOUND if the version was not created by traced request.
+ */
+esp_err_t relay_switch_get_trace(uint32_t version, relay_switch_trace_t* trace);
 
 /**
- * Get current switch state.
+ * Get current state of relay channel.
+ * @param[in] channel Index of relay channel.
  * @return Return current switch state.
  */
-relay_switch_state_t relay_switch_get_state(void);
+relay_switch_state_t relay_switch_get_state(uint8_t channel);
+
+/**
+ * Get current states of all relay channels.
+ * @param[out] states Array for states to be set. It must have space for relay_switch_get_channel_count() items.
+ * @return Return number of relay channels.
+ */
+size_t relay_switch_get_states(relay_switch_state_t* states);
+
+/**
+ * Get current states of all relay channels together with state version.
+ * @param[out] states Array for states to be set. It must have space for relay_switch_get_channel_count() items.
+ * @param[out] version A pointer to version of returned states.
+ * @return Return number of relay channels.
+ */
+size_t relay_switch_get_versioned_states(relay_switch_state_t* states, uint32_t* version);
+
+/**
+ * Get state version. Version is changed by every transition and by dropped timeout, so equal versions mean equal
+ * positions, sources and timeout deadlines of all channels.
+ * @return Return current state version.
+ */
+uint32_t relay_switch_get_version(void);
+
+/**
+ * Get number of relay channels.
+ * @return Return number of relay channels.
+ */
+size_t relay_switch_get_channel_count(void);
+
+/**
+ * Get name of relay channel.
+ * @param[in] channel Index of relay channel.
+ * @return Return channel name or NULL if channel is not valid.
+ */
+const char* relay_switch_get_channel_name(uint8_t channel);
+
+/**
+ * Find relay channel by name or by decimal index.
+ * @param[in] name Channel name or index string.
+ * @param[out] channel A pointer to channel index to be set.
+ * @return Return ESP_OK if succeeded or ESP_ERR_NOT_FOUND if there is no such channel.
+ */
+esp_err_t relay_switch_find_channel(const char* name, uint8_t* channel);
+
+/**
+ * Get name of switching request origin.
+ * @param[in] source Origin of switching request.
+ * @return Return source name.
+ */
+const char* relay_switch_source_to_name(relay_switch_source_t source);
+
+/**
+ * Get name of error code including relay switch specific errors.
+ * @param[in] error Error code.
+ * @return Return error name.
+ */
+const char* relay_switch_err_to_name(esp_err_t error);
 
 /**
  * Set callback fuction which will be called when switch state is changed.
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of RMS kernel. Squares of 12-bit samples fit 32-bit multiplication, only block sums use 64-bit
+ * arithmetic and square root is computed once per block.
+ */
+
+#include "rms_kernel.h"
+
+static uint32_t isqrt64(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = 1ULL << 62;
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+    while (bit != 0)
+    {
+        if (value >= result + bit)
+        {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        }
+        else
+        {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)result;
+}
+
+void rms_kernel_accumulate(rms_accumulator_t *accumulators, size_t accumulator_count, const uint16_t *words,
+        size_t word_count)
+{
+    for (size_t i = 0; i < word_count; i++)
+    {
+        uint32_t channel = words[i] >> RMS_KERNEL_CHANNEL_SHIFT;
+        if (channel >= accumulator_count)
+        {
+            continue;
+        }
+        uint32_t value = words[i] & RMS_KERNEL_DATA_MASK;
+        rms_accumulator_t *accumulator = &accumulators[channel];
+        accumulator->sum += value;
+        accumulator->sum_squares += value * value;
+        accumulator->count++;
+    }
+}
+
+uint32_t rms_kernel_compute(const rms_accumulator_t *accumulator)
+{
+    uint64_t count = accumulator->count;
+    if (count == 0)
+    {
+        return 0;
+    }
+    // n * sum(x^2) - sum(x)^2 equals n^2 * variance and it does not overflow for blocks up to 2^20 samples
+    uint64_t spread = count * accumulator->sum_squares - accumulator->sum * accumulator->sum;
+    uint64_t variance_micro = spread / count * 1000000 / count;
+    return isqrt64(variance_micro);
+}
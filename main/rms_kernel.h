@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains block-wise RMS kernel for ADC samples. Kernel uses only integer arithmetic and has no SDK
+ * dependencies, so it can be compiled and verified on host with synthetic waveforms.
+ */
+
+#ifndef MAIN_RMS_KERNEL_H_
+#define MAIN_RMS_KERNEL_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/** Bit position of ADC channel in sample word. */
+#define RMS_KERNEL_CHANNEL_SHIFT 12
+/** Mask of conversion result in sample word. */
+#define RMS_KERNEL_DATA_MASK 0x0FFF
+
+/**
+ * Sums of samples of single ADC channel over block.
+ */
+typedef struct rms_accumulator
+{
+    uint64_t sum;
+    uint64_t sum_squares;
+    uint32_t count;
+} rms_accumulator_t;
+
+/**
+ * Add samples to accumulators. Sample words contain ADC channel in upper 4 bits and 12-bit conversion result in lower
+ * bits, which is ESP32 DMA output format. Samples of channels without accumulator are skipped.
+ * @param[in,out] accumulators Array of accumulators indexed by ADC channel.
+ * @param[in] accumulator_count Number of accumulators.
+ * @param[in] words Array of sample words.
+ * @param[in] word_count Number of sample words.
+ */
+void rms_kernel_accumulate(rms_accumulator_t *accumulators, size_t accumulator_count, const uint16_t *words,
+        size_t word_count);
+
+/**
+ * Compute RMS of AC component of accumulated samples. DC offset of sensor is removed by subtracting block mean.
+ * @param[in] accumulator A pointer to accumulator with samples of whole block.
+ * @return Return RMS in thousandths of ADC count or 0 if accumulator is empty.
+ */
+uint32_t rms_kernel_compute(const rms_accumulator_t *accumulator);
+
+#endif /* MAIN_RMS_KERNEL_H_ */
@@ -0,0 +1,269 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of local automation rules. Rules JSON is kept in NVS as it was received, compiled table lives
+ * in RAM. Actions are passed to relay switch, so they are validated by interlock rules like any other request.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "rule_engine.h"
+#include "json_serializer.h"
+#include "buffer_pool.h"
+#include "platform_time.h"
+
+#define TAG "rule_engine"
+#define NVS_NAMESPACE "relay_switch"
+#define NVS_RULES_KEY "rules"
+#define EMPTY_RULES "[]"
+#define MINUTES_PER_DAY 1440
+
+static rule_table_t active_rules;
+static int64_t cooldown_end_us[RULE_MAX_COUNT];
+static SemaphoreHandle_t rules_mutex = NULL;
+
+static esp_err_t load_rules(char **rules_json)
+{
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (error != ESP_OK)
+        return error;
+    size_t length = 0;
+    error = nvs_get_str(handle, NVS_RULES_KEY, NULL, &length);
+    if (error == ESP_OK)
+    {
+        *rules_json = buffer_pool_alloc(length);
+        if (*rules_json == NULL)
+        {
+            error = ESP_ERR_NO_MEM;
+        }
+        else
+        {
+            error = nvs_get_str(handle, NVS_RULES_KEY, *rules_json, &length);
+        }
+    }
+    nvs_close(handle);
+    return error;
+}
+
+static esp_err_t store_rules(const char *rules_json)
+{
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (error != ESP_OK)
+        return error;
+    error = nvs_set_str(handle, NVS_RULES_KEY, rules_json);
+    if (error == ESP_OK)
+    {
+        error = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return error;
+}
+
+static void activate_rules(const rule_table_t *rules)
+{
+    xSemaphoreTake(rules_mutex, portMAX_DELAY);
+    active_rules = *rules;
+    memset(cooldown_end_us, 0, sizeof(cooldown_end_us));
+    xSemaphoreGive(rules_mutex);
+}
+
+static int32_t get_aggregate(const sensor_aggregate_t *aggregate, uint8_t type)
+{
+    switch (type)
+    {
+    case RULE_AGGREGATE_MIN:
+        return aggregate->min;
+    case RULE_AGGREGATE_MAX:
+        return aggregate->max;
+    case RULE_AGGREGATE_MEAN:
+        return aggregate->mean;
+    default:
+        return aggregate->last;
+    }
+}
+
+static bool is_condition_met(const rule_condition_t *condition, const sensor_aggregates_t *aggregates,
+        uint32_t on_mask, int32_t minute_of_day)
+{
+    switch (condition->type)
+    {
+    case RULE_CONDITION_SENSOR_BELOW:
+        return get_aggregate(&aggregates->quantities[condition->operand], condition->aggregate) < condition->value;
+    case RULE_CONDITION_SENSOR_ABOVE:
+        return get_aggregate(&aggregates->quantities[condition->operand], condition->aggregate) > condition->value;
+    case RULE_CONDITION_TIME_WINDOW:
+        if (minute_of_day < 0)
+        {
+            return false;
+        }
+        if (condition->value <= condition->end_value)
+        {
+            return minute_of_day >= condition->value && minute_of_day < condition->end_value;
+        }
+        return minute_of_day >= condition->value || minute_of_day < condition->end_value;
+    case RULE_CONDITION_RELAY_ON:
+        return (on_mask & (1UL << condition->operand)) != 0;
+    case RULE_CONDITION_RELAY_OFF:
+        return (on_mask & (1UL << condition->operand)) == 0;
+    default:
+        return false;
+    }
+}
+
+static int32_t get_minute_of_day(void)
+{
+    // Seeded time can lag by the whole power off duration, time windows would fire at wrong time of day
+    if (platform_get_time_quality() < TIME_QUALITY_HOLDOVER)
+    {
+        return -1;
+    }
+    return (int32_t)((platform_get_utc_millis() / 60000) % MINUTES_PER_DAY);
+}
+
+esp_err_t rule_engine_init()
+{
+    memset(&active_rules, 0, sizeof(active_rules));
+    rules_mutex = xSemaphoreCreateMutex();
+    if (rules_mutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    char *rules_json = NULL;
+    esp_err_t error = load_rules(&rules_json);
+    if (error != ESP_OK)
+    {
+        ESP_LOGI(TAG, "No rules stored.");
+        return ESP_OK;
+    }
+    rule_table_t rules;
+    memset(&rules, 0, sizeof(rules));
+    error = json_serializer_deserialize_rules(rules_json, &rules);
+    buffer_pool_free(rules_json);
+    if (error != ESP_OK)
+    {
+        // Broken rules are not executed, they can be fixed by API
+        ESP_LOGE(TAG, "Stored rules are invalid: %s", esp_err_to_name(error));
+        return ESP_OK;
+    }
+    activate_rules(&rules);
+    ESP_LOGI(TAG, "Loaded %d rules.", rules.count);
+    return ESP_OK;
+}
+
+void rule_engine_evaluate(const sensor_aggregates_t *aggregates)
+{
+    relay_switch_state_t states[RELAY_CHANNEL_COUNT];
+    size_t count = relay_switch_get_states(states);
+    uint32_t on_mask = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        on_mask |= states[i].is_switched_on ? 1UL << states[i].channel : 0;
+    }
+    int32_t minute_of_day = get_minute_of_day();
+    int64_t now = esp_timer_get_time();
+
+    relay_switch_command_t actions[RULE_MAX_COUNT];
+    size_t action_count = 0;
+    xSemaphoreTake(rules_mutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < active_rules.count; i++)
+    {
+        const rule_t *rule = &active_rules.rules[i];
+        bool target_reached = ((on_mask & (1UL << rule->action.channel)) != 0) == rule->action.switch_on;
+        if (target_reached || now < cooldown_end_us[i])
+        {
+            continue;
+        }
+        bool is_met = true;
+        for (uint8_t c = 0; c < rule->condition_count && is_met; c++)
+        {
+            is_met = is_condition_met(&rule->conditions[c], aggregates, on_mask, minute_of_day);
+        }
+        if (is_met)
+        {
+            // Cooldown starts even if the action is rejected, so rejected rule does not retry on every sample
+            cooldown_end_us[i] = now + (int64_t)rule->cooldown_millis * 1000;
+            actions[action_count++] = rule->action;
+            ESP_LOGI(TAG, "Rule %d matched.", i);
+        }
+    }
+    xSemaphoreGive(rules_mutex);
+
+    for (size_t i = 0; i < action_count; i++)
+    {
+        esp_err_t error = relay_switch_set_state(&actions[i]);
+        if (error != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Rule action rejected: %s", relay_switch_err_to_name(error));
+        }
+    }
+}
+
+esp_err_t rule_engine_set_rules(const char *rules_json)
+{
+    rule_table_t rules;
+    memset(&rules, 0, sizeof(rules));
+    esp_err_t error = json_serializer_deserialize_rules(rules_json, &rules);
+    if (error != ESP_OK)
+    {
+        return error;
+    }
+    error = store_rules(rules_json);
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to store rules: %s", esp_err_to_name(error));
+        return error;
+    }
+    activate_rules(&rules);
+    ESP_LOGI(TAG, "Rules updated.");
+    return ESP_OK;
+}
+
+esp_err_t rule_engine_get_rules(char **rules_json)
+{
+    esp_err_t error = load_rules(rules_json);
+    if (error == ESP_ERR_NVS_NOT_FOUND)
+    {
+        *rules_json = buffer_pool_alloc(sizeof(EMPTY_RULES));
+        if (*rules_json == NULL)
+            return ESP_ERR_NO_MEM;
+        strcpy(*rules_json, EMPTY_RULES);
+        error = ESP_OK;
+    }
+    return error;
+}
@@ -0,0 +1,138 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for local automation rules. Rules are stored in NVS in declarative JSON form and
+ * compiled to flat table of conditions, so evaluation of every sensor sample is bounded by RULE_MAX_COUNT *
+ * RULE_MAX_CONDITIONS comparisons.
+ */
+
+#ifndef MAIN_RULE_ENGINE_H_
+#define MAIN_RULE_ENGINE_H_
+
+#include <inttypes.h>
+
+#include <esp_err.h>
+
+#include "relay_switch.h"
+#include "sensor_sampler.h"
+#include "user_config.h"
+
+/**
+ * Type of rule condition.
+ */
+typedef enum rule_condition_type
+{
+    /** Sensor aggregate is lower than threshold. */
+    RULE_CONDITION_SENSOR_BELOW = 0,
+    /** Sensor aggregate is higher than threshold. */
+    RULE_CONDITION_SENSOR_ABOVE,
+    /** UTC time of day is within window. */
+    RULE_CONDITION_TIME_WINDOW,
+    /** Relay channel is switched on. */
+    RULE_CONDITION_RELAY_ON,
+    /** Relay channel is switched off. */
+    RULE_CONDITION_RELAY_OFF
+} rule_condition_type_t;
+
+/**
+ * Sensor aggregate compared by condition.
+ */
+typedef enum rule_aggregate
+{
+    RULE_AGGREGATE_LAST = 0,
+    RULE_AGGREGATE_MIN,
+    RULE_AGGREGATE_MAX,
+    RULE_AGGREGATE_MEAN
+} rule_aggregate_t;
+
+/**
+ * Compiled rule condition.
+ */
+typedef struct rule_condition
+{
+    uint8_t type;
+    /** Sensor quantity for sensor conditions or relay channel for relay conditions. */
+    uint8_t operand;
+    /** Compared aggregate for sensor conditions. */
+    uint8_t aggregate;
+    /** Threshold in tenths of quantity unit or start minute of time window. */
+    int32_t value;
+    /** End minute of time window. Window crosses midnight when it is lower than start minute. */
+    int32_t end_value;
+} rule_condition_t;
+
+/**
+ * Compiled rule. Action is executed when all conditions are met and cooldown elapsed.
+ */
+typedef struct rule
+{
+    rule_condition_t conditions[RULE_MAX_CONDITIONS];
+    uint8_t condition_count;
+    relay_switch_command_t action;
+    uint32_t cooldown_millis;
+} rule_t;
+
+/**
+ * Table of compiled rules.
+ */
+typedef struct rule_table
+{
+    rule_t rules[RULE_MAX_COUNT];
+    uint8_t count;
+} rule_table_t;
+
+/**
+ * Initialize rule engine. Rules stored in NVS are loaded and compiled.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t rule_engine_init(void);
+
+/**
+ * Evaluate all rules against new sensor sample and execute actions of matching rules.
+ * @param[in] aggregates A pointer to current sensor aggregates.
+ */
+void rule_engine_evaluate(const sensor_aggregates_t *aggregates);
+
+/**
+ * Compile, activate and store rules. Cooldowns of all rules are reset.
+ * @param[in] rules_json String with rules in JSON format.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t rule_engine_set_rules(const char *rules_json);
+
+/**
+ * Get stored rules. Output string must be freed by buffer_pool_free when it is not needed anymore.
+ * @param[out] rules_json A pointer to string variable for setting rules in JSON format.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t rule_engine_get_rules(char **rules_json);
+
+#endif /* MAIN_RULE_ENGINE_H_ */
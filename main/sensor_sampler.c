@@ -0,0 +1,263 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of sensor sampling. Each quantity has ring buffer with running sum for mean and monotonic
+ * deques for minimum and maximum, so every sample updates aggregates in amortized constant time.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+
+#include "sensor_sampler.h"
+#include "dht_sensor.h"
+#include "platform_time.h"
+#include "user_config.h"
+
+#define TAG "sensor_sampler"
+#define SENSOR_TASK_PRIORITY (tskIDLE_PRIORITY + 2)
+#define SAMPLES_PER_PUBLISH ((SENSOR_PUBLISH_PERIOD_MS + SENSOR_SAMPLE_PERIOD_MS - 1) / SENSOR_SAMPLE_PERIOD_MS)
+
+_Static_assert(SENSOR_WINDOW_SAMPLES > 0 && SENSOR_WINDOW_SAMPLES <= UINT16_MAX,
+        "SENSOR_WINDOW_SAMPLES must be in range 1-65535");
+
+/**
+ * Monotonic deque of sample sequence numbers. Values of referenced samples are monotonic from front to back, so the
+ * front is extreme of the window.
+ */
+typedef struct sample_deque
+{
+    uint32_t sequences[SENSOR_WINDOW_SAMPLES];
+    uint16_t head;
+    uint16_t length;
+} sample_deque_t;
+
+typedef struct sliding_window
+{
+    int32_t values[SENSOR_WINDOW_SAMPLES];
+    int64_t sum;
+    sample_deque_t min_deque;
+    sample_deque_t max_deque;
+} sliding_window_t;
+
+static const char* quantity_names[SENSOR_QUANTITY_COUNT] = { "temperature", "humidity" };
+
+static sliding_window_t windows[SENSOR_QUANTITY_COUNT];
+static uint32_t next_sequence = 0;
+static uint16_t sample_count = 0;
+static uint32_t error_count = 0;
+static uint64_t last_sample_utc_millis = 0;
+static SemaphoreHandle_t sampler_mutex = NULL;
+static sensor_aggregates_cb_t sensor_aggregates_cb = NULL;
+static void* sensor_aggregates_context = NULL;
+static sensor_aggregates_cb_t sensor_sample_cb = NULL;
+static void* sensor_sample_context = NULL;
+
+static uint32_t deque_get(const sample_deque_t *deque, uint16_t position)
+{
+    return deque->sequences[(deque->head + position) % SENSOR_WINDOW_SAMPLES];
+}
+
+static void deque_expire(sample_deque_t *deque, uint32_t oldest_sequence)
+{
+    // Sequence numbers can wrap around, so only difference is compared
+    while (deque->length > 0 && (int32_t)(deque_get(deque, 0) - oldest_sequence) < 0)
+    {
+        deque->head = (deque->head + 1) % SENSOR_WINDOW_SAMPLES;
+        deque->length--;
+    }
+}
+
+static void deque_push(sample_deque_t *deque, const int32_t *values, uint32_t sequence, bool is_min)
+{
+    int32_t value = values[sequence % SENSOR_WINDOW_SAMPLES];
+    while (deque->length > 0)
+    {
+        int32_t back = values[deque_get(deque, deque->length - 1) % SENSOR_WINDOW_SAMPLES];
+        if (is_min ? back < value : back > value)
+        {
+            break;
+        }
+        deque->length--;
+    }
+    deque->sequences[(deque->head + deque->length) % SENSOR_WINDOW_SAMPLES] = sequence;
+    deque->length++;
+}
+
+static void window_push(sliding_window_t *window, uint32_t sequence, int32_t value)
+{
+    uint16_t index = sequence % SENSOR_WINDOW_SAMPLES;
+    if (sample_count == SENSOR_WINDOW_SAMPLES)
+    {
+        // Oldest sample is overwritten by the new one
+        window->sum -= window->values[index];
+        deque_expire(&window->min_deque, sequence - SENSOR_WINDOW_SAMPLES + 1);
+        deque_expire(&window->max_deque, sequence - SENSOR_WINDOW_SAMPLES + 1);
+    }
+    window->values[index] = value;
+    window->sum += value;
+    deque_push(&window->min_deque, window->values, sequence, true);
+    deque_push(&window->max_deque, window->values, sequence, false);
+}
+
+static void add_sample(const int32_t *values)
+{
+    xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+    for (int quantity = 0; quantity < SENSOR_QUANTITY_COUNT; quantity++)
+    {
+        window_push(&windows[quantity], next_sequence, values[quantity]);
+    }
+    if (sample_count < SENSOR_WINDOW_SAMPLES)
+    {
+        sample_count++;
+    }
+    next_sequence++;
+    last_sample_utc_millis = platform_get_utc_millis();
+    xSemaphoreGive(sampler_mutex);
+}
+
+static void get_aggregates(sensor_aggregates_t *aggregates)
+{
+    uint32_t last_sequence = next_sequence - 1;
+    aggregates->utc_millis = last_sample_utc_millis;
+    aggregates->sample_count = sample_count;
+    aggregates->error_count = error_count;
+    for (int quantity = 0; quantity < SENSOR_QUANTITY_COUNT; quantity++)
+    {
+        const sliding_window_t *window = &windows[quantity];
+        sensor_aggregate_t *aggregate = &aggregates->quantities[quantity];
+        aggregate->last = window->values[last_sequence % SENSOR_WINDOW_SAMPLES];
+        aggregate->min = window->values[deque_get(&window->min_deque, 0) % SENSOR_WINDOW_SAMPLES];
+        aggregate->max = window->values[deque_get(&window->max_deque, 0) % SENSOR_WINDOW_SAMPLES];
+        aggregate->mean = (int32_t)(window->sum / sample_count);
+    }
+}
+
+static esp_err_t read_sample(int32_t *values)
+{
+    int16_t humidity = 0;
+    int16_t temperature = 0;
+    esp_err_t error = dht_sensor_read(&humidity, &temperature);
+    if (error != ESP_OK)
+        return error;
+    values[SENSOR_QUANTITY_TEMPERATURE] = temperature;
+    values[SENSOR_QUANTITY_HUMIDITY] = humidity;
+    return ESP_OK;
+}
+
+static void sensor_sampler_task(void* pvParameters)
+{
+    uint32_t samples_to_publish = SAMPLES_PER_PUBLISH;
+    TickType_t last_wake = xTaskGetTickCount();
+    while (true)
+    {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(SENSOR_SAMPLE_PERIOD_MS));
+        int32_t values[SENSOR_QUANTITY_COUNT];
+        esp_err_t error = read_sample(values);
+        sensor_aggregates_t aggregates;
+        if (error == ESP_OK)
+        {
+            add_sample(values);
+            if (sensor_sample_cb != NULL && sensor_sampler_get_aggregates(&aggregates) == ESP_OK)
+            {
+                sensor_sample_cb(&aggregates, sensor_sample_context);
+            }
+        }
+        else
+        {
+            xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+            error_count++;
+            xSemaphoreGive(sampler_mutex);
+            ESP_LOGW(TAG, "Sensor read failed: %s", esp_err_to_name(error));
+        }
+        if (--samples_to_publish > 0)
+        {
+            continue;
+        }
+        samples_to_publish = SAMPLES_PER_PUBLISH;
+        if (sensor_aggregates_cb != NULL && sensor_sampler_get_aggregates(&aggregates) == ESP_OK)
+        {
+            sensor_aggregates_cb(&aggregates, sensor_aggregates_context);
+        }
+    }
+}
+
+esp_err_t sensor_sampler_init()
+{
+    memset(windows, 0, sizeof(windows));
+    sampler_mutex = xSemaphoreCreateMutex();
+    if (sampler_mutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t error = dht_sensor_init(DHT_GPIO_NUM);
+    if (error != ESP_OK)
+        return error;
+    if (xTaskCreate(sensor_sampler_task, "sensor_sampler", 4096, NULL, SENSOR_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Sampling every %d ms, window of %d samples", SENSOR_SAMPLE_PERIOD_MS, SENSOR_WINDOW_SAMPLES);
+    return ESP_OK;
+}
+
+esp_err_t sensor_sampler_get_aggregates(sensor_aggregates_t *aggregates)
+{
+    esp_err_t error = ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+    if (sample_count > 0)
+    {
+        get_aggregates(aggregates);
+        error = ESP_OK;
+    }
+    xSemaphoreGive(sampler_mutex);
+    return error;
+}
+
+const char* sensor_sampler_quantity_to_name(sensor_quantity_t quantity)
+{
+    return quantity < SENSOR_QUANTITY_COUNT ? quantity_names[quantity] : "unknown";
+}
+
+void sensor_sampler_set_aggregates_cb(sensor_aggregates_cb_t aggregates_cb, void* context)
+{
+    sensor_aggregates_context = context;
+    sensor_aggregates_cb = aggregates_cb;
+}
+
+void sensor_sampler_set_sample_cb(sensor_aggregates_cb_t sample_cb, void* context)
+{
+    sensor_sample_context = context;
+    sensor_sample_cb = sample_cb;
+}
@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for periodic sensor sampling. Samples are kept in sliding window and only window
+ * aggregates are published, raw samples never leave the device.
+ */
+
+#ifndef MAIN_SENSOR_SAMPLER_H_
+#define MAIN_SENSOR_SAMPLER_H_
+
+#include <inttypes.h>
+#include <esp_err.h>
+
+/**
+ * Sampled physical quantities.
+ */
+typedef enum sensor_quantity
+{
+    SENSOR_QUANTITY_TEMPERATURE = 0,
+    SENSOR_QUANTITY_HUMIDITY,
+    SENSOR_QUANTITY_COUNT
+} sensor_quantity_t;
+
+/**
+ * Aggregates of single quantity over sliding window. Values are in tenths of quantity unit.
+ */
+typedef struct sensor_aggregate
+{
+    int32_t last;
+    int32_t min;
+    int32_t max;
+    int32_t mean;
+} sensor_aggregate_t;
+
+/**
+ * Aggregates of all quantities over sliding window.
+ */
+typedef struct sensor_aggregates
+{
+    /** UTC timestamp in ms of last sample. */
+    uint64_t utc_millis;
+    /** Number of samples in the window. */
+    uint16_t sample_count;
+    /** Number of failed sensor reads since startup. */
+    uint32_t error_count;
+    sensor_aggregate_t quantities[SENSOR_QUANTITY_COUNT];
+} sensor_aggregates_t;
+
+/**
+ * Callback which is called with current aggregates.
+ */
+typedef void (*sensor_aggregates_cb_t)(const sensor_aggregates_t*, void* context);
+
+/**
+ * Initialize sensor and start sampling task.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t sensor_sampler_init(void);
+
+/**
+ * Get current aggregates.
+ * @param[out] aggregates A pointer to aggregates to be set.
+ * @return Return ESP_OK if succeeded or ESP_ERR_INVALID_STATE if no sample was taken yet.
+ */
+esp_err_t sensor_sampler_get_aggregates(sensor_aggregates_t *aggregates);
+
+/**
+ * Get quantity name used in API.
+ * @param[in] quantity Sampled quantity.
+ * @return Return quantity name.
+ */
+const char* sensor_sampler_quantity_to_name(sensor_quantity_t quantity);
+
+/**
+ * Set callback for publishing aggregates.
+ * @param[in] aggregates_cb A pointer to callback function.
+ * @param[in] context A pointer to context which is passed to callback.
+ */
+void sensor_sampler_set_aggregates_cb(sensor_aggregates_cb_t aggregates_cb, void* context);
+
+/**
+ * Set callback which is called after every valid sample. Callback runs in sampling task and it must not block.
+ * @param[in] sample_cb A pointer to callback function.
+ * @param[in] context A pointer to context which is passed to callback.
+ */
+void sensor_sampler_set_sample_cb(sensor_aggregates_cb_t sample_cb, void* context);
+
+#endif /* MAIN_SENSOR_SAMPLER_H_ */
@@ -0,0 +1,230 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of state cache. Timeout values are stored as fixed width fields padded by spaces, so remaining
+ * time can be written to copy of the cached string without changing its length. Cache lock and relay switch state
+ * lock are never held together, because state changed callback takes them in opposite order.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "state_cache.h"
+#include "buffer_pool.h"
+#include "json_serializer.h"
+#include "metrics.h"
+#include "platform_time.h"
+#include "relay_switch.h"
+#include "user_config.h"
+
+#define TAG "state_cache"
+#define TIMEOUT_KEY "\"" JSON_SERIALIZER_TIMEOUT_KEY "\":"
+#define JSON_WHITESPACE " \t\r\n"
+/** Maximum number of digits of 32-bit timeout. */
+#define TIMEOUT_WIDTH 10
+
+#if STATE_CACHE_ENABLE
+typedef struct cache_entry
+{
+    bool valid;
+    uint32_t version;
+    time_quality_t time_quality;
+    int64_t created_us;
+    size_t length;
+    size_t timeout_offsets[RELAY_CHANNEL_COUNT];
+    int64_t timeout_deadlines_us[RELAY_CHANNEL_COUNT];
+    char json[STATE_CACHE_SIZE];
+} cache_entry_t;
+
+static cache_entry_t cache;
+static SemaphoreHandle_t cache_mutex = NULL;
+static bool is_overflow_logged = false;
+
+static bool is_valid(uint32_t version, time_quality_t time_quality, int64_t now)
+{
+    if (!cache.valid || cache.version != version || cache.time_quality != time_quality)
+        return false;
+#if CURRENT_SENSOR_ENABLE
+    // Current readings change without transition
+    if (now - cache.created_us > STATE_CACHE_MAX_AGE_MS * 1000LL)
+        return false;
+#endif
+    return true;
+}
+
+/**
+ * Copy serialized string to cache and replace timeout values by fixed width fields.
+ */
+static bool store_padded(const char *serialized_string, const relay_switch_state_t *states, size_t count,
+        int64_t now)
+{
+    const char *source = serialized_string;
+    size_t length = 0;
+    size_t channel = 0;
+    const char *key = NULL;
+    while ((key = strstr(source, TIMEOUT_KEY)) != NULL)
+    {
+        // Spacing after colon depends on serializer format
+        const char *value = key + strlen(TIMEOUT_KEY);
+        value += strspn(value, JSON_WHITESPACE);
+        size_t prefix_length = value - source;
+        if (channel >= count || length + prefix_length + TIMEOUT_WIDTH >= sizeof(cache.json))
+            return false;
+        memcpy(cache.json + length, source, prefix_length);
+        length += prefix_length;
+        cache.timeout_offsets[channel] = length;
+        cache.timeout_deadlines_us[channel] = states[channel].switch_timeout_millis > 0
+                ? now + states[channel].switch_timeout_millis * 1000LL : 0;
+        memset(cache.json + length, ' ', TIMEOUT_WIDTH);
+        length += TIMEOUT_WIDTH;
+        source = value + strspn(value, "0123456789");
+        channel++;
+    }
+    size_t rest_length = strlen(source);
+    if (channel != count || length + rest_length >= sizeof(cache.json))
+        return false;
+    memcpy(cache.json + length, source, rest_length + 1);
+    cache.length = length + rest_length;
+    return true;
+}
+
+/**
+ * Copy cached string to buffer pool and write remaining timeouts. Cache lock must be held by caller.
+ */
+static esp_err_t copy_cached(char **serialized_string, size_t *length, int64_t now)
+{
+    char *copy = buffer_pool_alloc(cache.length + 1);
+    if (copy == NULL)
+        return ESP_ERR_NO_MEM;
+    memcpy(copy, cache.json, cache.length + 1);
+    for (size_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        int64_t deadline = cache.timeout_deadlines_us[channel];
+        uint32_t remaining = deadline > now ? (uint32_t)((deadline - now + 999) / 1000) : 0;
+        char field[TIMEOUT_WIDTH + 1];
+        snprintf(field, sizeof(field), "%-10u", (unsigned)remaining);
+        memcpy(copy + cache.timeout_offsets[channel], field, TIMEOUT_WIDTH);
+    }
+    *serialized_string = copy;
+    *length = cache.length;
+    return ESP_OK;
+}
+
+#endif
+
+esp_err_t state_cache_init()
+{
+#if STATE_CACHE_ENABLE
+    cache_mutex = xSemaphoreCreateMutex();
+    return cache_mutex != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+#else
+    return ESP_OK;
+#endif
+}
+
+void state_cache_invalidate()
+{
+#if STATE_CACHE_ENABLE
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    cache.valid = false;
+    xSemaphoreGive(cache_mutex);
+#endif
+}
+
+esp_err_t state_cache_get(char **serialized_string, size_t *length)
+{
+#if !STATE_CACHE_ENABLE
+    relay_switch_state_t states[RELAY_CHANNEL_COUNT];
+    relay_switch_trace_t trace;
+    uint32_t version = 0;
+    size_t count = relay_switch_get_versioned_states(states, &version);
+    bool is_traced = relay_switch_get_trace(version, &trace) == ESP_OK;
+    return json_serializer_serialize(states, count, is_traced ? &trace : NULL, serialized_string, length);
+#else
+    uint32_t version = relay_switch_get_version();
+    time_quality_t time_quality = platform_get_time_quality();
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    if (is_valid(version, time_quality, now))
+    {
+        esp_err_t error = copy_cached(serialized_string, length, now);
+        xSemaphoreGive(cache_mutex);
+        metrics_increment(METRIC_STATE_CACHE_HITS);
+        return error;
+    }
+    xSemaphoreGive(cache_mutex);
+
+    // Cache is rebuilt without holding its lock
+    metrics_increment(METRIC_STATE_CACHE_MISSES);
+    relay_switch_state_t states[RELAY_CHANNEL_COUNT];
+    size_t count = relay_switch_get_versioned_states(states, &version);
+    // Trace belongs to the version, so it is cached together with the state
+    relay_switch_trace_t trace;
+    bool is_traced = relay_switch_get_trace(version, &trace) == ESP_OK;
+    now = esp_timer_get_time();
+    char *serialized = NULL;
+    size_t serialized_length = 0;
+    esp_err_t error = json_serializer_serialize(states, count, is_traced ? &trace : NULL, &serialized,
+            &serialized_length);
+    if (error != ESP_OK)
+        return error;
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    if (!store_padded(serialized, states, count, now))
+    {
+        cache.valid = false;
+        bool is_logged = is_overflow_logged;
+        is_overflow_logged = true;
+        xSemaphoreGive(cache_mutex);
+        metrics_increment(METRIC_STATE_CACHE_OVERFLOWS);
+        if (!is_logged)
+        {
+            ESP_LOGW(TAG, "Serialized state of %u bytes does not fit to cache, increase STATE_CACHE_SIZE.",
+                    (unsigned)serialized_length);
+        }
+        *serialized_string = serialized;
+        *length = serialized_length;
+        return ESP_OK;
+    }
+    json_serializer_free(serialized);
+    cache.valid = true;
+    cache.version = version;
+    cache.time_quality = time_quality;
+    cache.created_us = now;
+    error = copy_cached(serialized_string, length, now);
+    xSemaphoreGive(cache_mutex);
+    return error;
+#endif
+}
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for cached state serialization. JSON state of all channels is serialized once
+ * per state version and shared by HTTP API and MQTT notifications.
+ */
+
+#ifndef MAIN_STATE_CACHE_H_
+#define MAIN_STATE_CACHE_H_
+
+#include <stddef.h>
+#include <esp_err.h>
+
+/**
+ * Initialize state cache.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t state_cache_init(void);
+
+/**
+ * Get JSON state of all channels in the same format as json_serializer_serialize. Cached string is copied and
+ * remaining timeouts are patched in, it is serialized again only after state transition or time quality change.
+ * @param[out] serialized_string A pointer to output string. It must be freed by json_serializer_free.
+ * @param[out] length A pointer to output string length.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t state_cache_get(char **serialized_string, size_t *length);
+
+/**
+ * Invalidate cached state. It must be called when serialized state changes without relay switch transition.
+ */
+void state_cache_invalidate(void);
+
+#endif /* MAIN_STATE_CACHE_H_ */
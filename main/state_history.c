@@ -0,0 +1,436 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of state history log. Partition is ring of segments, each segment is one flash sector with
+ * header followed by records. Record starts with header byte which packs source, channel index and its new position,
+ * followed by zigzag varint of time delta from previous record. Transition of single channel 0-6 which does not
+ * change other channels takes header byte only, other records have channel field 7 and are followed by varints of
+ * changed and switched on channel masks. Header byte is never 0xFF, so erased flash terminates records. Time range of
+ * every segment is kept in RAM index, so query reads only segments which overlap requested range.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <esp_partition.h>
+#include <esp_log.h>
+
+#include "state_history.h"
+#include "buffer_pool.h"
+#include "metrics.h"
+#include "platform_time.h"
+#include "user_config.h"
+
+#define TAG "state_history"
+/** Segment is single flash sector, it is erased as a whole. */
+#define SEGMENT_SIZE 4096
+#define SEGMENT_MAGIC 0x48535432UL
+/** Header byte, 64-bit delta and two 32-bit masks. */
+#define MAX_RECORD_SIZE (1 + 10 + 5 + 5)
+#define SOURCE_MASK 0x0F
+/** New position of single channel. */
+#define STATE_BIT 0x10
+#define CHANNEL_SHIFT 5
+/** Channel field of record with channel masks. State bit is not set in such record, so header is not 0xFF. */
+#define CHANNEL_MASKS 7
+#define WRITER_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
+typedef struct segment_header
+{
+    uint32_t magic;
+    /** Sequence number increased by every new segment, the highest one is written. */
+    uint32_t sequence;
+    /** Time base of the first record delta. */
+    uint64_t base_utc_millis;
+    /** Channels switched on before the first record. */
+    uint32_t base_on_mask;
+    uint32_t reserved;
+} segment_header_t;
+
+typedef struct segment_entry
+{
+    /** Sequence number of segment or 0 if segment is not valid. */
+    uint32_t sequence;
+    uint64_t min_utc_millis;
+    uint64_t max_utc_millis;
+} segment_entry_t;
+
+typedef enum decode_result
+{
+    DECODE_OK,
+    DECODE_END,
+    DECODE_CORRUPTED
+} decode_result_t;
+
+static const esp_partition_t *partition = NULL;
+static segment_entry_t segments[HISTORY_MAX_SEGMENTS];
+static size_t segment_count = 0;
+static size_t active_segment = 0;
+static size_t write_offset = 0;
+static uint64_t last_utc_millis = 0;
+static uint32_t last_on_mask = 0;
+static SemaphoreHandle_t flash_mutex = NULL;
+static QueueHandle_t record_queue = NULL;
+
+static size_t encode_varint(uint64_t value, uint8_t *buffer)
+{
+    size_t length = 0;
+    while (value >= 0x80)
+    {
+        buffer[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t)value;
+    return length;
+}
+
+static bool decode_varint(const uint8_t *data, size_t size, size_t *offset, uint64_t *value)
+{
+    *value = 0;
+    for (unsigned shift = 0; shift < 64 && *offset < size; shift += 7)
+    {
+        uint8_t byte = data[(*offset)++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+static size_t encode_record(const state_history_record_t *record, uint64_t previous_utc_millis,
+        uint32_t previous_on_mask, uint8_t *buffer)
+{
+    int64_t delta = (int64_t)(record->utc_millis - previous_utc_millis);
+    uint32_t changed_mask = record->changed_mask;
+    // Masks are omitted when they can be derived from the previous record
+    bool is_single = changed_mask != 0 && (changed_mask & (changed_mask - 1)) == 0
+            && changed_mask < (1UL << CHANNEL_MASKS) && ((record->on_mask ^ previous_on_mask) & ~changed_mask) == 0;
+    uint8_t header = (uint8_t)record->source & SOURCE_MASK;
+    if (is_single)
+    {
+        header |= (uint8_t)(__builtin_ctz(changed_mask) << CHANNEL_SHIFT);
+        header |= (record->on_mask & changed_mask) != 0 ? STATE_BIT : 0;
+    }
+    else
+    {
+        header |= CHANNEL_MASKS << CHANNEL_SHIFT;
+    }
+    size_t length = 0;
+    buffer[length++] = header;
+    // Zigzag encoding keeps small backward time adjustments short
+    length += encode_varint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63), buffer + length);
+    if (!is_single)
+    {
+        length += encode_varint(changed_mask, buffer + length);
+        length += encode_varint(record->on_mask, buffer + length);
+    }
+    return length;
+}
+
+static decode_result_t decode_record(const uint8_t *data, size_t *offset, state_history_record_t *record)
+{
+    if (*offset >= SEGMENT_SIZE || data[*offset] == 0xFF)
+        return DECODE_END;
+    size_t position = *offset;
+    uint8_t header = data[position++];
+    uint8_t channel = header >> CHANNEL_SHIFT;
+    if (channel == CHANNEL_MASKS && (header & STATE_BIT) != 0)
+        return DECODE_CORRUPTED;
+    uint64_t zigzag = 0;
+    uint64_t changed_mask = 1UL << channel;
+    uint64_t on_mask = (header & STATE_BIT) != 0 ? record->on_mask | changed_mask : record->on_mask & ~changed_mask;
+    if (!decode_varint(data, SEGMENT_SIZE, &position, &zigzag))
+        return DECODE_CORRUPTED;
+    if (channel == CHANNEL_MASKS && (!decode_varint(data, SEGMENT_SIZE, &position, &changed_mask)
+            || !decode_varint(data, SEGMENT_SIZE, &position, &on_mask)
+            || changed_mask > UINT32_MAX || on_mask > UINT32_MAX))
+        return DECODE_CORRUPTED;
+    record->source = (relay_switch_source_t)(header & SOURCE_MASK);
+    record->utc_millis += (uint64_t)((int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1));
+    record->changed_mask = (uint32_t)changed_mask;
+    record->on_mask = (uint32_t)on_mask;
+    *offset = position;
+    return DECODE_OK;
+}
+
+static esp_err_t read_segment(size_t index, uint8_t *data)
+{
+    return esp_partition_read(partition, index * SEGMENT_SIZE, data, SEGMENT_SIZE);
+}
+
+/**
+ * Erase segment and write its header. Flash mutex must be held by caller after initialization.
+ */
+static esp_err_t open_segment(size_t index, uint32_t sequence, uint64_t utc_millis)
+{
+    segment_header_t header = {
+        .magic = SEGMENT_MAGIC,
+        .sequence = sequence,
+        .base_utc_millis = utc_millis,
+        .base_on_mask = last_on_mask,
+        .reserved = 0xFFFFFFFF
+    };
+    segments[index].sequence = 0;
+    esp_err_t error = esp_partition_erase_range(partition, index * SEGMENT_SIZE, SEGMENT_SIZE);
+    if (error == ESP_OK)
+    {
+        error = esp_partition_write(partition, index * SEGMENT_SIZE, &header, sizeof(header));
+    }
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open segment %u: %s", (unsigned)index, esp_err_to_name(error));
+        return error;
+    }
+    segments[index].sequence = sequence;
+    segments[index].min_utc_millis = utc_millis;
+    segments[index].max_utc_millis = utc_millis;
+    active_segment = index;
+    write_offset = sizeof(header);
+    last_utc_millis = utc_millis;
+    return ESP_OK;
+}
+
+/**
+ * Build index entry of segment. Records are decoded to find time range and end of the segment.
+ */
+static decode_result_t index_segment(size_t index, const uint8_t *data, size_t *end)
+{
+    const segment_header_t *header = (const segment_header_t*)data;
+    segments[index].sequence = 0;
+    *end = 0;
+    if (header->magic != SEGMENT_MAGIC || header->sequence == 0)
+        return DECODE_CORRUPTED;
+    state_history_record_t record = { .utc_millis = header->base_utc_millis, .on_mask = header->base_on_mask };
+    segments[index].sequence = header->sequence;
+    segments[index].min_utc_millis = record.utc_millis;
+    segments[index].max_utc_millis = record.utc_millis;
+    size_t offset = sizeof(segment_header_t);
+    decode_result_t result = DECODE_OK;
+    while ((result = decode_record(data, &offset, &record)) == DECODE_OK)
+    {
+        if (record.utc_millis < segments[index].min_utc_millis)
+            segments[index].min_utc_millis = record.utc_millis;
+        if (record.utc_millis > segments[index].max_utc_millis)
+            segments[index].max_utc_millis = record.utc_millis;
+    }
+    *end = offset;
+    if (index == active_segment)
+    {
+        last_utc_millis = record.utc_millis;
+        last_on_mask = record.on_mask;
+    }
+    return result;
+}
+
+static void write_record(const state_history_record_t *record)
+{
+    uint8_t buffer[MAX_RECORD_SIZE];
+    xSemaphoreTake(flash_mutex, portMAX_DELAY);
+    size_t length = encode_record(record, last_utc_millis, last_on_mask, buffer);
+    if (write_offset + length > SEGMENT_SIZE)
+    {
+        // The oldest segment is overwritten
+        uint32_t sequence = segments[active_segment].sequence + 1;
+        if (open_segment((active_segment + 1) % segment_count, sequence, record->utc_millis) != ESP_OK)
+        {
+            xSemaphoreGive(flash_mutex);
+            metrics_increment(METRIC_HISTORY_RECORDS_DROPPED);
+            return;
+        }
+        length = encode_record(record, last_utc_millis, last_on_mask, buffer);
+    }
+    esp_err_t error = esp_partition_write(partition, active_segment * SEGMENT_SIZE + write_offset, buffer, length);
+    if (error == ESP_OK)
+    {
+        segment_entry_t *entry = &segments[active_segment];
+        write_offset += length;
+        last_utc_millis = record->utc_millis;
+        last_on_mask = record->on_mask;
+        if (record->utc_millis < entry->min_utc_millis)
+            entry->min_utc_millis = record->utc_millis;
+        if (record->utc_millis > entry->max_utc_millis)
+            entry->max_utc_millis = record->utc_millis;
+    }
+    xSemaphoreGive(flash_mutex);
+    metrics_increment(error == ESP_OK ? METRIC_HISTORY_RECORDS : METRIC_HISTORY_RECORDS_DROPPED);
+}
+
+static void writer_task_run(void* pvParameters)
+{
+    state_history_record_t record;
+    while (true)
+    {
+        if (xQueueReceive(record_queue, &record, portMAX_DELAY) == pdTRUE)
+        {
+            write_record(&record);
+        }
+    }
+}
+
+esp_err_t state_history_init()
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, HISTORY_PARTITION_LABEL);
+    if (partition == NULL)
+    {
+        ESP_LOGE(TAG, "Partition %s not found.", HISTORY_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    segment_count = partition->size / SEGMENT_SIZE;
+    if (segment_count > HISTORY_MAX_SEGMENTS)
+    {
+        segment_count = HISTORY_MAX_SEGMENTS;
+    }
+    if (segment_count < 2)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t *data = buffer_pool_alloc(SEGMENT_SIZE);
+    if (data == NULL)
+        return ESP_ERR_NO_MEM;
+
+    // Segment with the highest sequence number is active even if its last record is corrupted
+    bool has_active = false;
+    for (size_t i = 0; i < segment_count; i++)
+    {
+        size_t end = 0;
+        if (read_segment(i, data) != ESP_OK)
+        {
+            segments[i].sequence = 0;
+            continue;
+        }
+        index_segment(i, data, &end);
+        if (segments[i].sequence != 0
+                && (!has_active || (int32_t)(segments[i].sequence - segments[active_segment].sequence) > 0))
+        {
+            active_segment = i;
+            write_offset = end;
+            has_active = true;
+        }
+    }
+    esp_err_t error = ESP_OK;
+    if (!has_active)
+    {
+        error = open_segment(0, 1, platform_get_utc_millis());
+    }
+    else
+    {
+        size_t end = 0;
+        read_segment(active_segment, data);
+        // Record interrupted by power loss stays in closed segment, the next record starts new one
+        if (index_segment(active_segment, data, &end) == DECODE_CORRUPTED)
+        {
+            write_offset = SEGMENT_SIZE;
+        }
+    }
+    buffer_pool_free(data);
+    if (error != ESP_OK)
+        return error;
+
+    flash_mutex = xSemaphoreCreateMutex();
+    record_queue = xQueueCreate(HISTORY_QUEUE_LENGTH, sizeof(state_history_record_t));
+    if (flash_mutex == NULL || record_queue == NULL)
+        return ESP_ERR_NO_MEM;
+    // Channels switched on before restart were switched off by it
+    if (last_on_mask != 0)
+    {
+        state_history_record(last_on_mask, 0, RELAY_SWITCH_SOURCE_STARTUP);
+    }
+    if (xTaskCreate(writer_task_run, "state_history", 3072, NULL, WRITER_TASK_PRIORITY, NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    ESP_LOGI(TAG, "History has %u segments, active segment %u", (unsigned)segment_count, (unsigned)active_segment);
+    return ESP_OK;
+}
+
+void state_history_record(uint32_t changed_mask, uint32_t on_mask, relay_switch_source_t source)
+{
+    if (record_queue == NULL)
+        return;
+    state_history_record_t record = {
+        .utc_millis = platform_get_utc_millis(),
+        .changed_mask = changed_mask,
+        .on_mask = on_mask,
+        .source = source
+    };
+    if (xQueueSend(record_queue, &record, 0) != pdTRUE)
+    {
+        metrics_increment(METRIC_HISTORY_RECORDS_DROPPED);
+    }
+}
+
+esp_err_t state_history_query(uint64_t from_utc_millis, uint64_t to_utc_millis, state_history_cb_t callback,
+        void *context)
+{
+    if (partition == NULL || flash_mutex == NULL)
+        return ESP_ERR_INVALID_STATE;
+    uint8_t *data = buffer_pool_alloc(SEGMENT_SIZE);
+    if (data == NULL)
+        return ESP_ERR_NO_MEM;
+    xSemaphoreTake(flash_mutex, portMAX_DELAY);
+    size_t start = active_segment;
+    xSemaphoreGive(flash_mutex);
+
+    // Segments are written in ring order, the one after active segment is the oldest
+    esp_err_t error = ESP_OK;
+    uint32_t previous_sequence = 0;
+    for (size_t i = 1; i <= segment_count && error == ESP_OK; i++)
+    {
+        size_t index = (start + i) % segment_count;
+        xSemaphoreTake(flash_mutex, portMAX_DELAY);
+        segment_entry_t entry = segments[index];
+        bool is_overlapping = entry.sequence != 0 && entry.min_utc_millis <= to_utc_millis
+                && entry.max_utc_millis >= from_utc_millis;
+        // Segment overwritten during query is skipped, its records were already sent
+        bool is_newer = previous_sequence == 0 || (int32_t)(entry.sequence - previous_sequence) > 0;
+        if (is_overlapping && is_newer)
+        {
+            error = read_segment(index, data);
+        }
+        xSemaphoreGive(flash_mutex);
+        if (!is_overlapping || !is_newer || error != ESP_OK)
+            continue;
+        previous_sequence = entry.sequence;
+        const segment_header_t *header = (const segment_header_t*)data;
+        if (header->magic != SEGMENT_MAGIC || header->sequence != entry.sequence)
+            continue;
+        state_history_record_t record = { .utc_millis = header->base_utc_millis, .on_mask = header->base_on_mask };
+        size_t offset = sizeof(segment_header_t);
+        while (error == ESP_OK && decode_record(data, &offset, &record) == DECODE_OK)
+        {
+            if (record.utc_millis >= from_utc_millis && record.utc_millis <= to_utc_millis)
+            {
+                error = callback(&record, context);
+            }
+        }
+    }
+    buffer_pool_free(data);
+    return error;
+}
@@ -0,0 +1,94 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for state history log. Transitions are appended to compact log in dedicated
+ * flash partition, so history survives restart and can be queried by time range.
+ */
+
+#ifndef MAIN_STATE_HISTORY_H_
+#define MAIN_STATE_HISTORY_H_
+
+#include <inttypes.h>
+#include <esp_err.h>
+
+#include "relay_switch.h"
+
+/**
+ * Single transition of relay channels.
+ */
+typedef struct state_history_record
+{
+    /** UTC timestamp of transition in milliseconds. */
+    uint64_t utc_millis;
+    /** Bit mask of channels which changed position. */
+    uint32_t changed_mask;
+    /** Bit mask of channels switched on after transition. */
+    uint32_t on_mask;
+    /** Origin of transition. */
+    relay_switch_source_t source;
+} state_history_record_t;
+
+/**
+ * Declaration of function for receiving queried records.
+ * @param[in] record A pointer to history record.
+ * @param[in] context Callback context.
+ * @return Return ESP_OK to continue query, other error stops the query and it is returned by state_history_query.
+ */
+typedef esp_err_t (*state_history_cb_t)(const state_history_record_t *record, void *context);
+
+/**
+ * Initialize state history. Segment index is built from history partition and writing task is started.
+ * @return Return ESP_OK if succeeded or ESP_ERR_NOT_FOUND if there is no history partition.
+ */
+esp_err_t state_history_init(void);
+
+/**
+ * Append transition to history. Record is written to flash by writing task, so caller is not blocked by flash
+ * operation. Record is dropped when writing queue is full.
+ * @param[in] changed_mask Bit mask of channels which changed position.
+ * @param[in] on_mask Bit mask of channels switched on after transition.
+ * @param[in] source Origin of transition.
+ */
+void state_history_record(uint32_t changed_mask, uint32_t on_mask, relay_switch_source_t source);
+
+/**
+ * Query records in time range. Only segments which can contain records from the range are read.
+ * @param[in] from_utc_millis Start of range in UTC milliseconds, inclusive.
+ * @param[in] to_utc_millis End of range in UTC milliseconds, inclusive.
+ * @param[in] callback Function called for every record in the range in order of writing.
+ * @param[in] context Callback context.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t state_history_query(uint64_t from_utc_millis, uint64_t to_utc_millis, state_history_cb_t callback,
+        void *context);
+
+#endif /* MAIN_STATE_HISTORY_H_ */
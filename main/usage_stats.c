@@ -0,0 +1,345 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of usage accounting. Counters of switched on channels are updated periodically, so on time is
+ * split between days with update period precision. Usage counted while calendar time is not known is kept pending
+ * and it is added to the current day and month when time becomes valid. Counters are persisted only when they changed
+ * and at most once per USAGE_PERSIST_PERIOD_MS to limit flash wear.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_log.h>
+#include <nvs.h>
+
+#include "usage_stats.h"
+#include "platform_time.h"
+#include "current_sensor.h"
+
+#define TAG "usage_stats"
+#define NVS_NAMESPACE "relay_switch"
+#define NVS_USAGE_KEY "usage"
+#define USAGE_TABLE_MAGIC 0x55534731UL
+#define MILLIS_PER_DAY 86400000ULL
+#define UPDATES_PER_PERSIST (USAGE_PERSIST_PERIOD_MS / USAGE_UPDATE_PERIOD_MS)
+/** NVS write takes tens of ms, it must not run in esp_timer task which also ends relay coil pulses. */
+#define PERSIST_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
+typedef struct usage_channel
+{
+    usage_counters_t total;
+    /** Usage counted while calendar time was not known. */
+    usage_counters_t pending;
+    usage_period_t days[USAGE_DAYS];
+    usage_period_t months[USAGE_MONTHS];
+} usage_channel_t;
+
+typedef struct usage_table
+{
+    uint32_t magic;
+    usage_channel_t channels[RELAY_CHANNEL_COUNT];
+} usage_table_t;
+
+static usage_table_t usage_table;
+/** Copy of counters written to NVS, so transitions are not blocked by flash write. */
+static usage_table_t persisted_table;
+/** Monotonic time since when switched on channel is not counted yet, 0 when channel is switched off. */
+static int64_t on_since_us[RELAY_CHANNEL_COUNT];
+#if CURRENT_SENSOR_ENABLE
+static uint64_t last_energy_millijoules[RELAY_CHANNEL_COUNT];
+#endif
+static bool is_changed = false;
+static uint32_t updates_since_persist = 0;
+static SemaphoreHandle_t usage_mutex = NULL;
+static esp_timer_handle_t update_timer = NULL;
+static TaskHandle_t persist_task = NULL;
+
+static void add_counters(usage_counters_t *target, const usage_counters_t *counters)
+{
+    target->on_millis += counters->on_millis;
+    target->energy_millijoules += counters->energy_millijoules;
+    target->cycles += counters->cycles;
+}
+
+/**
+ * Get slot of rollup ring for given period. Slot of older period is cleared.
+ */
+static usage_counters_t* get_period_counters(usage_period_t *periods, size_t count, uint32_t period)
+{
+    usage_period_t *slot = &periods[period % count];
+    if (slot->period != period)
+    {
+        memset(slot, 0, sizeof(*slot));
+        slot->period = period;
+    }
+    return &slot->counters;
+}
+
+/**
+ * Get current day and month. Seeded time can lag by the whole power off duration, so it is not used.
+ */
+static bool get_periods(uint32_t *day, uint32_t *month)
+{
+    if (platform_get_time_quality() < TIME_QUALITY_HOLDOVER)
+        return false;
+    uint64_t utc_millis = platform_get_utc_millis();
+    time_t epoch = utc_millis / 1000;
+    struct tm time_info;
+    gmtime_r(&epoch, &time_info);
+    *day = (uint32_t)(utc_millis / MILLIS_PER_DAY);
+    *month = (uint32_t)((time_info.tm_year + 1900) * 12 + time_info.tm_mon);
+    return true;
+}
+
+/**
+ * Add usage to total and pending counters and move pending counters to rollups if time is known.
+ */
+static void account(usage_channel_t *channel, const usage_counters_t *counters, bool has_periods, uint32_t day,
+        uint32_t month)
+{
+    add_counters(&channel->total, counters);
+    add_counters(&channel->pending, counters);
+    if (has_periods)
+    {
+        add_counters(get_period_counters(channel->days, USAGE_DAYS, day), &channel->pending);
+        add_counters(get_period_counters(channel->months, USAGE_MONTHS, month), &channel->pending);
+        memset(&channel->pending, 0, sizeof(channel->pending));
+    }
+}
+
+static void load_table(void)
+{
+    nvs_handle_t handle;
+    size_t length = sizeof(usage_table);
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (error == ESP_OK)
+    {
+        error = nvs_get_blob(handle, NVS_USAGE_KEY, &usage_table, &length);
+        nvs_close(handle);
+    }
+    // Stored table of another layout is discarded, e.g. after change of channel count or rollup lengths
+    if (error != ESP_OK || length != sizeof(usage_table) || usage_table.magic != USAGE_TABLE_MAGIC)
+    {
+        if (error != ESP_ERR_NVS_NOT_FOUND)
+        {
+            ESP_LOGW(TAG, "Stored usage counters are not valid, starting from zero.");
+        }
+        memset(&usage_table, 0, sizeof(usage_table));
+        usage_table.magic = USAGE_TABLE_MAGIC;
+    }
+}
+
+static void update_counters(int64_t now)
+{
+    uint32_t day = 0;
+    uint32_t month = 0;
+    bool has_periods = get_periods(&day, &month);
+    for (uint8_t channel = 0; channel < RELAY_CHANNEL_COUNT; channel++)
+    {
+        usage_counters_t counters = { 0 };
+        if (on_since_us[channel] != 0)
+        {
+            counters.on_millis = (now - on_since_us[channel]) / 1000;
+            // Remainder below millisecond is counted by the next update
+            on_since_us[channel] += counters.on_millis * 1000;
+        }
+#if CURRENT_SENSOR_ENABLE
+        current_reading_t reading;
+        if (current_sensor_get_reading(channel, &reading) == ESP_OK)
+        {
+            counters.energy_millijoules = reading.energy_millijoules - last_energy_millijoules[channel];
+            last_energy_millijoules[channel] = reading.energy_millijoules;
+        }
+#endif
+        if (counters.on_millis > 0 || counters.energy_millijoules > 0)
+        {
+            account(&usage_table.channels[channel], &counters, has_periods, day, month);
+            is_changed = true;
+        }
+    }
+}
+
+static void update_timer_callback(void* arg)
+{
+    xSemaphoreTake(usage_mutex, portMAX_DELAY);
+    update_counters(esp_timer_get_time());
+    bool is_persist_due = ++updates_since_persist >= UPDATES_PER_PERSIST;
+    xSemaphoreGive(usage_mutex);
+    if (is_persist_due)
+    {
+        xTaskNotifyGive(persist_task);
+    }
+}
+
+static void persist_task_run(void* pvParameters)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        usage_stats_persist();
+    }
+}
+
+static void shutdown_handler(void)
+{
+    usage_stats_persist();
+}
+
+esp_err_t usage_stats_init()
+{
+    usage_mutex = xSemaphoreCreateMutex();
+    if (usage_mutex == NULL)
+        return ESP_ERR_NO_MEM;
+    load_table();
+    memset(on_since_us, 0, sizeof(on_since_us));
+    if (xTaskCreate(persist_task_run, "usage_persist", 3072, NULL, PERSIST_TASK_PRIORITY, &persist_task) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    const esp_timer_create_args_t timer_args = {
+        .callback = update_timer_callback,
+        .name = "usage_update"
+    };
+    esp_err_t error = esp_timer_create(&timer_args, &update_timer);
+    if (error != ESP_OK)
+        return error;
+    // Software restart, e.g. after OTA update, does not lose counters since last persist
+    error = esp_register_shutdown_handler(shutdown_handler);
+    if (error != ESP_OK)
+        return error;
+    return esp_timer_start_periodic(update_timer, USAGE_UPDATE_PERIOD_MS * 1000ULL);
+}
+
+void usage_stats_record_transition(uint8_t channel, bool switched_on, int64_t now_us)
+{
+    if (channel >= RELAY_CHANNEL_COUNT || usage_mutex == NULL)
+        return;
+    uint32_t day = 0;
+    uint32_t month = 0;
+    bool has_periods = get_periods(&day, &month);
+    usage_counters_t counters = { 0 };
+    xSemaphoreTake(usage_mutex, portMAX_DELAY);
+    if (switched_on && on_since_us[channel] == 0)
+    {
+        on_since_us[channel] = now_us;
+        counters.cycles = 1;
+    }
+    else if (!switched_on && on_since_us[channel] != 0)
+    {
+        counters.on_millis = (now_us - on_since_us[channel]) / 1000;
+        on_since_us[channel] = 0;
+    }
+    account(&usage_table.channels[channel], &counters, has_periods, day, month);
+    is_changed = true;
+    xSemaphoreGive(usage_mutex);
+}
+
+esp_err_t usage_stats_get_report(uint8_t channel, usage_report_t *report)
+{
+    if (channel >= RELAY_CHANNEL_COUNT)
+        return ESP_ERR_INVALID_ARG;
+    uint32_t day = 0;
+    uint32_t month = 0;
+    bool has_periods = get_periods(&day, &month);
+    usage_channel_t usage;
+    xSemaphoreTake(usage_mutex, portMAX_DELAY);
+    usage = usage_table.channels[channel];
+    usage_counters_t counters = { 0 };
+    if (on_since_us[channel] != 0)
+    {
+        counters.on_millis = (esp_timer_get_time() - on_since_us[channel]) / 1000;
+    }
+    xSemaphoreGive(usage_mutex);
+
+    // On time of current period is added only to the copy
+    account(&usage, &counters, has_periods, day, month);
+    memset(report, 0, sizeof(*report));
+    report->total = usage.total;
+    for (uint32_t i = 0; i < USAGE_DAYS && has_periods && i <= day; i++)
+    {
+        const usage_period_t *slot = &usage.days[(day - i) % USAGE_DAYS];
+        if (slot->period == day - i)
+        {
+            report->days[report->day_count++] = *slot;
+        }
+    }
+    for (uint32_t i = 0; i < USAGE_MONTHS && has_periods && i <= month; i++)
+    {
+        const usage_period_t *slot = &usage.months[(month - i) % USAGE_MONTHS];
+        if (slot->period == month - i)
+        {
+            report->months[report->month_count++] = *slot;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t usage_stats_persist()
+{
+    if (usage_mutex == NULL)
+        return ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(usage_mutex, portMAX_DELAY);
+    bool is_persist_needed = is_changed;
+    if (is_persist_needed)
+    {
+        persisted_table = usage_table;
+        is_changed = false;
+    }
+    updates_since_persist = 0;
+    xSemaphoreGive(usage_mutex);
+    if (!is_persist_needed)
+        return ESP_OK;
+
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (error == ESP_OK)
+    {
+        error = nvs_set_blob(handle, NVS_USAGE_KEY, &persisted_table, sizeof(persisted_table));
+        if (error == ESP_OK)
+        {
+            error = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to store usage counters: %s", esp_err_to_name(error));
+        // Counters are written again by the next persist
+        xSemaphoreTake(usage_mutex, portMAX_DELAY);
+        is_changed = true;
+        xSemaphoreGive(usage_mutex);
+    }
+    return error;
+}
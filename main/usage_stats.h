@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for usage accounting of relay channels. On time, switch cycles and energy are
+ * counted in total and in daily and monthly rollups, counters are persisted to NVS in batches.
+ */
+
+#ifndef MAIN_USAGE_STATS_H_
+#define MAIN_USAGE_STATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <esp_err.h>
+
+#include "user_config.h"
+
+/**
+ * Usage counters of single channel.
+ */
+typedef struct usage_counters
+{
+    /** Time in milliseconds when channel was switched on. */
+    uint64_t on_millis;
+    /** Apparent energy in mJ measured by current sensor, 0 without current sensing. */
+    uint64_t energy_millijoules;
+    /** Number of switch on transitions. */
+    uint32_t cycles;
+} usage_counters_t;
+
+/**
+ * Usage counters of single day or month.
+ */
+typedef struct usage_period
+{
+    /** Day as number of days since epoch in UTC or month as year * 12 + month index. */
+    uint32_t period;
+    usage_counters_t counters;
+} usage_period_t;
+
+/**
+ * Usage report of single channel. Rollups are ordered from the current period to the oldest one.
+ */
+typedef struct usage_report
+{
+    usage_counters_t total;
+    usage_period_t days[USAGE_DAYS];
+    size_t day_count;
+    usage_period_t months[USAGE_MONTHS];
+    size_t month_count;
+} usage_report_t;
+
+/**
+ * Initialize usage accounting. Counters are loaded from NVS and periodic update is started. NVS must be initialized.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t usage_stats_init(void);
+
+/**
+ * Record position change of relay channel. It is called by relay switch on every transition.
+ * @param[in] channel Index of relay channel.
+ * @param[in] switched_on New position of the channel.
+ * @param[in] now_us Monotonic time of transition in microseconds.
+ */
+void usage_stats_record_transition(uint8_t channel, bool switched_on, int64_t now_us);
+
+/**
+ * Get usage report of relay channel including on time of current switched on period.
+ * @param[in] channel Index of relay channel.
+ * @param[out] report A pointer to report to be set.
+ * @return Return ESP_OK if succeeded or ESP_ERR_INVALID_ARG if channel is not valid.
+ */
+esp_err_t usage_stats_get_report(uint8_t channel, usage_report_t *report);
+
+/**
+ * Store counters to NVS immediately, e.g. before restart.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t usage_stats_persist(void);
+
+#endif /* MAIN_USAGE_STATS_H_ */
@@ -44,12 +44,135 @@
 #endif
 
 /**
- * GPIO pin used as signal for relay. It must be configurable as output.
+ * GPIO pin used as signal for relay of single channel device. It must be configurable as output.
  */
 #ifndef RELAY_GPIO_NUM
 #define RELAY_GPIO_NUM 4
 #endif
 
+/**
+ * Relay driver holding relay coil by GPIO level. It is suitable for monostable relays.
+ */
+#define RELAY_DRIVER_LEVEL 0
+
+/**
+ * Relay driver switching bistable (latching) relay by short pulses on separate set and reset coil pins.
+ */
+#define RELAY_DRIVER_LATCHING 1
+
+/**
+ * Relay driver used for controlling the relay coil. Set to RELAY_DRIVER_LEVEL or RELAY_DRIVER_LATCHING.
+ */
+#ifndef RELAY_DRIVER_MODE
+#define RELAY_DRIVER_MODE RELAY_DRIVER_LEVEL
+#endif
+
+/**
+ * GPIO pin driving set coil of latching relay. It must be configurable as output.
+ */
+#ifndef RELAY_SET_GPIO_NUM
+#define RELAY_SET_GPIO_NUM RELAY_GPIO_NUM
+#endif
+
+/**
+ * GPIO pin driving reset coil of latching relay. It must be configurable as output.
+ */
+#ifndef RELAY_RESET_GPIO_NUM
+#define RELAY_RESET_GPIO_NUM 5
+#endif
+
+/**
+ * Width of latching relay coil pulse in milliseconds. It must be longer than operate time of the relay.
+ */
+#ifndef RELAY_PULSE_WIDTH_MS
+#define RELAY_PULSE_WIDTH_MS 30
+#endif
+
+/**
+ * Number of relay channels controlled by the device. Maximum is 32.
+ */
+#ifndef RELAY_CHANNEL_COUNT
+#define RELAY_CHANNEL_COUNT 1
+#endif
+
+/**
+ * Names of relay channels in channel order. Channels can be addressed by name or by index.
+ */
+#ifndef RELAY_CHANNEL_NAMES
+#define RELAY_CHANNEL_NAMES { "relay0" }
+#endif
+
+/**
+ * GPIO pins used as signal for relays in channel order. They are used by RELAY_DRIVER_LEVEL driver.
+ */
+#ifndef RELAY_CHANNEL_GPIOS
+#define RELAY_CHANNEL_GPIOS { RELAY_GPIO_NUM }
+#endif
+
+/**
+ * GPIO pins driving set coils of latching relays in channel order.
+ */
+#ifndef RELAY_CHANNEL_SET_GPIOS
+#define RELAY_CHANNEL_SET_GPIOS { RELAY_SET_GPIO_NUM }
+#endif
+
+/**
+ * GPIO pins driving reset coils of latching relays in channel order.
+ */
+#ifndef RELAY_CHANNEL_RESET_GPIOS
+#define RELAY_CHANNEL_RESET_GPIOS { RELAY_RESET_GPIO_NUM }
+#endif
+
+/**
+ * Number of connection attempts to cached access point before falling back to full scan.
+ */
+#ifndef WIFI_FAST_CONNECT_ATTEMPTS
+#define WIFI_FAST_CONNECT_ATTEMPTS 2
+#endif
+
+/**
+ * Base reconnect delay in milliseconds. Delay doubles with every failed attempt.
+ */
+#ifndef WIFI_RECONNECT_BASE_MS
+#define WIFI_RECONNECT_BASE_MS 500
+#endif
+
+/**
+ * Maximum reconnect delay in milliseconds.
+ */
+#ifndef WIFI_RECONNECT_MAX_MS
+#define WIFI_RECONNECT_MAX_MS 30000
+#endif
+
+/**
+ * Wi-Fi power save policy: WIFI_POWER_POLICY_NONE, WIFI_POWER_POLICY_MODEM or WIFI_POWER_POLICY_LIGHT_SLEEP. Policy
+ * can be changed at runtime by HTTP API.
+ */
+#ifndef WIFI_POWER_POLICY
+#define WIFI_POWER_POLICY WIFI_POWER_POLICY_NONE
+#endif
+
+/**
+ * Maximum latency in milliseconds which power saving may add to command delivery. Listen interval is derived from it.
+ */
+#ifndef WIFI_POWER_MAX_LATENCY_MS
+#define WIFI_POWER_MAX_LATENCY_MS 1000
+#endif
+
+/**
+ * Maximum CPU frequency in MHz used with power management.
+ */
+#ifndef WIFI_POWER_MAX_CPU_FREQ_MHZ
+#define WIFI_POWER_MAX_CPU_FREQ_MHZ 240
+#endif
+
+/**
+ * Minimum CPU frequency in MHz used with power management.
+ */
+#ifndef WIFI_POWER_MIN_CPU_FREQ_MHZ
+#define WIFI_POWER_MIN_CPU_FREQ_MHZ 80
+#endif
+
 /**
  * Set to 1 to enable HTML web interface or 0 to disable.
  */
@@ -71,6 +194,318 @@
 #define MQTT_ADAPTER_ENABLE 1
 #endif
 
+/**
+ * Set to 1 to enable CoAP interface or 0 to disable.
+ */
+#ifndef COAP_ADAPTER_ENABLE
+#define COAP_ADAPTER_ENABLE 0
+#endif
+
+/**
+ * UDP port of CoAP server.
+ */
+#ifndef COAP_PORT
+#define COAP_PORT 5683
+#endif
+
+/**
+ * Maximum delay in ms between switch state change and CoAP observe notification.
+ */
+#ifndef COAP_NOTIFY_MAX_DELAY_MS
+#define COAP_NOTIFY_MAX_DELAY_MS 50
+#endif
+
+/**
+ * Set to 1 to advertise device and its interfaces by mDNS and DNS-SD or 0 to disable.
+ */
+#ifndef DISCOVERY_ENABLE
+#define DISCOVERY_ENABLE 1
+#endif
+
+/**
+ * mDNS host name, device is reachable as {name}.local.
+ */
+#ifndef DISCOVERY_HOSTNAME
+#define DISCOVERY_HOSTNAME SWITCH_ID
+#endif
+
+/**
+ * Set to 1 to enable switching by UDP multicast group requests or 0 to disable.
+ */
+#ifndef GROUP_CONTROL_ENABLE
+#define GROUP_CONTROL_ENABLE 0
+#endif
+
+/**
+ * Multicast address of group requests.
+ */
+#ifndef GROUP_MULTICAST_ADDRESS
+#define GROUP_MULTICAST_ADDRESS "239.255.71.1"
+#endif
+
+/**
+ * UDP port of group requests.
+ */
+#ifndef GROUP_PORT
+#define GROUP_PORT 5690
+#endif
+
+/**
+ * Names of groups the device is member of.
+ */
+#ifndef GROUP_NAMES
+#define GROUP_NAMES { "all" }
+#endif
+
+/**
+ * Maximum length of group and sender name including terminating character.
+ */
+#ifndef GROUP_NAME_MAX_LENGTH
+#define GROUP_NAME_MAX_LENGTH 24
+#endif
+
+/**
+ * Number of senders whose sequence numbers are remembered.
+ */
+#ifndef GROUP_MAX_SENDERS
+#define GROUP_MAX_SENDERS 8
+#endif
+
+/**
+ * Maximum size of group request datagram in bytes.
+ */
+#ifndef GROUP_MAX_DATAGRAM_SIZE
+#define GROUP_MAX_DATAGRAM_SIZE 512
+#endif
+
+/**
+ * Set to 1 to enable OTA firmware update over HTTP API and MQTT or 0 to disable.
+ */
+#ifndef OTA_ENABLE
+#define OTA_ENABLE 0
+#endif
+
+/**
+ * Size of buffer for receiving image chunks. It must hold image header (288 bytes).
+ */
+#ifndef OTA_BUFFER_SIZE
+#define OTA_BUFFER_SIZE 1024
+#endif
+
+/**
+ * Maximum length of image URL for MQTT triggered update.
+ */
+#ifndef OTA_URL_MAX_LENGTH
+#define OTA_URL_MAX_LENGTH 256
+#endif
+
+/**
+ * Network timeout of image download in ms.
+ */
+#ifndef OTA_PULL_TIMEOUT_MS
+#define OTA_PULL_TIMEOUT_MS 10000
+#endif
+
+/**
+ * Delay of restart after successful update in ms.
+ */
+#ifndef OTA_RESTART_DELAY_MS
+#define OTA_RESTART_DELAY_MS 1000
+#endif
+
+/**
+ * Upload over HTTP API is aborted when no image data is received for this time in ms.
+ */
+#ifndef OTA_UPLOAD_STALL_TIMEOUT_MS
+#define OTA_UPLOAD_STALL_TIMEOUT_MS 30000
+#endif
+
+/**
+ * Token required by update requests. It must be set when OTA_ENABLE is 1, firmware cannot be built with OTA enabled
+ * and empty token.
+ */
+#ifndef OTA_AUTH_TOKEN
+#define OTA_AUTH_TOKEN ""
+#endif
+
+/**
+ * Set to 1 to enable local button input or 0 to disable.
+ */
+#ifndef BUTTON_INPUT_ENABLE
+#define BUTTON_INPUT_ENABLE 0
+#endif
+
+/**
+ * GPIO pin with local button.
+ */
+#ifndef BUTTON_GPIO_NUM
+#define BUTTON_GPIO_NUM 0
+#endif
+
+/**
+ * Index of relay channel controlled by local button.
+ */
+#ifndef BUTTON_CHANNEL
+#define BUTTON_CHANNEL 0
+#endif
+
+/**
+ * Level of button pin when button is pressed. Pin is pulled to the opposite level.
+ */
+#ifndef BUTTON_ACTIVE_LEVEL
+#define BUTTON_ACTIVE_LEVEL 0
+#endif
+
+#define BUTTON_MODE_TOGGLE 0
+#define BUTTON_MODE_MOMENTARY 1
+#define BUTTON_MODE_LONG_PRESS 2
+
+/**
+ * Button mode. BUTTON_MODE_TOGGLE toggles relay on press, BUTTON_MODE_MOMENTARY keeps relay on while button is pressed
+ * and BUTTON_MODE_LONG_PRESS toggles relay on short press and switches relay on with timeout on long press.
+ */
+#ifndef BUTTON_MODE
+#define BUTTON_MODE BUTTON_MODE_TOGGLE
+#endif
+
+/**
+ * Debounce period in milliseconds. Edges following accepted edge within this period are ignored.
+ */
+#ifndef BUTTON_DEBOUNCE_MS
+#define BUTTON_DEBOUNCE_MS 30
+#endif
+
+/**
+ * Minimal press duration in milliseconds recognized as long press.
+ */
+#ifndef BUTTON_LONG_PRESS_MS
+#define BUTTON_LONG_PRESS_MS 1000
+#endif
+
+/**
+ * Timeout in milliseconds applied when relay is switched on by long press.
+ */
+#ifndef BUTTON_LONG_PRESS_TIMEOUT_MS
+#define BUTTON_LONG_PRESS_TIMEOUT_MS 600000
+#endif
+
+/**
+ * Set to 1 to enable DHT22 sensor sampling or 0 to disable.
+ */
+#ifndef SENSOR_ENABLE
+#define SENSOR_ENABLE 0
+#endif
+
+/**
+ * GPIO pin with DHT22 sensor data line.
+ */
+#ifndef DHT_GPIO_NUM
+#define DHT_GPIO_NUM 27
+#endif
+
+/**
+ * Sensor sampling period in milliseconds. DHT22 cannot be read more often than once per 2 seconds.
+ */
+#ifndef SENSOR_SAMPLE_PERIOD_MS
+#define SENSOR_SAMPLE_PERIOD_MS 2000
+#endif
+
+/**
+ * Number of samples in sliding window used for computing min, max and mean.
+ */
+#ifndef SENSOR_WINDOW_SAMPLES
+#define SENSOR_WINDOW_SAMPLES 30
+#endif
+
+/**
+ * Period of publishing sensor aggregates over MQTT in milliseconds.
+ */
+#ifndef SENSOR_PUBLISH_PERIOD_MS
+#define SENSOR_PUBLISH_PERIOD_MS 60000
+#endif
+
+/**
+ * Set to 1 to enable local automation rules or 0 to disable. Rules are evaluated on every sensor sample, so sensor
+ * sampling must be enabled.
+ */
+#ifndef RULE_ENGINE_ENABLE
+#define RULE_ENGINE_ENABLE 0
+#endif
+
+#if RULE_ENGINE_ENABLE && !SENSOR_ENABLE
+#error "RULE_ENGINE_ENABLE requires SENSOR_ENABLE"
+#endif
+
+/**
+ * Maximum number of automation rules.
+ */
+#ifndef RULE_MAX_COUNT
+#define RULE_MAX_COUNT 8
+#endif
+
+/**
+ * Maximum number of conditions of single automation rule.
+ */
+#ifndef RULE_MAX_CONDITIONS
+#define RULE_MAX_CONDITIONS 4
+#endif
+
+/**
+ * Set to 1 to enable load current sensing or 0 to disable. Continuous ADC mode requires ESP-IDF 4.4.
+ */
+#ifndef CURRENT_SENSOR_ENABLE
+#define CURRENT_SENSOR_ENABLE 0
+#endif
+
+/**
+ * ADC1 channels with current sensors in relay channel order. Use -1 for channels without sensor.
+ */
+#ifndef CURRENT_CHANNEL_ADC_CHANNELS
+#define CURRENT_CHANNEL_ADC_CHANNELS { 6 }
+#endif
+
+/**
+ * ADC sampling frequency in Hz shared by all current sensors.
+ */
+#ifndef CURRENT_SAMPLE_FREQ_HZ
+#define CURRENT_SAMPLE_FREQ_HZ 20000
+#endif
+
+/**
+ * Duration of RMS block in milliseconds. It should be multiple of mains period.
+ */
+#ifndef CURRENT_BLOCK_MS
+#define CURRENT_BLOCK_MS 100
+#endif
+
+/**
+ * Current sensor scale in microamperes per ADC count.
+ */
+#ifndef CURRENT_UA_PER_COUNT
+#define CURRENT_UA_PER_COUNT 4300
+#endif
+
+/**
+ * RMS current in milliamperes above which load is considered powered.
+ */
+#ifndef CURRENT_ON_THRESHOLD_MA
+#define CURRENT_ON_THRESHOLD_MA 50
+#endif
+
+/**
+ * Time in milliseconds for which current must disagree with relay position before fault is reported.
+ */
+#ifndef CURRENT_FAULT_MS
+#define CURRENT_FAULT_MS 1000
+#endif
+
+/**
+ * Nominal load voltage in volts used for energy computation.
+ */
+#ifndef CURRENT_LOAD_VOLTAGE
+#define CURRENT_LOAD_VOLTAGE 230
+#endif
+
 /**
  * Set to 1 if relay is connected by high input or 0 otherwise.
  */
@@ -85,6 +520,97 @@
 #define MQTT_BROKER_HOST "192.168.100.46"
 #endif
 
+/**
+ * Port of MQTT broker, 0 selects default port of the transport (1883 or 8883 with TLS).
+ */
+#ifndef MQTT_BROKER_PORT
+#define MQTT_BROKER_PORT 0
+#endif
+
+/**
+ * Set to 1 to connect to MQTT broker over TLS or 0 to use plain TCP.
+ */
+#ifndef MQTT_TLS_ENABLE
+#define MQTT_TLS_ENABLE 0
+#endif
+
+/**
+ * PEM encoded CA certificate of MQTT broker. When it is not defined, broker certificate is verified by ESP-IDF
+ * certificate bundle.
+ */
+#ifndef MQTT_BROKER_CA_CERT
+#define MQTT_BROKER_CA_CERT NULL
+#endif
+
+/**
+ * Set to 1 to keep MQTT session on broker between connections or 0 to start clean session with every connection.
+ */
+#ifndef MQTT_PERSISTENT_SESSION
+#define MQTT_PERSISTENT_SESSION 1
+#endif
+
+/**
+ * List of MQTT broker URIs. Connection fails over to the healthiest available broker when connected broker fails.
+ * Two local brokers can be set e.g. as { "mqtt://192.168.100.46:1883", "mqtt://192.168.100.46:1884" }.
+ */
+#ifndef MQTT_BROKER_URIS
+#if MQTT_TLS_ENABLE
+#define MQTT_BROKER_URIS { "mqtts://" MQTT_BROKER_HOST }
+#else
+#define MQTT_BROKER_URIS { "mqtt://" MQTT_BROKER_HOST }
+#endif
+#endif
+
+/**
+ * Maximum number of MQTT brokers in MQTT_BROKER_URIS.
+ */
+#ifndef MQTT_MAX_BROKERS
+#define MQTT_MAX_BROKERS 4
+#endif
+
+/**
+ * Time in milliseconds for which failed broker is not selected. It doubles with every consecutive failure up to 8
+ * times the value.
+ */
+#ifndef MQTT_BROKER_HOLD_DOWN_MS
+#define MQTT_BROKER_HOLD_DOWN_MS 30000
+#endif
+
+/**
+ * Minimum improvement of broker score in percent which causes fail back from connected broker.
+ */
+#ifndef MQTT_FAILBACK_HYSTERESIS_PERCENT
+#define MQTT_FAILBACK_HYSTERESIS_PERCENT 50
+#endif
+
+/**
+ * Period of round trip time probes and fail back checks in milliseconds.
+ */
+#ifndef MQTT_BROKER_PROBE_PERIOD_MS
+#define MQTT_BROKER_PROBE_PERIOD_MS 10000
+#endif
+
+/**
+ * Delay before reconnecting to MQTT broker in milliseconds.
+ */
+#ifndef MQTT_RECONNECT_DELAY_MS
+#define MQTT_RECONNECT_DELAY_MS 500
+#endif
+
+/**
+ * Timeout of MQTT network operations in milliseconds. It limits time of connecting to unreachable broker.
+ */
+#ifndef MQTT_NETWORK_TIMEOUT_MS
+#define MQTT_NETWORK_TIMEOUT_MS 3000
+#endif
+
+/**
+ * MQTT keep alive interval in seconds. Silent broker failure is detected after missing ping response.
+ */
+#ifndef MQTT_KEEPALIVE_S
+#define MQTT_KEEPALIVE_S 10
+#endif
+
 /**
  * Unique device ID - important for MQTT.
  */
@@ -99,4 +625,265 @@
 #define NTP_SERVER "pool.ntp.org"
 #endif
 
+/**
+ * Period of storing current time to NVS. Clock is seeded from it after power loss.
+ */
+#ifndef TIME_SEED_PERSIST_PERIOD_MS
+#define TIME_SEED_PERSIST_PERIOD_MS 3600000
+#endif
+
+/**
+ * Time since last SNTP synchronization after which time quality is lowered to hold-over.
+ */
+#ifndef TIME_SYNC_VALID_MS
+#define TIME_SYNC_VALID_MS 7200000
+#endif
+
+/**
+ * Size in bytes of single channel in serialized state document, including the longest addressable channel name,
+ * current sensing fields and timeout padded by state cache.
+ */
+#ifndef STATE_DOCUMENT_CHANNEL_SIZE
+#define STATE_DOCUMENT_CHANNEL_SIZE 240
+#endif
+
+/**
+ * Maximum size in bytes of serialized state document of all channels.
+ */
+#ifndef STATE_DOCUMENT_SIZE
+#define STATE_DOCUMENT_SIZE (320 + RELAY_CHANNEL_COUNT * STATE_DOCUMENT_CHANNEL_SIZE)
+#endif
+
+/**
+ * Size of the largest block class of buffer pool in bytes. It must hold request bodies and serialized state document.
+ */
+#ifndef BUFFER_POOL_LARGE_BLOCK_SIZE
+#define BUFFER_POOL_LARGE_BLOCK_SIZE (STATE_DOCUMENT_SIZE > 4096 ? (STATE_DOCUMENT_SIZE + 511) / 512 * 512 : 4096)
+#endif
+
+/**
+ * Block classes of buffer pool used for request and message buffers and JSON documents. Each entry contains block
+ * size in bytes and number of blocks, sizes must be in ascending order. Request is served by the smallest class
+ * with free block which is large enough. Every JSON node, key and string takes its own block, object of serialized
+ * channel state takes about 24 blocks of 32 bytes and 6 blocks of 128 bytes, so small classes grow with channel count.
+ */
+#ifndef BUFFER_POOL_CLASSES
+#define BUFFER_POOL_CLASSES(X) \
+    X(32, 128 + RELAY_CHANNEL_COUNT * 32) \
+    X(128, 64 + RELAY_CHANNEL_COUNT * 8) \
+    X(512, 16) \
+    X(BUFFER_POOL_LARGE_BLOCK_SIZE, 4)
+#endif
+
+/**
+ * Set to 1 to store log records of hot paths to deferred log ring or 0 to log them directly by ESP_LOG.
+ */
+#ifndef DEFERRED_LOG_ENABLE
+#define DEFERRED_LOG_ENABLE 1
+#endif
+
+/**
+ * Maximum level of deferred log records stored at build time, values are the same as esp_log_level_t (1 error,
+ * 2 warning, 3 info, 4 debug).
+ */
+#ifndef DEFERRED_LOG_LEVEL
+#define DEFERRED_LOG_LEVEL 3
+#endif
+
+/**
+ * Number of records in deferred log ring.
+ */
+#ifndef DEFERRED_LOG_RECORDS
+#define DEFERRED_LOG_RECORDS 128
+#endif
+
+/**
+ * Maximum number of 32-bit words of arguments stored with single deferred log record.
+ */
+#ifndef DEFERRED_LOG_MAX_WORDS
+#define DEFERRED_LOG_MAX_WORDS 6
+#endif
+
+/**
+ * Set to 1 to print deferred log records to console by low priority task or 0 to keep them only for API.
+ */
+#ifndef DEFERRED_LOG_CONSOLE_ENABLE
+#define DEFERRED_LOG_CONSOLE_ENABLE 1
+#endif
+
+/**
+ * Period of printing deferred log records to console in milliseconds.
+ */
+#ifndef DEFERRED_LOG_DRAIN_PERIOD_MS
+#define DEFERRED_LOG_DRAIN_PERIOD_MS 100
+#endif
+
+/**
+ * Enable caching of serialized state shared by HTTP API and MQTT notifications.
+ */
+#ifndef STATE_CACHE_ENABLE
+#define STATE_CACHE_ENABLE 1
+#endif
+
+/**
+ * Size of serialized state cache in bytes. Larger state is serialized on every request.
+ */
+#ifndef STATE_CACHE_SIZE
+#define STATE_CACHE_SIZE STATE_DOCUMENT_SIZE
+#endif
+
+/**
+ * Maximum age of cached state in milliseconds, it is used only with current sensor, which changes without transition.
+ */
+#ifndef STATE_CACHE_MAX_AGE_MS
+#define STATE_CACHE_MAX_AGE_MS 1000
+#endif
+
+/**
+ * Enable rate limiting of switching requests per source and per client address.
+ */
+#ifndef RATE_LIMIT_ENABLE
+#define RATE_LIMIT_ENABLE 1
+#endif
+
+/**
+ * Number of switching requests per minute allowed for each source (HTML, HTTP API, MQTT, CoAP, group).
+ */
+#ifndef RATE_LIMIT_SOURCE_PER_MINUTE
+#define RATE_LIMIT_SOURCE_PER_MINUTE 240
+#endif
+
+/**
+ * Number of switching requests which each source can send at once.
+ */
+#ifndef RATE_LIMIT_SOURCE_BURST
+#define RATE_LIMIT_SOURCE_BURST 20
+#endif
+
+/**
+ * Number of switching requests per minute allowed for each client address of HTTP and CoAP.
+ */
+#ifndef RATE_LIMIT_CLIENT_PER_MINUTE
+#define RATE_LIMIT_CLIENT_PER_MINUTE 60
+#endif
+
+/**
+ * Number of switching requests which each client address can send at once.
+ */
+#ifndef RATE_LIMIT_CLIENT_BURST
+#define RATE_LIMIT_CLIENT_BURST 10
+#endif
+
+/**
+ * Number of client addresses tracked by rate limiter, the least recently used one is replaced.
+ */
+#ifndef RATE_LIMIT_MAX_CLIENTS
+#define RATE_LIMIT_MAX_CLIENTS 8
+#endif
+
+/**
+ * Minimum time in milliseconds between position changes of relay channel.
+ */
+#ifndef RELAY_MIN_DWELL_MS
+#define RELAY_MIN_DWELL_MS 200
+#endif
+
+/**
+ * Maximum number of position changes of relay channel per minute, it is also allowed burst.
+ */
+#ifndef RELAY_MAX_SWITCHES_PER_MINUTE
+#define RELAY_MAX_SWITCHES_PER_MINUTE 30
+#endif
+
+/**
+ * Enable on time, switch cycle and energy accounting of relay channels.
+ */
+#ifndef USAGE_STATS_ENABLE
+#define USAGE_STATS_ENABLE 1
+#endif
+
+/**
+ * Number of days kept in daily usage rollup.
+ */
+#ifndef USAGE_DAYS
+#define USAGE_DAYS 7
+#endif
+
+/**
+ * Number of months kept in monthly usage rollup.
+ */
+#ifndef USAGE_MONTHS
+#define USAGE_MONTHS 12
+#endif
+
+/**
+ * Period in milliseconds of adding on time and energy of switched on channels to usage counters.
+ */
+#ifndef USAGE_UPDATE_PERIOD_MS
+#define USAGE_UPDATE_PERIOD_MS 60000
+#endif
+
+/**
+ * Period in milliseconds of storing changed usage counters to NVS. It must be multiple of USAGE_UPDATE_PERIOD_MS.
+ */
+#ifndef USAGE_PERSIST_PERIOD_MS
+#define USAGE_PERSIST_PERIOD_MS 900000
+#endif
+
+/**
+ * Enable state history log in flash partition.
+ */
+#ifndef HISTORY_ENABLE
+#define HISTORY_ENABLE 1
+#endif
+
+/**
+ * Label of data partition used for state history.
+ */
+#ifndef HISTORY_PARTITION_LABEL
+#define HISTORY_PARTITION_LABEL "history"
+#endif
+
+/**
+ * Maximum number of 4 kB history segments, larger partition is used only partially.
+ */
+#ifndef HISTORY_MAX_SEGMENTS
+#define HISTORY_MAX_SEGMENTS 64
+#endif
+
+/**
+ * Number of transitions waiting for write to flash, transitions over this limit are dropped.
+ */
+#ifndef HISTORY_QUEUE_LENGTH
+#define HISTORY_QUEUE_LENGTH 16
+#endif
+
+/**
+ * Enable named presets applying stored states of several channels in one transition.
+ */
+#ifndef PRESET_ENABLE
+#define PRESET_ENABLE 1
+#endif
+
+/**
+ * Maximum number of stored presets.
+ */
+#ifndef PRESET_MAX_COUNT
+#define PRESET_MAX_COUNT 8
+#endif
+
+/**
+ * Maximum length of preset name including terminating null character.
+ */
+#ifndef PRESET_NAME_MAX_LENGTH
+#define PRESET_NAME_MAX_LENGTH 16
+#endif
+
+/**
+ * Maximum length of trace ID of switching request including terminating null character.
+ */
+#ifndef TRACE_ID_MAX_LENGTH
+#define TRACE_ID_MAX_LENGTH 40
+#endif
+
 #endif /* MAIN_USER_CONFIG_H_ */
@@ -0,0 +1,274 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of Wi-Fi station connection management. Connection attempts use cached BSSID and channel
+ * first, so association does not need full channel scan. IP lease is restored by lwIP when
+ * CONFIG_LWIP_DHCP_RESTORE_LAST_IP is enabled. When cached access point does not respond, connection falls back to
+ * full scan. Station configuration is owned by this module, other modules change it only through its functions, so
+ * reconnect does not revert their settings.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
+#include <esp_wifi.h>
+#include <esp_event.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <nvs.h>
+
+#include "wifi_manager.h"
+#include "wifi_power.h"
+#include "metrics.h"
+#include "user_config.h"
+
+#define TAG "wifi_manager"
+#define NVS_NAMESPACE "relay_switch"
+#define NVS_CACHE_KEY "wifi_cache"
+#define WIFI_CONNECTED_BIT BIT0
+
+/**
+ * Access point of last successful connection.
+ */
+typedef struct wifi_cache
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+    bool is_valid;
+} wifi_cache_t;
+
+static EventGroupHandle_t wifi_event_group = NULL;
+static esp_timer_handle_t reconnect_timer = NULL;
+static wifi_config_t wifi_config;
+static SemaphoreHandle_t config_mutex = NULL;
+static wifi_cache_t cache;
+static wifi_cache_t connected_ap;
+static uint32_t attempt = 0;
+static bool is_fast_connect = false;
+static int64_t disconnected_at_us = 0;
+
+static void load_cache(void)
+{
+    nvs_handle_t handle;
+    memset(&cache, 0, sizeof(cache));
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return;
+    size_t length = sizeof(cache);
+    if (nvs_get_blob(handle, NVS_CACHE_KEY, &cache, &length) != ESP_OK || length != sizeof(cache))
+    {
+        memset(&cache, 0, sizeof(cache));
+    }
+    nvs_close(handle);
+}
+
+static void store_cache(const wifi_cache_t *new_cache)
+{
+    // Flash is written only when access point changes
+    if (memcmp(&cache, new_cache, sizeof(cache)) == 0)
+        return;
+    cache = *new_cache;
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (error != ESP_OK)
+        return;
+    error = nvs_set_blob(handle, NVS_CACHE_KEY, &cache, sizeof(cache));
+    if (error == ESP_OK)
+    {
+        error = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to store access point cache: %s", esp_err_to_name(error));
+    }
+}
+
+/**
+ * Select connection method for next attempt. First attempts of every outage go directly to cached access point,
+ * following attempts scan all channels.
+ */
+static void configure_attempt(void)
+{
+    bool fast_connect = cache.is_valid && attempt < WIFI_FAST_CONNECT_ATTEMPTS;
+    if (fast_connect == is_fast_connect)
+        return;
+    is_fast_connect = fast_connect;
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    if (fast_connect)
+    {
+        memcpy(wifi_config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Falling back to full scan.");
+        metrics_increment(METRIC_WIFI_SCAN_FALLBACKS);
+        wifi_config.sta.bssid_set = false;
+        wifi_config.sta.channel = 0;
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+    wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    xSemaphoreGive(config_mutex);
+}
+
+/**
+ * Get reconnect delay. Delay grows exponentially with attempts and random jitter in upper half of the delay spreads
+ * reconnects of devices which lost the same access point at the same time.
+ */
+static uint64_t get_reconnect_delay_us(void)
+{
+    uint32_t shift = attempt < 16 ? attempt : 16;
+    uint64_t delay_ms = (uint64_t)WIFI_RECONNECT_BASE_MS << shift;
+    if (delay_ms > WIFI_RECONNECT_MAX_MS)
+    {
+        delay_ms = WIFI_RECONNECT_MAX_MS;
+    }
+    uint64_t half_us = delay_ms * 1000 / 2;
+    return half_us + (half_us > 0 ? esp_random() % half_us : 0);
+}
+
+static void reconnect_timer_callback(void* arg)
+{
+    configure_attempt();
+    metrics_increment(METRIC_WIFI_CONNECT_ATTEMPTS);
+    esp_wifi_connect();
+}
+
+/**
+ * Handle Wi-Fi connection events and set related bits for tasks synchronization.
+ */
+static void event_handler(void* arg, esp_event_base_t event_base,
+        int32_t event_id, void* event_data)
+{
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        disconnected_at_us = esp_timer_get_time();
+        reconnect_timer_callback(NULL);
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
+    {
+        wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+        memcpy(connected_ap.bssid, event->bssid, sizeof(connected_ap.bssid));
+        connected_ap.channel = event->channel;
+        connected_ap.is_valid = true;
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;
+        if ((xEventGroupGetBits(wifi_event_group) & WIFI_CONNECTED_BIT) != 0)
+        {
+            disconnected_at_us = esp_timer_get_time();
+            xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        }
+        else
+        {
+            attempt++;
+        }
+        uint64_t delay_us = get_reconnect_delay_us();
+        ESP_LOGI(TAG, "Disconnected, reason %d, retry in %llu ms", event->reason, delay_us / 1000);
+        esp_timer_start_once(reconnect_timer, delay_us);
+    }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+        uint32_t connect_millis = (uint32_t)((esp_timer_get_time() - disconnected_at_us) / 1000);
+        ESP_LOGI(TAG, "got ip:" IPSTR " in %u ms", IP2STR(&event->ip_info.ip), connect_millis);
+        metrics_set(METRIC_WIFI_LAST_CONNECT_MILLIS, connect_millis);
+        if (is_fast_connect)
+        {
+            metrics_increment(METRIC_WIFI_FAST_CONNECTS);
+        }
+        attempt = 0;
+        store_cache(&connected_ap);
+        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    }
+}
+
+esp_err_t wifi_manager_init()
+{
+    wifi_event_group = xEventGroupCreate();
+    config_mutex = xSemaphoreCreateMutex();
+    if (wifi_event_group == NULL || config_mutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_callback,
+        .arg = NULL,
+        .name = "wifi_reconnect"
+    };
+    esp_err_t error = esp_timer_create(&timer_args, &reconnect_timer);
+    if (error != ESP_OK)
+        return error;
+    load_cache();
+
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL));
+
+    memset(&wifi_config, 0, sizeof(wifi_config));
+    strncpy((char*)wifi_config.sta.ssid, WIFI_SSID, sizeof(wifi_config.sta.ssid));
+    strncpy((char*)wifi_config.sta.password, WIFI_PASSWORD, sizeof(wifi_config.sta.password));
+    ESP_ERROR_CHECK(wifi_power_init(&wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_start());
+    ESP_ERROR_CHECK(wifi_power_apply());
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+    ESP_LOGI(TAG, "connect to ap SSID:%s", WIFI_SSID);
+    return ESP_OK;
+}
+
+esp_err_t wifi_manager_set_listen_interval(uint16_t listen_interval)
+{
+    if (config_mutex == NULL)
+        return ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    wifi_config.sta.listen_interval = listen_interval;
+    esp_err_t error = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    xSemaphoreGive(config_mutex);
+    return error;
+}
+
+bool wifi_manager_wait_connected(TickType_t timeout)
+{
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE, pdFALSE, timeout);
+    return (bits & WIFI_CONNECTED_BIT) != 0;
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for managing Wi-Fi station connection. Last good access point is cached in NVS
+ * for scan-less reconnect and reconnects are spread by exponential backoff with jitter.
+ */
+
+#ifndef MAIN_WIFI_MANAGER_H_
+#define MAIN_WIFI_MANAGER_H_
+
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+/**
+ * Initialize and start Wi-Fi station. Network interface and default event loop must be already created.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t wifi_manager_init(void);
+
+/**
+ * Change listen interval of station configuration. It is kept for all following connection attempts.
+ * @param[in] listen_interval Listen interval in beacon intervals.
+ * @return Return ESP_OK if succeeded or ESP_ERR_INVALID_STATE if station is not initialized.
+ */
+esp_err_t wifi_manager_set_listen_interval(uint16_t listen_interval);
+
+/**
+ * Wait until station is connected and has IP address.
+ * @param[in] timeout Maximum time to wait in ticks.
+ * @return Return true if station is connected.
+ */
+bool wifi_manager_wait_connected(TickType_t timeout);
+
+#endif /* MAIN_WIFI_MANAGER_H_ */
@@ -0,0 +1,247 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of Wi-Fi power saving. Sleeping station receives buffered frames only when it wakes for
+ * beacon, so listen interval is the largest number of beacon intervals which fits into latency budget.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include <nvs.h>
+#include <esp_wifi.h>
+#include <esp_pm.h>
+#include <esp32/pm.h>
+#include <esp_log.h>
+
+#include "wifi_power.h"
+#include "wifi_manager.h"
+#include "user_config.h"
+
+#define TAG "wifi_power"
+#define NVS_NAMESPACE "relay_switch"
+#define NVS_POLICY_KEY "ps_policy"
+#define NVS_LATENCY_KEY "ps_latency"
+// Default beacon interval is 100 TU of 1.024 ms
+#define BEACON_INTERVAL_US 102400
+#define DEFAULT_LISTEN_INTERVAL 3
+// Access points commonly refuse association with longer listen interval
+#define MAX_LISTEN_INTERVAL 20
+
+static wifi_power_config_t active_config = {
+    .policy = WIFI_POWER_POLICY,
+    .max_latency_millis = WIFI_POWER_MAX_LATENCY_MS
+};
+
+/**
+ * Get number of beacon intervals which can be slept through without exceeding latency budget.
+ */
+static uint16_t get_listen_interval(const wifi_power_config_t *config)
+{
+    if (config->policy == WIFI_POWER_POLICY_NONE)
+    {
+        return DEFAULT_LISTEN_INTERVAL;
+    }
+    uint32_t beacons = (uint32_t)((uint64_t)config->max_latency_millis * 1000 / BEACON_INTERVAL_US);
+    if (beacons > MAX_LISTEN_INTERVAL)
+    {
+        beacons = MAX_LISTEN_INTERVAL;
+    }
+    return beacons > 0 ? beacons : 1;
+}
+
+static wifi_ps_type_t get_ps_type(const wifi_power_config_t *config)
+{
+    if (config->policy == WIFI_POWER_POLICY_NONE || config->max_latency_millis * 1000ULL < BEACON_INTERVAL_US)
+    {
+        // Budget shorter than beacon interval cannot be met by sleeping radio
+        return WIFI_PS_NONE;
+    }
+    // Minimum modem sleep wakes every DTIM, maximum modem sleep every listen interval
+    return get_listen_interval(config) > 1 ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM;
+}
+
+static bool is_valid_config(const wifi_power_config_t *config)
+{
+#if BUTTON_INPUT_ENABLE
+    // Button edges are not detected while CPU is in light sleep
+    return config->policy == WIFI_POWER_POLICY_NONE || config->policy == WIFI_POWER_POLICY_MODEM;
+#else
+    return config->policy <= WIFI_POWER_POLICY_LIGHT_SLEEP;
+#endif
+}
+
+static esp_err_t load_config(wifi_power_config_t *config)
+{
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (error != ESP_OK)
+        return error;
+    uint8_t policy = 0;
+    uint32_t latency = 0;
+    error = nvs_get_u8(handle, NVS_POLICY_KEY, &policy);
+    if (error == ESP_OK)
+    {
+        error = nvs_get_u32(handle, NVS_LATENCY_KEY, &latency);
+    }
+    nvs_close(handle);
+    if (error == ESP_OK)
+    {
+        config->policy = (wifi_power_policy_t)policy;
+        config->max_latency_millis = latency;
+    }
+    return error;
+}
+
+static esp_err_t store_config(const wifi_power_config_t *config)
+{
+    nvs_handle_t handle;
+    esp_err_t error = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (error != ESP_OK)
+        return error;
+    error = nvs_set_u8(handle, NVS_POLICY_KEY, (uint8_t)config->policy);
+    if (error == ESP_OK)
+    {
+        error = nvs_set_u32(handle, NVS_LATENCY_KEY, config->max_latency_millis);
+    }
+    if (error == ESP_OK)
+    {
+        error = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return error;
+}
+
+static esp_err_t configure_light_sleep(bool enable)
+{
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = WIFI_POWER_MAX_CPU_FREQ_MHZ,
+        .min_freq_mhz = WIFI_POWER_MIN_CPU_FREQ_MHZ,
+        .light_sleep_enable = enable
+    };
+    esp_err_t error = esp_pm_configure(&pm_config);
+    if (error == ESP_ERR_NOT_SUPPORTED && !enable)
+    {
+        // Power management is disabled in sdkconfig, there is nothing to turn off
+        return ESP_OK;
+    }
+    return error;
+}
+
+esp_err_t wifi_power_init(wifi_config_t *wifi_config)
+{
+    wifi_power_config_t config;
+    if (load_config(&config) == ESP_OK && is_valid_config(&config))
+    {
+        active_config = config;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Using default power save configuration.");
+    }
+    wifi_config->sta.listen_interval = get_listen_interval(&active_config);
+    return ESP_OK;
+}
+
+esp_err_t wifi_power_apply()
+{
+    esp_err_t error = configure_light_sleep(active_config.policy == WIFI_POWER_POLICY_LIGHT_SLEEP);
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Light sleep configuration failed: %s", esp_err_to_name(error));
+        return error;
+    }
+    wifi_ps_type_t ps_type = get_ps_type(&active_config);
+    error = esp_wifi_set_ps(ps_type);
+    if (error != ESP_OK)
+        return error;
+    ESP_LOGI(TAG, "Power save policy %s, listen interval %d, ps type %d",
+            wifi_power_policy_to_name(active_config.policy), get_listen_interval(&active_config), ps_type);
+    return ESP_OK;
+}
+
+esp_err_t wifi_power_set_config(const wifi_power_config_t *config)
+{
+    if (!is_valid_config(config))
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    wifi_power_config_t previous_config = active_config;
+    active_config = *config;
+    esp_err_t error = wifi_power_apply();
+    if (error != ESP_OK)
+    {
+        active_config = previous_config;
+        wifi_power_apply();
+        return error;
+    }
+    // Station configuration is owned by Wi-Fi manager, it would revert direct change on reconnect
+    wifi_manager_set_listen_interval(get_listen_interval(&active_config));
+    error = store_config(&active_config);
+    if (error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to store power save configuration: %s", esp_err_to_name(error));
+    }
+    return error;
+}
+
+void wifi_power_get_config(wifi_power_config_t *config, uint16_t *listen_interval)
+{
+    *config = active_config;
+    *listen_interval = get_listen_interval(&active_config);
+}
+
+const char* wifi_power_policy_to_name(wifi_power_policy_t policy)
+{
+    switch (policy)
+    {
+    case WIFI_POWER_POLICY_NONE:
+        return "none";
+    case WIFI_POWER_POLICY_MODEM:
+        return "modem";
+    case WIFI_POWER_POLICY_LIGHT_SLEEP:
+        return "light";
+    default:
+        return "unknown";
+    }
+}
+
+esp_err_t wifi_power_policy_from_name(const char *name, wifi_power_policy_t *policy)
+{
+    for (int i = WIFI_POWER_POLICY_NONE; name != NULL && i <= WIFI_POWER_POLICY_LIGHT_SLEEP; i++)
+    {
+        if (strcmp(name, wifi_power_policy_to_name(i)) == 0)
+        {
+            *policy = i;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,109 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions for Wi-Fi power saving. Power save parameters are derived from selected policy
+ * and maximum command latency which the device is allowed to add by sleeping.
+ */
+
+#ifndef MAIN_WIFI_POWER_H_
+#define MAIN_WIFI_POWER_H_
+
+#include <inttypes.h>
+#include <esp_err.h>
+#include <esp_wifi.h>
+
+/**
+ * Wi-Fi power save policy.
+ */
+typedef enum wifi_power_policy
+{
+    /** Radio is always on. */
+    WIFI_POWER_POLICY_NONE = 0,
+    /** Radio sleeps between beacons, CPU keeps running. */
+    WIFI_POWER_POLICY_MODEM,
+    /** Radio sleeps between beacons and CPU enters light sleep when idle. */
+    WIFI_POWER_POLICY_LIGHT_SLEEP
+} wifi_power_policy_t;
+
+/**
+ * Power save configuration.
+ */
+typedef struct wifi_power_config
+{
+    wifi_power_policy_t policy;
+    /** Maximum latency in ms added to command delivery by sleeping radio. */
+    uint32_t max_latency_millis;
+} wifi_power_config_t;
+
+/**
+ * Load stored power save configuration and set listen interval of station configuration. It must be called before
+ * station configuration is set.
+ * @param[in,out] wifi_config A pointer to station configuration.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t wifi_power_init(wifi_config_t *wifi_config);
+
+/**
+ * Apply current power save configuration. It must be called after Wi-Fi is started.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t wifi_power_apply(void);
+
+/**
+ * Validate, store and apply new power save configuration. Changed listen interval is used after next association.
+ * @param[in] config A pointer to new configuration.
+ * @return Return ESP_OK if succeeded.
+ */
+esp_err_t wifi_power_set_config(const wifi_power_config_t *config);
+
+/**
+ * Get current power save configuration.
+ * @param[out] config A pointer to configuration to be set.
+ * @param[out] listen_interval A pointer to derived listen interval in beacon intervals to be set.
+ */
+void wifi_power_get_config(wifi_power_config_t *config, uint16_t *listen_interval);
+
+/**
+ * Get policy name used in API.
+ * @param[in] policy Power save policy.
+ * @return Return policy name.
+ */
+const char* wifi_power_policy_to_name(wifi_power_policy_t policy);
+
+/**
+ * Find policy by name used in API.
+ * @param[in] name Policy name.
+ * @param[out] policy A pointer to policy to be set.
+ * @return Return ESP_OK if succeeded or ESP_ERR_NOT_FOUND if there is no such policy.
+ */
+esp_err_t wifi_power_policy_from_name(const char *name, wifi_power_policy_t *policy);
+
+#endif /* MAIN_WIFI_POWER_H_ */
@@ -0,0 +1,334 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of host shims of ESP-IDF services used by firmware modules: time, timers,
+ * logging, error names, NVS and GPIO.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_crt_bundle.h>
+#include <nvs.h>
+#include <driver/gpio.h>
+#include <soc/gpio_struct.h>
+
+#include "sim_device.h"
+#include "sim_shim.h"
+#include "user_config.h"
+
+/** Free heap reported by virtual devices, it is the typical free heap of the firmware after start. */
+#define SIM_FREE_HEAP_SIZE 200000
+
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+    /** Time of next expiration, SIM_NO_DEADLINE when timer is stopped. */
+    int64_t deadline_us;
+    /** Period of periodic timer, 0 for one-shot timer. */
+    uint64_t period_us;
+    struct esp_timer *next;
+};
+
+static int64_t start_us = -1;
+static esp_timer_handle_t timers = NULL;
+static esp_log_level_t log_level = ESP_LOG_WARN;
+static gpio_dev_t gpio_registers;
+static uint64_t output_mask = 0;
+
+static int64_t get_monotonic_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int64_t sim_get_time_us(void)
+{
+    int64_t now = get_monotonic_us();
+    if (start_us < 0)
+    {
+        start_us = now;
+    }
+    return now - start_us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return sim_get_time_us();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    esp_timer_handle_t timer = calloc(1, sizeof(struct esp_timer));
+    if (timer == NULL)
+        return ESP_ERR_NO_MEM;
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->name = create_args->name;
+    timer->deadline_us = SIM_NO_DEADLINE;
+    timer->next = timers;
+    timers = timer;
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t start_timer(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (timer->deadline_us != SIM_NO_DEADLINE)
+        return ESP_ERR_INVALID_STATE;
+    timer->deadline_us = sim_get_time_us() + (int64_t)timeout_us;
+    timer->period_us = period_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return start_timer(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    return start_timer(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer->deadline_us == SIM_NO_DEADLINE)
+        return ESP_ERR_INVALID_STATE;
+    timer->deadline_us = SIM_NO_DEADLINE;
+    return ESP_OK;
+}
+
+int64_t sim_timers_run(void)
+{
+    int64_t now = sim_get_time_us();
+    // Callback can start or stop any timer, so the list is searched again after every callback
+    for (;;)
+    {
+        esp_timer_handle_t expired = NULL;
+        for (esp_timer_handle_t timer = timers; timer != NULL; timer = timer->next)
+        {
+            if (timer->deadline_us <= now && (expired == NULL || timer->deadline_us < expired->deadline_us))
+            {
+                expired = timer;
+            }
+        }
+        if (expired == NULL)
+            break;
+        if (expired->period_us > 0)
+        {
+            // Periods missed while the event loop was busy are skipped
+            expired->deadline_us += expired->period_us;
+            if (expired->deadline_us <= now)
+            {
+                expired->deadline_us = now + expired->period_us;
+            }
+        }
+        else
+        {
+            expired->deadline_us = SIM_NO_DEADLINE;
+        }
+        expired->callback(expired->arg);
+    }
+    int64_t nearest_deadline = SIM_NO_DEADLINE;
+    for (esp_timer_handle_t timer = timers; timer != NULL; timer = timer->next)
+    {
+        if (timer->deadline_us < nearest_deadline)
+        {
+            nearest_deadline = timer->deadline_us;
+        }
+    }
+    return nearest_deadline;
+}
+
+void sim_log_set_level(esp_log_level_t level)
+{
+    log_level = level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(sim_get_time_us() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char level_letters[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+    if (level > log_level || level == ESP_LOG_NONE)
+        return;
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    fprintf(stderr, "%s %c (%" PRIu32 ") %s: %s\n", SWITCH_ID, level_letters[level], esp_log_timestamp(), tag,
+            message);
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE:
+        return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:
+        return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION:
+        return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return SIM_FREE_HEAP_SIZE;
+}
+
+esp_err_t esp_crt_bundle_attach(void *conf)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *out_value)
+{
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    if (config->pin_bit_mask >> GPIO_PIN_COUNT != 0)
+        return ESP_ERR_INVALID_ARG;
+    if (config->mode == GPIO_MODE_OUTPUT)
+    {
+        output_mask |= config->pin_bit_mask;
+    }
+    return ESP_OK;
+}
+
+gpio_dev_t* sim_gpio_latch(void)
+{
+    gpio_registers.out = (gpio_registers.out | gpio_registers.out_w1ts) & ~gpio_registers.out_w1tc;
+    gpio_registers.out1.data = (gpio_registers.out1.data | gpio_registers.out1_w1ts.data)
+            & ~gpio_registers.out1_w1tc.data;
+    gpio_registers.out_w1ts = 0;
+    gpio_registers.out_w1tc = 0;
+    gpio_registers.out1_w1ts.val = 0;
+    gpio_registers.out1_w1tc.val = 0;
+    return &gpio_registers;
+}
+
+int sim_gpio_get_level(gpio_num_t gpio)
+{
+    if (gpio < 0 || gpio >= GPIO_PIN_COUNT || (output_mask & (1ULL << gpio)) == 0)
+        return -1;
+    const gpio_dev_t *registers = sim_gpio_latch();
+    return gpio < 32 ? (registers->out >> gpio) & 1 : (registers->out1.data >> (gpio - 32)) & 1;
+}
+
+size_t sim_strlcpy(char *destination, const char *source, size_t size)
+{
+    size_t length = strlen(source);
+    if (size > 0)
+    {
+        size_t copied = length < size ? length : size - 1;
+        memcpy(destination, source, copied);
+        destination[copied] = '\0';
+    }
+    return length;
+}
+
+size_t sim_strlcat(char *destination, const char *source, size_t size)
+{
+    size_t length = strnlen(destination, size);
+    if (length == size)
+        return size + strlen(source);
+    return length + sim_strlcpy(destination + length, source, size - length);
+}
@@ -0,0 +1,276 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of FreeRTOS shim. Tasks are coroutines with own stacks switched by ucontext.
+ * Task runs until it blocks by delay, notification wait or contended mutex and scheduler returns to the caller of
+ * sim_device_poll, so firmware tasks and the event loop of the simulator share single thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include "sim_shim.h"
+
+/**
+ * Stack size of every task. Host frames are larger than Xtensa frames, so requested depth is not used. Stack is
+ * mapped lazily, only touched pages take memory.
+ */
+#define TASK_STACK_SIZE (128 * 1024)
+#define GUARD_SIZE 4096
+/** Task waiting for contended mutex retries after this time. */
+#define MUTEX_RETRY_US 1000
+
+typedef struct sim_task
+{
+    ucontext_t context;
+    void *stack;
+    TaskFunction_t function;
+    void *parameters;
+    const char *name;
+    /** Time when blocked task becomes ready, SIM_NO_DEADLINE if it waits for notification only. */
+    int64_t wake_us;
+    bool is_waiting_notification;
+    bool is_finished;
+    uint32_t notification;
+    struct sim_task *next;
+} sim_task_t;
+
+typedef struct sim_mutex
+{
+    /** Holder of mutex, NULL for code outside of tasks. */
+    sim_task_t *owner;
+    uint32_t depth;
+    bool is_recursive;
+} sim_mutex_t;
+
+static sim_task_t *tasks = NULL;
+static sim_task_t *current_task = NULL;
+static ucontext_t scheduler_context;
+
+static void task_entry(void)
+{
+    current_task->function(current_task->parameters);
+    // FreeRTOS task must not return, returned task is never scheduled again
+    current_task->is_finished = true;
+}
+
+/**
+ * Switch from current task back to scheduler. Task continues when it is ready again.
+ */
+static void block(int64_t wake_us)
+{
+    sim_task_t *task = current_task;
+    task->wake_us = wake_us;
+    swapcontext(&task->context, &scheduler_context);
+}
+
+static bool is_ready(const sim_task_t *task, int64_t now)
+{
+    if (task->is_finished)
+        return false;
+    if (task->is_waiting_notification && task->notification > 0)
+        return true;
+    return task->wake_us <= now;
+}
+
+int64_t sim_tasks_run(void)
+{
+    int64_t now = sim_get_time_us();
+    int64_t nearest_wake = SIM_NO_DEADLINE;
+    // Every ready task runs once, task which is still ready after that runs on the next poll
+    for (sim_task_t *task = tasks; task != NULL; task = task->next)
+    {
+        if (is_ready(task, now))
+        {
+            current_task = task;
+            swapcontext(&scheduler_context, &task->context);
+            current_task = NULL;
+            now = sim_get_time_us();
+        }
+        if (task->is_finished)
+            continue;
+        int64_t wake_us = task->is_waiting_notification && task->notification > 0 ? now : task->wake_us;
+        if (wake_us < nearest_wake)
+        {
+            nearest_wake = wake_us < now ? now : wake_us;
+        }
+    }
+    return nearest_wake;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+        UBaseType_t priority, TaskHandle_t *task_handle)
+{
+    sim_task_t *task = calloc(1, sizeof(sim_task_t));
+    if (task == NULL)
+        return pdFAIL;
+    task->stack = mmap(NULL, TASK_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+            | MAP_STACK, -1, 0);
+    if (task->stack == MAP_FAILED)
+    {
+        free(task);
+        return pdFAIL;
+    }
+    // Stack overflow hits guard page instead of other memory
+    mprotect(task->stack, GUARD_SIZE, PROT_NONE);
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = TASK_STACK_SIZE;
+    task->context.uc_link = &scheduler_context;
+    makecontext(&task->context, task_entry, 0);
+    task->function = function;
+    task->parameters = parameters;
+    task->name = name;
+    task->wake_us = 0;
+    sim_task_t **last = &tasks;
+    while (*last != NULL)
+    {
+        last = &(*last)->next;
+    }
+    *last = task;
+    if (task_handle != NULL)
+    {
+        *task_handle = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (current_task == NULL)
+        return;
+    block(sim_get_time_us() + (int64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(sim_get_time_us() / 1000 / portTICK_PERIOD_MS);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    task->notification++;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    sim_task_t *task = current_task;
+    if (task == NULL)
+        return 0;
+    if (task->notification == 0 && ticks_to_wait > 0)
+    {
+        task->is_waiting_notification = true;
+        block(ticks_to_wait == portMAX_DELAY ? SIM_NO_DEADLINE
+                : sim_get_time_us() + (int64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000);
+        task->is_waiting_notification = false;
+    }
+    uint32_t value = task->notification;
+    if (value > 0)
+    {
+        task->notification = clear_on_exit ? 0 : value - 1;
+    }
+    return value;
+}
+
+static SemaphoreHandle_t create_mutex(bool is_recursive)
+{
+    sim_mutex_t *mutex = calloc(1, sizeof(sim_mutex_t));
+    if (mutex != NULL)
+    {
+        mutex->is_recursive = is_recursive;
+    }
+    return mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return create_mutex(false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return create_mutex(true);
+}
+
+static BaseType_t take_mutex(sim_mutex_t *mutex, TickType_t ticks_to_wait)
+{
+    int64_t deadline = ticks_to_wait == portMAX_DELAY ? SIM_NO_DEADLINE
+            : sim_get_time_us() + (int64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000;
+    while (mutex->depth > 0 && !(mutex->is_recursive && mutex->owner == current_task))
+    {
+        if (current_task == NULL)
+        {
+            fprintf(stderr, "Mutex is held by blocked task, it cannot be taken outside of tasks\n");
+            abort();
+        }
+        if (sim_get_time_us() >= deadline)
+            return pdFALSE;
+        block(sim_get_time_us() + MUTEX_RETRY_US);
+    }
+    mutex->owner = current_task;
+    mutex->depth++;
+    return pdTRUE;
+}
+
+static BaseType_t give_mutex(sim_mutex_t *mutex)
+{
+    if (mutex->depth == 0 || mutex->owner != current_task)
+        return pdFALSE;
+    mutex->depth--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks_to_wait)
+{
+    return take_mutex(mutex, ticks_to_wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    return give_mutex(mutex);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks_to_wait)
+{
+    return take_mutex(mutex, ticks_to_wait);
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+    return give_mutex(mutex);
+}
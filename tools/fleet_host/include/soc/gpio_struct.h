@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Host shim of ESP32 GPIO registers. Writes to write-1-to-set and write-1-to-clear registers
+ * are applied to output registers before the next access to GPIO, so consecutive writes are not lost.
+ */
+
+#ifndef FLEET_HOST_GPIO_STRUCT_H_
+#define FLEET_HOST_GPIO_STRUCT_H_
+
+#include <inttypes.h>
+
+/**
+ * Register of pins 32-39.
+ */
+typedef union
+{
+    struct
+    {
+        uint32_t data: 8;
+        uint32_t reserved: 24;
+    };
+    uint32_t val;
+} gpio_high_reg_t;
+
+typedef struct gpio_dev
+{
+    uint32_t out;
+    uint32_t out_w1ts;
+    uint32_t out_w1tc;
+    gpio_high_reg_t out1;
+    gpio_high_reg_t out1_w1ts;
+    gpio_high_reg_t out1_w1tc;
+} gpio_dev_t;
+
+/**
+ * Apply pending set and clear writes to output registers and get the registers.
+ */
+gpio_dev_t* sim_gpio_latch(void);
+
+#define GPIO (*sim_gpio_latch())
+
+#endif /* FLEET_HOST_GPIO_STRUCT_H_ */
@@ -0,0 +1,301 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Implementation of esp-mqtt shim. Client keeps connection state and reconnect timer like
+ * esp-mqtt, network traffic is executed by the simulator.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <esp_timer.h>
+#include <mqtt_client.h>
+
+#include "sim_device.h"
+
+/** Reconnect timeout of esp-mqtt when configuration does not set it. */
+#define DEFAULT_RECONNECT_TIMEOUT_MS 10000
+#define DEFAULT_NETWORK_TIMEOUT_MS 10000
+#define DEFAULT_KEEPALIVE_S 120
+
+typedef enum client_state
+{
+    CLIENT_STATE_STOPPED,
+    CLIENT_STATE_CONNECTING,
+    CLIENT_STATE_CONNECTED,
+    CLIENT_STATE_WAITING_RECONNECT
+} client_state_t;
+
+typedef struct action_node
+{
+    sim_mqtt_action_t action;
+    struct action_node *next;
+} action_node_t;
+
+struct esp_mqtt_client
+{
+    esp_mqtt_client_config_t config;
+    const char *uri;
+    client_state_t state;
+    int last_msg_id;
+    esp_timer_handle_t reconnect_timer;
+};
+
+static struct esp_mqtt_client client;
+static action_node_t *first_action = NULL;
+static action_node_t *last_action = NULL;
+/** Action returned by the last take, it is released by the next take. */
+static action_node_t *taken_action = NULL;
+
+static char* copy_data(const char *data, size_t length)
+{
+    char *copy = malloc(length + 1);
+    if (copy != NULL)
+    {
+        memcpy(copy, data, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+static void free_action(action_node_t *node)
+{
+    if (node == NULL)
+        return;
+    free((char*)node->action.topic);
+    free((char*)node->action.data);
+    free(node);
+}
+
+static bool queue_action(sim_mqtt_action_type_t type, int msg_id, const char *topic, const char *data, int length,
+        int qos, int retain)
+{
+    action_node_t *node = calloc(1, sizeof(action_node_t));
+    if (node == NULL)
+        return false;
+    node->action.type = type;
+    node->action.msg_id = msg_id;
+    node->action.qos = qos;
+    node->action.retain = retain;
+    if (topic != NULL)
+    {
+        node->action.topic = copy_data(topic, strlen(topic));
+        node->action.data = copy_data(data != NULL ? data : "", length);
+        node->action.data_len = length;
+        if (node->action.topic == NULL || node->action.data == NULL)
+        {
+            free_action(node);
+            return false;
+        }
+    }
+    if (last_action == NULL)
+    {
+        first_action = node;
+    }
+    else
+    {
+        last_action->next = node;
+    }
+    last_action = node;
+    return true;
+}
+
+static void dispatch_event(esp_mqtt_event_t *event)
+{
+    event->client = &client;
+    event->user_context = client.config.user_context;
+    if (client.config.event_handle != NULL)
+    {
+        client.config.event_handle(event);
+    }
+}
+
+static void dispatch_simple_event(esp_mqtt_event_id_t event_id)
+{
+    esp_mqtt_event_t event = { .event_id = event_id };
+    dispatch_event(&event);
+}
+
+static void connect_client(void)
+{
+    client.state = CLIENT_STATE_CONNECTING;
+    dispatch_simple_event(MQTT_EVENT_BEFORE_CONNECT);
+    queue_action(SIM_MQTT_ACTION_CONNECT, 0, NULL, NULL, 0, 0, 0);
+}
+
+static void reconnect_timer_callback(void *arg)
+{
+    if (client.state == CLIENT_STATE_WAITING_RECONNECT)
+    {
+        connect_client();
+    }
+}
+
+static int next_msg_id(void)
+{
+    client.last_msg_id = client.last_msg_id % 65535 + 1;
+    return client.last_msg_id;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    memset(&client, 0, sizeof(client));
+    client.config = *config;
+    client.uri = config->uri;
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_callback,
+        .name = "mqtt_reconnect"
+    };
+    if (esp_timer_create(&timer_args, &client.reconnect_timer) != ESP_OK)
+        return NULL;
+    return &client;
+}
+
+esp_err_t esp_mqtt_client_set_uri(esp_mqtt_client_handle_t mqtt_client, const char *uri)
+{
+    mqtt_client->uri = uri;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t mqtt_client)
+{
+    if (mqtt_client->state != CLIENT_STATE_STOPPED)
+        return ESP_FAIL;
+    connect_client();
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t mqtt_client)
+{
+    if (mqtt_client->state != CLIENT_STATE_CONNECTED)
+        return ESP_FAIL;
+    return queue_action(SIM_MQTT_ACTION_DISCONNECT, 0, NULL, NULL, 0, 0, 0) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t mqtt_client, const char *topic, int qos)
+{
+    if (mqtt_client->state != CLIENT_STATE_CONNECTED)
+        return -1;
+    int msg_id = next_msg_id();
+    return queue_action(SIM_MQTT_ACTION_SUBSCRIBE, msg_id, topic, NULL, 0, qos, 0) ? msg_id : -1;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t mqtt_client, const char *topic, const char *data, int len,
+        int qos, int retain)
+{
+    if (mqtt_client->state != CLIENT_STATE_CONNECTED)
+        return -1;
+    if (len <= 0 && data != NULL)
+    {
+        len = strlen(data);
+    }
+    int msg_id = qos > 0 ? next_msg_id() : 0;
+    return queue_action(SIM_MQTT_ACTION_PUBLISH, msg_id, topic, data, len, qos, retain) ? msg_id : -1;
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t mqtt_client, const char *topic, const char *data, int len,
+        int qos, int retain, bool store)
+{
+    return esp_mqtt_client_publish(mqtt_client, topic, data, len, qos, retain);
+}
+
+bool sim_mqtt_take_action(sim_mqtt_action_t *action)
+{
+    free_action(taken_action);
+    taken_action = first_action;
+    if (taken_action == NULL)
+        return false;
+    first_action = taken_action->next;
+    if (first_action == NULL)
+    {
+        last_action = NULL;
+    }
+    *action = taken_action->action;
+    return true;
+}
+
+void sim_mqtt_get_config(sim_mqtt_config_t *config)
+{
+    config->uri = client.uri;
+    config->client_id = client.config.client_id;
+    config->keepalive = client.config.keepalive > 0 ? client.config.keepalive : DEFAULT_KEEPALIVE_S;
+    config->clean_session = !client.config.disable_clean_session;
+    config->network_timeout_ms = client.config.network_timeout_ms > 0 ? client.config.network_timeout_ms
+            : DEFAULT_NETWORK_TIMEOUT_MS;
+}
+
+void sim_mqtt_connected(bool session_present)
+{
+    if (client.state != CLIENT_STATE_CONNECTING)
+        return;
+    client.state = CLIENT_STATE_CONNECTED;
+    esp_mqtt_event_t event = { .event_id = MQTT_EVENT_CONNECTED, .session_present = session_present };
+    dispatch_event(&event);
+}
+
+void sim_mqtt_disconnected(void)
+{
+    if (client.state != CLIENT_STATE_CONNECTING && client.state != CLIENT_STATE_CONNECTED)
+        return;
+    client.state = CLIENT_STATE_WAITING_RECONNECT;
+    dispatch_simple_event(MQTT_EVENT_DISCONNECTED);
+    int timeout_ms = client.config.reconnect_timeout_ms > 0 ? client.config.reconnect_timeout_ms
+            : DEFAULT_RECONNECT_TIMEOUT_MS;
+    esp_timer_start_once(client.reconnect_timer, timeout_ms * 1000ULL);
+}
+
+void sim_mqtt_error(void)
+{
+    dispatch_simple_event(MQTT_EVENT_ERROR);
+}
+
+void sim_mqtt_published(int msg_id)
+{
+    if (client.state != CLIENT_STATE_CONNECTED)
+        return;
+    esp_mqtt_event_t event = { .event_id = MQTT_EVENT_PUBLISHED, .msg_id = msg_id };
+    dispatch_event(&event);
+}
+
+void sim_mqtt_data(const char *topic, int topic_len, const char *data, int data_len, int msg_id)
+{
+    if (client.state != CLIENT_STATE_CONNECTED)
+        return;
+    esp_mqtt_event_t event = {
+        .event_id = MQTT_EVENT_DATA,
+        .topic = (char*)topic,
+        .topic_len = topic_len,
+        .data = (char*)data,
+        .data_len = data_len,
+        .total_data_len = data_len,
+        .msg_id = msg_id
+    };
+    dispatch_event(&event);
+}
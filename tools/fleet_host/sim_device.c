@@ -0,0 +1,115 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief Entry point of virtual device. Modules are initialized in the same order as in app_main,
+ * modules which need hardware or other network interfaces than MQTT are disabled by the build of the simulator.
+ */
+
+#include "deferred_log.h"
+#include "json_serializer.h"
+#include "metrics.h"
+#include "mqtt_adapter.h"
+#include "platform_time.h"
+#include "rate_limiter.h"
+#include "relay_switch.h"
+#include "state_cache.h"
+#include "user_config.h"
+
+#include "sim_device.h"
+#include "sim_shim.h"
+
+#if !MQTT_ADAPTER_ENABLE || HTTP_HTML_ENABLE || HTTP_JSON_ENABLE || COAP_ADAPTER_ENABLE || GROUP_CONTROL_ENABLE \
+    || DISCOVERY_ENABLE || OTA_ENABLE || BUTTON_INPUT_ENABLE || SENSOR_ENABLE || RULE_ENGINE_ENABLE \
+    || CURRENT_SENSOR_ENABLE || USAGE_STATS_ENABLE || HISTORY_ENABLE || PRESET_ENABLE || MQTT_TLS_ENABLE
+#error "Virtual device supports only MQTT adapter without TLS, other features must be disabled"
+#endif
+
+static void switch_state_changed(const relay_switch_state_t* relay_switch_states, size_t count, void* context)
+{
+    mqtt_adapter_notify_switch_status();
+}
+
+esp_err_t sim_device_start(void)
+{
+    sim_get_time_us();
+    json_serializer_init();
+    esp_err_t error = deferred_log_init();
+    if (error == ESP_OK)
+    {
+        error = state_cache_init();
+    }
+    if (error == ESP_OK)
+    {
+        error = platform_time_init();
+    }
+    if (error == ESP_OK)
+    {
+        rate_limiter_init();
+        error = relay_switch_init();
+    }
+    if (error == ESP_OK)
+    {
+        error = mqtt_adapter_init();
+    }
+    if (error == ESP_OK)
+    {
+        relay_switch_set_state_changed_cb(switch_state_changed, NULL);
+    }
+    return error;
+}
+
+int64_t sim_device_poll(void)
+{
+    // Timer callbacks can notify tasks and tasks can start timers
+    sim_timers_run();
+    int64_t task_wake = sim_tasks_run();
+    int64_t timer_deadline = sim_timers_run();
+    int64_t deadline = task_wake < timer_deadline ? task_wake : timer_deadline;
+    if (deadline == SIM_NO_DEADLINE)
+        return -1;
+    int64_t now = sim_get_time_us();
+    return deadline > now ? deadline - now : 0;
+}
+
+size_t sim_metrics_get_count(void)
+{
+    return METRIC_COUNT;
+}
+
+const char* sim_metrics_get_name(uint32_t id)
+{
+    return id < METRIC_COUNT ? metrics_get_name((metric_id_t)id) : NULL;
+}
+
+uint32_t sim_metrics_get(uint32_t id)
+{
+    return id < METRIC_COUNT ? metrics_get((metric_id_t)id) : 0;
+}
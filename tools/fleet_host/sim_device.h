@@ -0,0 +1,147 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains API of virtual device library used by the fleet simulator. Library contains
+ * firmware modules and host shims of ESP-IDF, every virtual device loads its own copy of the library, so static
+ * state of modules is not shared. All functions must be called from single thread.
+ */
+
+#ifndef FLEET_HOST_SIM_DEVICE_H_
+#define FLEET_HOST_SIM_DEVICE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <driver/gpio.h>
+
+#define SIM_EXPORT __attribute__((visibility("default")))
+
+typedef enum sim_mqtt_action_type
+{
+    SIM_MQTT_ACTION_CONNECT = 1,
+    SIM_MQTT_ACTION_DISCONNECT,
+    SIM_MQTT_ACTION_SUBSCRIBE,
+    SIM_MQTT_ACTION_PUBLISH
+} sim_mqtt_action_type_t;
+
+/**
+ * Action of MQTT client which must be executed by the simulator. Topic and data are valid until next take.
+ */
+typedef struct sim_mqtt_action
+{
+    int32_t type;
+    int32_t msg_id;
+    int32_t qos;
+    int32_t retain;
+    const char *topic;
+    const char *data;
+    int32_t data_len;
+} sim_mqtt_action_t;
+
+/**
+ * Connection parameters of MQTT client. Broker URI changes when firmware selects other broker.
+ */
+typedef struct sim_mqtt_config
+{
+    const char *uri;
+    const char *client_id;
+    int32_t keepalive;
+    int32_t clean_session;
+    int32_t network_timeout_ms;
+} sim_mqtt_config_t;
+
+/**
+ * Initialize firmware modules like app_main and start MQTT client.
+ * @return Return ESP_OK or error of the first module which failed.
+ */
+SIM_EXPORT esp_err_t sim_device_start(void);
+
+/**
+ * Run ready tasks and expired timers.
+ * @return Return time in microseconds until the device must be polled again or -1 if it waits for events only.
+ */
+SIM_EXPORT int64_t sim_device_poll(void);
+
+/**
+ * Set the most verbose level of ESP_LOG lines printed by the device, default is ESP_LOG_WARN.
+ */
+SIM_EXPORT void sim_log_set_level(esp_log_level_t level);
+
+/**
+ * Get output level of GPIO pin.
+ * @return Return 0 or 1 or -1 if the pin was not configured as output.
+ */
+SIM_EXPORT int sim_gpio_get_level(gpio_num_t gpio);
+
+SIM_EXPORT size_t sim_metrics_get_count(void);
+
+SIM_EXPORT const char* sim_metrics_get_name(uint32_t id);
+
+SIM_EXPORT uint32_t sim_metrics_get(uint32_t id);
+
+/**
+ * Take the oldest action queued by MQTT client.
+ * @param[out] action Action to execute.
+ * @return Return false if no action is queued.
+ */
+SIM_EXPORT bool sim_mqtt_take_action(sim_mqtt_action_t *action);
+
+SIM_EXPORT void sim_mqtt_get_config(sim_mqtt_config_t *config);
+
+/**
+ * Report accepted connection. Firmware subscribes to its topics unless session is present.
+ */
+SIM_EXPORT void sim_mqtt_connected(bool session_present);
+
+/**
+ * Report closed connection or failed connection attempt. Client connects again after reconnect timeout of its
+ * configuration.
+ */
+SIM_EXPORT void sim_mqtt_disconnected(void);
+
+/**
+ * Report transport error, it is followed by sim_mqtt_disconnected.
+ */
+SIM_EXPORT void sim_mqtt_error(void);
+
+/**
+ * Report acknowledged QoS 1 publication.
+ */
+SIM_EXPORT void sim_mqtt_published(int msg_id);
+
+/**
+ * Deliver received publication.
+ */
+SIM_EXPORT void sim_mqtt_data(const char *topic, int topic_len, const char *data, int data_len, int msg_id);
+
+#endif /* FLEET_HOST_SIM_DEVICE_H_ */
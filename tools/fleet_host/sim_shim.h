@@ -0,0 +1,62 @@
+/*
+ *  Copyright (c) 2019, Vit Holasek.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the copyright holder nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @author Vit Holasek
+ * @brief This file contains functions shared by host shims of one virtual device. They are not exported
+ * from the device library.
+ */
+
+#ifndef FLEET_HOST_SIM_SHIM_H_
+#define FLEET_HOST_SIM_SHIM_H_
+
+#include <inttypes.h>
+
+/** Deadline of task or timer which waits without timeout. */
+#define SIM_NO_DEADLINE INT64_MAX
+
+/**
+ * Get monotonic time in microseconds since start of virtual device.
+ */
+int64_t sim_get_time_us(void);
+
+/**
+ * Run every task which is ready, each task runs until it blocks.
+ * @return Return the nearest wake time of blocked tasks, the current time if some task is still ready or
+ * SIM_NO_DEADLINE.
+ */
+int64_t sim_tasks_run(void);
+
+/**
+ * Dispatch callbacks of expired timers.
+ * @return Return the nearest deadline of running timers or SIM_NO_DEADLINE.
+ */
+int64_t sim_timers_run(void);
+
+#endif /* FLEET_HOST_SIM_SHIM_H_ */
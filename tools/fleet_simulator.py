@@ -0,0 +1,769 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2019, Vit Holasek.
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#  1. Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#  2. Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#  3. Neither the name of the copyright holder nor the
+#     names of its contributors may be used to endorse or promote products
+#     derived from this software without specific prior written permission.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+#  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+#  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+#  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+#  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+#  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+#  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+#  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+#  POSSIBILITY OF SUCH DAMAGE.
+#
+
+"""
+Fleet simulator for load testing of MQTT broker and backend.
+
+Every virtual switch runs the firmware: relay_switch, relay_driver, relay_interlock, rate_limiter, json_serializer,
+state_cache, buffer_pool, metrics, deferred_log, broker_selector and mqtt_adapter modules are compiled for the host
+together with thin shims of FreeRTOS, esp_timer, NVS, GPIO registers and esp-mqtt client from tools/fleet_host. Each
+switch loads its own copy of the library with its own SWITCH_ID, so static state of modules is not shared, and relays
+of the switch drive its virtual GPIO register. Firmware tasks are coroutines which run when the switch is polled from
+the asyncio event loop. MQTT client of the firmware queues its actions, which are executed by minimal MQTT 3.1.1 client
+of the simulator, and received packets are passed back to the firmware. Subscriptions, persistent session, reconnect
+delay, rate limiting, wear protection and all publications therefore follow the firmware build configuration, which
+can be changed by --define. Simulated controller sends traced commands to random switches and measures end-to-end
+latency from publishing command to receiving state with its trace ID.
+
+All switches and the controller run on single asyncio event loop, so thousands of switches fit to one process. Only
+Python standard library and C compiler of the host are used.
+"""
+
+import argparse
+import asyncio
+import ctypes
+import itertools
+import json
+import os
+import random
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import urllib.parse
+
+STATE_TOPIC = "switch/state"
+ERROR_TOPIC = "switch/error"
+
+CONNECT = 0x10
+CONNACK = 0x20
+PUBLISH = 0x30
+PUBACK = 0x40
+PUBREC = 0x50
+PUBREL = 0x62
+PUBCOMP = 0x70
+SUBSCRIBE = 0x82
+SUBACK = 0x90
+PINGREQ = 0xC0
+PINGRESP = 0xD0
+DISCONNECT = 0xE0
+
+CLEAN_SESSION = 0x02
+SESSION_PRESENT = 0x01
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir)
+FIRMWARE_DIR = os.path.join(ROOT, "main")
+HOST_DIR = os.path.join(ROOT, "tools", "fleet_host")
+PARSON_DIR = os.path.join(ROOT, "components", "parson", "parson")
+FIRMWARE_SOURCES = ["relay_switch.c", "relay_driver.c", "relay_interlock.c", "rate_limiter.c", "json_serializer.c",
+                    "state_cache.c", "buffer_pool.c", "metrics.c", "deferred_log.c", "mqtt_adapter.c",
+                    "broker_selector.c"]
+HOST_SOURCES = ["freertos_shim.c", "esp_shim.c", "mqtt_shim.c", "platform_time_host.c", "sim_device.c"]
+
+# Features which need hardware or other network interfaces than MQTT
+DISABLED_FEATURES = ["HTTP_HTML_ENABLE", "HTTP_JSON_ENABLE", "COAP_ADAPTER_ENABLE", "GROUP_CONTROL_ENABLE",
+                     "DISCOVERY_ENABLE", "OTA_ENABLE", "BUTTON_INPUT_ENABLE", "SENSOR_ENABLE", "RULE_ENGINE_ENABLE",
+                     "CURRENT_SENSOR_ENABLE", "USAGE_STATS_ENABLE", "HISTORY_ENABLE", "PRESET_ENABLE",
+                     "MQTT_TLS_ENABLE"]
+MANAGED_DEFINES = set(DISABLED_FEATURES) | {"SWITCH_ID", "MQTT_BROKER_URIS", "RELAY_CHANNEL_COUNT",
+                                            "RELAY_CHANNEL_NAMES", "RELAY_CHANNEL_GPIOS", "RELAY_DRIVER_MODE",
+                                            "HIGH_ON"}
+CHANNEL_GPIO_BASE = 4
+MAX_CHANNELS = 32
+
+ACTION_CONNECT = 1
+ACTION_DISCONNECT = 2
+ACTION_SUBSCRIBE = 3
+ACTION_PUBLISH = 4
+
+LOG_LEVELS = {"none": 0, "error": 1, "warn": 2, "info": 3, "debug": 4, "verbose": 5}
+
+
+class MqttAction(ctypes.Structure):
+    _fields_ = [("type", ctypes.c_int32), ("msg_id", ctypes.c_int32), ("qos", ctypes.c_int32),
+                ("retain", ctypes.c_int32), ("topic", ctypes.c_char_p), ("data", ctypes.c_void_p),
+                ("data_len", ctypes.c_int32)]
+
+
+class MqttConfig(ctypes.Structure):
+    _fields_ = [("uri", ctypes.c_char_p), ("client_id", ctypes.c_char_p), ("keepalive", ctypes.c_int32),
+                ("clean_session", ctypes.c_int32), ("network_timeout_ms", ctypes.c_int32)]
+
+
+def encode_string(value):
+    data = value.encode()
+    return struct.pack("!H", len(data)) + data
+
+
+def encode_packet(packet_type, body):
+    length = len(body)
+    header = bytearray([packet_type])
+    while True:
+        byte = length % 128
+        length //= 128
+        header.append(byte | 0x80 if length > 0 else byte)
+        if length == 0:
+            return bytes(header) + body
+
+
+def get_defines(args, placeholder):
+    names = ["relay%d" % i for i in range(args.channels)]
+    defines = {name: "0" for name in DISABLED_FEATURES}
+    # Deferred log lines of thousands of switches would flood the console
+    defines["DEFERRED_LOG_CONSOLE_ENABLE"] = "0"
+    for define in args.define:
+        name, _, value = define.partition("=")
+        if name in MANAGED_DEFINES:
+            raise ValueError("%s is set by the simulator" % name)
+        defines[name] = value or "1"
+    defines.update({
+        "SWITCH_ID": '"%s"' % placeholder,
+        "MQTT_BROKER_URIS": '{ "mqtt://%s:%d" }' % (args.host, args.port),
+        "RELAY_CHANNEL_COUNT": str(args.channels),
+        "RELAY_CHANNEL_NAMES": "{ %s }" % ", ".join('"%s"' % name for name in names),
+        "RELAY_CHANNEL_GPIOS": "{ %s }" % ", ".join(str(CHANNEL_GPIO_BASE + i) for i in range(args.channels)),
+        "RELAY_DRIVER_MODE": "RELAY_DRIVER_LEVEL",
+        "HIGH_ON": "1",
+    })
+    return defines
+
+
+def build_library(args, defines, directory):
+    parson = os.path.join(args.parson_dir, "parson.c")
+    if not os.path.exists(parson):
+        raise FileNotFoundError("%s not found, run git submodule update --init" % parson)
+    output = os.path.join(directory, "fleet_device.so")
+    command = [os.environ.get("CC", "cc"), "-std=gnu11", "-O2", "-fPIC", "-shared", "-fvisibility=hidden",
+               "-ffunction-sections", "-fdata-sections", "-Wl,--gc-sections", "-Wl,--no-undefined",
+               "-I", os.path.join(HOST_DIR, "include"), "-I", FIRMWARE_DIR, "-I", args.parson_dir,
+               "-include", os.path.join(HOST_DIR, "include", "sim_compat.h")]
+    command += ["-D%s=%s" % item for item in defines.items()]
+    command += [os.path.join(FIRMWARE_DIR, source) for source in FIRMWARE_SOURCES]
+    command += [os.path.join(HOST_DIR, source) for source in HOST_SOURCES]
+    command += [parson, "-o", output]
+    subprocess.run(command, check=True)
+    return output
+
+
+class DeviceLibrary:
+    """
+    Library image compiled with placeholder SWITCH_ID. Every switch loads its own copy with the placeholder replaced,
+    because dynamic loader shares static variables of the same file.
+    """
+
+    def __init__(self, path, placeholder, directory):
+        with open(path, "rb") as library:
+            self.image = library.read()
+        self.placeholder = placeholder.encode()
+        self.directory = directory
+        if self.image.count(self.placeholder) == 0 or self.image.count(self.placeholder + b"@") > 0:
+            raise RuntimeError("SWITCH_ID placeholder not found in %s" % path)
+
+    def load(self, switch_id):
+        path = os.path.join(self.directory, "%s.so" % switch_id)
+        with open(path, "wb") as library:
+            library.write(self.image.replace(self.placeholder, switch_id.encode()))
+        try:
+            library = ctypes.CDLL(path, mode=os.RTLD_LOCAL)
+        finally:
+            os.unlink(path)
+        library.sim_device_start.restype = ctypes.c_int32
+        library.sim_device_poll.restype = ctypes.c_int64
+        library.sim_log_set_level.argtypes = [ctypes.c_int]
+        library.sim_gpio_get_level.argtypes = [ctypes.c_int]
+        library.sim_metrics_get_count.restype = ctypes.c_size_t
+        library.sim_metrics_get_name.argtypes = [ctypes.c_uint32]
+        library.sim_metrics_get_name.restype = ctypes.c_char_p
+        library.sim_metrics_get.argtypes = [ctypes.c_uint32]
+        library.sim_metrics_get.restype = ctypes.c_uint32
+        library.sim_mqtt_take_action.argtypes = [ctypes.POINTER(MqttAction)]
+        library.sim_mqtt_take_action.restype = ctypes.c_bool
+        library.sim_mqtt_get_config.argtypes = [ctypes.POINTER(MqttConfig)]
+        library.sim_mqtt_connected.argtypes = [ctypes.c_bool]
+        library.sim_mqtt_published.argtypes = [ctypes.c_int]
+        library.sim_mqtt_data.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_int, ctypes.c_int]
+        return library
+
+
+class MqttClient:
+    """
+    Minimal MQTT 3.1.1 client with QoS 0 and 1 publishing and subscriptions up to QoS 2.
+    """
+
+    def __init__(self, client_id, on_message, on_disconnect=None, on_published=None, keepalive=60,
+                 clean_session=True):
+        self.client_id = client_id
+        self.clean_session = clean_session
+        self.on_message = on_message
+        self.on_disconnect = on_disconnect
+        self.on_published = on_published
+        self.keepalive = keepalive
+        self.reader = None
+        self.writer = None
+        self.packet_ids = itertools.cycle(range(1, 65536))
+        self.tasks = []
+        self.connected = False
+        self.bytes_sent = 0
+        self.bytes_received = 0
+
+    async def connect(self, host, port, timeout):
+        """
+        Connect to broker.
+        :return: True if broker has session of the client.
+        """
+        self.reader, self.writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout)
+        try:
+            flags = CLEAN_SESSION if self.clean_session else 0
+            body = encode_string("MQTT") + bytes([4, flags]) + struct.pack("!H", self.keepalive)
+            body += encode_string(self.client_id)
+            self.send(CONNECT, body)
+            packet_type, payload = await asyncio.wait_for(self.read_packet(), timeout)
+            if packet_type != CONNACK or payload[1] != 0:
+                raise ConnectionError("connection refused by broker")
+        except BaseException:
+            self.writer.close()
+            raise
+        self.connected = True
+        self.tasks = [asyncio.create_task(self.read_loop())]
+        if self.keepalive > 0:
+            self.tasks.append(asyncio.create_task(self.ping_loop()))
+        return bool(payload[0] & SESSION_PRESENT)
+
+    def send(self, packet_type, body):
+        packet = encode_packet(packet_type, body)
+        self.bytes_sent += len(packet)
+        self.writer.write(packet)
+
+    def subscribe(self, topics, qos=1, packet_id=None):
+        body = struct.pack("!H", packet_id or next(self.packet_ids))
+        for topic in topics:
+            body += encode_string(topic) + bytes([qos])
+        self.send(SUBSCRIBE, body)
+
+    def publish(self, topic, payload, qos=0, retain=False, packet_id=None):
+        body = encode_string(topic)
+        if qos > 0:
+            body += struct.pack("!H", packet_id or next(self.packet_ids))
+        self.send(PUBLISH | (qos << 1) | int(retain), body + payload)
+
+    async def read_packet(self):
+        packet_type = (await self.reader.readexactly(1))[0]
+        length = 0
+        for shift in range(0, 28, 7):
+            byte = (await self.reader.readexactly(1))[0]
+            length |= (byte & 0x7F) << shift
+            if byte & 0x80 == 0:
+                break
+        payload = await self.reader.readexactly(length) if length > 0 else b""
+        self.bytes_received += length + 2
+        return packet_type, payload
+
+    async def read_loop(self):
+        try:
+            while True:
+                packet_type, payload = await self.read_packet()
+                if packet_type & 0xF0 == PUBLISH:
+                    qos = (packet_type >> 1) & 0x03
+                    topic_length = struct.unpack("!H", payload[:2])[0]
+                    topic = payload[2:2 + topic_length].decode()
+                    offset = 2 + topic_length
+                    packet_id = 0
+                    if qos > 0:
+                        packet_id = struct.unpack("!H", payload[offset:offset + 2])[0]
+                        self.send(PUBACK if qos == 1 else PUBREC, payload[offset:offset + 2])
+                        offset += 2
+                    self.on_message(topic, payload[offset:], packet_id)
+                elif packet_type == PUBREL:
+                    self.send(PUBCOMP, payload[:2])
+                elif packet_type == PUBACK and self.on_published is not None:
+                    self.on_published(struct.unpack("!H", payload[:2])[0])
+        except (asyncio.IncompleteReadError, ConnectionError, OSError):
+            pass
+        finally:
+            self.close()
+
+    async def ping_loop(self):
+        while True:
+            await asyncio.sleep(self.keepalive / 2)
+            self.send(PINGREQ, b"")
+
+    def close(self):
+        if not self.connected:
+            return
+        self.connected = False
+        current = asyncio.current_task()
+        for task in self.tasks:
+            if task is not current:
+                task.cancel()
+        try:
+            self.writer.close()
+        except (ConnectionError, OSError):
+            pass
+        if self.on_disconnect is not None:
+            self.on_disconnect()
+
+    def disconnect(self):
+        if self.connected:
+            self.send(DISCONNECT, b"")
+        self.close()
+
+
+class Stats:
+    def __init__(self):
+        self.commands_sent = 0
+        self.states_received = 0
+        self.errors_received = 0
+        self.traces_matched = 0
+        self.commands_lost = 0
+        self.device_commands = 0
+        self.device_publishes = 0
+        self.device_drops = 0
+        self.connects = 0
+        self.sessions_present = 0
+        self.connect_failures = 0
+        self.disconnects = 0
+        self.errors = {}
+        self.latencies_ms = []
+        self.parse_us = []
+        self.actuation_us = []
+
+    def snapshot(self):
+        return (self.commands_sent, self.states_received, self.device_publishes, len(self.latencies_ms))
+
+
+class VirtualSwitch:
+    """
+    Virtual relay switch running the firmware library. Firmware is polled whenever it receives an event and when its
+    nearest task wake up or timer deadline expires, actions queued by its MQTT client are executed after every poll.
+    """
+
+    def __init__(self, library, switch_id, channel_count, args, stats):
+        self.library = library
+        self.switch_id = switch_id
+        self.channel_names = ["relay%d" % i for i in range(channel_count)]
+        self.args = args
+        self.stats = stats
+        self.action = MqttAction()
+        self.client = None
+        self.connecting = None
+        self.poll_handle = None
+        self.bytes_transferred = 0
+        self.running = False
+        self.prefix = "switch/%s/" % switch_id
+
+    def start(self):
+        self.library.sim_log_set_level(LOG_LEVELS[self.args.log_level])
+        error = self.library.sim_device_start()
+        if error != 0:
+            raise RuntimeError("firmware of %s failed to start with error 0x%x" % (self.switch_id, error))
+        self.running = True
+        self.service()
+
+    def service(self):
+        """
+        Run the firmware until it waits and execute actions of its MQTT client.
+        """
+        if not self.running:
+            return
+        delay_us = self.library.sim_device_poll()
+        while self.library.sim_mqtt_take_action(ctypes.byref(self.action)):
+            self.execute(self.action)
+        if self.poll_handle is not None:
+            self.poll_handle.cancel()
+            self.poll_handle = None
+        if delay_us >= 0:
+            self.poll_handle = asyncio.get_running_loop().call_later(delay_us / 1000000.0, self.service)
+
+    def deliver(self, event, *args):
+        if self.running:
+            event(*args)
+            self.service()
+
+    def execute(self, action):
+        if action.type == ACTION_CONNECT:
+            self.connecting = asyncio.create_task(self.connect())
+        elif action.type == ACTION_DISCONNECT:
+            if self.client is not None:
+                self.client.disconnect()
+        elif self.client is None or not self.client.connected:
+            # Connection was lost before the firmware was told, data would be lost by socket of the device as well
+            return
+        elif action.type == ACTION_SUBSCRIBE:
+            self.client.subscribe([action.topic.decode()], action.qos, action.msg_id)
+        elif action.type == ACTION_PUBLISH:
+            payload = ctypes.string_at(action.data, action.data_len)
+            self.client.publish(action.topic.decode(), payload, action.qos, bool(action.retain), action.msg_id)
+            self.stats.device_publishes += 1
+
+    async def connect(self):
+        config = MqttConfig()
+        self.library.sim_mqtt_get_config(ctypes.byref(config))
+        uri = urllib.parse.urlsplit(config.uri.decode())
+        self.bytes_transferred = self.get_bytes_transferred()
+        client = MqttClient(config.client_id.decode(), self.on_message, on_published=self.on_published,
+                            keepalive=config.keepalive, clean_session=bool(config.clean_session))
+        try:
+            session_present = await client.connect(uri.hostname, uri.port or 1883, config.network_timeout_ms / 1000.0)
+        except (asyncio.TimeoutError, ConnectionError, OSError):
+            self.stats.connect_failures += 1
+            self.deliver(self.library.sim_mqtt_error)
+            self.deliver(self.library.sim_mqtt_disconnected)
+            return
+        if not self.running:
+            client.disconnect()
+            return
+        client.on_disconnect = lambda: asyncio.get_running_loop().call_soon(self.on_connection_lost, client)
+        self.client = client
+        self.stats.connects += 1
+        self.stats.sessions_present += int(session_present)
+        self.deliver(self.library.sim_mqtt_connected, session_present)
+
+    def on_connection_lost(self, client):
+        if client is not self.client or not self.running:
+            return
+        self.bytes_transferred = self.get_bytes_transferred()
+        self.client = None
+        self.stats.disconnects += 1
+        self.deliver(self.library.sim_mqtt_disconnected)
+
+    def on_message(self, topic, payload, packet_id):
+        self.stats.device_commands += 1
+        if random.random() < self.args.drop_probability:
+            self.stats.device_drops += 1
+            return
+        topic = topic.encode()
+        self.deliver(self.library.sim_mqtt_data, topic, len(topic), payload, len(payload), packet_id)
+
+    def on_published(self, packet_id):
+        self.deliver(self.library.sim_mqtt_published, packet_id)
+
+    def get_bytes_transferred(self):
+        if self.client is None:
+            return self.bytes_transferred
+        return self.bytes_transferred + self.client.bytes_sent + self.client.bytes_received
+
+    def is_connected(self):
+        return self.client is not None and self.client.connected
+
+    def is_switched_on(self, channel):
+        return self.library.sim_gpio_get_level(CHANNEL_GPIO_BASE + channel) == 1
+
+    def get_metrics(self):
+        return {self.library.sim_metrics_get_name(i).decode(): self.library.sim_metrics_get(i)
+                for i in range(self.library.sim_metrics_get_count())}
+
+    def drop_connection(self):
+        if self.client is not None and self.client.connected:
+            self.client.close()
+
+    def stop(self):
+        self.running = False
+        if self.poll_handle is not None:
+            self.poll_handle.cancel()
+        if self.connecting is not None:
+            self.connecting.cancel()
+        if self.client is not None:
+            self.client.disconnect()
+
+
+class Controller:
+    """
+    Simulated backend which sends traced commands and matches them with state publications.
+    """
+
+    def __init__(self, switches, args, stats):
+        self.switches = switches
+        self.args = args
+        self.stats = stats
+        self.pending = {}
+        self.trace_ids = itertools.count(1)
+        self.client = MqttClient("%s-controller" % args.id_prefix, self.on_message)
+
+    async def start(self):
+        await self.client.connect(self.args.host, self.args.port, self.args.connect_timeout)
+        self.client.subscribe([STATE_TOPIC, ERROR_TOPIC], qos=1)
+        await self.client.writer.drain()
+
+    def on_message(self, topic, payload, packet_id):
+        received = time.monotonic()
+        if topic == ERROR_TOPIC:
+            self.stats.errors_received += 1
+            try:
+                error = json.loads(payload).get("error", "unknown")
+            except ValueError:
+                error = "unknown"
+            self.stats.errors[error] = self.stats.errors.get(error, 0) + 1
+            return
+        self.stats.states_received += 1
+        try:
+            trace = json.loads(payload).get("trace")
+        except ValueError:
+            return
+        if trace is None:
+            return
+        sent = self.pending.pop(trace.get("id"), None)
+        if sent is None:
+            return
+        self.stats.traces_matched += 1
+        self.stats.latencies_ms.append((received - sent) * 1000.0)
+        self.stats.parse_us.append(trace["parsedMicros"] - trace["receivedMicros"])
+        self.stats.actuation_us.append(trace["actuatedMicros"] - trace["parsedMicros"])
+
+    def make_command(self, switch):
+        trace_id = "%s-%d" % (self.args.id_prefix, next(self.trace_ids))
+        channel_count = len(switch.channel_names)
+        if self.args.pattern == "batch" and channel_count > 1:
+            switch_on = random.random() < 0.5
+            request = {"channels": [{"channel": name, "switchedOn": switch_on, "timeout": self.args.command_timeout_ms}
+                                    for name in switch.channel_names]}
+        else:
+            channel = random.randrange(channel_count)
+            request = {"channel": switch.channel_names[channel], "switchedOn": not switch.is_switched_on(channel),
+                       "timeout": self.args.command_timeout_ms}
+        request["traceId"] = trace_id
+        request["clientMillis"] = int(time.time() * 1000)
+        return trace_id, request
+
+    def pick_switches(self):
+        if self.args.pattern == "burst":
+            return random.sample(self.switches, min(self.args.burst_size, len(self.switches)))
+        return [random.choice(self.switches)]
+
+    async def run(self, duration):
+        interval = 1.0 / self.args.command_rate if self.args.command_rate > 0 else None
+        if self.args.pattern == "burst" and interval is not None:
+            interval *= self.args.burst_size
+        end = time.monotonic() + duration
+        next_send = time.monotonic()
+        while interval is not None and time.monotonic() < end and self.client.connected:
+            for switch in self.pick_switches():
+                trace_id, request = self.make_command(switch)
+                self.pending[trace_id] = time.monotonic()
+                self.client.publish(switch.prefix + "switch", json.dumps(request).encode(), qos=self.args.command_qos)
+                self.stats.commands_sent += 1
+            next_send += interval
+            await asyncio.sleep(max(0.0, next_send - time.monotonic()))
+            self.expire_pending()
+        if interval is None:
+            await asyncio.sleep(duration)
+
+    def expire_pending(self):
+        deadline = time.monotonic() - self.args.response_timeout
+        expired = [trace_id for trace_id, sent in self.pending.items() if sent < deadline]
+        for trace_id in expired:
+            del self.pending[trace_id]
+        self.stats.commands_lost += len(expired)
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def summarize(values):
+    return {"count": len(values), "mean": statistics.fmean(values) if values else 0.0,
+            "p50": percentile(values, 0.5), "p90": percentile(values, 0.9), "p99": percentile(values, 0.99),
+            "max": max(values) if values else 0.0}
+
+
+def summarize_metrics(switches):
+    """
+    Aggregate firmware metrics of all switches, metrics which are zero on every switch are omitted.
+    """
+    totals = {}
+    for switch in switches:
+        for name, value in switch.get_metrics().items():
+            total = totals.setdefault(name, {"sum": 0, "max": 0})
+            total["sum"] += value
+            total["max"] = max(total["max"], value)
+    return {name: total for name, total in totals.items() if total["max"] > 0}
+
+
+async def report_progress(stats, switches, interval):
+    previous = stats.snapshot()
+    while True:
+        await asyncio.sleep(interval)
+        current = stats.snapshot()
+        connected = sum(1 for switch in switches if switch.is_connected())
+        recent = stats.latencies_ms[previous[3]:]
+        print("connected %d/%d, commands %.1f/s, device publishes %.1f/s, states received %.1f/s, latency p50 %.1f ms "
+              "p99 %.1f ms" % (connected, len(switches), (current[0] - previous[0]) / interval,
+                               (current[2] - previous[2]) / interval, (current[1] - previous[1]) / interval,
+                               percentile(recent, 0.5), percentile(recent, 0.99)), file=sys.stderr)
+        previous = current
+
+
+async def inject_disconnects(switches, stats, args):
+    if args.disconnects_per_minute <= 0:
+        return
+    while True:
+        await asyncio.sleep(random.expovariate(args.disconnects_per_minute / 60.0))
+        random.choice(switches).drop_connection()
+
+
+async def reconnect_storm(switches, delay):
+    await asyncio.sleep(delay)
+    print("Dropping connections of all switches", file=sys.stderr)
+    for switch in switches:
+        switch.drop_connection()
+
+
+async def run(args, library):
+    stats = Stats()
+    switches = [VirtualSwitch(library.load("%s%05d" % (args.id_prefix, i)), "%s%05d" % (args.id_prefix, i),
+                              args.channels, args, stats) for i in range(args.devices)]
+    controller = Controller(switches, args, stats)
+    await controller.start()
+
+    started = time.monotonic()
+    for switch in switches:
+        switch.start()
+        # Ramp up avoids connect storm unless it is tested explicitly
+        if args.connect_rate > 0:
+            await asyncio.sleep(1.0 / args.connect_rate)
+    while stats.connects + stats.connect_failures < len(switches) and time.monotonic() - started < args.ramp_timeout:
+        await asyncio.sleep(0.1)
+    ramp_seconds = time.monotonic() - started
+    print("%d switches connected in %.1f s" % (stats.connects, ramp_seconds), file=sys.stderr)
+
+    helpers = [asyncio.create_task(report_progress(stats, switches, args.report_interval)),
+               asyncio.create_task(inject_disconnects(switches, stats, args))]
+    if args.storm_at > 0:
+        helpers.append(asyncio.create_task(reconnect_storm(switches, args.storm_at)))
+    load_started = time.monotonic()
+    bytes_before = sum(switch.get_bytes_transferred() for switch in switches)
+    await controller.run(args.duration)
+    await asyncio.sleep(args.response_timeout)
+    controller.expire_pending()
+    load_seconds = time.monotonic() - load_started
+    bytes_after = sum(switch.get_bytes_transferred() for switch in switches)
+
+    for task in helpers:
+        task.cancel()
+    for switch in switches:
+        switch.stop()
+    controller.client.disconnect()
+    await asyncio.gather(*helpers, return_exceptions=True)
+
+    return {
+        "devices": args.devices,
+        "rampSeconds": round(ramp_seconds, 3),
+        "loadSeconds": round(load_seconds, 3),
+        "commandsSent": stats.commands_sent,
+        "commandsLost": stats.commands_lost,
+        "commandsDroppedBySwitches": stats.device_drops,
+        "statesReceived": stats.states_received,
+        "errorsReceived": stats.errors_received,
+        "errors": stats.errors,
+        "connects": stats.connects,
+        "sessionsPresent": stats.sessions_present,
+        "connectFailures": stats.connect_failures,
+        "disconnects": stats.disconnects,
+        "brokerMessagesPerSecond": round((stats.commands_sent + stats.device_commands + stats.device_publishes
+                                          + stats.states_received) / load_seconds, 1),
+        "switchBytesPerSecond": round((bytes_after - bytes_before) / load_seconds, 1),
+        "latencyMillis": {key: round(value, 3) for key, value in summarize(stats.latencies_ms).items()},
+        "parseMicros": summarize(stats.parse_us),
+        "actuationMicros": summarize(stats.actuation_us),
+        "firmwareMetrics": summarize_metrics(switches),
+    }
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--host", default="localhost", help="broker host (default localhost)")
+    parser.add_argument("--port", type=int, default=1883, help="broker port (default 1883)")
+    parser.add_argument("--devices", type=int, default=100, help="number of virtual switches (default 100)")
+    parser.add_argument("--channels", type=int, default=1, help="relay channels of each switch (default 1)")
+    parser.add_argument("--id-prefix", default="SIM", help="prefix of SWITCH_ID of virtual switches (default SIM)")
+    parser.add_argument("--define", action="append", default=[], metavar="NAME[=VALUE]",
+                        help="firmware build option, e.g. --define RATE_LIMIT_ENABLE=0, can be repeated")
+    parser.add_argument("--parson-dir", default=PARSON_DIR, help="directory with parson sources (default submodule)")
+    parser.add_argument("--log-level", choices=list(LOG_LEVELS), default="warn",
+                        help="most verbose firmware log level printed (default warn)")
+    parser.add_argument("--duration", type=float, default=60, help="duration of command load in s (default 60)")
+    parser.add_argument("--command-rate", type=float, default=10,
+                        help="commands per second sent to the whole fleet, 0 for idle fleet (default 10)")
+    parser.add_argument("--pattern", choices=["random", "burst", "batch"], default="random",
+                        help="random: single channel of random switch, burst: --burst-size switches at once, "
+                             "batch: all channels of switch in one request (default random)")
+    parser.add_argument("--burst-size", type=int, default=50, help="switches addressed by one burst (default 50)")
+    parser.add_argument("--command-timeout-ms", type=int, default=0,
+                        help="timeout of commands, reverts generate additional publications (default 0)")
+    parser.add_argument("--command-qos", type=int, choices=[0, 1], default=1, help="QoS of commands (default 1)")
+    parser.add_argument("--drop-probability", type=float, default=0,
+                        help="probability that switch loses received command (default 0)")
+    parser.add_argument("--disconnects-per-minute", type=float, default=0,
+                        help="random switch connection drops per minute over the fleet (default 0)")
+    parser.add_argument("--storm-at", type=float, default=0,
+                        help="drop connections of all switches this many s after load starts (default off)")
+    parser.add_argument("--connect-rate", type=float, default=200,
+                        help="switch starts per second during ramp up, 0 for all at once (default 200)")
+    parser.add_argument("--connect-timeout", type=float, default=10,
+                        help="connect timeout of the controller in s (default 10)")
+    parser.add_argument("--ramp-timeout", type=float, default=120, help="maximum ramp up duration in s (default 120)")
+    parser.add_argument("--response-timeout", type=float, default=5,
+                        help="command without state publication within this time in s is lost (default 5)")
+    parser.add_argument("--report-interval", type=float, default=5, help="progress report period in s (default 5)")
+    args = parser.parse_args()
+    if not 1 <= args.channels <= MAX_CHANNELS:
+        parser.error("--channels must be between 1 and %d" % MAX_CHANNELS)
+    if not 1 <= args.devices <= 100000:
+        parser.error("--devices must be between 1 and 100000")
+    return args
+
+
+def main():
+    args = parse_args()
+    # SWITCH_ID of all switches has the same length, so the placeholder is patched in place
+    placeholder = "@" * len("%s%05d" % (args.id_prefix, 0))
+    with tempfile.TemporaryDirectory(prefix="fleet_simulator") as directory:
+        try:
+            library = DeviceLibrary(build_library(args, get_defines(args, placeholder), directory), placeholder,
+                                    directory)
+        except (ValueError, OSError, subprocess.CalledProcessError) as error:
+            print("Cannot build firmware library: %s" % error, file=sys.stderr)
+            return 1
+        try:
+            result = asyncio.run(run(args, library))
+        except KeyboardInterrupt:
+            return 1
+        except (ConnectionError, OSError, asyncio.TimeoutError) as error:
+            print("Cannot connect to broker %s:%d: %s" % (args.host, args.port, error), file=sys.stderr)
+            return 1
+    print(json.dumps(result, indent=4))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2019, Vit Holasek.
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#  1. Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#  2. Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#  3. Neither the name of the copyright holder nor the
+#     names of its contributors may be used to endorse or promote products
+#     derived from this software without specific prior written permission.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+#  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+#  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+#  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+#  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+#  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+#  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+#  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+#  POSSIBILITY OF SUCH DAMAGE.
+#
+
+"""
+Soak test of heap drift of the relay switch firmware.
+
+Metrics heapFreeBytes, heapLargestFreeBlock and bufferPoolInUseBytes are read from GET /api/metrics, then mixed
+traffic is sent to HTTP API and optionally over MQTT: switching requests with and without trace, state, metrics, log,
+usage and history reads, malformed and oversized request bodies. After the traffic the device is left idle and metrics
+are read again until they return to the initial values. Test fails with exit code 1 when free heap or the largest free
+block stays lower than initial value by more than tolerance or buffer pool is not released.
+
+Only Python standard library is used.
+"""
+
+import argparse
+import itertools
+import json
+import socket
+import struct
+import sys
+import threading
+import time
+import urllib.error
+import urllib.request
+
+CONNECT = 0x10
+CONNACK = 0x20
+PUBLISH = 0x30
+DISCONNECT = 0xE0
+
+HEAP_METRICS = ["heapFreeBytes", "heapLargestFreeBlock"]
+POOL_METRIC = "bufferPoolInUseBytes"
+
+
+def encode_string(value):
+    data = value.encode()
+    return struct.pack("!H", len(data)) + data
+
+
+def encode_packet(packet_type, body):
+    length = len(body)
+    header = bytearray([packet_type])
+    while True:
+        byte = length % 128
+        length //= 128
+        header.append(byte | 0x80 if length > 0 else byte)
+        if length == 0:
+            return bytes(header) + body
+
+
+class MqttPublisher:
+    """
+    Minimal blocking MQTT 3.1.1 client publishing with QoS 0.
+    """
+
+    def __init__(self, host, port, client_id, timeout):
+        self.socket = socket.create_connection((host, port), timeout)
+        body = encode_string("MQTT") + bytes([4, 0x02]) + struct.pack("!H", 60) + encode_string(client_id)
+        self.socket.sendall(encode_packet(CONNECT, body))
+        response = self.socket.recv(4)
+        if len(response) < 4 or response[0] != CONNACK or response[3] != 0:
+            raise ConnectionError("connection refused by broker")
+        self.lock = threading.Lock()
+
+    def publish(self, topic, payload):
+        with self.lock:
+            self.socket.sendall(encode_packet(PUBLISH, encode_string(topic) + payload.encode()))
+
+    def close(self):
+        self.socket.sendall(encode_packet(DISCONNECT, b""))
+        self.socket.close()
+
+
+class SoakTest:
+
+    def __init__(self, args):
+        self.args = args
+        self.base_url = args.url.rstrip("/")
+        self.counter = itertools.count()
+        self.lock = threading.Lock()
+        self.statuses = {}
+        self.mqtt = None
+
+    def request(self, method, path, body=None):
+        data = body.encode() if body is not None else None
+        request = urllib.request.Request(self.base_url + path, data=data, method=method)
+        try:
+            with urllib.request.urlopen(request, timeout=self.args.timeout) as response:
+                status = response.status
+                content = response.read()
+        except urllib.error.HTTPError as error:
+            status = error.code
+            content = error.read()
+        except (urllib.error.URLError, OSError):
+            status = "failed"
+            content = None
+        with self.lock:
+            key = "%s %s %s" % (method, path.split("?")[0], status)
+            self.statuses[key] = self.statuses.get(key, 0) + 1
+        return content
+
+    def read_metrics(self):
+        with urllib.request.urlopen(self.base_url + "/api/metrics", timeout=self.args.timeout) as response:
+            metrics = json.loads(response.read())
+        return {name: metrics.get(name) for name in HEAP_METRICS + [POOL_METRIC]}
+
+    def send_mixed(self, index):
+        channel = index % self.args.channels
+        self.request("POST", "/api/state", json.dumps(
+            {"channel": channel, "switchedOn": True, "timeout": 100, "traceId": "soak-%d" % index}))
+        self.request("POST", "/api/state/%d" % channel, '{"switchedOn":false,"timeout":0}')
+        self.request("GET", "/api/state")
+        self.request("GET", "/api/state/%d" % channel)
+        self.request("GET", "/api/metrics")
+        if index % 10 == 0:
+            self.request("GET", "/api/logs")
+            self.request("GET", "/api/usage")
+            self.request("GET", "/api/history/archive?from=0")
+            self.request("POST", "/api/state", '{"switchedOn":')
+            self.request("POST", "/api/state", json.dumps({"switchedOn": True, "padding": "x" * self.args.oversized}))
+        if self.mqtt is not None:
+            topic = "switch/%s/%d/switch" % (self.args.switch_id, channel)
+            self.mqtt.publish(topic, json.dumps({"switchedOn": index % 2 == 0, "timeout": 100}))
+
+    def worker(self):
+        while True:
+            index = next(self.counter)
+            if index >= self.args.iterations:
+                return
+            self.send_mixed(index)
+
+    def wait_settled(self, initial):
+        deadline = time.monotonic() + self.args.settle_timeout
+        time.sleep(self.args.idle)
+        while True:
+            final = self.read_metrics()
+            drift = get_drift(initial, final, self.args.tolerance)
+            if not drift or time.monotonic() >= deadline:
+                return final, drift
+            time.sleep(self.args.idle)
+
+    def run(self):
+        initial = self.read_metrics()
+        missing = [name for name, value in initial.items() if value is None]
+        if missing:
+            raise ValueError("metrics %s not available" % ", ".join(missing))
+        print("Initial metrics: %s" % json.dumps(initial), file=sys.stderr)
+        if self.args.mqtt_host:
+            self.mqtt = MqttPublisher(self.args.mqtt_host, self.args.mqtt_port, "soak-test", self.args.timeout)
+        started = time.monotonic()
+        workers = [threading.Thread(target=self.worker) for _ in range(self.args.concurrency)]
+        for worker in workers:
+            worker.start()
+        for worker in workers:
+            worker.join()
+        duration = time.monotonic() - started
+        if self.mqtt is not None:
+            self.mqtt.close()
+        final, drift = self.wait_settled(initial)
+        return {
+            "iterations": self.args.iterations,
+            "durationSeconds": round(duration, 1),
+            "responses": dict(sorted(self.statuses.items())),
+            "initial": initial,
+            "final": final,
+            "drift": drift,
+            "passed": not drift,
+        }
+
+
+def get_drift(initial, final, tolerance):
+    drift = {}
+    for name in HEAP_METRICS:
+        if initial[name] - final[name] > tolerance:
+            drift[name] = final[name] - initial[name]
+    if final[POOL_METRIC] > initial[POOL_METRIC]:
+        drift[POOL_METRIC] = final[POOL_METRIC] - initial[POOL_METRIC]
+    return drift
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--url", required=True, help="base URL of the device, e.g. http://192.168.1.10")
+    parser.add_argument("--iterations", type=int, default=10000, help="rounds of mixed requests (default 10000)")
+    parser.add_argument("--concurrency", type=int, default=2, help="parallel HTTP clients (default 2)")
+    parser.add_argument("--channels", type=int, default=1, help="relay channels of the device (default 1)")
+    parser.add_argument("--oversized", type=int, default=5000,
+                        help="size of oversized request body in bytes (default 5000)")
+    parser.add_argument("--mqtt-host", help="broker host, MQTT requests are sent only when set")
+    parser.add_argument("--mqtt-port", type=int, default=1883, help="broker port (default 1883)")
+    parser.add_argument("--switch-id", default="SWITCH1", help="SWITCH_ID of the device (default SWITCH1)")
+    parser.add_argument("--timeout", type=float, default=10, help="request timeout in s (default 10)")
+    parser.add_argument("--idle", type=float, default=10,
+                        help="idle time in s before metrics are read after traffic (default 10)")
+    parser.add_argument("--settle-timeout", type=float, default=60,
+                        help="maximum time in s waiting for metrics to return to initial values (default 60)")
+    parser.add_argument("--tolerance", type=int, default=512,
+                        help="allowed decrease of free heap and largest free block in bytes (default 512)")
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    try:
+        result = SoakTest(args).run()
+    except KeyboardInterrupt:
+        return 1
+    except (ConnectionError, OSError, ValueError) as error:
+        print("Soak test failed: %s" % error, file=sys.stderr)
+        return 1
+    print(json.dumps(result, indent=4))
+    return 0 if result["passed"] else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())